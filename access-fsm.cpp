@@ -0,0 +1,488 @@
+#include <Arduino.h>
+#include <FastLED.h>
+#include "access-fsm.h"
+#include "led-engine.h"
+#include "auth-cache.h"
+#include "access-log.h"
+#include "outbox.h"
+#include "debug-log.h"
+#include "metrics.h"
+#include "lf-ring.h"
+#include "warm-state.h"
+#include "estop.h"
+
+/* Access state machine. Everything that can change what a station is doing (readerTask, the MQTT callbacks, WiFi
+   events, the timeout timers) posts an accessEvent to one lock-free ring, and accessTask feeds them through
+   accessDispatch () one at a time. Posting never blocks or takes a lock, so the network side (AsyncTCP, WiFi events,
+   on the other core) can't hold up the relay. The transition table below is the whole behaviour: for the current state and the event it says the
+   next state, whether the relay is open or closed, what the LEDs do and which action (if any) runs.
+   Any (state, event) pair without a row is ignored, that's how stale answers and timer expiries fall out.
+   Every station runs its own copy of the machine off the same table, events carry the station they're for.
+*/
+
+latencyStat tapToRelay;
+latencyStat removalToTimeout;
+latencyStat transitionLatency;
+
+typedef struct { // One station's machine
+  metaStruct *params;
+  TimerHandle_t timer;                // One shot, auth wait or the removal/collision timeout, posts EV_TIMEOUT_EXPIRED
+  StaticTimer_t timerBuf;             // timer lives here, not on the heap
+  volatile byte state;
+  volatile uint32_t transitionCount;
+  volatile uint16_t timerGen;         // Bumped on every start/stop so an expiry already in the queue is recognised as stale
+  bool inSession;                     // Relay was closed for sessionUid
+  uidType sessionUid;                 // Card the relay was closed for, card.uid moves on to the next tap during a handover
+} stationFsm;
+
+static stationFsm fsm[STATION_COUNT];
+static lfRing<accessEvent, ACCESS_QUEUE_DEPTH> accessRing;
+static TaskHandle_t consumer = NULL;      // accessTask, notified on every post
+static uint32_t ringHighWater = 0;        // Most events there have been waiting in accessRing, just after a post
+static accessEvent followUps[ACCESS_FOLLOWUP_DEPTH]; // Only accessTask touches these, no atomics needed
+static byte followHead = 0;
+static byte followCount = 0;
+static bool offline = 1;                  // Until MQTT says otherwise, it's the same network for every station
+
+static const accessStateInfo stateInfo[] = {
+  {"IDLE",       READER_SCAN},
+  {"OUTAGE",     READER_SCAN},
+  {"CARD",       READER_HOLD},
+  {"AUTHORIZED", READER_TRACK},
+  {"RELAY_ON",   READER_TRACK},
+  {"TIMEOUT",    READER_SCAN},   // A new card can take over before the relay opens
+  {"HANDOVER",   READER_HOLD},
+  {"COLLISION",  READER_HOLD},   // Force waiting out the timeout
+  {"ESTOP",      READER_HOLD},
+};
+static_assert(sizeof(stateInfo) / sizeof(stateInfo[0]) == ST_COUNT, "stateInfo needs a row per ST_*");
+
+static const char * const eventNames[] = {
+  "CARD_ARRIVED", "CARD_REMOVED", "COLLISION", "AUTH_CACHED", "AUTH_GRANTED", "AUTH_DENIED", "AUTH_REVOKED", "TIMEOUT_EXPIRED", "ESTOP_FIRE", "ESTOP_CLEAR", "NET_DOWN", "NET_UP",
+};
+static_assert(sizeof(eventNames) / sizeof(eventNames[0]) == EV_COUNT, "eventNames needs a name per EV_*");
+
+//////// Helpers ////////
+
+static bool postEvent (byte station, byte type, uint16_t arg, const uidType *uid, bool next){
+  accessEvent event;
+
+  event.station = station;
+  event.type = type;
+  event.arg = arg;
+  if (uid != NULL){
+    event.uid = *uid;
+  }
+  else{
+    event.uid.length = 0;
+  }
+  event.stamp = micros();
+  if (next){ // Follow up to the transition being run (so we're in accessTask), goes ahead of anything else waiting
+    if (followCount == ACCESS_FOLLOWUP_DEPTH){
+      return 0;
+    }
+    followUps[(followHead + followCount) % ACCESS_FOLLOWUP_DEPTH] = event;
+    followCount++;
+    return 1;
+  }
+  if (!accessRing.push(event)){
+    return 0;
+  }
+  uint32_t depth = accessRing.depth();
+  uint32_t high = __atomic_load_n(&ringHighWater, __ATOMIC_RELAXED);
+  while (depth > high && !__atomic_compare_exchange_n(&ringHighWater, &high, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    // Another post raised it, high has what it raised it to
+  }
+  if (consumer != NULL){
+    xTaskNotifyGive(consumer);
+  }
+  return 1;
+}
+
+static void timerCallback (TimerHandle_t timer){
+  byte station = (byte)(uintptr_t)pvTimerGetTimerID(timer);
+  postEvent(station, EV_TIMEOUT_EXPIRED, fsm[station].timerGen, NULL, 0);
+}
+
+static void startTimer (byte station, TickType_t period){
+  fsm[station].timerGen++;
+  xTimerChangePeriod(fsm[station].timer, period, 0); // Also (re)starts it
+}
+
+static void stopTimer (byte station){
+  fsm[station].timerGen++;
+  xTimerStop(fsm[station].timer, 0);
+}
+
+static void ledApply (byte station, byte led){
+  byte first = stationConfigs[station].firstLed;
+  byte count = stationConfigs[station].ledCount;
+
+  switch (led){
+    case LED_OFF:          ledSetPattern(first, count, LEDPAT_SOLID, CRGB::Black, 0, 0);                 break;
+    case LED_GREEN:        ledSetPattern(first, count, LEDPAT_SOLID, CRGB::Green, 0, 0);                 break;
+    case LED_BLUE_BLINK:   ledSetPattern(first, count, LEDPAT_BLINK, CRGB::Blue, LED_BLINK_PERIOD, 0);   break;
+    case LED_PURPLE_BLINK: ledSetPattern(first, count, LEDPAT_BLINK, CRGB::Purple, LED_BLINK_PERIOD, 0); break;
+    case LED_YELLOW_BLINK: ledSetPattern(first, count, LEDPAT_BLINK, CRGB::Yellow, LED_BLINK_PERIOD, 0); break;
+    case LED_RED_TEMP:{ // Off underneath so it doesn't drop back to the green of a revoked session
+      const ledPattern off = {LEDPAT_SOLID, CRGB::Black, 0, 0};
+      const ledPattern red = {LEDPAT_BLINK, CRGB::Red, LED_BLINK_PERIOD, LED_TEMP_PERIOD};
+      ledSetPatterns(first, count, &off, &red);
+      break;
+    }
+    default:               break; // LED_KEEP
+  }
+}
+
+// Log the end of the session the relay was closed for, if there was one
+static void endSession (metaStruct *progParams){
+  stationFsm *f = &fsm[progParams->station];
+  if (f->inSession){
+    accessLogAppend(progParams->station, LOG_SESSION_END, &f->sessionUid, millis() - progParams->card.sessionStart);
+    f->inSession = 0;
+    warmStateSession(progParams->station, NULL);
+  }
+}
+
+// Sessions start the same way whether the relay just closed or was already closed for the card before
+static void startSession (metaStruct *progParams){
+  stationFsm *f = &fsm[progParams->station];
+  progParams->card.sessionStart = millis();
+  f->sessionUid = progParams->card.uid;
+  f->inSession = 1;
+  warmStateSession(progParams->station, &f->sessionUid); // Survives a power blip, see warm-state.h
+}
+
+// Anything that lands back in IDLE goes on to OUTAGE if the network is still out
+static void backToIdle (byte station){
+  if (offline){
+    postEvent(station, EV_NET_DOWN, 0, NULL, 1);
+  }
+}
+
+/* Works out if the card just read is authorized. Posts EV_AUTH_CACHED/GRANTED/DENIED if it can be decided here,
+   otherwise the answer comes from the server as rfid/auth/rsp.
+*/
+static void decideAuth (metaStruct *progParams, const accessEvent *event){
+  byte station = progParams->station;
+
+  // Keep the binary UID around, it's what the auth cache is keyed on
+  progParams->card.uid = event->uid;
+  progParams->card.tapStamp = event->stamp;
+  progParams->card.uidStrLen = (event->uid.length*3); // Our string length will be 3x the length the equivalent byte value
+  byteToHexStr(progParams->card.uid.bytes, progParams->card.uid.length, progParams->card.uidStr, progParams->card.uidStrLen);
+
+  bool local = offline;
+  authCacheResult cached = authCacheLookup(station, &progParams->card.uid, offline);
+  if (cached == CACHE_MISS && isAllowed(station, &progParams->card.uid)){
+    cached = CACHE_ALLOW; // On this station's provisioned member list, good as a cached grant
+  }
+
+  if (!local){ // Ask the server, the rsp can still revoke a cached grant
+    accessLogAppend(station, LOG_TAP_REQ, &progParams->card.uid, 0);
+    authCacheSetPending(station, &progParams->card.uid, (cached == CACHE_ALLOW));
+    if (!outboxPush(station, OUTBOX_REQ, progParams->card.uidStr, 0)){ // Lost the broker and haven't heard about it yet
+      DLOG_WARN("Request not sent, deciding offline");
+      authCacheClearPending(station, 0); // Never went out, no rsp is coming for it
+      local = 1;
+    }
+    else if (cached == CACHE_ALLOW){
+      DLOG_DEBUG("Auth cache hit");
+      accessLogAppend(station, LOG_TAP_CACHED, &progParams->card.uid, 0);
+      postEvent(station, EV_AUTH_CACHED, 0, NULL, 1); // Don't make them wait on the broker
+    }
+  }
+
+  if (local){ // The cache is all we have to go on
+    if (cached == CACHE_ALLOW || (cached == CACHE_MISS && OFFLINE_GRANT_UNKNOWN)){
+      accessLogAppend(station, LOG_TAP_OFFLINE, &progParams->card.uid, 0);
+      outboxPush(station, OUTBOX_TAP, progParams->card.uidStr, 1); // Report the tap once we're back online
+      postEvent(station, EV_AUTH_GRANTED, 0, NULL, 1);
+    }
+    else{ // Denied or never seen, treat it the same as a denied rsp
+      DLOG_INFO("Not in auth cache, denied!");
+      accessLogAppend(station, LOG_AUTH_DENIED, &progParams->card.uid, 0);
+      outboxPush(station, OUTBOX_TAP, progParams->card.uidStr, 0);
+      postEvent(station, EV_AUTH_DENIED, 0, NULL, 1);
+    }
+  }
+}
+
+//////// Actions ////////
+
+static void actCardArrived (metaStruct *progParams, const accessEvent *event){
+  metricCount(CTR_TAPS);
+  startTimer(progParams->station, MS_AUTH_WAIT_PERIOD);
+  decideAuth(progParams, event);
+}
+
+static void actHandover (metaStruct *progParams, const accessEvent *event){
+  metricCount(CTR_TAPS);
+  decideAuth(progParams, event); // The removal timeout keeps running, if it runs out first the relay opens
+}
+
+static void actSessionStart (metaStruct *progParams, const accessEvent *event){
+  uint32_t relayStamp = relayLastChange(progParams->station);
+  stopTimer(progParams->station);
+  startSession(progParams);
+  latencyRecord(&tapToRelay, relayStamp - progParams->card.tapStamp);
+  metricCount(CTR_GRANTS);
+  metricObserve(HIST_TAP_TO_AUTH, event->stamp - progParams->card.tapStamp);
+  metricObserve(HIST_AUTH_TO_RELAY, relayStamp - event->stamp);
+  metricsBootMark(BOOT_FIRST_AUTH);
+}
+
+static void actHandoverGrant (metaStruct *progParams, const accessEvent *event){
+  stopTimer(progParams->station);
+  endSession(progParams); // The relay never opened, but it's a new card's session from here
+  startSession(progParams);
+  metricCount(CTR_GRANTS);
+  metricObserve(HIST_TAP_TO_AUTH, event->stamp - progParams->card.tapStamp); // Relay never opened, nothing to time there
+}
+
+static void actHandoverExpired (metaStruct *progParams, const accessEvent *event){
+  endSession(progParams);
+  startTimer(progParams->station, MS_AUTH_WAIT_PERIOD); // Still waiting on the server for the new card
+}
+
+static void actDenied (metaStruct *progParams, const accessEvent *event){
+  metricCount(CTR_DENIES);
+  metricObserve(HIST_TAP_TO_AUTH, event->stamp - progParams->card.tapStamp);
+  stopTimer(progParams->station);
+  backToIdle(progParams->station);
+}
+
+static void actNoAnswer (metaStruct *progParams, const accessEvent *event){
+  DLOG_WARN("No rsp from the server, giving up on this card");
+  metricCount(CTR_TIMEOUTS);
+  authCacheClearPending(progParams->station, 1); // A late one mustn't land on the next card
+  backToIdle(progParams->station);
+}
+
+static void actRevoked (metaStruct *progParams, const accessEvent *event){
+  DLOG_INFO("Revoking cached grant!");
+  metricCount(CTR_DENIES);
+  stopTimer(progParams->station);
+  endSession(progParams);
+  backToIdle(progParams->station);
+}
+
+static void actRemoved (metaStruct *progParams, const accessEvent *event){
+  DLOG_DEBUG("Card removed");
+  progParams->card.removedStamp = event->stamp;
+  // Publish our UID to end of use RIGHT AWAY, if we wait for the full timeout someone could interrupt with a new card.
+  // Goes through the outbox so it is held (not lost) if WiFi/MQTT is out
+  outboxPush(progParams->station, OUTBOX_EOU, progParams->card.uidStr, 0);
+  startTimer(progParams->station, MS_TIMEOUT_PERIOD);
+  uint32_t us = micros() - event->stamp;
+  latencyRecord(&removalToTimeout, us);
+  metricObserve(HIST_REMOVAL_TO_TIMEOUT, us);
+}
+
+static void actCollision (metaStruct *progParams, const accessEvent *event){
+  DLOG_INFO("Collision!");
+  metricCount(CTR_COLLISIONS);
+  accessLogAppend(progParams->station, LOG_COLLISION, &fsm[progParams->station].sessionUid, 0);
+  outboxPush(progParams->station, OUTBOX_EOU, progParams->card.uidStr, 0);
+  startTimer(progParams->station, MS_TIMEOUT_PERIOD);
+}
+
+static void actTimedOut (metaStruct *progParams, const accessEvent *event){
+  DLOG_DEBUG("Timeout!");
+  endSession(progParams);
+  backToIdle(progParams->station);
+}
+
+static void actEstop (metaStruct *progParams, const accessEvent *event){
+  DLOG_WARN("Stop work!");
+  metricCount(CTR_ESTOPS);
+  stopTimer(progParams->station);
+  authCacheClearPending(progParams->station, 1);
+  endSession(progParams);
+  accessLogAppend(progParams->station, LOG_ESTOP, NULL, 0);
+  warmStateEstop(progParams->station, 1);
+  estopStateReached(); // The relay was already open, this times the LEDs and session catching up
+}
+
+static void actEstopRepeat (metaStruct *progParams, const accessEvent *event){
+  estopStateReached(); // Was already stopped (restored from NVS), a new fire still gets timed
+}
+
+static void actEstopClear (metaStruct *progParams, const accessEvent *event){
+  DLOG_INFO("Back to work!");
+  warmStateEstop(progParams->station, 0);
+  relayTripClear();
+  backToIdle(progParams->station);
+}
+
+//////// Transition table ////////
+
+// First matching row wins, so ST_ANY rows go last
+static constexpr accessTransition transitionTable[] = {
+  // from          event               to             relay        LEDs              action
+  {ST_IDLE,        EV_CARD_ARRIVED,    ST_CARD,       RELAY_OPEN,  LED_KEEP,         actCardArrived},
+  {ST_IDLE,        EV_NET_DOWN,        ST_OUTAGE,     RELAY_OPEN,  LED_KEEP,         NULL},
+  {ST_OUTAGE,      EV_CARD_ARRIVED,    ST_CARD,       RELAY_OPEN,  LED_KEEP,         actCardArrived},
+  {ST_OUTAGE,      EV_NET_UP,          ST_IDLE,       RELAY_OPEN,  LED_KEEP,         NULL},
+
+  {ST_CARD,        EV_AUTH_CACHED,     ST_AUTHORIZED, RELAY_CLOSE, LED_GREEN,        actSessionStart},
+  {ST_CARD,        EV_AUTH_GRANTED,    ST_RELAY_ON,   RELAY_CLOSE, LED_GREEN,        actSessionStart},
+  {ST_CARD,        EV_AUTH_DENIED,     ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actDenied},
+  {ST_CARD,        EV_TIMEOUT_EXPIRED, ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actNoAnswer},
+
+  {ST_AUTHORIZED,  EV_AUTH_GRANTED,    ST_RELAY_ON,   RELAY_CLOSE, LED_KEEP,         NULL},
+  {ST_AUTHORIZED,  EV_AUTH_DENIED,     ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actRevoked},
+  {ST_AUTHORIZED,  EV_AUTH_REVOKED,    ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actRevoked},
+  {ST_AUTHORIZED,  EV_CARD_REMOVED,    ST_TIMEOUT,    RELAY_CLOSE, LED_BLUE_BLINK,   actRemoved},
+  {ST_AUTHORIZED,  EV_COLLISION,       ST_COLLISION,  RELAY_CLOSE, LED_PURPLE_BLINK, actCollision},
+
+  {ST_RELAY_ON,    EV_CARD_REMOVED,    ST_TIMEOUT,    RELAY_CLOSE, LED_BLUE_BLINK,   actRemoved},
+  {ST_RELAY_ON,    EV_COLLISION,       ST_COLLISION,  RELAY_CLOSE, LED_PURPLE_BLINK, actCollision},
+
+  {ST_TIMEOUT,     EV_CARD_ARRIVED,    ST_HANDOVER,   RELAY_CLOSE, LED_KEEP,         actHandover},
+  {ST_TIMEOUT,     EV_AUTH_REVOKED,    ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actRevoked},
+  {ST_TIMEOUT,     EV_TIMEOUT_EXPIRED, ST_IDLE,       RELAY_OPEN,  LED_OFF,          actTimedOut},
+
+  {ST_HANDOVER,    EV_AUTH_CACHED,     ST_AUTHORIZED, RELAY_CLOSE, LED_GREEN,        actHandoverGrant},
+  {ST_HANDOVER,    EV_AUTH_GRANTED,    ST_RELAY_ON,   RELAY_CLOSE, LED_GREEN,        actHandoverGrant},
+  {ST_HANDOVER,    EV_AUTH_DENIED,     ST_TIMEOUT,    RELAY_CLOSE, LED_KEEP,         NULL},
+  {ST_HANDOVER,    EV_AUTH_REVOKED,    ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actRevoked},
+  {ST_HANDOVER,    EV_TIMEOUT_EXPIRED, ST_CARD,       RELAY_OPEN,  LED_OFF,          actHandoverExpired},
+
+  {ST_COLLISION,   EV_AUTH_REVOKED,    ST_IDLE,       RELAY_OPEN,  LED_RED_TEMP,     actRevoked},
+  {ST_COLLISION,   EV_TIMEOUT_EXPIRED, ST_IDLE,       RELAY_OPEN,  LED_OFF,          actTimedOut},
+
+  {ST_ESTOP,       EV_ESTOP_FIRE,      ST_ESTOP,      RELAY_OPEN,  LED_KEEP,         actEstopRepeat},
+  {ST_ESTOP,       EV_ESTOP_CLEAR,     ST_IDLE,       RELAY_OPEN,  LED_OFF,          actEstopClear},
+
+  {ST_ANY,         EV_ESTOP_FIRE,      ST_ESTOP,      RELAY_OPEN,  LED_YELLOW_BLINK, actEstop},
+};
+
+static constexpr size_t TRANSITION_COUNT = sizeof(transitionTable) / sizeof(transitionTable[0]);
+
+// Compile time checks on the table, C++11 constexpr so it's recursion rather than loops
+static constexpr bool rowValid (size_t i){
+  return (transitionTable[i].from < ST_COUNT || transitionTable[i].from == ST_ANY) && transitionTable[i].event < EV_COUNT
+         && transitionTable[i].to < ST_COUNT && transitionTable[i].relay <= RELAY_CLOSE && transitionTable[i].led <= LED_RED_TEMP;
+}
+
+static constexpr bool rowUnique (size_t i, size_t j){
+  return j >= TRANSITION_COUNT || (!(transitionTable[i].from == transitionTable[j].from && transitionTable[i].event == transitionTable[j].event)
+                                   && rowUnique(i, j + 1));
+}
+
+static constexpr bool tableValid (size_t i){
+  return i >= TRANSITION_COUNT || (rowValid(i) && rowUnique(i, i + 1) && tableValid(i + 1));
+}
+
+static_assert(tableValid(0), "transitionTable has an out of range field or two rows for the same state and event");
+
+static const accessTransition * findTransition (byte from, byte event){
+  for (size_t i = 0; i < TRANSITION_COUNT; i++){
+    if (transitionTable[i].event == event && (transitionTable[i].from == from || transitionTable[i].from == ST_ANY)){
+      return &transitionTable[i];
+    }
+  }
+  return NULL;
+}
+
+//////// State Machine Functions ////////
+
+void accessInit (metaStruct progParams[]){
+  for (byte i = 0; i < STATION_COUNT; i++){
+    fsm[i].params = &progParams[i];
+    fsm[i].state = ST_IDLE;
+    fsm[i].timer = xTimerCreateStatic("accessTimer", MS_TIMEOUT_PERIOD, pdFALSE, (void*)(uintptr_t)i, timerCallback, &fsm[i].timerBuf); // Timer ID is the station
+  }
+  postEvent(STATION_ALL, EV_NET_DOWN, 0, NULL, 0); // Start out in OUTAGE until MQTT connects
+}
+
+bool accessPost (byte station, byte type, const uidType *uid){
+  return postEvent(station, type, 0, uid, 0);
+}
+
+uint32_t accessQueueDepth (uint32_t *highWater){
+  *highWater = __atomic_load_n(&ringHighWater, __ATOMIC_RELAXED);
+  return accessRing.depth();
+}
+
+bool accessReceive (accessEvent *event, TickType_t wait){
+  consumer = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    if (followCount > 0){
+      *event = followUps[followHead];
+      followHead = (followHead + 1) % ACCESS_FOLLOWUP_DEPTH;
+      followCount--;
+      return 1;
+    }
+    accessEvent *e = accessRing.peek();
+    if (e != NULL){
+      *event = *e;
+      accessRing.pop();
+      return 1;
+    }
+    if (wait == 0 || ulTaskNotifyTake(pdTRUE, wait) == 0){ // Posts notify after they're in the ring, so none are missed
+      return 0;
+    }
+  }
+}
+
+// Runs one station's transition for the event, if it has one
+static void dispatchStation (byte station, const accessEvent *event){
+  stationFsm *f = &fsm[station];
+
+  if (event->type == EV_TIMEOUT_EXPIRED && event->arg != f->timerGen){
+    return; // Timer was stopped or restarted after this was posted
+  }
+
+  const accessTransition *t = findTransition(f->state, event->type);
+  if (t == NULL){
+    return; // Nothing to do for this event in this state
+  }
+
+  DLOG_INFO("%u: %s -> %s on %s", station, stateInfo[f->state].name, stateInfo[t->to].name, eventNames[event->type]);
+  f->state = t->to;
+  f->transitionCount++;
+
+  if (relayIsClosed(station) != (t->relay == RELAY_CLOSE)){
+    relaySet(station, t->relay == RELAY_CLOSE);
+  }
+  ledApply(station, t->led);
+  if (t->action != NULL){
+    t->action(f->params, event);
+  }
+}
+
+void accessDispatch (const accessEvent *event){
+  if (event->type == EV_NET_DOWN){ // Network state is kept whatever state we're in, it changes how taps are decided
+    offline = 1;
+    authCacheClearPending(STATION_ALL, 0); // The outbox drops unsent reqs, and a rsp to one that went isn't coming through a reconnect
+  }
+  else if (event->type == EV_NET_UP){
+    offline = 0;
+  }
+
+  if (event->station == STATION_ALL){ // Network and eStop events, every station in turn
+    for (byte i = 0; i < STATION_COUNT; i++){
+      dispatchStation(i, event);
+    }
+  }
+  else if (event->station < STATION_COUNT){
+    dispatchStation(event->station, event);
+  }
+
+  latencyRecord(&transitionLatency, micros() - event->stamp);
+}
+
+byte accessState (byte station){
+  return fsm[station].state;
+}
+
+byte accessReaderMode (byte station){
+  return stateInfo[fsm[station].state].readerMode;
+}
+
+uint32_t accessTransitions (byte station){
+  return fsm[station].transitionCount;
+}
@@ -0,0 +1,99 @@
+#ifndef ACCESS_FSM_H
+#define ACCESS_FSM_H
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "tool-access-RTOS.h"
+#include "latency.h"
+
+// States
+#define ST_IDLE       0 // No card, scanning for one
+#define ST_OUTAGE     1 // Same as idle but WiFi/MQTT is out, taps are decided locally
+#define ST_CARD       2 // Card read, waiting on the server (relay open)
+#define ST_AUTHORIZED 3 // Granted off the auth cache/member list, relay closed, server answer still to come
+#define ST_RELAY_ON   4 // Granted by the server (or offline), relay closed
+#define ST_TIMEOUT    5 // Card removed, relay stays closed for MS_TIMEOUT_PERIOD in case they tap back in
+#define ST_HANDOVER   6 // New card read during the timeout, waiting on the server with the relay still closed
+#define ST_COLLISION  7 // More than one card at the reader, relay stays closed until the timeout, no new cards
+#define ST_ESTOP      8 // Emergency stop, relay open, nothing happens until cleared
+#define ST_COUNT      9
+#define ST_ANY        0xFF // Wildcard for the from column
+
+// Events
+#define EV_CARD_ARRIVED   0 // readerTask read a new card, uid valid
+#define EV_CARD_REMOVED   1 // readerTask: card in session gone
+#define EV_COLLISION      2 // readerTask: more than one card
+#define EV_AUTH_CACHED    3 // Granted locally, server still to answer
+#define EV_AUTH_GRANTED   4 // Server said auth (or granted while offline)
+#define EV_AUTH_DENIED    5 // Server said denied (or denied while offline)
+#define EV_AUTH_REVOKED   6 // Server denied a card we had granted off the cache
+#define EV_TIMEOUT_EXPIRED 7 // accessTimer ran out
+#define EV_ESTOP_FIRE     8
+#define EV_ESTOP_CLEAR    9
+#define EV_NET_DOWN       10 // WiFi or MQTT lost
+#define EV_NET_UP         11 // MQTT connected
+#define EV_COUNT          12
+
+// Relay column
+#define RELAY_OPEN  0
+#define RELAY_CLOSE 1
+
+// LED column
+#define LED_KEEP          0 // Leave the LEDs as they are
+#define LED_OFF           1
+#define LED_GREEN         2 // In use
+#define LED_BLUE_BLINK    3 // Timing out
+#define LED_PURPLE_BLINK  4 // Collision
+#define LED_YELLOW_BLINK  5 // eStop
+#define LED_RED_TEMP      6 // Denied, blinks for LED_TEMP_PERIOD then goes off
+
+// What readerTask should be doing in a state
+#define READER_HOLD  0 // Leave the field alone
+#define READER_SCAN  1 // Look for new cards
+#define READER_TRACK 2 // Watch the card in session for removal/collision
+
+#define MS_AUTH_WAIT_PERIOD pdMS_TO_TICKS(5000) // Give up on the server answering after this
+#define ACCESS_QUEUE_DEPTH  32 // Power of 2, room for a burst from every station at once
+#define ACCESS_FOLLOWUP_DEPTH 4 // Events a transition posts to itself, run before anything else waiting
+
+typedef struct { // Everything that drives a station's state machine comes in as one of these
+  byte station;    // Index into stationConfigs[], or STATION_ALL
+  byte type;       // EV_*
+  uint16_t arg;    // EV_TIMEOUT_EXPIRED: timer generation, stale expiries are dropped
+  uidType uid;     // EV_CARD_ARRIVED
+  uint32_t stamp;  // micros() when it was posted
+} accessEvent;
+
+typedef void (*accessAction)(metaStruct *progParams, const accessEvent *event);
+
+typedef struct { // One row of the transition table
+  byte from;            // ST_* or ST_ANY
+  byte event;           // EV_*
+  byte to;              // ST_*
+  byte relay;           // RELAY_*
+  byte led;             // LED_*
+  accessAction action;  // Runs after the relay and LEDs are set, may be NULL
+} accessTransition;
+
+typedef struct {
+  const char *name;
+  byte readerMode;      // READER_*
+} accessStateInfo;
+
+// Latency stats, printed by readerTask every READER_STATS_PERIOD
+extern latencyStat tapToRelay;        // Card selected by readerTask to relay closed
+extern latencyStat removalToTimeout;  // Removal seen by readerTask to the timeout starting
+extern latencyStat transitionLatency; // Any event posted to its transition done
+
+extern void accessInit (metaStruct progParams[]); // Creates the queue and a timer per station. progParams has STATION_COUNT entries
+extern bool accessPost (byte station, byte type, const uidType *uid); // Safe from any task (not ISRs). station may be STATION_ALL, uid may be NULL
+extern bool accessReceive (accessEvent *event, TickType_t wait);
+extern uint32_t accessQueueDepth (uint32_t *highWater); // Events waiting on accessTask now, highWater gets the most there have been since boot
+extern void accessDispatch (const accessEvent *event); // Looks up the transition and runs it, only from accessTask
+extern byte accessState (byte station);
+extern byte accessReaderMode (byte station);
+extern uint32_t accessTransitions (byte station); // Count of transitions the station has taken, lets readerTask know the last card was picked up
+
+#endif // ACCESS_FSM_H
@@ -0,0 +1,181 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <time.h>
+#include "access-log.h"
+#include "debug-log.h"
+#include "lf-ring.h"
+
+/* Binary, append-only access log. Replaces the old CSV writeLog.
+   Callers only copy a record into a lock-free RAM ring (a few us, never touches flash or waits on the other core).
+   That works from the first line of setup (), before SPIFFS is mounted, the ring just holds on to it until then.
+   accessLogTask owns the open File and writes the ring out in batches, flushing after every batch so a power cut loses
+   at most what was still in the ring. While the file isn't open records stay in the ring, it tries again every flush
+   period. Anything that doesn't fit in the ring or doesn't make it into the file is counted in accessLogDropped ().
+   A record torn by a power cut fails its crc and is skipped by the decoder, on the next boot we pad the file back to a
+   record boundary so everything after it lines up again.
+*/
+
+static File logFile;
+static lfRing<accessLogRecord, ACCESSLOG_RING_SIZE> ring;
+static uint32_t nextSeq = 0;    // accessLogTask's, records get their seq (and crc) as they're written
+static uint32_t dropped = 0;
+static TaskHandle_t flushHandle = NULL;
+
+// CRC-16/CCITT-FALSE, bitwise. Records are 26 bytes so a table isn't worth the flash
+uint16_t accessLogCrc (const byte *data, size_t len){
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++){
+    crc ^= (uint16_t)data[i] << 8;
+    for (byte b = 0; b < 8; b++){
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static bool recordValid (const accessLogRecord *r){
+  return (r->magic == ACCESSLOG_MAGIC) && (r->crc == accessLogCrc((const byte*)r, offsetof(accessLogRecord, crc)));
+}
+
+/* Finds the seq of the last good record in a log file, scanning back over a torn tail.
+   Returns false if there is no good record.
+*/
+static bool lastSeq (const char * path, uint32_t *seq){
+  File f = SPIFFS.open(path, FILE_READ);
+  if (!f){
+    return 0;
+  }
+
+  accessLogRecord r;
+  size_t records = f.size() / sizeof(accessLogRecord);
+  for (int back = 0; back < 8 && records > 0; back++, records--){
+    f.seek((records - 1) * sizeof(accessLogRecord));
+    if (f.read((byte*)&r, sizeof(r)) == sizeof(r) && recordValid(&r)){
+      *seq = r.seq;
+      f.close();
+      return 1;
+    }
+  }
+  f.close();
+  return 0;
+}
+
+static bool openLog (){
+  logFile = SPIFFS.open(ACCESSLOG_PATH, FILE_APPEND);
+  if (!logFile){
+    return 0; // The callers say so, accessLogTask retries quietly
+  }
+
+  // A torn record from a power cut leaves us off a record boundary, pad so the next record is aligned
+  size_t partial = logFile.size() % sizeof(accessLogRecord);
+  if (partial != 0){
+    byte pad[sizeof(accessLogRecord)];
+    memset(pad, 0xFF, sizeof(pad));
+    logFile.write(pad, sizeof(accessLogRecord) - partial);
+    logFile.flush();
+  }
+  return 1;
+}
+
+bool accessLogInit (){
+  uint32_t seq;
+  if (lastSeq(ACCESSLOG_PATH, &seq) || lastSeq(ACCESSLOG_OLD_PATH, &seq)){ // Old log covers a crash right after rotating
+    nextSeq = seq + 1;
+  }
+
+  return openLog();
+}
+
+static void countDropped (uint32_t n){
+  __atomic_add_fetch(&dropped, n, __ATOMIC_RELAXED);
+}
+
+void accessLogAppend (byte station, byte event, const uidType *uid, uint32_t duration){
+  accessLogRecord r;
+  time_t now = time(NULL);
+
+  memset(&r, 0, sizeof(r));
+  r.magic = ACCESSLOG_MAGIC;
+  r.event = event;
+  r.flags = station << LOGFLAG_STATION_SHIFT;
+  if (now > 1600000000){ // SNTP has set the clock
+    r.flags |= LOGFLAG_EPOCH;
+    r.timestamp = (uint32_t)now;
+  }
+  else{
+    r.timestamp = millis();
+  }
+  if (uid != NULL){
+    r.uid = *uid;
+  }
+  r.duration = duration;
+
+  if (!ring.push(r)){
+    countDropped(1); // Never block the caller on flash, count it instead
+    return;
+  }
+
+  if (flushHandle != NULL && ring.depth() >= ACCESSLOG_BATCH){
+    xTaskNotifyGive(flushHandle);
+  }
+}
+
+uint32_t accessLogDropped (){
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+static void rotateLog (){
+  DLOG_INFO("Rotating access log");
+  logFile.close();
+  SPIFFS.remove(ACCESSLOG_OLD_PATH);
+  SPIFFS.rename(ACCESSLOG_PATH, ACCESSLOG_OLD_PATH);
+  if (!openLog()){
+    DLOG_ERROR("Access log could not be reopened after rotating");
+  }
+}
+
+/* Drains the ring to flash. Wakes when ACCESSLOG_BATCH records are waiting or every ACCESSLOG_FLUSH_PERIOD.
+*/
+void accessLogTask (void *params){
+  accessLogRecord batch[ACCESSLOG_RING_SIZE];
+  uint16_t n;
+
+  flushHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    ulTaskNotifyTake(pdTRUE, ACCESSLOG_FLUSH_PERIOD);
+
+    if (!logFile && !openLog()){
+      continue; // SPIFFS didn't mount or the file won't open, leave the records in the ring
+    }
+
+    // Copy out so the ring has room again while we're writing
+    accessLogRecord *r;
+    n = 0;
+    while (n < ACCESSLOG_RING_SIZE && (r = ring.peek()) != NULL){
+      batch[n] = *r;
+      ring.pop();
+      batch[n].seq = nextSeq++;
+      batch[n].crc = accessLogCrc((const byte*)&batch[n], offsetof(accessLogRecord, crc));
+      n++;
+    }
+
+    if (n == 0){
+      continue;
+    }
+
+    if (logFile.size() + (n * sizeof(accessLogRecord)) > ACCESSLOG_MAX_SIZE){
+      rotateLog();
+    }
+    if (!logFile){
+      countDropped(n); // Rotating lost the file, these already have their seq so they can't wait for the next one
+      continue;
+    }
+
+    size_t written = logFile.write((const byte*)batch, n * sizeof(accessLogRecord));
+    logFile.flush(); // Commit the batch so it survives a power cut
+    if (written < n * sizeof(accessLogRecord)){
+      countDropped(n - written / sizeof(accessLogRecord)); // SPIFFS full, a torn last one is skipped by the decoder anyway
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+// Access log defines
+#define ACCESSLOG_PATH        "/access.log"   // Current log, stays open in append mode
+#define ACCESSLOG_OLD_PATH    "/access.old"   // Previous log after rotation, only one generation is kept
+#define ACCESSLOG_MAX_SIZE    (64 * 1024)     // Rotate once the current log reaches this many bytes
+#define ACCESSLOG_RING_SIZE   32              // Records buffered in RAM between flushes, power of 2
+#define ACCESSLOG_BATCH       8               // Wake the flush task once this many records are waiting
+#define ACCESSLOG_FLUSH_PERIOD pdMS_TO_TICKS(5000) // Flush whatever is waiting at least this often
+#define ACCESSLOG_MAGIC       0xA5            // First byte of every record, lets the decoder resync after a torn write
+
+// Event types, stored in accessLogRecord.event. Keep tools/accesslog-decode.py in step with these
+#define LOG_BOOT          0  // Log opened after power on
+#define LOG_TAP_REQ       1  // Card read, rfid/auth/req published
+#define LOG_TAP_CACHED    2  // Card granted off the auth cache / member list
+#define LOG_TAP_OFFLINE   3  // Card granted while WiFi/MQTT was out
+#define LOG_AUTH_GRANTED  4  // Server said auth
+#define LOG_AUTH_DENIED   5  // Server (or offline cache) said denied
+#define LOG_AUTH_REVOKED  6  // Server denied a card we had let in off the cache
+#define LOG_SESSION_END   7  // Relay opened after timeout, duration = ms the relay was closed
+#define LOG_COLLISION     8  // More than one card at the reader
+#define LOG_ESTOP         9  // eStop fired
+
+// Flag bits, stored in accessLogRecord.flags
+#define LOGFLAG_EPOCH     (1 << 0) // timestamp is seconds since 1970 (SNTP has set the clock), otherwise it is millis() since boot
+#define LOGFLAG_STATION_SHIFT 4    // Top 4 bits are the station the event happened at
+
+/* One fixed size record, little endian, 28 bytes.
+   crc is CRC-16/CCITT-FALSE over every byte before it. A record with a bad magic or crc is a torn write and is skipped.
+*/
+typedef struct __attribute__((packed)) {
+  byte magic;          // ACCESSLOG_MAGIC
+  byte event;          // LOG_*
+  byte flags;          // LOGFLAG_*
+  uidType uid;         // 11 bytes, length 0 when the event has no card
+  uint32_t seq;        // Monotonic across reboots and rotations
+  uint32_t timestamp;  // See LOGFLAG_EPOCH
+  uint32_t duration;   // ms, only meaningful for LOG_SESSION_END
+  uint16_t crc;
+} accessLogRecord;
+
+extern bool accessLogInit ();  // Opens (or creates) the log and recovers seq. Call after SPIFFS is mounted, before accessLogTask starts
+extern void accessLogTask (void *params); // Low priority task that batches the RAM ring out to flash
+extern void accessLogAppend (byte station, byte event, const uidType *uid, uint32_t duration); // Non-blocking, safe from any task. uid may be NULL
+extern uint32_t accessLogDropped (); // Records lost because the ring was full or the write to SPIFFS fell short
+extern uint16_t accessLogCrc (const byte *data, size_t len);
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,228 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "tool-access-RTOS.h"
+#include "auth-cache.h"
+#include "access-fsm.h"
+#include "debug-log.h"
+
+/* Local allow/deny cache so a tap doesn't have to wait on the rfid/auth/req -> rfid/auth/rsp round trip.
+   Keyed on the station and the binary UID (not uidStr). Fixed size, no heap. When full the entry with the oldest stamp is evicted.
+   Touched from pollNewTask and from the AsyncMqttClient callback (a different task) so everything goes through cacheMux.
+*/
+
+static authCacheEntry cache[AUTHCACHE_SIZE];
+static portMUX_TYPE cacheMux = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct { // The card a station last asked the server about
+  uidType uid;         // length 0 means no request outstanding
+  bool fromCache;      // Did we already grant this card off the cache?
+} pendingRequest;
+
+static pendingRequest pending[STATION_COUNT];
+static uint16_t unnamedOwed = 0;     // Reqs given up on whose rsp may still come, the next unnamed rsps are theirs
+static uint32_t generation = 0;
+
+// Must be called with cacheMux held
+static authCacheEntry * findEntry (byte station, const uidType *uid){
+  for (int i = 0; i < AUTHCACHE_SIZE; i++){
+    if (cache[i].station == station && uidEqual(cache[i].uid, *uid)){
+      return &cache[i];
+    }
+  }
+  return NULL;
+}
+
+void authCacheInit (){
+  portENTER_CRITICAL(&cacheMux);
+  memset(cache, 0, sizeof(cache));
+  memset(pending, 0, sizeof(pending));
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+authCacheResult authCacheLookup (byte station, const uidType *uid, bool offline){
+  authCacheResult result = CACHE_MISS;
+  uint32_t now = millis();
+
+  if (uid->length == 0){
+    return CACHE_MISS;
+  }
+
+  portENTER_CRITICAL(&cacheMux);
+  authCacheEntry *e = findEntry(station, uid);
+  if (e != NULL){
+    uint32_t age = now - e->stamp; // Unsigned subtraction so millis() rollover doesn't matter
+    if (e->allowed){
+      if (age < (offline ? AUTHCACHE_OFFLINE_TTL : AUTHCACHE_ALLOW_TTL)){
+        result = CACHE_ALLOW;
+      }
+    }
+    else if (age < AUTHCACHE_DENY_TTL){
+      result = CACHE_DENY;
+    }
+  }
+  portEXIT_CRITICAL(&cacheMux);
+
+  return result;
+}
+
+void authCacheStore (byte station, const uidType *uid, bool allowed){
+  uint32_t now = millis();
+
+  if (uid->length == 0){
+    return;
+  }
+
+  portENTER_CRITICAL(&cacheMux);
+  authCacheEntry *e = findEntry(station, uid);
+  if (e == NULL){ // Not cached yet, take a free slot or evict the oldest
+    e = &cache[0];
+    for (int i = 0; i < AUTHCACHE_SIZE; i++){
+      if (cache[i].uid.length == 0){
+        e = &cache[i];
+        break;
+      }
+      if ((now - cache[i].stamp) > (now - e->stamp)){
+        e = &cache[i];
+      }
+    }
+    e->uid = *uid;
+    e->station = station;
+  }
+  e->allowed = allowed;
+  e->stamp = now;
+  generation++;
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+uint32_t authCacheGeneration (){
+  return generation;
+}
+
+byte authCacheExport (authCacheEntry *out){
+  uint32_t now = millis();
+  byte n = 0;
+
+  portENTER_CRITICAL(&cacheMux);
+  for (int i = 0; i < AUTHCACHE_SIZE; i++){
+    if (cache[i].uid.length != 0){
+      out[n] = cache[i];
+      out[n].stamp = now - cache[i].stamp;
+      n++;
+    }
+  }
+  portEXIT_CRITICAL(&cacheMux);
+  return n;
+}
+
+void authCacheImport (const authCacheEntry *in, byte count){
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&cacheMux);
+  for (byte i = 0; i < count && i < AUTHCACHE_SIZE; i++){
+    if (in[i].station < STATION_COUNT && in[i].uid.length > 0 && in[i].uid.length <= UID_MAX_SIZE){
+      cache[i] = in[i];
+      cache[i].stamp = now - in[i].stamp; // Unsigned, wraps back before boot and the TTL checks still work
+    }
+  }
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+void authCacheSetPending (byte station, const uidType *uid, bool grantedFromCache){
+  portENTER_CRITICAL(&cacheMux);
+  pending[station].uid = *uid;
+  pending[station].fromCache = grantedFromCache;
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+/* The broker keeps rsps in order, so when a station gives up on a req that went out, the next rsp without a uidStr is the
+   late answer to it and not to whatever the station asks next. If it never comes the next card times out instead,
+   which is the safe way round. Losing the network (STATION_ALL, not sent) starts the count over. With several stations
+   unnamed rsps are never taken so there's nothing to count.
+*/
+void authCacheClearPending (byte station, bool sent){
+  portENTER_CRITICAL(&cacheMux);
+  if (station == STATION_ALL && !sent){
+    unnamedOwed = 0;
+  }
+  for (byte i = 0; i < STATION_COUNT; i++){
+    if ((station == STATION_ALL || station == i) && pending[i].uid.length > 0){
+      pending[i].uid.length = 0;
+      pending[i].fromCache = 0;
+      if (sent && STATION_COUNT == 1){
+        unnamedOwed++;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+/* Only a station still waiting on the server can take a rsp that doesn't say which card it's for. Once it has given up
+   (timed out, eStop, network lost) or moved on, an unnamed rsp could just as well be for the card before.
+   With one station that's enough to go on.
+*/
+static bool waitingOnServer (byte station){
+  byte state = accessState(station);
+  return (state == ST_CARD || state == ST_AUTHORIZED || state == ST_HANDOVER);
+}
+
+/* Called from onMqttMessage when rfid/auth/rsp arrives. Refreshes the cache entry of the card we asked about.
+   Returns true when that card was let in off the cache but the server now says denied, ie. the caller must revoke.
+   An echoed uidStr has to match the card pending. A rsp without one is only taken with a single station: the station
+   has at most one request outstanding and the broker keeps rsps in order. With several stations any of them could be
+   the one it answers and guessing would open the wrong tool, so the server has to echo the uidStr.
+*/
+bool authCacheResolve (bool allowed, const char *args, size_t argsLen, uidType *resolved, byte *station){
+  uidType echoed;
+  uidType uid;
+  bool revoke = 0;
+  int found = -1;
+
+  size_t uidLen = 0;
+  while (uidLen < argsLen && args[uidLen] != ',' && args[uidLen] != ' '){ // Only the first field, anything after is for someone else
+    uidLen++;
+  }
+  uidFromHexStr(&echoed, args, uidLen);
+  bool unnamedOk = (echoed.length == 0) && (STATION_COUNT == 1) && waitingOnServer(0);
+
+  portENTER_CRITICAL(&cacheMux);
+  bool late = (echoed.length == 0 && unnamedOwed > 0); // Answers a req already given up on
+  if (late){
+    unnamedOwed--;
+  }
+  for (byte i = 0; i < STATION_COUNT && !late; i++){
+    if (pending[i].uid.length == 0){
+      continue;
+    }
+    if ((echoed.length > 0) ? uidEqual(pending[i].uid, echoed) : unnamedOk){
+      found = i;
+      break;
+    }
+  }
+  memset(&uid, 0, sizeof(uid));
+  if (found >= 0){
+    uid = pending[found].uid;
+    revoke = pending[found].fromCache && !allowed;
+    pending[found].uid.length = 0;
+    pending[found].fromCache = 0;
+  }
+  portEXIT_CRITICAL(&cacheMux);
+
+  if (resolved != NULL){
+    *resolved = uid;
+  }
+  if (station != NULL){
+    *station = (found >= 0) ? found : 0;
+  }
+
+  if (uid.length == 0){ // Not for anything outstanding (a stray, late or retained rsp)
+    if (echoed.length == 0 && STATION_COUNT > 1){
+      DLOG_WARN("rsp without a uidStr dropped, with several stations the server has to echo it");
+    }
+    return 0;
+  }
+
+  authCacheStore(found, &uid, allowed);
+  return revoke;
+}
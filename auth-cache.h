@@ -0,0 +1,43 @@
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+// Auth cache defines
+#define AUTHCACHE_SIZE          32          // # of UIDs we remember, oldest entry gets evicted when full
+#define AUTHCACHE_ALLOW_TTL     3600000UL   // ms an allow entry lets a tap skip the MQTT round trip (1 hour)
+#define AUTHCACHE_DENY_TTL      600000UL    // ms a deny entry is honoured while offline (10 min)
+#define AUTHCACHE_OFFLINE_TTL   604800000UL // ms an allow entry is honoured while WiFi/MQTT is out (7 days)
+#define OFFLINE_GRANT_UNKNOWN   0           // Set to 1 to restore the old "grant everyone while offline" behaviour for uncached cards
+
+// Result of a cache lookup
+typedef enum {
+  CACHE_MISS = 0,   // Never seen this card or its entry is stale
+  CACHE_ALLOW,      // Server said auth recently enough
+  CACHE_DENY        // Server said denied recently enough
+} authCacheResult;
+
+typedef struct {
+  uidType uid;                 // Binary UID as read out of mfrc522.uid.uidByte, length 0 marks a free slot
+  byte station;                // Answers are per tool, a grant on one station says nothing about the next
+  bool allowed;                // Last answer from the server
+  uint32_t stamp;              // millis() when the server answered
+} authCacheEntry;
+
+extern void authCacheInit ();
+extern authCacheResult authCacheLookup (byte station, const uidType *uid, bool offline); // offline picks the long TTLs
+extern void authCacheStore (byte station, const uidType *uid, bool allowed);
+extern uint32_t authCacheGeneration ();               // Goes up on every store, tells warm-state.cpp there's something new to save
+extern byte authCacheExport (authCacheEntry *out);    // Copies out the used entries with stamp turned into their age in ms, returns how many
+extern void authCacheImport (const authCacheEntry *in, byte count); // Back from authCacheExport (), ages carry on from where they were
+extern void authCacheSetPending (byte station, const uidType *uid, bool grantedFromCache); // Remember the card a station is waiting on an rfid/auth/rsp for
+extern void authCacheClearPending (byte station, bool sent); // Stop waiting, a late rsp for that card is dropped. sent if the req went out. STATION_ALL for every station
+/* Store an rsp against the card it answers: the pending card whose uidStr is in args. A rsp without a uidStr is only
+   taken with STATION_COUNT 1, by the station if it's still waiting on the server (ST_CARD, ST_AUTHORIZED, ST_HANDOVER).
+   Returns true if a cached grant must be revoked. resolved and station (may be NULL) get the card and its station,
+   resolved->length is 0 if the rsp wasn't for anything pending.
+*/
+extern bool authCacheResolve (bool allowed, const char *args, size_t argsLen, uidType *resolved, byte *station);
+
+#endif // AUTH_CACHE_H
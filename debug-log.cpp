@@ -0,0 +1,164 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "debug-log.h"
+#include "lf-ring.h"
+
+/* One lock-free ring per core (see lf-ring.h), so a task logging on one core never contends with the other core.
+   dlogTask is the only consumer of both. Nothing here ever blocks a caller, unless built with DLOG_SYNC.
+*/
+
+typedef struct {
+  uint32_t stamp;                // millis() when it was logged
+  const char *fmt;
+  byte level;
+  byte nargs;
+  uint32_t args[DLOG_MAX_ARGS];
+} dlogEntry;
+
+typedef lfRing<dlogEntry, DLOG_RING_SIZE> dlogRing;
+
+static dlogRing rings[portNUM_PROCESSORS];
+static uint32_t dropped = 0;
+static byte sinkLevel[DLOG_SINK_COUNT] = {DLOG_LEVEL_INFO, DLOG_LEVEL_WARN, DLOG_LEVEL_NONE}; // Only problems go to flash
+static dlogPublishFn publishFn = NULL;
+static TaskHandle_t drainHandle = NULL;
+static File logFile;
+static bool flashReady = 0; // SPIFFS is mounted, until then flash lines are left out
+
+static const char levelChars[] = {'-', 'E', 'W', 'I', 'D'};
+
+void dlogInit (dlogPublishFn publish){
+  publishFn = publish;
+  if (publish != NULL){
+    sinkLevel[DLOG_SINK_MQTT] = DLOG_LEVEL_WARN;
+  }
+}
+
+void dlogSetSink (byte sink, byte level){
+  if (sink < DLOG_SINK_COUNT){
+    sinkLevel[sink] = level;
+  }
+}
+
+void dlogFlashReady (){
+  __atomic_store_n(&flashReady, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t dlogDropped (){
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+static size_t render (const dlogEntry *e, char *line, size_t size){
+  const uint32_t *a = e->args;
+  int n = snprintf(line, size, "%lu %c ", (unsigned long)e->stamp, levelChars[min(e->level, (byte)DLOG_LEVEL_DEBUG)]);
+  // Every argument went in as 32 bits, which is what the ESP32 passes through varargs for ints and pointers alike.
+  // Widened to a pointer's size for the host build (tools/host), where %s wants 64 bits. On the ESP32 the casts change nothing
+  int m = snprintf(line + n, size - n, e->fmt, (uintptr_t)a[0], (uintptr_t)a[1], (uintptr_t)a[2], (uintptr_t)a[3],
+                   (uintptr_t)a[4], (uintptr_t)a[5]);
+  return min((size_t)(n + max(m, 0)), size - 1);
+}
+
+bool dlogPush (byte level, const char *fmt, const uint32_t *args, byte nargs){
+  dlogRing *r = &rings[xPortGetCoreID()];
+  dlogEntry e;
+
+  e.stamp = millis();
+  e.fmt = fmt;
+  e.level = level;
+  e.nargs = nargs;
+  memcpy(e.args, args, nargs * sizeof(uint32_t));
+#ifdef DLOG_SYNC
+  if (level <= sinkLevel[DLOG_SINK_SERIAL]){ // Formatted and written here, by the caller
+    char line[DLOG_LINE_MAX];
+    size_t len = render(&e, line, sizeof(line));
+    Serial.write((const uint8_t*)line, len);
+    Serial.write((const uint8_t*)"\r\n", 2);
+  }
+#endif
+  if (!r->push(e)){ // Full
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  if (drainHandle != NULL && r->depth() >= DLOG_RING_SIZE / 2){ // Getting full, don't wait out the drain period
+    xTaskNotifyGive(drainHandle);
+  }
+  return 1;
+}
+
+static void writeLine (byte level, const char *line, size_t len){
+#ifndef DLOG_SYNC
+  if (level <= sinkLevel[DLOG_SINK_SERIAL]){
+    Serial.write((const uint8_t*)line, len);
+    Serial.write((const uint8_t*)"\r\n", 2);
+  }
+#endif
+  // Nothing to open before storageInit () has mounted SPIFFS, and every try costs a trip through the VFS
+  if (level <= sinkLevel[DLOG_SINK_FLASH] && __atomic_load_n(&flashReady, __ATOMIC_ACQUIRE)){
+    if (!logFile){ // Once, and again after each rotation
+      logFile = SPIFFS.open(DLOG_PATH, FILE_APPEND);
+      if (!logFile){
+        flashReady = 0; // Mounted but it won't open (full?), not worth trying again every line
+        static const char off[] = "dlog: " DLOG_PATH " won't open, flash sink off";
+        writeLine(DLOG_LEVEL_WARN, off, sizeof(off) - 1);
+      }
+    }
+    if (logFile){
+      logFile.write((const uint8_t*)line, len);
+      logFile.write((const uint8_t*)"\n", 1);
+      if (logFile.size() > DLOG_FILE_MAX){ // Keep one old generation, same as the access log
+        logFile.close();
+        SPIFFS.remove(DLOG_OLD_PATH);
+        SPIFFS.rename(DLOG_PATH, DLOG_OLD_PATH);
+      }
+    }
+  }
+  if (level <= sinkLevel[DLOG_SINK_MQTT] && publishFn != NULL){
+    publishFn(DLOG_MQTT_TOPIC, line);
+  }
+}
+
+/* Drains both rings oldest first. Runs at the lowest priority so logging only uses time nothing else wanted.
+*/
+void dlogTask (void *params){
+  uint32_t reportedDrops = 0;
+  char line[DLOG_LINE_MAX];
+  dlogEntry *next;
+  dlogEntry *e;
+  byte from;
+
+  drainHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    ulTaskNotifyTake(pdTRUE, DLOG_DRAIN_PERIOD);
+
+    for(;;){
+      next = NULL;
+      from = 0;
+      for (byte c = 0; c < portNUM_PROCESSORS; c++){
+        e = rings[c].peek();
+        if (e != NULL && (next == NULL || (int32_t)(e->stamp - next->stamp) < 0)){
+          next = e;
+          from = c;
+        }
+      }
+      if (next == NULL){
+        break;
+      }
+      writeLine(next->level, line, render(next, line, sizeof(line)));
+      rings[from].pop();
+    }
+
+    if (logFile){
+      logFile.flush();
+    }
+
+    uint32_t d = dlogDropped();
+    if (d != reportedDrops){
+      char line[48];
+      int n = snprintf(line, sizeof(line), "%lu W dlog dropped %lu records", (unsigned long)millis(), (unsigned long)(d - reportedDrops));
+      writeLine(DLOG_LEVEL_WARN, line, n);
+      reportedDrops = d;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include <Arduino.h>
+#include <type_traits>
+
+/* Debug logging. DLOG_* calls don't format or print anything, they drop the format string and its arguments into a
+   ring for the core they're on and return. dlogTask formats them later, at low priority, and sends them to Serial,
+   a file on flash and/or an MQTT debug topic. If the ring is full the record is dropped and counted, never waited on.
+   Rules that come with deferred formatting:
+   - The format string must be a literal, and so must any %s argument (state names, etc.), they're read later.
+   - At most DLOG_MAX_ARGS arguments, each 32 bits. No %f, no %llu.
+   Built with DLOG_SYNC the Serial sink is written by the caller instead, the old blocking way. For chasing a crash,
+   where the last lines matter more than the time, and as the before for tools/debug-log-bench.cpp.
+*/
+
+// Levels
+#define DLOG_LEVEL_NONE  0
+#define DLOG_LEVEL_ERROR 1
+#define DLOG_LEVEL_WARN  2
+#define DLOG_LEVEL_INFO  3
+#define DLOG_LEVEL_DEBUG 4
+
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL DLOG_LEVEL_INFO // Calls above this level compile to nothing
+#endif
+
+// Sinks
+#define DLOG_SINK_SERIAL 0
+#define DLOG_SINK_FLASH  1
+#define DLOG_SINK_MQTT   2
+#define DLOG_SINK_COUNT  3
+
+#define DLOG_MAX_ARGS      6
+#define DLOG_RING_SIZE     32      // Records per core, power of 2
+#define DLOG_DRAIN_PERIOD  pdMS_TO_TICKS(50)
+#define DLOG_LINE_MAX      128
+#define DLOG_PATH          "/debug.log"
+#define DLOG_OLD_PATH      "/debug.old"
+#define DLOG_FILE_MAX      (16 * 1024)
+#define DLOG_MQTT_TOPIC    "rfid/debug"
+
+typedef uint16_t (*dlogPublishFn)(const char *topic, const char *payload); // Returns 0 if it wasn't sent
+
+extern void dlogInit (dlogPublishFn publish); // publish may be NULL, the MQTT sink then stays quiet
+extern void dlogSetSink (byte sink, byte level); // Most verbose level a sink gets, DLOG_LEVEL_NONE turns it off
+extern void dlogFlashReady (); // SPIFFS is mounted, the flash sink can open its file. Lines before this don't go to flash
+extern void dlogTask (void *params);
+extern uint32_t dlogDropped ();
+extern bool dlogPush (byte level, const char *fmt, const uint32_t *args, byte nargs); // Use the macros
+
+template<typename T> inline uint32_t dlogArg (T v){
+  static_assert(!std::is_floating_point<T>::value, "DLOG can't take floats");
+  return (uint32_t)v;
+}
+
+template<typename T> inline uint32_t dlogArg (T *p){
+  return (uint32_t)(uintptr_t)p;
+}
+
+template<typename... Args> inline void dlogRecord (byte level, const char *fmt, Args... args){
+  static_assert(sizeof...(args) <= DLOG_MAX_ARGS, "Too many DLOG arguments");
+  const uint32_t a[] = {0, dlogArg(args)...};
+  dlogPush(level, fmt, a + 1, sizeof...(args));
+}
+
+#if DLOG_LEVEL >= DLOG_LEVEL_ERROR
+#define DLOG_ERROR(...) dlogRecord(DLOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define DLOG_ERROR(...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_WARN
+#define DLOG_WARN(...) dlogRecord(DLOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define DLOG_WARN(...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_INFO
+#define DLOG_INFO(...) dlogRecord(DLOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define DLOG_INFO(...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_DEBUG
+#define DLOG_DEBUG(...) dlogRecord(DLOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define DLOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif // DEBUG_LOG_H
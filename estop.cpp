@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "estop.h"
+#include "access-fsm.h"
+#include "outbox.h"
+#include "debug-log.h"
+#include "metrics.h"
+
+static volatile uint32_t fireUs = 0;    // micros() the fire reached the board
+static volatile uint32_t openUs = 0;    // micros() every relay pin read back low
+static volatile bool openSeen = 0;      // They did, within ESTOP_READBACK_TRIES reads
+static volatile byte source = 0;        // ESTOP_SRC_* of the last fire
+static volatile bool pendingFire = 0;   // Tripped, estopTask hasn't followed up yet
+static volatile bool stateDue = 0;      // Tripped, the state machine hasn't reached ESTOP yet
+static uint32_t relayMaxUs = 0;
+static uint32_t stateMaxUs = 0;
+static TaskHandle_t followHandle = NULL;
+
+// Only the first fire since the last clear is timed and followed up, later ones (switch bounce too) just open again
+static bool IRAM_ATTR trip (byte src, uint32_t seen){
+  bool open = 0;
+  if (!relayTrip()){
+    return 0;
+  }
+  for (byte i = 0; i < ESTOP_READBACK_TRIES && !open; i++){ // The pads follow the register within a few APB cycles
+    open = relayAllOpen();
+  }
+  openUs = micros();
+  openSeen = open;
+  fireUs = seen;
+  source = src;
+  stateDue = 1;
+  __atomic_store_n(&pendingFire, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static void IRAM_ATTR estopIsr (){
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  if (trip(ESTOP_SRC_SWITCH, micros()) && followHandle != NULL){
+    vTaskNotifyGiveFromISR(followHandle, &xHigherPriorityTaskWoken);
+  }
+  if (xHigherPriorityTaskWoken){
+    portYIELD_FROM_ISR();
+  }
+}
+
+static bool switchPressed (){
+  return ESTOP_PIN >= 0 && digitalRead(ESTOP_PIN) == HIGH;
+}
+
+void estopInit (){
+  if (ESTOP_PIN < 0){
+    return;
+  }
+  pinMode(ESTOP_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ESTOP_PIN), estopIsr, RISING);
+  if (switchPressed()){ // Pressed (or cut) before we were listening, estopTask follows up once it starts
+    trip(ESTOP_SRC_SWITCH, micros());
+  }
+}
+
+void estopFire (byte src, uint32_t seenUs){
+  if (trip(src, seenUs) && followHandle != NULL){
+    xTaskNotifyGive(followHandle);
+  }
+}
+
+bool estopClear (){
+  if (switchPressed()){
+    DLOG_WARN("eStop switch still pressed, not clearing");
+    return 0;
+  }
+  stateDue = 0;
+  if (!accessPost(STATION_ALL, EV_ESTOP_CLEAR, NULL)){ // The relay latch comes off when the state machine gets this
+    DLOG_WARN("eStop clear dropped, the access queue is full, still stopped");
+    return 0; // The AsyncTCP task can't wait on it, the server sends clear again
+  }
+  return 1;
+}
+
+// Keeps the worst, checks it against the bound. Returns true if it was within it
+static bool check (uint32_t *worst, byte hist, uint32_t us, uint32_t bound){
+  metricObserve(hist, us);
+  if (us > __atomic_load_n(worst, __ATOMIC_RELAXED)){
+    __atomic_store_n(worst, us, __ATOMIC_RELAXED);
+  }
+  if (us > bound){
+    metricCount(CTR_ESTOP_LATE);
+    return 0;
+  }
+  return 1;
+}
+
+void estopStateReached (){
+  if (!__atomic_exchange_n(&stateDue, 0, __ATOMIC_ACQUIRE)){
+    return; // Restored from NVS, or another station already got there
+  }
+  uint32_t us = micros() - fireUs;
+  if (!check(&stateMaxUs, HIST_ESTOP_TO_STATE, us, ESTOP_STATE_BOUND_US)){
+    DLOG_ERROR("eStop took %luus to reach the state machine, bound is %luus", (unsigned long)us, (unsigned long)ESTOP_STATE_BOUND_US);
+  }
+}
+
+uint32_t estopRelayMaxUs (){
+  return __atomic_load_n(&relayMaxUs, __ATOMIC_RELAXED);
+}
+
+uint32_t estopStateMaxUs (){
+  return __atomic_load_n(&stateMaxUs, __ATOMIC_RELAXED);
+}
+
+/* Sleeps until a fire. The relays are already open by the time it runs, this is the follow up.
+*/
+void estopTask (void *params){
+  followHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    if (__atomic_exchange_n(&pendingFire, 0, __ATOMIC_ACQUIRE)){
+      uint32_t us = openUs - fireUs;
+      if (!openSeen){ // Not straight away. Late, or not at all
+        us = relayAllOpen() ? micros() - fireUs : UINT32_MAX;
+      }
+      // First, the LEDs and session wait on this. It has to get there, a lost fire leaves the relays latched open
+      // with the state machine none the wiser, and a clear then has nothing to clear. accessTask is below us on this
+      // core, a tick is plenty for it to make room
+      while (!accessPost(STATION_ALL, EV_ESTOP_FIRE, NULL)){
+        vTaskDelay(1);
+      }
+      if (!check(&relayMaxUs, HIST_ESTOP_TO_RELAY, us, ESTOP_RELAY_BOUND_US)){
+        if (us == UINT32_MAX){
+          DLOG_ERROR("eStop tripped but a relay pin still reads high");
+        }
+        else{
+          DLOG_ERROR("eStop took %luus to open the relays, bound is %luus", (unsigned long)us, (unsigned long)ESTOP_RELAY_BOUND_US);
+        }
+      }
+      if (source == ESTOP_SRC_SWITCH){
+        DLOG_WARN("eStop switch pressed, relays open after %luus", (unsigned long)us);
+        outboxPush(0, OUTBOX_ESTOP, "switch", 0); // The server only knows about the MQTT ones otherwise
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef ESTOP_H
+#define ESTOP_H
+
+#include <Arduino.h>
+
+/* Emergency stop. Whatever fires it, the local switch on ESTOP_PIN or "fire" on rfid/estop, the relays are opened
+   right there by relayTrip () (in the ISR for the switch), not by the state machine. estopTask, the highest priority
+   task we have, follows up: it tells the state machine (LEDs, session, access log), reports a switch press over MQTT
+   and checks how long it took against the bounds below.
+
+   Two latencies are timed on every fire, from the moment it reached the board (ISR entry for the switch, which is the
+   earliest we can see the edge, or the first chunk of the rfid/estop message arriving): to every relay pin reading
+   back low at the pad (relayAllOpen ()), and to the state machine being in ESTOP. Both go into the metrics as
+   histograms plus the worst since boot, and a fire over a bound is counted and logged as an error. A relay pin that
+   still reads high after the trip (held up from outside, a mask that missed it) counts as never opening, UINT32_MAX.
+   tools/estop-test.cpp checks all of that on the host harness, edge to pad from outside the firmware.
+   An MQTT fire takes exactly the same path as the switch bar the ISR, so tools/estop-bench.py can fire it in a loop
+   on a bench board with nothing wired and check the bounds from the metrics.
+*/
+
+#define ESTOP_SRC_SWITCH      0
+#define ESTOP_SRC_MQTT        1
+#define ESTOP_RELAY_BOUND_US  50     // Fire to relays reading open. Mostly interrupt entry, then two register writes and a read back
+#define ESTOP_READBACK_TRIES  8      // Reads of the pads after the trip before we say a relay didn't open
+#define ESTOP_STATE_BOUND_US  5000   // Fire to the state machine in ESTOP, two task switches on the RF core
+#define ESTOP_REPORT_TOPIC    "rfid/estop/tripped" // A switch press goes out on this (through the outbox), payload "switch"
+
+extern void estopInit ();           // After relayInit (). Arms the switch and trips at once if it's already open
+extern void estopTask (void *params);
+extern void estopFire (byte source, uint32_t seenUs); // Task context, for rfid/estop "fire". seenUs: micros() it arrived
+extern bool estopClear ();          // rfid/estop "clear". Refused (false) while the switch is still pressed or the state machine's queue is full
+extern void estopStateReached ();   // From the state machine once it is in ESTOP
+extern uint32_t estopRelayMaxUs (); // Worst fire to relays open since boot
+extern uint32_t estopStateMaxUs (); // Worst fire to ESTOP since boot
+
+#endif // ESTOP_H
@@ -0,0 +1,48 @@
+#include <Arduino.h>
+#include "latency.h"
+#include "debug-log.h"
+
+static portMUX_TYPE latencyMux = portMUX_INITIALIZER_UNLOCKED;
+
+void latencyRecord (latencyStat *stat, uint32_t us){
+  portENTER_CRITICAL(&latencyMux);
+  stat->samples[stat->next] = us;
+  stat->next = (stat->next + 1) % LATENCY_SAMPLES;
+  if (stat->count < LATENCY_SAMPLES){
+    stat->count++;
+  }
+  stat->total++;
+  portEXIT_CRITICAL(&latencyMux);
+}
+
+uint32_t latencyPercentile (latencyStat *stat, byte pct){
+  uint32_t sorted[LATENCY_SAMPLES];
+  uint16_t n;
+
+  portENTER_CRITICAL(&latencyMux);
+  n = stat->count;
+  memcpy(sorted, stat->samples, n * sizeof(uint32_t));
+  portEXIT_CRITICAL(&latencyMux);
+
+  if (n == 0){
+    return 0;
+  }
+
+  // Insertion sort, it's 64 entries
+  for (uint16_t i = 1; i < n; i++){
+    uint32_t v = sorted[i];
+    int j = i - 1;
+    while (j >= 0 && sorted[j] > v){
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = v;
+  }
+
+  return sorted[((uint32_t)(n - 1) * pct) / 100];
+}
+
+void latencyPrint (const char *name, latencyStat *stat){
+  DLOG_INFO("%s: n=%lu p50=%luus p99=%luus max=%luus", name, (unsigned long)stat->total,
+            (unsigned long)latencyPercentile(stat, 50), (unsigned long)latencyPercentile(stat, 99), (unsigned long)latencyPercentile(stat, 100));
+}
@@ -0,0 +1,22 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <Arduino.h>
+
+#define LATENCY_SAMPLES 64 // Most recent samples kept per stat, percentiles are over these
+
+/* Rolling window of latency samples in microseconds. Recording is a couple of stores under a spinlock so it is
+   fine from the hot path, the sorting for percentiles only happens when someone asks.
+*/
+typedef struct {
+  uint32_t samples[LATENCY_SAMPLES];
+  uint16_t next;   // Where the next sample goes
+  uint16_t count;  // How many of samples[] are valid
+  uint32_t total;  // Samples ever recorded
+} latencyStat;
+
+extern void latencyRecord (latencyStat *stat, uint32_t us);
+extern uint32_t latencyPercentile (latencyStat *stat, byte pct); // eg. 50 or 99, returns 0 with no samples
+extern void latencyPrint (const char *name, latencyStat *stat); // p50/p99/max to the debug log, name must be a literal
+
+#endif // LATENCY_H
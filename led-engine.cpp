@@ -0,0 +1,185 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "tool-access-RTOS.h"
+#include "led-engine.h"
+
+/* LED renderer. ledTask owns leds[] and is the only caller of FastLED.show (). Everyone else describes what an LED
+   should be doing with ledSetPattern (), which drops the pattern in that LED's mailbox and pokes the renderer.
+   Each LED has two mailbox slots, the base pattern and a temporary overlay, so a base and an overlay written back to
+   back both get through. Each slot is guarded by a sequence number (odd while a write is in progress) so neither side
+   ever waits on the other, the renderer just picks the pattern up on its next frame if it caught a write half done.
+   The renderer works out every pixel each frame but only calls show () when one of them changed, and sleeps until the
+   next pixel change is due (forever if everything is solid).
+*/
+
+#define LED_WAIT_FOREVER 0xFFFFFFFF
+
+typedef struct { // What the renderer is doing with one LED
+  ledPattern base;    // Last non-temporary pattern, what a temporary one drops back to
+  ledPattern active;  // What is showing now
+  uint32_t start;     // millis() active started, blink/pulse phase and temporary expiry count from here
+  uint32_t seenBase;     // Mailbox sequence numbers last taken
+  uint32_t seenOverlay;
+} ledSlot;
+
+typedef struct { // One mailbox slot
+  ledPattern pattern;
+  uint32_t seq;      // Odd while ledSetPatterns () is writing it
+} ledBox;
+
+static ledBox baseBox[NUM_LEDS];
+static ledBox overlayBox[NUM_LEDS];   // duration 0 means no overlay
+static ledSlot slots[NUM_LEDS];
+static TaskHandle_t renderer = NULL;
+static ledStats stats;
+
+static void putBox (ledBox *box, const ledPattern *pattern){
+  __atomic_add_fetch(&box->seq, 1, __ATOMIC_ACQ_REL); // Odd, the renderer leaves the slot alone
+  box->pattern = *pattern;
+  __atomic_add_fetch(&box->seq, 1, __ATOMIC_RELEASE); // Even again, slot is complete
+}
+
+void ledSetPatterns (byte first, byte count, const ledPattern *base, const ledPattern *overlay){
+  ledPattern none = {LEDPAT_SOLID, CRGB::Black, 0, 0};
+
+  for (byte i = first; i < first + count && i < NUM_LEDS; i++){
+    if (base != NULL){
+      putBox(&baseBox[i], base);
+    }
+    putBox(&overlayBox[i], (overlay != NULL) ? overlay : &none); // Overlay last, the renderer may take the base on its own first
+  }
+
+  if (renderer != NULL){
+    xTaskNotifyGive(renderer);
+  }
+}
+
+void ledSetPattern (byte first, byte count, byte kind, CRGB colour, uint16_t period, uint32_t duration){
+  ledPattern pattern = {kind, colour, period, duration};
+  if (duration == 0){
+    ledSetPatterns(first, count, &pattern, NULL);
+  }
+  else{
+    ledSetPatterns(first, count, NULL, &pattern);
+  }
+}
+
+ledStats * ledGetStats (){
+  return &stats;
+}
+
+// Copies a new pattern out of a mailbox slot, false if there isn't one or we caught it mid write (we're notified again when it's done)
+static bool takeBox (ledBox *box, uint32_t *seen, ledPattern *pattern){
+  uint32_t seq = __atomic_load_n(&box->seq, __ATOMIC_ACQUIRE);
+  if (seq == *seen || (seq & 1)){
+    return 0;
+  }
+  *pattern = box->pattern;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&box->seq, __ATOMIC_RELAXED) != seq){
+    return 0; // Written again while we copied it
+  }
+  *seen = seq;
+  return 1;
+}
+
+/* Colour of LED i at now. wait is lowered to the ms until it next changes on its own.
+*/
+static CRGB render (byte i, uint32_t now, uint32_t *wait){
+  ledSlot *s = &slots[i];
+  uint32_t t = now - s->start;
+  uint32_t next = LED_WAIT_FOREVER;
+  CRGB colour;
+
+  if (s->active.duration != 0 && t >= s->active.duration){ // Temporary pattern is done
+    s->active = s->base;
+    s->start = now;
+    t = 0;
+  }
+
+  uint32_t period = s->active.period;
+  if (s->active.kind == LEDPAT_BLINK && period > 0){
+    uint32_t phase = t % (2 * period);
+    colour = (phase < period) ? CRGB(CRGB::Black) : s->active.colour; // Starts off, same as the old blink tasks
+    next = period - (phase % period);
+  }
+  else if (s->active.kind == LEDPAT_PULSE && period > 1){
+    uint32_t phase = t % period;
+    uint32_t half = period / 2;
+    uint32_t level = (phase < half) ? (phase * 255) / half : ((period - phase) * 255) / half;
+    colour = s->active.colour;
+    colour.nscale8(min(level, (uint32_t)255));
+    next = LED_FRAME_PERIOD;
+  }
+  else{ // LEDPAT_SOLID
+    colour = s->active.colour;
+  }
+
+  if (s->active.duration != 0){
+    next = min(next, s->active.duration - t);
+  }
+  *wait = min(*wait, next);
+  return colour;
+}
+
+void ledTask (void *params){
+  ledPattern pattern;
+  uint32_t now;
+  uint32_t wait;
+  uint32_t showStart;
+  bool changed;
+
+  for (byte i = 0; i < NUM_LEDS; i++){
+    slots[i].base.kind = LEDPAT_SOLID;
+    slots[i].base.colour = CRGB::Black;
+    slots[i].base.period = 0;
+    slots[i].base.duration = 0;
+    slots[i].active = slots[i].base;
+    slots[i].start = millis();
+    slots[i].seenBase = 0;
+    slots[i].seenOverlay = 0;
+  }
+  renderer = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    now = millis();
+    wait = LED_WAIT_FOREVER;
+    changed = 0;
+
+    for (byte i = 0; i < NUM_LEDS; i++){
+      ledSlot *s = &slots[i];
+      bool newBase = takeBox(&baseBox[i], &s->seenBase, &pattern);
+      if (newBase){
+        s->base = pattern;
+      }
+      if (takeBox(&overlayBox[i], &s->seenOverlay, &pattern)){
+        s->active = (pattern.duration != 0) ? pattern : s->base;
+        s->start = now;
+      }
+      else if (newBase && s->active.duration == 0){ // No overlay showing, the new base shows straight away
+        s->active = s->base;
+        s->start = now;
+      }
+      CRGB colour = render(i, now, &wait);
+      if (leds[i] != colour){
+        leds[i] = colour;
+        changed = 1;
+      }
+    }
+    stats.frames++;
+
+    if (changed){
+      showStart = micros();
+      FastLED.show();
+      uint32_t us = micros() - showStart;
+      stats.shows++;
+      stats.showUs += us;
+      stats.maxShowUs = max(stats.maxShowUs, us);
+    }
+
+    // Sleep until something is due to change, ledSetPattern () wakes us early
+    ulTaskNotifyTake(pdTRUE, (wait == LED_WAIT_FOREVER) ? portMAX_DELAY : max(pdMS_TO_TICKS(wait), (TickType_t)1));
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef LED_ENGINE_H
+#define LED_ENGINE_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+// Pattern kinds
+#define LEDPAT_SOLID 0
+#define LEDPAT_BLINK 1 // Off for period ms then colour for period ms
+#define LEDPAT_PULSE 2 // Fades up and down over period ms
+
+#define LED_BLINK_PERIOD   200   // ms, half of a blink
+#define LED_PULSE_PERIOD   2000  // ms, one full fade up and down
+#define LED_TEMP_PERIOD    10000 // ms a temporary pattern shows before going back to the one underneath
+#define LED_FRAME_PERIOD   20    // ms between frames while something is fading
+
+typedef struct {
+  byte kind;          // LEDPAT_*
+  CRGB colour;
+  uint16_t period;    // ms, ignored for LEDPAT_SOLID
+  uint32_t duration;  // ms, 0 = stays until replaced, otherwise temporary and drops back to the last non-temporary pattern
+} ledPattern;
+
+typedef struct { // Renderer counters
+  uint32_t frames;     // Times the pixels were worked out
+  uint32_t shows;      // FastLED.show () calls, only made when a pixel changed
+  uint32_t showUs;     // Total us spent in FastLED.show ()
+  uint32_t maxShowUs;  // Longest single FastLED.show ()
+} ledStats;
+
+extern void ledSetPattern (byte first, byte count, byte kind, CRGB colour, uint16_t period, uint32_t duration); // Non-blocking, leds first .. first + count - 1. One writer at a time
+/* Both at once: base is what shows once overlay (a temporary pattern, duration != 0) runs out. base NULL leaves the one
+   underneath as it is, overlay NULL cancels any temporary pattern showing. ledSetPattern () is this with one of them.
+*/
+extern void ledSetPatterns (byte first, byte count, const ledPattern *base, const ledPattern *overlay);
+extern void ledTask (void *params); // The only thing that touches leds[] and calls FastLED.show ()
+extern ledStats * ledGetStats ();
+
+#endif // LED_ENGINE_H
@@ -0,0 +1,78 @@
+#ifndef LF_RING_H
+#define LF_RING_H
+
+#include <Arduino.h>
+
+/* Bounded lock-free queue for handing work between tasks on different cores. Any number of producers (tasks on
+   either core, or ISRs) and one consumer. Producers claim a slot with a compare and swap on head, each slot's sequence
+   number says whether it is free or holds something to read (the usual bounded MPMC queue, with only one reader).
+   Nothing here blocks or takes a lock, push () just fails when the ring is full. The consumer sleeps on a task
+   notification, so wake it with xTaskNotifyGive () after a push.
+   A zeroed ring is an empty one, so a static ring can be pushed to before whatever drains it has been set up.
+*/
+template<typename T, uint32_t N> struct lfRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "lfRing size must be a power of 2");
+
+  struct slot {
+    uint32_t seq;   // Plus the slot's index: == position: free, == position + 1: ready to read. Starts at 0
+    T item;
+  };
+
+  slot slots[N];
+  uint32_t head;    // Next position to claim
+  uint32_t tail;    // Next position to read, only the consumer touches it
+
+  // Slot i first serves position i, storing seq relative to that is what makes all zeros the empty ring
+  static uint32_t seqOf (const slot *s, uint32_t pos){
+    return __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) + (pos & (N - 1));
+  }
+
+  bool push (const T &item){
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    slot *s;
+
+    for(;;){
+      s = &slots[pos & (N - 1)];
+      int32_t diff = (int32_t)(seqOf(s, pos) - pos);
+      if (diff == 0){
+        if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+          break; // Slot is ours
+        }
+        // Someone beat us to it, pos now has the new head
+      }
+      else if (diff < 0){ // Full
+        return 0;
+      }
+      else{
+        pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+      }
+    }
+
+    s->item = item;
+    __atomic_store_n(&s->seq, pos + 1 - (pos & (N - 1)), __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  // Oldest item, NULL if there isn't one (or the oldest is still being written). Consumer only
+  T * peek (){
+    slot *s = &slots[tail & (N - 1)];
+    if (seqOf(s, tail) != tail + 1){
+      return NULL;
+    }
+    return &s->item;
+  }
+
+  // Frees the slot peek () returned. Consumer only
+  void pop (){
+    slot *s = &slots[tail & (N - 1)];
+    __atomic_store_n(&s->seq, tail + N - (tail & (N - 1)), __ATOMIC_RELEASE);
+    tail++;
+  }
+
+  // Claimed slots not yet popped, a snapshot that may be stale by the time it's used
+  uint32_t depth (){
+    return __atomic_load_n(&head, __ATOMIC_RELAXED) - __atomic_load_n(&tail, __ATOMIC_RELAXED);
+  }
+};
+
+#endif // LF_RING_H
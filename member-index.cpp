@@ -0,0 +1,108 @@
+#include <Arduino.h>
+#include "member-index.h"
+
+typedef struct {
+  const memberEntry *members;
+  uint16_t count;
+  uint16_t bucketStart[MEMBER_INDEX_BUCKETS + 1]; // Members of bucket b live at members[bucketStart[b]] up to members[bucketStart[b+1]]
+  uint32_t readers;    // Lookups in this table right now
+} memberTable;
+
+static memberTable tables[2];
+static memberTable *current = NULL; // The one lookups use, the other is free for the next build
+
+/* Count ourselves into the table lookups use. A build may switch tables between the load and the count going up, the
+   second look at current catches that and we go again on the new one. Once we're counted and current still points at
+   us no build touches the table until unpin ().
+*/
+static memberTable * pin (){
+  for (;;){
+    memberTable *t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (t == NULL){
+      return NULL;
+    }
+    __atomic_fetch_add(&t->readers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&current, __ATOMIC_SEQ_CST) == t){
+      return t;
+    }
+    __atomic_fetch_sub(&t->readers, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void unpin (memberTable *t){
+  __atomic_fetch_sub(&t->readers, 1, __ATOMIC_RELEASE);
+}
+
+void memberIndexDrain (){
+  memberTable *retired = (__atomic_load_n(&current, __ATOMIC_ACQUIRE) == &tables[0]) ? &tables[1] : &tables[0];
+  while (__atomic_load_n(&retired->readers, __ATOMIC_SEQ_CST) > 0){
+    vTaskDelay(1); // A lookup is a handful of compares, it's only still there if it got preempted
+  }
+}
+
+static inline uint16_t bucketOf (uint32_t hash){
+  return hash >> (32 - MEMBER_INDEX_BITS);
+}
+
+bool memberIndexBuild (const memberEntry *list, uint16_t count){
+  memberTable *t = (current == &tables[0]) ? &tables[1] : &tables[0];
+
+  if (count > MEMBER_INDEX_MAX){
+    return 0;
+  }
+  memberIndexDrain(); // t was current before the last build, lookups may still be in it
+
+  // Make sure the list is sorted by hash, otherwise buckets wouldn't be contiguous
+  for (uint16_t i = 1; i < count; i++){
+    if (uidHash(list[i - 1].uid) > uidHash(list[i].uid)){
+      return 0;
+    }
+  }
+
+  // One pass to find where each bucket begins
+  uint16_t m = 0;
+  for (uint32_t b = 0; b <= MEMBER_INDEX_BUCKETS; b++){
+    while (m < count && bucketOf(uidHash(list[m].uid)) < b){
+      m++;
+    }
+    t->bucketStart[b] = m;
+  }
+
+  t->members = list;
+  t->count = count;
+  __atomic_store_n(&current, t, __ATOMIC_RELEASE); // Lookups from here on see the new list, never half of it
+  return 1;
+}
+
+/* Constant time on average: hash, jump to the bucket, compare the handful of members that share it.
+*/
+byte memberIndexStations (const uidType *uid){
+  if (uid->length == 0){
+    return 0;
+  }
+  memberTable *t = pin();
+  if (t == NULL){
+    return 0;
+  }
+
+  byte stations = 0;
+  uint16_t b = bucketOf(uidHash(*uid));
+  for (uint16_t i = t->bucketStart[b]; i < t->bucketStart[b + 1]; i++){
+    if (uidEqual(t->members[i].uid, *uid)){
+      stations = t->members[i].stations;
+      break;
+    }
+  }
+  unpin(t);
+  return stations;
+}
+
+uint16_t memberIndexCount (){
+  memberTable *t = pin();
+  if (t == NULL){
+    return 0;
+  }
+  uint16_t count = t->count;
+  unpin(t);
+  return count;
+}
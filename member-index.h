@@ -0,0 +1,31 @@
+#ifndef MEMBER_INDEX_H
+#define MEMBER_INDEX_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+#define MEMBER_INDEX_MAX    10000 // Most members we expect on one board
+#define MEMBER_INDEX_BITS   10    // Top bits of uidHash used to pick a bucket
+#define MEMBER_INDEX_BUCKETS (1 << MEMBER_INDEX_BITS) // 1024 buckets, ~10 members per bucket at MEMBER_INDEX_MAX
+
+/* A member and the stations on this board they may use. Each station is its own tool, being allowed on one says
+   nothing about the others
+*/
+typedef struct {
+  uidType uid;
+  byte stations;  // Bit n set: allowed on station n
+} memberEntry;
+
+/* Membership index over a const (ie. flash resident) member list.
+   The list MUST be sorted by uidHash() ascending, memberIndexBuild () checks this and refuses the list otherwise.
+   All we keep in RAM is a table of where each bucket starts, (MEMBER_INDEX_BUCKETS + 1) * 2 bytes. There are two of
+   them: a build fills the one not in use and switches lookups over in one store, so a list can be swapped for another
+   (member-sync.cpp) while the state machine is looking things up. Builds must all come from the same task.
+   A lookup counts itself into the table it uses and a build waits for that count to drop to 0 before refilling it.
+*/
+extern bool memberIndexBuild (const memberEntry *list, uint16_t count); // Returns false (and keeps the old list) if list is too long or not sorted
+extern byte memberIndexStations (const uidType *uid); // The member's stations bits, 0 if they aren't on the list
+extern uint16_t memberIndexCount ();
+extern void memberIndexDrain (); // Returns once no lookup is left on the list before the last build, its memory is free then
+
+#endif // MEMBER_INDEX_H
@@ -0,0 +1,14 @@
+#ifndef MEMBER_LIST_H
+#define MEMBER_LIST_H
+
+#include "member-index.h"
+
+/* Members allowed on this board's tools, each with the stations they may use. Lives in flash (const), indexed by
+   member-index. Entries MUST be sorted by uidHash(), memberIndexBuild () will refuse the list otherwise.
+   Empty until a list is provisioned for the tool, the server stays the authority in the meantime.
+   Once the server has synced a list into flash (member-sync.cpp) that one is used instead and this is only the fallback.
+*/
+#define MEMBER_LIST_COUNT 0
+static const memberEntry memberList[MEMBER_LIST_COUNT + 1] = { {{{0}, 0}, 0} }; // +1 keeps the array from being zero length, a length 0 entry never matches
+
+#endif // MEMBER_LIST_H
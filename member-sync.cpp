@@ -0,0 +1,565 @@
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "member-sync.h"
+#include "member-index.h"
+#include "debug-log.h"
+#include "metrics.h"
+
+/* Two sides to this. The receive side runs in the AsyncTCP task (memberSyncMessage) and parses messages a byte at a
+   time as the chunks come in, so a snapshot of thousands of members never has to fit in RAM: it is written straight
+   into the spare partition and committed by writing the slot header last. A delta is small enough to keep in RAM.
+   memberSyncTask, on the network core, does the slow flash work: merging a delta with the current list into the
+   spare, swapping a finished list in and erasing the spare for next time.
+   spareState says who owns the spare partition at any moment, ownership only ever changes hands through it.
+*/
+
+#define MEMBER_SLOT_MAGIC   0x3154534D // "MST1", marks a complete list in a partition
+#define MEMBER_WIRE_HEADER  16
+#define MEMBER_WIRE_TRAILER 4
+#define MEMBER_WRITE_BATCH  32         // Entries buffered between flash writes
+
+// spareState
+#define SPARE_DIRTY  0 // Needs erasing before anything can be written to it
+#define SPARE_READY  1 // Erased, the receive side can claim it
+#define SPARE_RX     2 // Claimed by a message being received
+#define SPARE_SNAP   3 // Holds a complete snapshot to swap in
+#define SPARE_DELTA  4 // Still erased, deltas[] holds a delta to merge into it
+
+// Receive modes
+#define RX_IDLE   0
+#define RX_TAKE   1 // Parsing a message we've claimed the spare for
+#define RX_SKIP   2 // Ignoring the rest of a message
+
+typedef struct {
+  uint32_t magic;    // MEMBER_SLOT_MAGIC, written last of all
+  uint32_t version;
+  uint32_t count;
+  uint32_t crc;      // crc32 of the count memberEntry entries after the header
+} memberSlotHeader;
+
+typedef struct {
+  const esp_partition_t *part;
+  const memberEntry *entries;   // Mapped list, NULL when it isn't
+  spi_flash_mmap_handle_t map;
+  memberSlotHeader header;
+} memberSlot;
+
+typedef struct {
+  memberEntry entry;
+  uint32_t hash;
+  bool remove;
+  bool done;         // Merged with the member already in the list, written, or a later entry for the same uid replaces it
+} memberDelta;
+
+typedef struct {     // Appends memberEntrys to a slot in batches
+  const memberSlot *slot;
+  memberEntry batch[MEMBER_WRITE_BATCH];
+  byte batchCount;
+  uint32_t count;
+  uint32_t crc;
+  bool failed;
+} slotWriter;
+
+typedef struct {     // The message being received
+  byte mode;
+  size_t total;
+  size_t next;       // Offset the next chunk should start at
+  uint32_t crc;
+  byte head[MEMBER_WIRE_HEADER];
+  byte trailer[MEMBER_WIRE_TRAILER];
+  byte kind;
+  uint16_t count;
+  uint32_t version;
+  uint32_t base;
+  uint16_t seen;     // Entries parsed so far
+  byte entry[1 + UID_MAX_SIZE + 1];
+  byte entryHave;
+  uint32_t lastHash;
+} memberRx;
+
+static memberSlot slots[2];
+static byte active = 0xFF;           // Slot the index is built on, 0xFF while there isn't one
+static byte spare = 0;               // Slot the next list is written into
+static byte spareState = SPARE_DIRTY;
+static uint32_t version = 0;
+static bool announceWanted = 0;
+static memberSyncPublishFn publishFn = NULL;
+static TaskHandle_t syncHandle = NULL;
+static char mac[13];
+static char topic[sizeof(MEMBER_TOPIC_BASE) + 12];
+
+// Owned by whoever holds the spare, static so none of it is on a task stack
+static memberRx rx;
+static slotWriter writer;
+static memberDelta deltas[MEMBER_DELTA_MAX];
+static uint16_t deltaCount = 0;
+
+// crc32 as in zlib. Start with 0xFFFFFFFF, invert at the end. Bitwise, it only runs when a list comes in
+static uint32_t crc32Step (uint32_t crc, byte b){
+  crc ^= b;
+  for (byte i = 0; i < 8; i++){
+    crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : (crc >> 1);
+  }
+  return crc;
+}
+
+static uint32_t crc32Of (const byte *data, size_t len){
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++){
+    crc = crc32Step(crc, data[i]);
+  }
+  return ~crc;
+}
+
+static uint32_t get32 (const byte *p){
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void wakeSync (){
+  if (syncHandle != NULL){
+    xTaskNotifyGive(syncHandle);
+  }
+}
+
+//////// Slots ////////
+
+static bool slotFits (const memberSlot *s, uint32_t count){
+  return s->part != NULL && count <= MEMBER_INDEX_MAX && sizeof(memberSlotHeader) + count * sizeof(memberEntry) <= s->part->size;
+}
+
+static void slotUnmap (memberSlot *s){
+  if (s->entries != NULL){
+    spi_flash_munmap(s->map);
+    s->entries = NULL;
+  }
+}
+
+// Maps the list in a slot and checks it is whole, false if it isn't a good list
+static bool slotLoad (memberSlot *s){
+  const void *p;
+
+  slotUnmap(s);
+  if (s->part == NULL || esp_partition_read(s->part, 0, &s->header, sizeof(s->header)) != ESP_OK
+      || s->header.magic != MEMBER_SLOT_MAGIC || !slotFits(s, s->header.count)){
+    return 0;
+  }
+  size_t len = sizeof(memberSlotHeader) + s->header.count * sizeof(memberEntry);
+  if (esp_partition_mmap(s->part, 0, len, SPI_FLASH_MMAP_DATA, &p, &s->map) != ESP_OK){
+    return 0;
+  }
+  s->entries = (const memberEntry*)((const byte*)p + sizeof(memberSlotHeader));
+  if (crc32Of((const byte*)s->entries, s->header.count * sizeof(memberEntry)) != s->header.crc){
+    slotUnmap(s);
+    return 0;
+  }
+  return 1;
+}
+
+static void writerStart (slotWriter *w, const memberSlot *s){
+  w->slot = s;
+  w->batchCount = 0;
+  w->count = 0;
+  w->crc = 0xFFFFFFFF;
+  w->failed = 0;
+}
+
+static void writerFlush (slotWriter *w){
+  size_t len = w->batchCount * sizeof(memberEntry);
+  size_t at = sizeof(memberSlotHeader) + (w->count - w->batchCount) * sizeof(memberEntry);
+  if (len > 0 && esp_partition_write(w->slot->part, at, w->batch, len) != ESP_OK){
+    w->failed = 1;
+  }
+  w->batchCount = 0;
+}
+
+static void writerAdd (slotWriter *w, const memberEntry *m){
+  if (w->failed || !slotFits(w->slot, w->count + 1)){
+    w->failed = 1;
+    return;
+  }
+  for (byte i = 0; i < sizeof(memberEntry); i++){
+    w->crc = crc32Step(w->crc, ((const byte*)m)[i]);
+  }
+  w->batch[w->batchCount++] = *m;
+  w->count++;
+  if (w->batchCount == MEMBER_WRITE_BATCH){
+    writerFlush(w);
+  }
+}
+
+// Writes the header, from here on the slot holds a good list. False if anything along the way failed
+static bool writerCommit (slotWriter *w, uint32_t listVersion){
+  memberSlotHeader h;
+
+  writerFlush(w);
+  if (w->failed){
+    return 0;
+  }
+  h.magic = MEMBER_SLOT_MAGIC;
+  h.version = listVersion;
+  h.count = w->count;
+  h.crc = ~w->crc;
+  return (esp_partition_write(w->slot->part, 0, &h, sizeof(h)) == ESP_OK);
+}
+
+//////// Receive, AsyncTCP task ////////
+
+static void rxEnd (byte state){
+  rx.mode = RX_IDLE;
+  __atomic_store_n(&spareState, state, __ATOMIC_RELEASE);
+  wakeSync();
+}
+
+static void rxReject (const char *why){
+  DLOG_WARN("Member list rejected: %s", why);
+  announceWanted = 1; // Let the server know we're still on the old version
+  rxEnd((rx.kind == MEMBER_WIRE_SNAPSHOT && writer.count > 0) ? SPARE_DIRTY : SPARE_READY);
+  rx.mode = RX_SKIP;
+}
+
+static void rxHeader (){
+  if (get32(rx.head) != MEMBER_WIRE_MAGIC){
+    rxReject("bad magic");
+    return;
+  }
+  rx.kind = rx.head[4];
+  rx.count = rx.head[6] | (rx.head[7] << 8);
+  rx.version = get32(rx.head + 8);
+  rx.base = get32(rx.head + 12);
+  if (rx.kind == MEMBER_WIRE_SNAPSHOT){
+    if (!slotFits(&slots[spare], rx.count)){
+      rxReject("too many members");
+      return;
+    }
+    writerStart(&writer, &slots[spare]);
+  }
+  else if (rx.kind == MEMBER_WIRE_DELTA){
+    if (rx.count > MEMBER_DELTA_MAX || rx.base != __atomic_load_n(&version, __ATOMIC_RELAXED) || rx.base == 0){
+      rxReject("delta doesn't apply to our version");
+      return;
+    }
+    deltaCount = 0;
+  }
+  else{
+    rxReject("unknown kind");
+  }
+}
+
+static void rxEntry (){
+  byte len = rx.entry[0] & ~MEMBER_OP_REMOVE;
+  memberEntry m;
+
+  if (rx.seen == rx.count){
+    rxReject("more entries than the header says");
+    return;
+  }
+  rx.seen++;
+  uidFromBytes(&m.uid, rx.entry + 1, len);
+  m.stations = rx.entry[1 + len];
+
+  if (rx.kind == MEMBER_WIRE_SNAPSHOT){
+    uint32_t h = uidHash(m.uid);
+    if ((rx.entry[0] & MEMBER_OP_REMOVE) || (rx.seen > 1 && h < rx.lastHash)){
+      rxReject("snapshot not sorted by uidHash");
+      return;
+    }
+    rx.lastHash = h;
+    writerAdd(&writer, &m);
+  }
+  else{
+    memberDelta *d = &deltas[deltaCount++];
+    d->entry = m;
+    d->hash = uidHash(m.uid);
+    d->remove = (rx.entry[0] & MEMBER_OP_REMOVE) != 0;
+    d->done = 0;
+  }
+}
+
+static void rxFinish (){
+  if (rx.entryHave != 0 || rx.seen != rx.count){
+    rxReject("truncated");
+    return;
+  }
+  if (~rx.crc != get32(rx.trailer)){
+    rxReject("crc");
+    return;
+  }
+  if (rx.kind == MEMBER_WIRE_DELTA){
+    rxEnd(SPARE_DELTA);
+    return;
+  }
+  if (!writerCommit(&writer, rx.version)){
+    rxReject("flash write failed");
+    return;
+  }
+  rxEnd(SPARE_SNAP);
+}
+
+static void rxByte (size_t pos, byte c){
+  size_t body = rx.total - MEMBER_WIRE_TRAILER;
+
+  if (pos < body){
+    rx.crc = crc32Step(rx.crc, c);
+  }
+  if (pos < MEMBER_WIRE_HEADER){
+    rx.head[pos] = c;
+    if (pos == MEMBER_WIRE_HEADER - 1){
+      rxHeader();
+    }
+  }
+  else if (pos >= body){
+    rx.trailer[pos - body] = c;
+    if (pos == rx.total - 1){
+      rxFinish();
+    }
+  }
+  else{
+    if (rx.entryHave == 0){
+      byte len = c & ~MEMBER_OP_REMOVE;
+      if (len == 0 || len > UID_MAX_SIZE){
+        rxReject("bad uid length");
+        return;
+      }
+    }
+    rx.entry[rx.entryHave++] = c;
+    if (rx.entryHave == 1 + (rx.entry[0] & ~MEMBER_OP_REMOVE) + 1){ // Length, uid, stations
+      rx.entryHave = 0;
+      rxEntry();
+    }
+  }
+}
+
+void memberSyncMessage (const char *payload, size_t len, size_t index, size_t total){
+  if (slots[0].part == NULL){
+    return;
+  }
+
+  if (index == 0){ // A new message, whatever we were in the middle of isn't coming
+    if (rx.mode == RX_TAKE){
+      rxReject("cut short");
+    }
+    rx.mode = RX_SKIP;
+    if (total < MEMBER_WIRE_HEADER + MEMBER_WIRE_TRAILER){
+      return;
+    }
+    byte ready = SPARE_READY;
+    if (!__atomic_compare_exchange_n(&spareState, &ready, SPARE_RX, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+      DLOG_WARN("Member list arrived before the spare partition was ready, asking again");
+      announceWanted = 1;
+      wakeSync();
+      return;
+    }
+    memset(&rx, 0, sizeof(rx));
+    rx.mode = RX_TAKE;
+    rx.total = total;
+    rx.crc = 0xFFFFFFFF;
+    writer.count = 0;
+  }
+
+  if (rx.mode != RX_TAKE){
+    return;
+  }
+  if (index != rx.next || total != rx.total){
+    rxReject("chunks out of order");
+    return;
+  }
+  rx.next = index + len;
+
+  for (size_t i = 0; i < len && rx.mode == RX_TAKE; i++){
+    rxByte(index + i, payload[i]);
+  }
+}
+
+//////// Apply, memberSyncTask ////////
+
+/* Sorts the delta by hash so it can be merged with the list in one pass. Insertion sort, there are a few hundred at
+   most, and it keeps entries with the same hash in the order they came. So of a uid that is in the delta more than
+   once the last one is the one that counts, the ones before it are marked done and left out of the merge.
+*/
+static void sortDeltas (){
+  for (uint16_t i = 1; i < deltaCount; i++){
+    memberDelta d = deltas[i];
+    uint16_t j = i;
+    while (j > 0 && deltas[j - 1].hash > d.hash){
+      deltas[j] = deltas[j - 1];
+      j--;
+    }
+    deltas[j] = d;
+  }
+  for (uint16_t i = 0; i < deltaCount; i++){
+    for (uint16_t k = i + 1; k < deltaCount && deltas[k].hash == deltas[i].hash; k++){
+      if (uidEqual(deltas[k].entry.uid, deltas[i].entry.uid)){
+        deltas[i].done = 1;
+        break;
+      }
+    }
+  }
+}
+
+// A delta entry that didn't match anyone in the list, only an add has anything to write
+static void addDelta (memberDelta *d){
+  if (!d->remove && !d->done){
+    writerAdd(&writer, &d->entry);
+  }
+  d->done = 1;
+}
+
+/* Current list + delta -> spare. Both sides are in hash order, so this is a merge. An add of someone already in the
+   list replaces their stations, a remove of someone we don't have is ignored.
+*/
+static bool mergeDelta (){
+  const memberSlot *from = &slots[active];
+  uint16_t j = 0;
+
+  sortDeltas();
+  writerStart(&writer, &slots[spare]);
+
+  for (uint32_t i = 0; i < from->header.count; i++){
+    const memberEntry *m = &from->entries[i];
+    const memberEntry *out = m;
+    uint32_t h = uidHash(m->uid);
+
+    for (; j < deltaCount && deltas[j].hash < h; j++){
+      addDelta(&deltas[j]);
+    }
+    for (uint16_t k = j; k < deltaCount && deltas[k].hash == h; k++){ // Same hash, could be this member
+      if (!deltas[k].done && uidEqual(deltas[k].entry.uid, m->uid)){
+        deltas[k].done = 1;
+        out = deltas[k].remove ? NULL : &deltas[k].entry;
+      }
+    }
+    if (out != NULL){
+      writerAdd(&writer, out);
+    }
+  }
+  for (; j < deltaCount; j++){
+    addDelta(&deltas[j]);
+  }
+  return writerCommit(&writer, rx.version);
+}
+
+// The spare holds a good list, make it the one lookups use. The old one becomes the spare
+static bool swapIn (){
+  memberSlot *s = &slots[spare];
+
+  if (!slotLoad(s) || !memberIndexBuild(s->entries, s->header.count)){
+    slotUnmap(s);
+    return 0;
+  }
+  byte old = active;
+  active = spare;
+  spare = active ^ 1;
+  __atomic_store_n(&version, s->header.version, __ATOMIC_RELAXED);
+  metricCount(CTR_MEMBER_SYNCS);
+  DLOG_INFO("Member list version %lu in, %u members", (unsigned long)s->header.version, memberIndexCount());
+
+  if (old != 0xFF){
+    memberIndexDrain(); // Nothing writes the old list's flash until lookups have moved off it
+    slotUnmap(&slots[old]);
+  }
+  return 1;
+}
+
+static void eraseSpare (){
+  const memberSlot *s = &slots[spare];
+  if (esp_partition_erase_range(s->part, 0, s->part->size) == ESP_OK){
+    __atomic_store_n(&spareState, SPARE_READY, __ATOMIC_RELEASE);
+  }
+  else{
+    DLOG_ERROR("Couldn't erase %s", s->part->label);
+  }
+}
+
+void memberSyncTask (void *params){
+  if (slots[0].part == NULL){
+    vTaskSuspend(NULL); // No partitions, nothing to sync into. Suspended rather than deleted, metrics still reads its handle
+  }
+  syncHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    switch (__atomic_load_n(&spareState, __ATOMIC_ACQUIRE)){
+      case SPARE_DIRTY:
+        eraseSpare();
+        break;
+      case SPARE_SNAP:
+        if (!swapIn()){
+          DLOG_ERROR("Member list didn't read back from flash");
+        }
+        __atomic_store_n(&spareState, SPARE_DIRTY, __ATOMIC_RELEASE);
+        announceWanted = 1;
+        continue; // Go round and erase the new spare
+      case SPARE_DELTA:
+        if (!mergeDelta() || !swapIn()){
+          DLOG_ERROR("Member list delta couldn't be applied");
+        }
+        __atomic_store_n(&spareState, SPARE_DIRTY, __ATOMIC_RELEASE);
+        announceWanted = 1;
+        continue;
+    }
+
+    if (announceWanted && __atomic_load_n(&spareState, __ATOMIC_ACQUIRE) == SPARE_READY){ // Only once we can take the answer
+      char payload[24];
+      snprintf(payload, sizeof(payload), "%s,%lu", mac, (unsigned long)memberSyncVersion());
+      if (publishFn != NULL && publishFn(MEMBER_HAVE_TOPIC, payload) != 0){
+        announceWanted = 0;
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+//////// Setup ////////
+
+bool memberSyncInit (memberSyncPublishFn publish){
+  uint8_t m[6];
+
+  publishFn = publish;
+  rx.mode = RX_IDLE; // Nothing is half received at boot
+  esp_efuse_mac_get_default(m);
+  snprintf(mac, sizeof(mac), "%02X%02X%02X%02X%02X%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+  snprintf(topic, sizeof(topic), MEMBER_TOPIC_BASE "%s", mac);
+
+  slots[0].part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MEMBER_PART_A);
+  slots[1].part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MEMBER_PART_B);
+  if (slots[0].part == NULL || slots[1].part == NULL){
+    DLOG_WARN("No member list partitions, flash with partitions.csv to sync the member list");
+    slots[0].part = NULL;
+    return 0;
+  }
+
+  // Newest good list wins, a power cut mid write leaves the other one
+  bool good[2];
+  for (byte i = 0; i < 2; i++){
+    good[i] = slotLoad(&slots[i]);
+  }
+  byte pick = (good[0] && good[1]) ? (slots[1].header.version > slots[0].header.version) : (good[1] ? 1 : 0);
+  slotUnmap(&slots[pick ^ 1]);
+  spare = pick ^ 1;
+  spareState = SPARE_DIRTY; // Whatever is in the spare goes, memberSyncTask erases it first thing
+
+  if (!good[pick] || !memberIndexBuild(slots[pick].entries, slots[pick].header.count)){
+    slotUnmap(&slots[pick]);
+    spare = 0;
+    return 0;
+  }
+  active = pick;
+  version = slots[pick].header.version;
+  return 1;
+}
+
+const char * memberSyncTopic (){
+  return topic;
+}
+
+void memberSyncAnnounce (){
+  announceWanted = 1;
+  wakeSync();
+}
+
+bool memberSyncOwns (const char *t){
+  return slots[0].part != NULL && strcmp(t, topic) == 0;
+}
+
+uint32_t memberSyncVersion (){
+  return __atomic_load_n(&version, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,49 @@
+#ifndef MEMBER_SYNC_H
+#define MEMBER_SYNC_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+/* Member list sync. The server pushes this board's whole member list ahead of time as a versioned binary snapshot,
+   then keeps it current with small add/remove deltas, so a tap can be decided from flash without a round trip and a
+   reconnect costs one delta rather than a req per tap. tools/member-encode.py builds both.
+
+   The list lives in one of two flash partitions (members_a, members_b in partitions.csv). A new list is always
+   written into the one not in use and only takes over once it is complete and its crc checks out, lookups never see
+   a half written list and a power cut at any point leaves the old one in place.
+
+   Wire format, little endian:
+     header   uint32 MEMBER_WIRE_MAGIC, byte kind (MEMBER_WIRE_*), byte 0, uint16 entry count,
+              uint32 version, uint32 base version (deltas only, the version they apply on top of, 0 in a snapshot)
+     entries  snapshot: byte uid length, uid bytes, byte stations (bit n: allowed on station n). Sorted by uidHash ()
+                        ascending, same as member-list.h
+              delta: byte uid length | MEMBER_OP_REMOVE to remove it, uid bytes, byte stations (replaces what the
+                     member had, 0 in a remove). Any order, if a uid is in it twice the last one counts
+     trailer  uint32 crc32 of everything before it
+   Both come in on MEMBER_TOPIC_BASE<MAC>. On connect, and after every list change, we say which version we have on
+   MEMBER_HAVE_TOPIC ("<MAC>,<version>") and the server answers with a delta from that version or a fresh snapshot.
+   tools/member-sync-test.cpp checks all of this on the host harness, power cuts mid write included.
+*/
+
+#define MEMBER_TOPIC_BASE   "rfid/members/"      // Followed by the board's MAC, 12 hex digits
+#define MEMBER_HAVE_TOPIC   "rfid/members/have"
+#define MEMBER_WIRE_MAGIC   0x3153424D           // "MBS1"
+#define MEMBER_WIRE_SNAPSHOT 0
+#define MEMBER_WIRE_DELTA    1
+#define MEMBER_OP_REMOVE    0x80
+#define MEMBER_DELTA_MAX    256                  // Most entries in one delta, the server sends a snapshot for anything bigger
+#define MEMBER_PART_A       "members_a"
+#define MEMBER_PART_B       "members_b"
+
+// Publishes a short text payload at QoS 0, returns 0 if it wasn't sent
+typedef uint16_t (*memberSyncPublishFn)(const char *topic, const char *payload);
+
+extern bool memberSyncInit (memberSyncPublishFn publish); // Builds the member index off the newest good list in flash, false if there isn't one
+extern void memberSyncTask (void *params);               // Applies deltas, swaps lists in and readies the spare partition
+extern const char * memberSyncTopic ();                  // Subscribe to this in onMqttConnect, then call memberSyncAnnounce ()
+extern void memberSyncAnnounce ();                       // Tell the server which version we have
+extern bool memberSyncOwns (const char *topic);
+extern void memberSyncMessage (const char *payload, size_t len, size_t index, size_t total); // From mqttDispatch, chunks and all
+extern uint32_t memberSyncVersion ();                    // 0 until a list has come from the server
+
+#endif // MEMBER_SYNC_H
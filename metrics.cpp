@@ -0,0 +1,233 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <esp_heap_caps.h>
+#include "metrics.h"
+#include "access-fsm.h"
+#include "outbox.h"
+#include "access-log.h"
+#include "debug-log.h"
+#include "member-sync.h"
+#include "estop.h"
+
+/* Snapshot layout, all little endian, no padding:
+     header   version, flags, counter count, gauge count, histogram count, bucket count, task count, station count (8 bytes)
+              uint32 seq, uint32 us since the last snapshot
+     counters uint32 x counter count
+     gauges   uint32 x gauge count
+     buckets  uint32 x bucket count, per histogram
+     tasks    per task: byte name length, name, uint32 stack headroom (bytes), uint32 runtime since the last snapshot
+   The counts are in the header so the decoder can skip anything added to the end of a section.
+*/
+
+#define METRICS_FLAG_RUNTIME 0x01 // Task runtimes are real, otherwise FreeRTOS wasn't built with run time stats and they're 0
+
+#if (configGENERATE_RUN_TIME_STATS == 1) && (configUSE_TRACE_FACILITY == 1)
+#define METRICS_RUNTIME 1
+#else
+#define METRICS_RUNTIME 0
+#endif
+
+uint32_t metricCounters[CTR_COUNT];
+uint32_t metricBuckets[HIST_COUNT][METRIC_BUCKETS];
+
+typedef struct {
+  TaskHandle_t handle;
+  uint32_t lastRuntime;
+} metricsTaskSlot;
+
+static metricsTaskSlot tasks[METRICS_MAX_TASKS];
+static byte taskCount = 0;
+static metricsPublishFn publishFn = NULL;
+static char topic[sizeof(METRICS_TOPIC_BASE) + 12];
+static uint8_t payload[METRICS_PAYLOAD_MAX]; // Static so it isn't on the task stack
+static portMUX_TYPE tasksMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t bootMs[BOOT_COUNT];
+static uint32_t heapSettled = 0;
+static bool heapDrifting = 0;
+
+static const char * const bootNames[] = {"tap ready", "storage", "WiFi", "MQTT", "first auth"};
+static_assert(sizeof(bootNames) / sizeof(bootNames[0]) == BOOT_COUNT, "bootNames needs a name per BOOT_*");
+
+void metricsInit (metricsPublishFn publish){
+  uint8_t mac[6];
+
+  publishFn = publish;
+  esp_efuse_mac_get_default(mac);
+  snprintf(topic, sizeof(topic), METRICS_TOPIC_BASE "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+  for (byte c = 0; c < portNUM_PROCESSORS; c++){ // Their runtime is what tells us how busy each core is
+    metricsWatchTask(xTaskGetIdleTaskHandleForCPU(c));
+  }
+}
+
+void metricsWatchTask (TaskHandle_t task){
+  portENTER_CRITICAL(&tasksMux);
+  if (task != NULL && taskCount < METRICS_MAX_TASKS){
+    tasks[taskCount].handle = task;
+    tasks[taskCount].lastRuntime = 0;
+    taskCount++;
+  }
+  portEXIT_CRITICAL(&tasksMux);
+}
+
+void metricsBootMark (byte mark){
+  uint32_t ms = millis();
+  uint32_t unset = 0;
+
+  if (ms == 0){ // 0 means not reached
+    ms = 1;
+  }
+
+  if (__atomic_compare_exchange_n(&bootMs[mark], &unset, ms, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    DLOG_INFO("Boot: %s after %lums", bootNames[mark], (unsigned long)ms);
+  }
+}
+
+//////// Payload ////////
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  bool overflow;
+} metricsWriter;
+
+static void put8 (metricsWriter *w, uint8_t v){
+  if (w->len >= METRICS_PAYLOAD_MAX){
+    w->overflow = 1;
+    return;
+  }
+  w->buf[w->len++] = v;
+}
+
+static void put32 (metricsWriter *w, uint32_t v){
+  for (byte i = 0; i < 4; i++){
+    put8(w, (uint8_t)(v >> (8 * i)));
+  }
+}
+
+static uint32_t accessStates (){
+  uint32_t states = 0;
+  for (byte i = 0; i < STATION_COUNT; i++){
+    states |= (uint32_t)(accessState(i) & 0x0F) << (4 * i);
+  }
+  return states;
+}
+
+static uint32_t gauge (byte g){
+  if (g >= GAUGE_BOOT_FIRST && g < GAUGE_BOOT_FIRST + BOOT_COUNT){
+    return __atomic_load_n(&bootMs[g - GAUGE_BOOT_FIRST], __ATOMIC_RELAXED);
+  }
+  switch (g){
+    case GAUGE_UPTIME_S:       return millis() / 1000;
+    case GAUGE_HEAP_FREE:      return esp_get_free_heap_size();
+    case GAUGE_HEAP_MIN:       return esp_get_minimum_free_heap_size();
+    case GAUGE_OUTBOX_DEPTH:   return outboxDepth();
+    case GAUGE_OUTBOX_DROPPED: return outboxDropped();
+    case GAUGE_DLOG_DROPPED:   return dlogDropped();
+    case GAUGE_ACCESS_STATE:   return accessStates();
+    case GAUGE_MEMBER_VERSION: return memberSyncVersion();
+    case GAUGE_ESTOP_RELAY_MAX: return estopRelayMaxUs();
+    case GAUGE_ESTOP_STATE_MAX: return estopStateMaxUs();
+    case GAUGE_HEAP_SETTLED:   return heapSettled;
+    case GAUGE_HEAP_LARGEST:   return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    case GAUGE_ACCESSLOG_DROPPED: return accessLogDropped();
+  }
+  return 0;
+}
+
+static size_t buildSnapshot (uint32_t seq, uint32_t elapsedUs){
+  metricsWriter w = {payload, 0, 0};
+
+  put8(&w, METRICS_VERSION);
+  put8(&w, METRICS_RUNTIME ? METRICS_FLAG_RUNTIME : 0);
+  put8(&w, CTR_COUNT);
+  put8(&w, GAUGE_COUNT);
+  put8(&w, HIST_COUNT);
+  put8(&w, METRIC_BUCKETS);
+  put8(&w, taskCount);
+  put8(&w, STATION_COUNT);
+  put32(&w, seq);
+  put32(&w, elapsedUs);
+
+  for (byte c = 0; c < CTR_COUNT; c++){
+    put32(&w, __atomic_load_n(&metricCounters[c], __ATOMIC_RELAXED));
+  }
+  for (byte g = 0; g < GAUGE_COUNT; g++){
+    put32(&w, gauge(g));
+  }
+  for (byte h = 0; h < HIST_COUNT; h++){
+    for (byte b = 0; b < METRIC_BUCKETS; b++){
+      put32(&w, __atomic_load_n(&metricBuckets[h][b], __ATOMIC_RELAXED));
+    }
+  }
+
+  for (byte t = 0; t < taskCount; t++){
+    const char *name = pcTaskGetTaskName(tasks[t].handle);
+    byte nameLen = min(strlen(name), (size_t)configMAX_TASK_NAME_LEN);
+    uint32_t runtime = 0;
+#if METRICS_RUNTIME
+    TaskStatus_t status;
+    vTaskGetInfo(tasks[t].handle, &status, pdFALSE, eInvalid); // pdFALSE, the headroom comes from the call below
+    runtime = status.ulRunTimeCounter - tasks[t].lastRuntime;
+    tasks[t].lastRuntime = status.ulRunTimeCounter;
+#endif
+    put8(&w, nameLen);
+    for (byte i = 0; i < nameLen; i++){
+      put8(&w, name[i]);
+    }
+    put32(&w, uxTaskGetStackHighWaterMark(tasks[t].handle)); // Bytes on the ESP32, StackType_t is a byte
+    put32(&w, runtime);
+  }
+
+  return w.overflow ? 0 : w.len;
+}
+
+/* Everything of ours is allocated by the time MQTT first connects (tasks, queues and timers are static), so from then
+   on the free heap should only move with what WiFi, lwIP and AsyncMqttClient have in flight. The first snapshot after
+   BOOT_MQTT sets where it settled (raised if it's seen higher later, that one was mid publish), and every snapshot
+   after that found more than HEAP_DRIFT_MAX under it counts as drift. Warns once each time it starts drifting.
+*/
+static void heapCheck (){
+  uint32_t freeHeap = esp_get_free_heap_size();
+
+  if (__atomic_load_n(&bootMs[BOOT_MQTT], __ATOMIC_RELAXED) == 0){
+    return; // Not settled yet
+  }
+  if (freeHeap > heapSettled){
+    heapSettled = freeHeap;
+  }
+  if (freeHeap + HEAP_DRIFT_MAX < heapSettled){
+    metricCount(CTR_HEAP_DRIFT);
+    if (!heapDrifting){
+      DLOG_WARN("Heap has drifted to %lu bytes free from %lu after boot", (unsigned long)freeHeap, (unsigned long)heapSettled);
+    }
+    heapDrifting = 1;
+  }
+  else{
+    heapDrifting = 0;
+  }
+}
+
+/* Builds and publishes a snapshot every METRICS_PERIOD. Low priority, it's only reading things other tasks keep.
+*/
+void metricsTask (void *params){
+  uint32_t seq = 0;
+  uint32_t last = micros();
+
+  for(;;){
+    vTaskDelay(METRICS_PERIOD);
+
+    heapCheck();
+    uint32_t now = micros();
+    size_t len = buildSnapshot(seq, now - last);
+    last = now;
+    if (len == 0){
+      DLOG_ERROR("Metrics snapshot doesn't fit in METRICS_PAYLOAD_MAX");
+      continue;
+    }
+    if (publishFn != NULL && publishFn(topic, payload, len) != 0){
+      seq++; // Gaps in seq on the collector side are lost snapshots, not missed publishes
+    }
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+/* Field telemetry. Counters and latency histograms are recorded from wherever the thing happens and cost one relaxed
+   atomic add, nothing is formatted or locked on the hot path. Gauges (heap, stack headroom, runtime, queue depths) are
+   sampled by metricsTask itself when it builds a snapshot. Every METRICS_PERIOD the snapshot goes out as a packed
+   little endian payload on rfid/metrics/<MAC>, tools/metrics-decode.py turns it back into something readable.
+   Counters and histogram buckets are totals since boot, so a lost QoS 0 snapshot doesn't lose anything.
+*/
+
+#define METRICS_PERIOD       pdMS_TO_TICKS(60000)
+#define METRICS_TOPIC_BASE   "rfid/metrics/"  // Followed by the station's MAC, 12 hex digits
+#define METRICS_VERSION      2                // Bump whenever the payload layout changes, the decoder checks it
+#define METRICS_MAX_TASKS    16               // Tasks metricsWatchTask () can take, the idle tasks included
+#define METRICS_PAYLOAD_MAX  1024
+#define HEAP_DRIFT_MAX       8192             // Free heap can be this far under where it settled after boot before it counts as a leak
+
+// Counters, metricCount ()
+#define CTR_TAPS           0  // Cards read in scan mode
+#define CTR_GRANTS         1  // Sessions started, cached or from the server
+#define CTR_DENIES         2  // Denied or revoked
+#define CTR_TIMEOUTS       3  // Gave up waiting on the server for an answer
+#define CTR_COLLISIONS     4
+#define CTR_ESTOPS         5
+#define CTR_WIFI_DROPS     6  // WiFi disconnects, each one is a reconnect cycle
+#define CTR_MQTT_CONNECTS  7
+#define CTR_MQTT_DROPS     8
+#define CTR_MEMBER_SYNCS   9  // Member lists (snapshot or delta) swapped in
+#define CTR_ESTOP_LATE     10 // eStops over ESTOP_RELAY_BOUND_US or ESTOP_STATE_BOUND_US (estop.h)
+#define CTR_HEAP_DRIFT     11 // Snapshots taken with the free heap more than HEAP_DRIFT_MAX under GAUGE_HEAP_SETTLED
+#define CTR_COUNT          12
+
+// Gauges, sampled when the snapshot is built
+#define GAUGE_UPTIME_S       0
+#define GAUGE_HEAP_FREE      1
+#define GAUGE_HEAP_MIN       2  // Lowest free heap since boot
+#define GAUGE_OUTBOX_DEPTH   3
+#define GAUGE_OUTBOX_DROPPED 4
+#define GAUGE_DLOG_DROPPED   5
+#define GAUGE_ACCESS_STATE   6  // ST_* of every station, 4 bits each, station 0 in the bottom bits
+#define GAUGE_MEMBER_VERSION 7  // Version of the synced member list, 0 if there isn't one
+#define GAUGE_BOOT_FIRST     8  // BOOT_COUNT of them from here, ms each boot milestone took, 0 until it's reached
+#define GAUGE_ESTOP_RELAY_MAX (GAUGE_BOOT_FIRST + BOOT_COUNT) // Worst eStop fire to relays open since boot, us
+#define GAUGE_ESTOP_STATE_MAX (GAUGE_ESTOP_RELAY_MAX + 1)    // Worst eStop fire to the state machine in ESTOP, us
+#define GAUGE_HEAP_SETTLED    (GAUGE_ESTOP_STATE_MAX + 1) // Free heap once boot settled (MQTT up), 0 until then. Should stay flat from there
+#define GAUGE_HEAP_LARGEST    (GAUGE_HEAP_SETTLED + 1)    // Largest free block, falls away from heap_free as the heap fragments
+#define GAUGE_ACCESSLOG_DROPPED (GAUGE_HEAP_LARGEST + 1) // Access log records that never made it to SPIFFS
+#define GAUGE_COUNT          (GAUGE_ACCESSLOG_DROPPED + 1)
+
+// Boot milestones, metricsBootMark (). Timed from the app starting, the bootloader's own time comes before that
+#define BOOT_TAP_READY   0  // readerTask polling, taps are served from here (offline until MQTT is up)
+#define BOOT_STORAGE     1  // SPIFFS mounted, access log and outbox open
+#define BOOT_WIFI        2  // Got an IP
+#define BOOT_MQTT        3
+#define BOOT_FIRST_AUTH  4  // Relay closed for a card the first time
+#define BOOT_COUNT       5
+
+// Latency histograms, metricObserve ()
+#define HIST_TAP_TO_AUTH         0  // Card read to the answer (cached, local or server) reaching the state machine
+#define HIST_AUTH_TO_RELAY       1  // Answer reaching the state machine to the relay closed
+#define HIST_REMOVAL_TO_TIMEOUT  2  // Removal seen by readerTask to the timeout starting
+#define HIST_MQTT_RTT            3  // Outbox publish to the broker's ack
+#define HIST_POLL_LAG            4  // How late readerTask got round to a reader's poll, grows with the number of readers
+#define HIST_ESTOP_TO_RELAY      5  // eStop seen (ISR or rfid/estop) to every relay open
+#define HIST_ESTOP_TO_STATE      6  // eStop seen to the state machine in ESTOP
+#define HIST_COUNT               7
+
+/* Buckets are powers of 2 in microseconds: bucket 0 is everything under 2^METRIC_BUCKET_SHIFT (256us), bucket n is
+   [2^(n+7), 2^(n+8)) and the last one takes everything from 2^22us (~4.2s) up. Picking one is a count leading zeros.
+*/
+#define METRIC_BUCKETS      16
+#define METRIC_BUCKET_SHIFT 8
+
+extern uint32_t metricCounters[CTR_COUNT];
+extern uint32_t metricBuckets[HIST_COUNT][METRIC_BUCKETS];
+
+typedef uint16_t (*metricsPublishFn)(const char *topic, const uint8_t *payload, size_t len); // Returns 0 if it wasn't sent
+
+extern void metricsInit (metricsPublishFn publish);
+extern void metricsWatchTask (TaskHandle_t task); // Include this task's stack headroom (and runtime, if enabled) in snapshots
+extern void metricsBootMark (byte mark);          // Safe from any task, only the first call for each BOOT_* counts
+extern void metricsTask (void *params);
+
+static inline byte metricBucket (uint32_t us){
+  if (us < (1UL << METRIC_BUCKET_SHIFT)){
+    return 0;
+  }
+  byte b = (32 - __builtin_clz(us)) - METRIC_BUCKET_SHIFT; // Bit length, 9 for [256, 512)
+  return (b < METRIC_BUCKETS) ? b : METRIC_BUCKETS - 1;
+}
+
+static inline void metricCount (byte counter){
+  __atomic_add_fetch(&metricCounters[counter], 1, __ATOMIC_RELAXED);
+}
+
+static inline void metricObserve (byte hist, uint32_t us){
+  __atomic_add_fetch(&metricBuckets[hist][metricBucket(us)], 1, __ATOMIC_RELAXED);
+}
+
+#endif // METRICS_H
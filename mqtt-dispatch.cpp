@@ -0,0 +1,176 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "mqtt-dispatch.h"
+#include "access-fsm.h"
+#include "auth-cache.h"
+#include "access-log.h"
+#include "member-sync.h"
+#include "estop.h"
+
+/* Incoming MQTT. onMqttMessage hands everything straight to mqttDispatch (), which runs in the AsyncTCP task so it
+   doesn't block or allocate: the topic and command word are hashed in one pass over the bytes, looked up in a table
+   whose keys are worked out (and checked for collisions) at compile time, and the handler posts a typed event to the
+   state machine. The payload is only ever read up to len, it isn't null terminated.
+   Messages that arrive in chunks are put back together in a small static buffer first, ours are all short.
+   The one exception is the member list, which is binary and can be tens of kB. It skips the table and goes to
+   member-sync.cpp a chunk at a time.
+*/
+
+static mqttDispatchStats stats;
+static char chunkBuf[MQTT_CMD_MAX];
+static size_t chunkTotal = 0;    // total of the message being reassembled, 0 when there isn't one
+static size_t chunkHave = 0;     // Bytes of it we've got so far
+static uint32_t arrivedUs = 0;   // micros() the message being dispatched started arriving, an eStop is timed from it
+
+//////// Handlers ////////
+
+/* The rsp goes to the station that asked about the card. If the server echoes the uidStr after the command word
+   ("auth,DE:AD:BE:EF") that picks the station. Without it the rsp is only used with a single station, with several
+   the server has to echo it or every rsp is dropped.
+   Late rsps, for a card a station has given up on, are dropped (see authCacheResolve ()).
+*/
+static void handleAuth (const char *args, size_t argsLen){
+  uidType resolved;
+  byte station;
+  authCacheResolve(1, args, argsLen, &resolved, &station); // Remember the grant so the next tap of this card skips the round trip
+  if (resolved.length == 0){
+    return; // Nobody asked
+  }
+  accessLogAppend(station, LOG_AUTH_GRANTED, &resolved, 0);
+  accessPost(station, EV_AUTH_GRANTED, &resolved); // Ignored unless we're waiting on an answer
+}
+
+static void handleDenied (const char *args, size_t argsLen){
+  uidType resolved;
+  byte station;
+  bool revoke = authCacheResolve(0, args, argsLen, &resolved, &station); // True if we already let this card in off the cache
+  if (resolved.length == 0){
+    return;
+  }
+  accessLogAppend(station, revoke ? LOG_AUTH_REVOKED : LOG_AUTH_DENIED, &resolved, 0);
+  accessPost(station, revoke ? EV_AUTH_REVOKED : EV_AUTH_DENIED, &resolved); // A revoke opens the relay if it was closed off the cache
+}
+
+static void handleKiosk (const char *args, size_t argsLen){
+  // Set kiosk bit?
+}
+
+static void handleEstopFire (const char *args, size_t argsLen){
+  estopFire(ESTOP_SRC_MQTT, arrivedUs); // Relays open right here, the whole bench
+}
+
+static void handleEstopClear (const char *args, size_t argsLen){
+  estopClear(); // Not while the local switch is still pressed
+}
+
+//////// Dispatch table ////////
+
+#define MQTT_ROW(topic, command, retainedOk, handler) {topic, command, retainedOk, handler, mqttKey(topic, command)}
+
+static constexpr mqttCommand commands[] = {
+  MQTT_ROW("rfid/auth/rsp", "auth",     0, handleAuth),
+  MQTT_ROW("rfid/auth/rsp", "denied",   0, handleDenied),
+  MQTT_ROW("rfid/auth/rsp", "seekiosk", 0, handleKiosk),
+  MQTT_ROW("rfid/estop",    "fire",     1, handleEstopFire),  // A retained fire keeps the tool stopped across reboots
+  MQTT_ROW("rfid/estop",    "clear",    1, handleEstopClear),
+};
+
+static constexpr size_t COMMAND_COUNT = sizeof(commands) / sizeof(commands[0]);
+
+// Every key has to be unique for the lookup to be a perfect hash over the table
+static constexpr bool keyUnique (size_t i, size_t j){
+  return j >= COMMAND_COUNT || (commands[i].key != commands[j].key && keyUnique(i, j + 1));
+}
+
+static constexpr bool keysUnique (size_t i){
+  return i >= COMMAND_COUNT || (keyUnique(i, i + 1) && keysUnique(i + 1));
+}
+
+static_assert(keysUnique(0), "Two mqtt commands hash to the same key, change one or the hash");
+
+static inline bool isSeparator (char c){
+  return (c == ',' || c == ' ' || c == '\r' || c == '\n');
+}
+
+/* Looks up a complete message and runs its handler.
+*/
+static void dispatchMessage (const char *topic, const char *payload, size_t len, bool retain){
+  uint32_t h = 2166136261UL;
+  const char *t;
+  size_t cmdLen = 0;
+
+  stats.received++;
+
+  for (t = topic; *t != 0; t++){
+    h = (h ^ (byte)*t) * 16777619UL;
+  }
+  h = (h ^ 0) * 16777619UL;
+  while (cmdLen < len && !isSeparator(payload[cmdLen])){
+    h = (h ^ (byte)payload[cmdLen]) * 16777619UL;
+    cmdLen++;
+  }
+
+  for (size_t i = 0; i < COMMAND_COUNT; i++){
+    const mqttCommand *c = &commands[i];
+    if (c->key != h){
+      continue;
+    }
+    // Hash matched, make sure it really is this row and not a stranger that collides with it
+    if (strcmp(topic, c->topic) != 0 || strlen(c->command) != cmdLen || memcmp(payload, c->command, cmdLen) != 0){
+      break;
+    }
+    if (retain && !c->retainedOk){
+      stats.retained++;
+      return;
+    }
+    size_t argsStart = (cmdLen < len) ? cmdLen + 1 : len; // Skip the separator
+    c->handler(payload + argsStart, len - argsStart);
+    stats.handled++;
+    return;
+  }
+
+  stats.unknown++;
+}
+
+void mqttDispatch (const char *topic, const char *payload, bool retain, size_t len, size_t index, size_t total){
+  if (index == 0){
+    arrivedUs = micros();
+  }
+  if (memberSyncOwns(topic)){
+    memberSyncMessage(payload, len, index, total);
+    return;
+  }
+
+  if (index == 0 && len == total){ // The usual case, whole message in one go, parse it where it is
+    chunkTotal = 0;
+    dispatchMessage(topic, payload, len, retain);
+    return;
+  }
+
+  if (index == 0){ // First chunk of a new message
+    chunkTotal = 0;
+    chunkHave = 0;
+    if (total > MQTT_CMD_MAX){
+      stats.oversize++;
+      return;
+    }
+    chunkTotal = total;
+  }
+  if (chunkTotal == 0 || index != chunkHave || total != chunkTotal || len > chunkTotal - chunkHave){
+    chunkTotal = 0; // Missed the start of it, it's out of order or too long, drop the rest of it
+    return;
+  }
+
+  memcpy(chunkBuf + index, payload, len);
+  chunkHave += len;
+  if (chunkHave >= chunkTotal){
+    chunkTotal = 0;
+    dispatchMessage(topic, chunkBuf, chunkHave, retain);
+  }
+}
+
+mqttDispatchStats * mqttDispatchGetStats (){
+  return &stats;
+}
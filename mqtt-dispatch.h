@@ -0,0 +1,42 @@
+#ifndef MQTT_DISPATCH_H
+#define MQTT_DISPATCH_H
+
+#include <Arduino.h>
+
+#define MQTT_CMD_MAX 32 // Longest message we reassemble from chunks, anything longer can't be one of our commands
+
+/* One row of the dispatch table: a topic, the command word its payload starts with and what to do about it.
+   The command word runs up to the end of the payload or the first ',', ' ', '\r' or '\n', whatever is after that
+   is handed to the handler as args (not null terminated, use argsLen).
+*/
+typedef void (*mqttHandler)(const char *args, size_t argsLen);
+
+typedef struct {
+  const char *topic;
+  const char *command;
+  bool retainedOk;      // Act on retained messages too. Retained messages fall straight through on boot, be very careful
+  mqttHandler handler;
+  uint32_t key;         // mqttKey (topic, command), filled in at compile time
+} mqttCommand;
+
+typedef struct { // Dispatch counters
+  uint32_t received;  // Complete messages seen
+  uint32_t handled;   // Matched a row and ran its handler
+  uint32_t unknown;   // No row for the topic/command
+  uint32_t retained;  // Matched but retained, ignored
+  uint32_t oversize;  // Chunked message longer than MQTT_CMD_MAX, dropped
+} mqttDispatchStats;
+
+// FNV-1a, same as uidHash. The topic and command are hashed as one string with a 0 between them
+constexpr uint32_t mqttHashStep (const char *s, uint32_t h){
+  return (*s == 0) ? h : mqttHashStep(s + 1, (h ^ (byte)*s) * 16777619UL);
+}
+
+constexpr uint32_t mqttKey (const char *topic, const char *command){
+  return mqttHashStep(command, (mqttHashStep(topic, 2166136261UL) ^ 0) * 16777619UL);
+}
+
+extern void mqttDispatch (const char *topic, const char *payload, bool retain, size_t len, size_t index, size_t total); // Straight from onMqttMessage
+extern mqttDispatchStats * mqttDispatchGetStats ();
+
+#endif // MQTT_DISPATCH_H
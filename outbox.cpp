@@ -0,0 +1,457 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include "tool-access-RTOS.h"
+#include "outbox.h"
+#include "estop.h"
+#include "debug-log.h"
+#include "metrics.h"
+#include "lf-ring.h"
+
+/* Store-and-forward queue for everything we publish about sessions (req, eou, offline taps).
+   Events are only removed once the broker acks their packet id in onMqttPublish, so a drop in the middle of a publish
+   just means it gets sent again. While WiFi/MQTT is out events pile up here and are persisted to flash by outboxTask.
+   On reconnect we wait a random jitter, then drain with at most OUTBOX_INFLIGHT unacked publishes outstanding so a
+   shop full of stations coming back at once doesn't flood the broker. Reqs jump the queue but not the window.
+   Flash only gets written during an outage: losing the connection writes what is still unacked once, events queued
+   after that are appended one by one, and once the backlog is acked after a reconnect the file is removed. While
+   connected nothing is written, an ack takes milliseconds and a reboot in between just loses the one event.
+   outboxPush () only hands the event to outboxTask through a lock-free ring, it is called from accessTask on the RF
+   core and must never wait on boxMux, the MQTT client or flash. outboxTask, on the network core, does the rest.
+   A board gating more than one tool adds ",<station>" to the end of every payload so the server knows which tool it
+   was. With a single station the payloads are exactly as they always were.
+*/
+
+#define OUTBOX_MAGIC 0x3258424F // "OBX2", entries up to the end of the file
+#define OUTBOX_RECENT_ACKS 4    // Acks that beat us to recording their packet id
+
+typedef struct {
+  uint32_t stamp;
+  byte station;
+  byte topic;
+  byte granted;
+  char uidStr[sizeof(((outboxEntry*)0)->uidStr)];
+} outboxIntake;
+
+static lfRing<outboxIntake, OUTBOX_INTAKE_SIZE> intake;
+static outboxEntry box[OUTBOX_SIZE];
+static outboxEntry snapshot[OUTBOX_SIZE]; // Copy taken for persisting, static so it isn't on the task stack
+static uint16_t boxHead = 0;
+static uint16_t boxCount = 0;
+static uint16_t inflight = 0;
+static uint32_t nextSeq = 0;
+static uint32_t dropped = 0;
+static bool dirty = 0;             // Entries queued that aren't on flash yet
+static bool compactDue = 0;        // Connection lost, rewrite the file with everything still unacked
+static bool onFile = 0;            // OUTBOX_PATH holds entries
+static uint16_t fileCount = 0;     // Entries we've written to it, 0 if it has to be rewritten before appending
+static uint32_t persistedSeq = 0;  // Entries from this seq on aren't on flash
+static volatile bool connected = 0;
+static uint32_t drainAfter = 0;  // millis() before which we hold off after a reconnect
+static uint16_t recentAcks[OUTBOX_RECENT_ACKS];
+static byte recentAckNext = 0;
+static outboxPublishFn publishFn = NULL;
+static TaskHandle_t drainHandle = NULL;
+static portMUX_TYPE boxMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char * topicName (byte topic){
+  switch (topic){
+    case OUTBOX_REQ: return "rfid/auth/req";
+    case OUTBOX_EOU: return "rfid/auth/eou";
+    case OUTBOX_TAP: return "rfid/auth/offline";
+    case OUTBOX_ESTOP: return ESTOP_REPORT_TOPIC;
+  }
+  return NULL;
+}
+
+static inline outboxEntry * entryAt (uint16_t i){
+  return &box[(boxHead + i) % OUTBOX_SIZE];
+}
+
+// Must be called with boxMux held. Frees slots at the head that are done with
+static void popAcked (){
+  while (boxCount > 0 && entryAt(0)->acked){
+    boxHead = (boxHead + 1) % OUTBOX_SIZE;
+    boxCount--;
+  }
+}
+
+static void wakeOutbox (){
+  if (drainHandle != NULL){
+    xTaskNotifyGive(drainHandle);
+  }
+}
+
+bool outboxPush (byte station, byte topic, const char *uidStr, bool granted){
+  outboxIntake in;
+
+  if (topic == OUTBOX_REQ && !connected){ // A stale auth request is no use to anyone
+    return 0;
+  }
+
+  in.stamp = millis();
+  in.station = station;
+  in.topic = topic;
+  in.granted = granted;
+  strncpy(in.uidStr, uidStr, sizeof(in.uidStr) - 1);
+  in.uidStr[sizeof(in.uidStr) - 1] = 0;
+  if (!intake.push(in)){ // outboxTask has fallen a long way behind
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  wakeOutbox();
+  return 1;
+}
+
+// outboxTask only. Moves everything pushed since last time into box
+static void takeIntake (){
+  outboxIntake *in;
+
+  while ((in = intake.peek()) != NULL){
+    if (in->topic == OUTBOX_REQ && !connected){ // Went down since it was pushed
+      intake.pop();
+      continue;
+    }
+    portENTER_CRITICAL(&boxMux);
+    if (boxCount == OUTBOX_SIZE){ // Full, lose the oldest rather than hold up the new one
+      if (entryAt(0)->packetId != 0 && !entryAt(0)->acked){
+        inflight--;
+      }
+      boxHead = (boxHead + 1) % OUTBOX_SIZE;
+      boxCount--;
+      __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED); // outboxPush counts its drops from the other core
+    }
+    outboxEntry *e = entryAt(boxCount);
+    memset(e, 0, sizeof(outboxEntry));
+    e->seq = nextSeq++;
+    e->stamp = in->stamp;
+    e->topic = in->topic;
+    e->granted = in->granted;
+    e->station = in->station;
+    memcpy(e->uidStr, in->uidStr, sizeof(e->uidStr));
+    boxCount++;
+    if (in->topic != OUTBOX_REQ){
+      dirty = 1;
+    }
+    portEXIT_CRITICAL(&boxMux);
+    intake.pop();
+  }
+}
+
+void outboxAck (uint16_t packetId){
+  bool matched = 0;
+
+  portENTER_CRITICAL(&boxMux);
+  for (uint16_t i = 0; i < boxCount; i++){
+    outboxEntry *e = entryAt(i);
+    if (e->packetId == packetId && !e->acked){
+      metricObserve(HIST_MQTT_RTT, (millis() - e->sentAt) * 1000);
+      e->acked = 1;
+      e->packetId = 0;
+      inflight--;
+      matched = 1;
+      break;
+    }
+  }
+  if (!matched){ // Either a duplicate ack (ignore) or it raced ahead of outboxTask recording the id
+    recentAcks[recentAckNext] = packetId;
+    recentAckNext = (recentAckNext + 1) % OUTBOX_RECENT_ACKS;
+  }
+  popAcked();
+  portEXIT_CRITICAL(&boxMux);
+
+  wakeOutbox();
+}
+
+void outboxConnected (bool isConnected){
+  portENTER_CRITICAL(&boxMux);
+  bool was = connected;
+  connected = isConnected;
+  if (isConnected){
+    drainAfter = millis() + random(OUTBOX_CONNECT_JITTER);
+  }
+  else{
+    // Nothing in flight will be acked now, send it all again next time. Pending requests are dropped, nobody is waiting on them
+    for (uint16_t i = 0; i < boxCount; i++){
+      outboxEntry *e = entryAt(i);
+      e->packetId = 0;
+      if (e->topic == OUTBOX_REQ){
+        e->acked = 1;
+      }
+    }
+    inflight = 0;
+    popAcked();
+    compactDue = was; // Not on every failed reconnect
+  }
+  portEXIT_CRITICAL(&boxMux);
+
+  wakeOutbox();
+}
+
+uint16_t outboxDepth (){
+  return boxCount + intake.depth();
+}
+
+uint32_t outboxDropped (){
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+static void formatPayload (const outboxEntry *e, char *payload, size_t size){
+  int n;
+  if (e->topic != OUTBOX_TAP){
+    n = snprintf(payload, size, "%s", e->uidStr); // req and eou keep their original uidStr payload
+  }
+  else if (e->restored){
+    n = snprintf(payload, size, "%s,%s,?", e->uidStr, e->granted ? "granted" : "denied"); // How long ago is unknown across a reboot
+  }
+  else{
+    n = snprintf(payload, size, "%s,%s,%lu", e->uidStr, e->granted ? "granted" : "denied", (unsigned long)(millis() - e->stamp)); // ms since the tap
+  }
+  if (STATION_COUNT > 1 && e->topic != OUTBOX_ESTOP && n > 0 && (size_t)n < size){ // An eStop is the whole board
+    snprintf(payload + n, size - n, ",%u", e->station);
+  }
+}
+
+/* Publishes the oldest unsent entry, or the oldest unsent req if reqOnly.
+   Returns false when there was nothing to send or the client wouldn't take it.
+*/
+static bool sendNext (bool reqOnly){
+  outboxEntry e;
+  bool found = 0;
+  char payload[64];
+
+  portENTER_CRITICAL(&boxMux);
+  for (uint16_t i = 0; i < boxCount; i++){
+    if (!entryAt(i)->acked && !entryAt(i)->sending && entryAt(i)->packetId == 0 && (!reqOnly || entryAt(i)->topic == OUTBOX_REQ)){
+      entryAt(i)->sending = 1;
+      e = *entryAt(i);
+      found = 1;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&boxMux);
+
+  if (!found){
+    return 0;
+  }
+
+  formatPayload(&e, payload, sizeof(payload));
+  uint16_t packetId = publishFn(topicName(e.topic), payload);
+
+  portENTER_CRITICAL(&boxMux);
+  for (uint16_t i = 0; i < boxCount; i++){
+    outboxEntry *p = entryAt(i);
+    if (p->seq == e.seq && !p->acked){
+      p->sending = 0;
+      if (packetId == 0){ // Client wouldn't take it, try again later
+        break;
+      }
+      p->packetId = packetId;
+      p->sentAt = millis();
+      inflight++;
+      for (byte a = 0; a < OUTBOX_RECENT_ACKS; a++){ // Ack already came in while we were publishing
+        if (recentAcks[a] == packetId){
+          recentAcks[a] = 0;
+          p->acked = 1;
+          p->packetId = 0;
+          inflight--;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  popAcked();
+  portEXIT_CRITICAL(&boxMux);
+  return (packetId != 0);
+}
+
+/* Copies the unacked events (never reqs) into snapshot, only those queued since the last write if fresh.
+   Everything queued so far counts as on flash from here.
+*/
+static uint16_t takeSnapshot (bool fresh){
+  uint16_t n = 0;
+
+  portENTER_CRITICAL(&boxMux);
+  for (uint16_t i = 0; i < boxCount; i++){
+    outboxEntry *e = entryAt(i);
+    if (!e->acked && e->topic != OUTBOX_REQ && (!fresh || (int32_t)(e->seq - persistedSeq) >= 0)){
+      snapshot[n] = *e;
+      snapshot[n].packetId = 0;
+      n++;
+    }
+  }
+  persistedSeq = nextSeq;
+  dirty = 0;
+  portEXIT_CRITICAL(&boxMux);
+  return n;
+}
+
+static void removeFile (){
+  SPIFFS.remove(OUTBOX_PATH);
+  SPIFFS.remove(OUTBOX_TMP_PATH); // We may have restored from it
+  onFile = 0;
+  fileCount = 0;
+}
+
+// Rewrites the file with just what is still unacked
+static void compact (){
+  uint16_t n = takeSnapshot(0);
+  compactDue = 0;
+
+  if (n == 0){
+    removeFile();
+    return;
+  }
+
+  // Write a new copy then swap it in, so a power cut leaves either the old or the new file intact
+  File f = SPIFFS.open(OUTBOX_TMP_PATH, FILE_WRITE);
+  if (!f){
+    DLOG_ERROR("Failed to open outbox for writing");
+    fileCount = 0;
+    return;
+  }
+  uint32_t magic = OUTBOX_MAGIC;
+  f.write((const byte*)&magic, sizeof(magic));
+  f.write((const byte*)snapshot, n * sizeof(outboxEntry));
+  f.close();
+  SPIFFS.remove(OUTBOX_PATH);
+  SPIFFS.rename(OUTBOX_TMP_PATH, OUTBOX_PATH);
+  onFile = 1;
+  fileCount = n;
+}
+
+/* Adds what was queued since the last write to the end of the file. Once the file would hold more than the box does
+   (acked and dropped ones are still in it) it's compacted instead.
+*/
+static void append (){
+  if (fileCount == 0){ // Never written, or restored from a file that may have a torn tail
+    compact();
+    return;
+  }
+
+  uint16_t n = takeSnapshot(1);
+  if (n == 0){
+    return;
+  }
+  if (fileCount + n > OUTBOX_SIZE){
+    compact();
+    return;
+  }
+
+  File f = SPIFFS.open(OUTBOX_PATH, FILE_APPEND);
+  if (!f){
+    DLOG_ERROR("Failed to open outbox for appending");
+    fileCount = 0;
+    return;
+  }
+  f.write((const byte*)snapshot, n * sizeof(outboxEntry));
+  f.close();
+  fileCount += n;
+}
+
+// Anything left that the file is there to keep?
+static bool backlogLeft (){
+  bool left = 0;
+  portENTER_CRITICAL(&boxMux);
+  for (uint16_t i = 0; i < boxCount && !left; i++){
+    left = !entryAt(i)->acked && entryAt(i)->topic != OUTBOX_REQ;
+  }
+  portEXIT_CRITICAL(&boxMux);
+  return left;
+}
+
+// outboxTask only, after every pass
+static void persist (){
+  if (compactDue){
+    compact();
+  }
+  else if (!connected && dirty){
+    append();
+  }
+  else if (connected && onFile && !backlogLeft()){ // Drained, a reboot now has nothing to replay
+    removeFile();
+  }
+}
+
+static bool restore (const char *path){
+  File f = SPIFFS.open(path, FILE_READ);
+  if (!f){
+    return 0;
+  }
+
+  uint32_t magic = 0;
+  uint16_t n = OUTBOX_SIZE;
+  if (f.read((byte*)&magic, sizeof(magic)) != sizeof(magic) || magic != OUTBOX_MAGIC){
+    f.close();
+    return 0;
+  }
+
+  for (uint16_t i = 0; i < n; i++){
+    if (f.read((byte*)&box[i], sizeof(outboxEntry)) != sizeof(outboxEntry)){
+      n = i; // End of the file, or torn by a power cut mid append. Keep what we got
+      break;
+    }
+    box[i].seq = i;
+    box[i].packetId = 0;
+    box[i].acked = 0;
+    box[i].sending = 0;
+    box[i].restored = 1;
+  }
+  f.close();
+
+  boxHead = 0;
+  boxCount = n;
+  nextSeq = n;
+  persistedSeq = n;
+  onFile = 1;
+  fileCount = 0; // The next write rewrites it
+  return 1;
+}
+
+void outboxInit (outboxPublishFn publish){
+  publishFn = publish;
+  if (restore(OUTBOX_PATH) || restore(OUTBOX_TMP_PATH)){
+    DLOG_INFO("Outbox restored %u events", boxCount);
+  }
+}
+
+void outboxTask (void *params){
+  TickType_t sleep = 0; // First pass takes whatever was pushed before the task started
+
+  drainHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    ulTaskNotifyTake(pdTRUE, sleep);
+    sleep = OUTBOX_ACK_TIMEOUT;
+
+    takeIntake();
+    while (connected && inflight < OUTBOX_INFLIGHT && sendNext(1)){
+      // Someone is standing at the tool, reqs go ahead of the backlog and the jitter. Usually just the one
+    }
+
+    int32_t wait = (int32_t)(drainAfter - millis());
+    if (connected && wait > 0){ // Just reconnected, hold off the backlog for our bit of jitter but stay awake for new reqs
+      sleep = pdMS_TO_TICKS(wait) + 1;
+    }
+    else if (connected){
+      // Anything that has gone unacked too long gets sent again
+      portENTER_CRITICAL(&boxMux);
+      for (uint16_t i = 0; i < boxCount; i++){
+        outboxEntry *e = entryAt(i);
+        if (e->packetId != 0 && (millis() - e->sentAt) > OUTBOX_ACK_TIMEOUT * portTICK_PERIOD_MS){
+          e->packetId = 0;
+          inflight--;
+        }
+      }
+      portEXIT_CRITICAL(&boxMux);
+
+      while (connected && inflight < OUTBOX_INFLIGHT && (sendNext(1) || sendNext(0))){
+        // Keep going until the in flight window is full, acks wake us for the next batch. A req still first
+      }
+    }
+
+    persist();
+  }
+}
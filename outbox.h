@@ -0,0 +1,46 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <Arduino.h>
+
+// Outbox defines
+#define OUTBOX_SIZE           64      // Events held while WiFi/MQTT is out, oldest is dropped when full
+#define OUTBOX_INTAKE_SIZE    16      // Pushes waiting for outboxTask to pick them up, power of 2
+#define OUTBOX_INFLIGHT       4       // Most publishes waiting on a broker ack at once (backpressure)
+#define OUTBOX_CONNECT_JITTER 2000    // Max random ms to wait after onMqttConnect before draining, spreads out reconnect storms
+#define OUTBOX_ACK_TIMEOUT    pdMS_TO_TICKS(5000) // Republish anything not acked within this
+#define OUTBOX_PATH           "/outbox.bin"
+#define OUTBOX_TMP_PATH       "/outbox.tmp"   // Compacting writes here then renames it over OUTBOX_PATH
+
+// Topics the outbox publishes to, stored in outboxEntry.topic
+#define OUTBOX_REQ  0  // rfid/auth/req - only meaningful while connected, dropped (never replayed) on disconnect
+#define OUTBOX_EOU  1  // rfid/auth/eou - end of use
+#define OUTBOX_TAP  2  // rfid/auth/offline - a tap decided locally while WiFi/MQTT was out
+#define OUTBOX_ESTOP 3 // ESTOP_REPORT_TOPIC - the local eStop switch was pressed, uidStr holds what fired it
+
+typedef struct {
+  uint32_t seq;       // Order events were queued in
+  uint32_t stamp;     // millis() when queued
+  uint32_t sentAt;    // millis() of the last publish attempt
+  uint16_t packetId;  // Non zero while waiting on the broker's ack
+  byte topic;         // OUTBOX_*
+  byte granted;       // OUTBOX_TAP only: 1 granted, 0 denied
+  bool restored;      // Came back from flash after a reboot, stamp is meaningless
+  bool acked;         // Broker acked it, slot frees once everything before it is acked too
+  bool sending;       // A task is in the middle of publishing it, keeps two tasks from sending it twice
+  byte station;       // Station it happened at
+  char uidStr[31];
+} outboxEntry;
+
+// Publishes payload to topic at QoS 1, returns the packet id or 0 if it couldn't be sent. Wraps mqttClient.publish
+typedef uint16_t (*outboxPublishFn)(const char *topic, const char *payload);
+
+extern void outboxInit (outboxPublishFn publish); // Restores anything persisted from before a reboot. Call after SPIFFS is mounted
+extern void outboxTask (void *params);           // Drains to the broker, persists to flash during outages
+extern bool outboxPush (byte station, byte topic, const char *uidStr, bool granted); // Lock-free and never publishes, safe from any task
+extern void outboxConnected (bool connected);    // Call from onMqttConnect/onMqttDisconnect
+extern void outboxAck (uint16_t packetId);       // Call from onMqttPublish
+extern uint16_t outboxDepth ();
+extern uint32_t outboxDropped ();
+
+#endif // OUTBOX_H
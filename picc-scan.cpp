@@ -0,0 +1,227 @@
+#include <Arduino.h>
+#include "picc-scan.h"
+
+#define PICC_CMD_REQA  0x26    // 7 bit short frames
+#define PICC_CMD_WUPA  0x52
+#define PICC_CMD_SEL1  0x93    // Cascade levels 1-3 are 0x93, 0x95, 0x97
+#define PICC_CMD_HLTA  0x50
+#define PICC_CT        0x88    // Cascade tag, first byte of a level that isn't the last
+#define PICC_SAK_MORE  0x04    // SAK bit saying the UID isn't complete yet
+
+uint16_t piccCrcA (const byte *data, byte len){
+  uint16_t crc = 0x6363;
+  for (byte i = 0; i < len; i++){
+    byte b = data[i] ^ (byte)crc;
+    b ^= b << 4;
+    crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+  }
+  return crc;
+}
+
+static byte shortFrame (const piccLink *link, byte cmd){
+  byte atqa[2];
+  byte bits = 0;
+  byte coll = 0;
+  byte s = link->transceive(link->ctx, &cmd, 7, atqa, sizeof(atqa), &bits, &coll);
+  return (s == PICC_COLLISION) ? PICC_OK : s; // Different ATQAs overlapping still means someone is there
+}
+
+// HLTA is only answered to say no, silence is success
+static bool halt (const piccLink *link){
+  byte frame[4] = {PICC_CMD_HLTA, 0x00, 0, 0};
+  byte back[1];
+  byte bits = 0;
+  byte coll = 0;
+  uint16_t crc = piccCrcA(frame, 2);
+  frame[2] = crc & 0xFF;
+  frame[3] = crc >> 8;
+  return link->transceive(link->ctx, frame, 32, back, sizeof(back), &bits, &coll) == PICC_TIMEOUT;
+}
+
+typedef struct { // Where a walk down the anticollision tree starts
+  uidType uid;     // Cascade levels already done, CT stripped. Their SELECTs are sent again to get back here
+  byte level;
+  byte known;      // Bits of cl already decided
+  byte cl[5];      // This level's 4 UID bytes and BCC, as far as known
+} piccBranch;
+
+// SELECT of a whole cascade level, only the PICC with exactly this cl answers. Returns its SAK or -1
+static int selectLevel (const piccLink *link, byte level, const byte *cl){
+  byte frame[9];
+  byte back[4];
+  byte bits = 0;
+  byte coll = 0;
+
+  frame[0] = PICC_CMD_SEL1 + 2 * level;
+  frame[1] = 0x70; // NVB, all 7 bytes
+  memcpy(frame + 2, cl, 5);
+  uint16_t crc = piccCrcA(frame, 7);
+  frame[7] = crc & 0xFF;
+  frame[8] = crc >> 8;
+  if (link->transceive(link->ctx, frame, 72, back, sizeof(back), &bits, &coll) != PICC_OK || bits != 24 || piccCrcA(back, 3) != 0){
+    return -1; // CRC over the data and its own CRC comes out 0
+  }
+  return back[0];
+}
+
+/* Walks the anticollision tree from start down to one PICC and selects it. Every READY PICC still on the path answers
+   each round, where they differ we take the branch with a 1 there and the others drop out. The 0 branch goes on
+   pending (up to pendingMax) for a later walk. collided is set if any round saw more than one PICC.
+*/
+static byte walk (const piccLink *link, const piccBranch *start, piccBranch *pending, byte *pendingCount, byte pendingMax,
+                  uidType *uid, bool *collided){
+  byte frame[7];
+  byte back[6];
+  byte cl[5];
+  byte bits;
+  byte coll;
+  byte s;
+
+  *uid = start->uid;
+  for (byte level = 0; level < start->level; level++){ // Back to where the branch was taken
+    byte done[5] = {PICC_CT, uid->bytes[level * 3], uid->bytes[level * 3 + 1], uid->bytes[level * 3 + 2], 0};
+    done[4] = done[0] ^ done[1] ^ done[2] ^ done[3];
+    int sak = selectLevel(link, level, done);
+    if (sak < 0 || !(sak & PICC_SAK_MORE)){
+      return PICC_ERROR;
+    }
+  }
+
+  memcpy(cl, start->cl, sizeof(cl));
+  byte known = start->known;
+  for (byte level = start->level; level < 3; level++){
+    frame[0] = PICC_CMD_SEL1 + 2 * level;
+
+    while (known < 40){
+      byte whole = known / 8;
+      frame[1] = ((2 + whole) << 4) | (known % 8); // NVB, bytes then bits we're sending
+      memcpy(frame + 2, cl, whole + ((known % 8) ? 1 : 0));
+      bits = 0;
+      s = link->transceive(link->ctx, frame, 16 + known, back, sizeof(back), &bits, &coll);
+      if (s != PICC_OK && s != PICC_COLLISION){
+        return s;
+      }
+
+      byte end = (s == PICC_COLLISION) ? coll : bits; // Stored bit positions in back we can trust
+      if (whole * 8 + end > 40){
+        end = 40 - whole * 8;
+      }
+      if (s == PICC_COLLISION && (whole * 8 + coll < known || whole * 8 + coll >= 32)){
+        return PICC_ERROR; // Before what we sent or in the BCC, nothing sensible to branch on
+      }
+      for (byte b = known % 8; b < end; b++){ // Received bits carry on from the partial byte we sent
+        cl[whole + b / 8] = (cl[whole + b / 8] & ~(1 << (b % 8))) | (back[b / 8] & (1 << (b % 8)));
+      }
+      if (s == PICC_COLLISION){
+        byte at = whole * 8 + coll;
+        *collided = 1;
+        cl[at / 8] &= (1 << (at % 8)) - 1; // Nothing past the collision is known
+        if (*pendingCount < pendingMax){
+          piccBranch *b = &pending[(*pendingCount)++];
+          b->uid = *uid;
+          b->level = level;
+          b->known = at + 1;
+          memcpy(b->cl, cl, sizeof(cl)); // With a 0 at the collision
+        }
+        cl[at / 8] |= 1 << (at % 8);    // We take the 1
+        known = at + 1;
+      }
+      else if (whole * 8 + end < 40){
+        return PICC_ERROR; // Came up short
+      }
+      else{
+        known = 40;
+      }
+    }
+
+    if ((cl[0] ^ cl[1] ^ cl[2] ^ cl[3]) != cl[4]){
+      return PICC_ERROR;
+    }
+    int sak = selectLevel(link, level, cl);
+    if (sak < 0){
+      return PICC_ERROR;
+    }
+    if (!(sak & PICC_SAK_MORE)){
+      memcpy(uid->bytes + uid->length, cl, 4);
+      uid->length += 4;
+      return (uid->length <= UID_MAX_SIZE) ? PICC_OK : PICC_ERROR;
+    }
+    if (cl[0] != PICC_CT || uid->length + 3 > UID_MAX_SIZE){
+      return PICC_ERROR;
+    }
+    memcpy(uid->bytes + uid->length, cl + 1, 3);
+    uid->length += 3;
+    memset(cl, 0, sizeof(cl));
+    known = 0;
+  }
+  return PICC_ERROR; // SAK still said there was more after level 3
+}
+
+bool piccScanHas (const piccScanResult *r, const uidType *uid){
+  for (byte i = 0; i < r->count && i < PICC_SCAN_MAX; i++){
+    if (uidEqual(r->found[i], *uid)){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* WUPA wakes everything, halted or not, so a card in session is found the same as a new one. If the first walk saw no
+   collision it was the only PICC there and that is the whole scan: WUPA, anticollision, SELECT, HLTA. Otherwise each
+   branch it passed up is walked in turn, each from a fresh WUPA since the HLTA that ends a walk sends every PICC still
+   READY back to IDLE or HALT.
+   A lost ATQA doesn't make a card gone: it went READY all the same, and a second WUPA would only send it to HALT.
+   The first walk goes ahead regardless and its anticollision is the second chance to answer.
+*/
+void piccScan (const piccLink *link, piccScanResult *r){
+  piccBranch pending[PICC_SCAN_ROUNDS];
+  byte pendingCount = 1;
+  bool retried = 0;
+  uidType uid;
+
+  memset(r, 0, sizeof(piccScanResult));
+  memset(&pending[0], 0, sizeof(piccBranch)); // From the root
+
+  for (byte round = 0; round < PICC_SCAN_ROUNDS && pendingCount > 0; round++){
+    bool woke = (shortFrame(link, PICC_CMD_WUPA) == PICC_OK);
+    if (!woke && round > 0){
+      return; // Whatever was left has gone
+    }
+
+    piccBranch from = pending[--pendingCount];
+    bool collided = 0;
+    byte s = walk(link, &from, pending, &pendingCount, PICC_SCAN_ROUNDS, &uid, &collided);
+    if (round == 0 && !woke && s == PICC_TIMEOUT){
+      return; // Nothing answered twice over, the field is empty
+    }
+    r->answered = 1;
+    r->collided = r->collided || collided;
+
+    if (s == PICC_OK){
+      if (!piccScanHas(r, &uid)){
+        if (r->count < PICC_SCAN_MAX){
+          r->found[r->count] = uid;
+        }
+        r->count++;
+      }
+      halt(link);
+    }
+    else if (!retried && pendingCount < PICC_SCAN_ROUNDS){ // Garbled, give the same branch one more go
+      retried = 1;
+      pending[pendingCount++] = from;
+    }
+  }
+}
+
+bool piccReadReady (const piccLink *link, uidType *uid){
+  piccBranch root;
+  byte none = 0;
+  bool collided = 0;
+
+  memset(&root, 0, sizeof(root));
+  if (walk(link, &root, NULL, &none, 0, uid, &collided) != PICC_OK){
+    return 0;
+  }
+  halt(link);
+  return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef PICC_SCAN_H
+#define PICC_SCAN_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+/* ISO 14443-3 type A anticollision, done here rather than in the MFRC522 library so a scan can tell us what it saw:
+   every PICC in the field, by UID, in one pass. Presence and collision checks both come out of the same scan.
+   It only needs a raw frame exchange (piccLink), the MFRC522 one is in tool-access-RTOS.cpp and
+   tools/picc-scan-bench.cpp drives the same code against a simulated field.
+
+   CRC_A is worked out here too, in software, which saves the MFRC522's CRC coprocessor round trips on the bus.
+*/
+
+#define PICC_SCAN_MAX     4    // Most UIDs a scan reports, two is already a collision
+#define PICC_SCAN_ROUNDS  6    // Most selects a scan tries before it gives up on what's left in the field
+
+// piccLink.transceive results
+#define PICC_OK        0
+#define PICC_TIMEOUT   1       // Nothing answered
+#define PICC_COLLISION 2       // More than one answered and they differed, collBit says where
+#define PICC_ERROR     3       // Garbled (parity, CRC, framing) or a NAK
+
+/* One reader's raw frame exchange. Sends sendBits bits of send (LSB first, the last byte may be partial) and fills back
+   with the answer. Received bits are stored carrying on from where the sent ones left off, so back[0] holds them
+   from bit (sendBits % 8) up (the MFRC522's RxAlign). backBits is how far back is filled, alignment included, and on
+   PICC_COLLISION collBit is the first collided bit, counted the same way. Nothing is added to or checked of the frame.
+*/
+typedef struct {
+  void *ctx;
+  byte (*transceive)(void *ctx, const byte *send, byte sendBits, byte *back, byte backMax, byte *backBits, byte *collBit);
+} piccLink;
+
+typedef struct {
+  bool answered;       // Something answered the WUPA. count can still be 0 if it couldn't be read (a card half in the field)
+  bool collided;       // Anticollision saw more than one PICC, even if they couldn't all be read
+  byte count;          // PICCs read and halted, the first PICC_SCAN_MAX are in found[]
+  uidType found[PICC_SCAN_MAX];
+} piccScanResult;
+
+extern void piccScan (const piccLink *link, piccScanResult *r); // Wakes every PICC (halted ones too), reads and halts each
+extern bool piccReadReady (const piccLink *link, uidType *uid); // Reads and halts one PICC already READY (answered a REQA)
+extern bool piccScanHas (const piccScanResult *r, const uidType *uid);
+extern uint16_t piccCrcA (const byte *data, byte len);
+
+#endif // PICC_SCAN_H
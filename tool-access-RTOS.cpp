@@ -4,11 +4,37 @@
 #include <WiFi.h>
 #include <SPIFFS.h>
 #include <AsyncMqttClient.h>
+#include <soc/gpio_struct.h>
+#include <driver/gpio.h>
 #include "tool-access-RTOS.h"
+#include "member-index.h"
+#include "debug-log.h"
+#include "picc-scan.h"
 #include "credentials.h"
 
-// MFRC522 Instantiation
-MFRC522 mfrc522(SS_PIN, RST_PIN);
+/* Station bindings. To gate another tool from this board add a row (and bump STATION_COUNT and NUM_LEDS).
+   Every reader hangs off the same SPI bus with its own SS, readerTask takes turns between them.
+*/
+constexpr stationConfig stationConfigs[STATION_COUNT] = {
+#ifdef STATION_ROWS
+  STATION_ROWS // From the build, tools/station-scaling-bench.h has them for the host
+#else
+  // SS       RST      relay      IRQ             LEDs
+  {SS_PIN,    RST_PIN, RELAY_PIN, READER_IRQ_PIN, 0, NUM_LEDS},
+#endif
+};
+
+// Compile time checks on the table, every station needs LEDs of its own within the chain
+static constexpr bool ledsValid (size_t i){
+  return i >= STATION_COUNT || (stationConfigs[i].ledCount > 0 && stationConfigs[i].firstLed + stationConfigs[i].ledCount <= NUM_LEDS
+                                && ledsValid(i + 1));
+}
+
+static_assert(STATION_COUNT >= 1 && STATION_COUNT <= STATION_MAX, "STATION_COUNT must be 1 to STATION_MAX");
+static_assert(ledsValid(0), "A station's LEDs run off the end of the chain, check firstLed/ledCount against NUM_LEDS");
+
+// MFRC522 Instantiation, pins are given to PCD_Init ()
+MFRC522 readers[STATION_COUNT];
 
 // SPIFFS Instantiation
 File file;
@@ -20,30 +46,44 @@ CRGB leds[NUM_LEDS]; // We have 2 LEDs and we count from 0
 void toolAccessInit () {
 
   //GPIO Config
-  pinMode(RELAY_PIN, OUTPUT);   // Set relay pin for output
+  relayInit();   // Set relay pins for output
   pinMode(LEDATA_PIN, OUTPUT); // Set LED pin for output
 
-  Serial.begin(115200);   // Initialize serial communications with the PC
   SPI.begin();      // Init SPI bus
 
   //RFID Setup
-  mfrc522.PCD_Init();   // Init MFRC522
+  for (byte i = 0; i < STATION_COUNT; i++){ // Every SS high first so an uninitialised reader doesn't answer on the bus
+    pinMode(stationConfigs[i].ssPin, OUTPUT);
+    digitalWrite(stationConfigs[i].ssPin, HIGH);
+  }
+  for (byte i = 0; i < STATION_COUNT; i++){
+    readers[i].PCD_Init(stationConfigs[i].ssPin, stationConfigs[i].rstPin);   // Init MFRC522
 
-  // For debugging purposes - lets us know if getting coms from RFID module
-  mfrc522.PCD_DumpVersionToSerial();  // Show details of PCD - MFRC522 Card Reader details
-  Serial.println(F("Scan PICC to see UID, SAK, type, and data blocks..."));
+    // Lets us know if we're getting coms from the RFID module, without holding up boot on Serial
+    byte version = readers[i].PCD_ReadRegister(MFRC522::VersionReg);
+    if (version == 0x00 || version == 0xFF){
+      DLOG_ERROR("Station %u: no answer from the MFRC522, check the wiring", i);
+    }
+    else{
+      DLOG_INFO("Station %u: MFRC522 version 0x%02X", i, version);
+    }
+  }
 
   // LED Init
   FastLED.addLeds<WS2812, LEDATA_PIN, RGB>(leds, NUM_LEDS);
   LEDS.setBrightness(50); // Set LED brightness to 50%
+}
 
-  // SPIFFS Init
-  // Mount SPIFFS file system
-  if (!SPIFFS.begin(true)){ // Passing true will format SPIFFS on first interaction?
-    Serial.println("An Error has occured SPIFFS during mount");
-      return;
+/* Mounts SPIFFS. Kept out of toolAccessInit () because the first mount formats, which takes seconds, and nothing a tap
+   needs is on SPIFFS. setup () runs it once the readers are already up.
+*/
+bool storageInit (){
+  if (!SPIFFS.begin(true)){ // Passing true formats SPIFFS if it won't mount
+    DLOG_ERROR("An Error has occured SPIFFS during mount");
+    return 0;
   }
-
+  dlogFlashReady();
+  return 1;
 }
 
 /////////////////////////////////////////  RFID Functions   ///////////////////////////////////
@@ -55,141 +95,204 @@ Need not do both but which depends on approach
 If sticking with MQTT may as well convert directly to string
 If going with something else may make more sense to use byte
 */ 
-/* Reads UID out of mfrc522.uid.uidByte struct, prints to serial and into array
-   Card MUST have already been read by PICC_Select () OR PICC_ReadCardSerial ()
+/* Compares two UIDs, length included. Replaces comparing the colon-hex uidStr's
 */
-uint8_t userID(metaStruct *progParams, byte value[], byte valueSize) {
-  // Prog struct , mfrc522 struct
-  //byte buffer[], byte *sizeBuff,
-  //metaStruct->card
-
-  progParams->card.uid_length = valueSize; 
-  Serial.print(F("Card UID:"));
-  for (byte i = 0; i < progParams->card.uid_length; i++) {
-    if (value[i] < 0x10) //
-      Serial.print(F(" 0"));
-    else
-      Serial.print(F(" "));
-    progParams->card.uid_buffer[i] = value[i];
-    //Serial.print(mfrc522.uid.uidByte[i], HEX);
-    Serial.print(progParams->card.uid_buffer[i], HEX);
-  }
+bool checkTwo (const uidType *a, const uidType *b){
+  return uidEqual(*a, *b);
+}
 
-  Serial.println(); // print a space
-  mfrc522.PICC_HaltA(); // Place card in halt state
+/* Checks the UID against the flash resident member list, see member-index.cpp. Only for this station, a member of
+   one tool on the board isn't a member of the rest.
+   No heap and constant time on average so it is fine to call from the polling task
+*/
+bool isAllowed (byte station, const uidType *test){
+  return (memberIndexStations(test) >> station) & 1;
 }
 
 
-/* Checks for continued presence of previously read (ie. Halted) card.
-    Polling frequency is controlled externally using the isitTime ()
-    Current implementation means that there is a 0-10s timer on when the ESP reacts to the removal of the card.
-    How this works:
-    PICC_WakeupA (byte *bufferATQA, byte *bufferSize), see MFRC522.cpp lines 568
-    WakeupA returns STATUS_OK = 0 (see MFRC522.h lines 307-317 for StatusCode enums) on successful wakeup
-    Otherwise STATUS_?? on unsuccessful
+/* Reader scheduling primitives. These are only ever called from readerTask, which owns the MFRC522s, so no mutex.
+   Idle scanning doesn't use PICC_IsNewCardPresent () directly because when there is no card it busy waits on the
+   MFRC522 timer (~25ms) every call. Instead we arm a REQA and come back later to check ComIrqReg for RxIRq.
+   If READER_IRQ_PIN is wired the same RxIRq also drives the IRQ pin so readerTask can sleep until it fires.
 */
+void readerIrqInit (byte station){
+  if (stationConfigs[station].irqPin >= 0){
+    pinMode(stationConfigs[station].irqPin, INPUT_PULLUP);
+    readers[station].PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0); // IRqInv (IRQ pin active low) | RxIEn, only a received frame raises the pin
+  }
+}
 
-extern void collPolling (metaStruct *progParams, TaskHandle_t *blinkLEDHandle0, TaskHandle_t *blinkLEDHandle1, EventGroupHandle_t *rfidStatesGroup, TaskHandle_t *pollNewHandle){
-// When an additional card has entered the field in addition to a previously halted card repeated calls of 
-// IsNewCard will produce a pattern of 0101 telling us we have a collision.
+/* Transmits a REQA and leaves the receiver listening. Any PICC in the field that isn't halted will answer with its
+   ATQA, setting RxIRq in ComIrqReg. Three register writes, no waiting.
+*/
+void readerArm (byte station){
+  MFRC522 *reader = &readers[station];
+  reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);   // Stop anything in progress
+  reader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);                 // Clear all the IRQ bits
+  reader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);              // Flush the FIFO
+  reader->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+  reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+  reader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);             // StartSend, REQA is a 7 bit short frame
+}
+
+// Did anything answer the REQA sent by readerArm ()
+bool readerArmedHit (byte station){
+  return (readers[station].PCD_ReadRegister(MFRC522::ComIrqReg) & 0x20) != 0; // RxIRq
+}
 
-for (int i = 0; i < 4; i++){ 
-  Serial.println("--");
-  if (mfrc522.PICC_IsNewCardPresent()){ // Any more than 1 and we have a collision or a misaligned card
-    //inc counter
-  //++(progParams->card.collCounter);
-  (progParams->card.collCounter)++;
+/* piccLink over an MFRC522, see picc-scan.h. PCD_TransceiveData () already speaks in RxAlign and last byte bits, this
+   just turns its answer into bit counts and reads CollReg on a collision.
+*/
+static readerStats stats;
+
+static byte mfrcTransceive (void *ctx, const byte *send, byte sendBits, byte *back, byte backMax, byte *backBits, byte *collBit){
+  MFRC522 *reader = (MFRC522*)ctx;
+  byte len = backMax;
+  byte lastBits = sendBits % 8; // In: bits of the last byte to send, 0 is all 8. Out: bits of the last byte received
+  byte rxAlign = (sendBits > 8) ? sendBits % 8 : 0; // REQA/WUPA are 7 bit short frames, their answer isn't aligned
+
+  stats.frames++;
+  MFRC522::StatusCode s = reader->PCD_TransceiveData((byte*)send, (sendBits + 7) / 8, back, &len, &lastBits, rxAlign, false);
+  if (s == MFRC522::STATUS_TIMEOUT){
+    return PICC_TIMEOUT;
   }
-  else{
-    // Do nothing
+  if (s != MFRC522::STATUS_OK && s != MFRC522::STATUS_COLLISION){
+    return PICC_ERROR;
   }
-}
-// Note on the counter: for the life of me I can't figure out what I can't make the counter a member of the card Struct and have this function behave properly
-  if (progParams->card.collCounter >= 2){
-    // We have a collision
-    // GOTO state TIMEOUT
-    xEventGroupClearBits(*rfidStatesGroup, CARD_BIT_0|AUTH_BIT_1); // Revoke card and authorization bits
-    Serial.println("Collision!");
-
-    // Blink purple lights to indicated collision detected
-    progParams->LEDParams0.myColour = CRGB::Purple;
-    progParams->LEDParams1.myColour = CRGB::Purple;
-    progParams->LEDParams0.blink = 1;
-    progParams->LEDParams1.blink = 1;
-    
-    // Resume our LED blinking
-    vTaskResume(*blinkLEDHandle0); 
-    vTaskResume(*blinkLEDHandle1);
-    
-    //mfrc522.PICC_HaltA(); // Halt the offending cards
-    //mfrc522.PICC_HaltA(); // Halt the offending cards
-
-    //vTaskResume(*pollNewHandle);
-
-    // This should be last so that the Timeout Task doesn't unblock until we're done twidling flags and LEDParams
-    xEventGroupSetBits(*rfidStatesGroup, TIMEOUT_BIT_3|COLL_BIT_4); // Set Timeout and collision bits as last action as this unblocks the timeout task
+  *backBits = (len == 0) ? 0 : (len - 1) * 8 + (lastBits ? lastBits : 8);
+  if (s == MFRC522::STATUS_COLLISION){
+    byte coll = reader->PCD_ReadRegister(MFRC522::CollReg);
+    if (coll & 0x20){ // CollPosNotValid, somewhere past what it can count
+      return PICC_ERROR;
+    }
+    *collBit = ((coll & 0x1F) ? (coll & 0x1F) : 32) - 1; // 1-32, 0 meaning 32
+    return PICC_COLLISION;
   }
-  else{ // No collision
-    Serial.println("No collision");
-    
-    // This could possibly be an issue
-    //xEventGroupClearBits(*rfidStatesGroup, COLL_BIT_4); // We can revoke the collision flag if it was previously set because the offending card has been removed
+  return PICC_OK;
+}
+
+/* PCD_Init () leaves the MFRC522's timer at 25ms, which is how long every frame nobody answers holds the bus.
+   A PICC answers within ~100us, so scans run with READER_SCAN_TIMEOUT and put it back after for the library's own calls.
+*/
+static void scanTimer (MFRC522 *reader, uint16_t ticks){
+  reader->PCD_WriteRegister(MFRC522::TReloadRegH, ticks >> 8);
+  reader->PCD_WriteRegister(MFRC522::TReloadRegL, ticks & 0xFF);
+}
+
+/* Select of a new card. Fills uid and halts the card so it won't answer REQA again.
+   Returns false if nothing (or nothing readable) is there.
+*/
+bool readerNewCard (byte station, uidType *uid){
+  MFRC522 *reader = &readers[station];
+  piccLink link = {reader, mfrcTransceive};
+  byte atqa[2];
+  byte size = sizeof(atqa);
+
+  reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle); // Leave the armed REQA behind
+  scanTimer(reader, READER_SCAN_TIMEOUT);
+  // The card answered our REQA so it is already READY, go straight to anticollision/select
+  bool read = piccReadReady(&link, uid);
+  if (!read){ // It may have dropped back to IDLE, give it one full request before giving up
+    read = (reader->PICC_RequestA(atqa, &size) != MFRC522::STATUS_TIMEOUT) && piccReadReady(&link, uid);
   }
-progParams->card.collCounter = 0;
+  scanTimer(reader, READER_LIB_TIMEOUT);
+  return read;
 }
 
-/* Polls the RFID card read for the continued presence of a card.
-It works based on only Halted cards responded to the WakeupA () command
+/* Every PICC in the field, halted ones included, by UID (see picc-scan.cpp). What readerTask checks the card in
+   session against: gone if nothing answered, a collision if more than one card did. Each card found is left halted.
 */
-void pollPres (metaStruct *progParams, EventGroupHandle_t *rfidStatesGroup, TaskHandle_t *blinkLEDHandle0, TaskHandle_t *blinkLEDHandle1, TaskHandle_t *pollNewHandle) {
-
-  Serial.println("Welcome to presence polling");
-
-  EventBits_t uxBits;
-  byte bufferATQA[2];
-  byte bufferSize = sizeof(bufferATQA);
-  byte resultWake;
-  byte resultReq;
-
-// Reset baud rates
-	mfrc522.PCD_WriteRegister(mfrc522.TxModeReg, 0x00);
-	mfrc522.PCD_WriteRegister(mfrc522.RxModeReg, 0x00);
-	// Reset ModWidthReg
-	mfrc522.PCD_WriteRegister(mfrc522.ModWidthReg, 0x26);
-
-  resultWake = mfrc522.PICC_WakeupA (bufferATQA, &bufferSize);
- 
-  // Old implenetation - is broken by collisions, therefore must ensure it only occurs in state1Card
-  
-  if (resultWake == 0) { // STATUS_OK == 0 tells us our card is still there
-    mfrc522.PICC_HaltA(); // Re-halt the card after successful Wakeup otherwise we will unnecessarily reread the UID
+void readerScan (byte station, piccScanResult *result){
+  MFRC522 *reader = &readers[station];
+  piccLink link = {reader, mfrcTransceive};
+
+  scanTimer(reader, READER_SCAN_TIMEOUT);
+  piccScan(&link, result);
+  scanTimer(reader, READER_LIB_TIMEOUT);
+}
+
+// readerTask's bus time, busyUs covers all SPI traffic
+void readerBusBusy (uint32_t us){
+  stats.busyUs += us;
+  stats.cycles++;
+}
+
+readerStats * readerGetStats (){
+  return &stats;
+}
+
+/////////////////////////////////////////  Relay Functions   ///////////////////////////////////
+
+/* Every change to a relay goes through here, nothing else writes a station's relayPin.
+   Keeps the hardware behind one call (so it can be swapped for a fake off target) and remembers when it last
+   changed so the time any state change took to reach the relay can be measured against it.
+   relayTrip () is the eStop's way round that: straight from the ISR, every relay pin low in two register writes.
+   Everything it touches is in IRAM/DRAM (stationConfigs[] is in flash, hence the masks) so it is safe while the
+   flash cache is off. The latch keeps accessTask from closing a relay again before the state machine hears about it.
+   The relay pins have their input buffer on as well, so relayAllOpen () reads what the pads are doing rather than
+   what we last wrote, and the eStop can tell a relay that didn't open from one that did.
+*/
+static volatile bool relayClosed[STATION_COUNT];
+static volatile uint32_t relayStamp[STATION_COUNT];
+static volatile bool relayTripped = 0;
+static uint32_t relayMaskLow = 0;   // Relay pins 0-31, GPIO.out_w1tc
+static uint32_t relayMaskHigh = 0;  // Relay pins 32 and 33, GPIO.out1_w1tc
+static portMUX_TYPE relayMux = portMUX_INITIALIZER_UNLOCKED;
+
+void relayInit (){
+  for (byte i = 0; i < STATION_COUNT; i++){
+    pinMode(stationConfigs[i].relayPin, OUTPUT);
+    gpio_set_direction((gpio_num_t)stationConfigs[i].relayPin, GPIO_MODE_INPUT_OUTPUT); // Still driven, now readable too
+    relaySet(i, 0);
+    if (stationConfigs[i].relayPin < 32){
+      relayMaskLow |= (1UL << stationConfigs[i].relayPin);
+    }
+    else{
+      relayMaskHigh |= (1UL << (stationConfigs[i].relayPin - 32));
+    }
   }
-  else{ //Did not recieve STATUS_OK from WakeupA therefore the card is gone
-    
-    //*cardFlag = 0; // Change the flag state so that polling for continue card presence will cease
-    xEventGroupClearBits(*rfidStatesGroup, CARD_BIT_0 | AUTH_BIT_1); // Clear the card and auth bit
-    //vTaskResume()
-
-    //Creat blink task?
-    // Set both LEDS to Green
-    progParams->LEDParams0.myColour = CRGB::Blue; 
-    progParams->LEDParams1.myColour = CRGB::Blue;
-    // Set both LEDs to not blink
-    progParams->LEDParams0.blink = 1;
-    progParams->LEDParams1.blink = 1;
-    // Now resume the blink tasks
-    vTaskResume(*blinkLEDHandle0); 
-    vTaskResume(*blinkLEDHandle1);
-    
-    // Initiate timeout via setting TIMEOUT_BIT_3 to unblock timeout task
-    xEventGroupSetBits(*rfidStatesGroup, TIMEOUT_BIT_3);
-    
-    //vTaskResume(*pollNewHandle);
-    
-    // Is this actually needed?
-    mfrc522.PICC_WakeupA (bufferATQA, &bufferSize); // This is needed incase a second card was introduced creating a false timeout. Should force reauth on exit?
+}
+
+void relaySet (byte station, bool closed){
+  portENTER_CRITICAL(&relayMux); // So a trip can't land between the latch check and the write
+  closed = closed && !relayTripped;
+  digitalWrite(stationConfigs[station].relayPin, closed ? HIGH : LOW);
+  relayClosed[station] = closed;
+  relayStamp[station] = micros();
+  portEXIT_CRITICAL(&relayMux);
+}
+
+bool IRAM_ATTR relayTrip (){
+  portENTER_CRITICAL_ISR(&relayMux);
+  GPIO.out_w1tc = relayMaskLow;
+  GPIO.out1_w1tc.val = relayMaskHigh;
+  bool first = !relayTripped;
+  relayTripped = 1;
+  uint32_t now = micros();
+  for (byte i = 0; i < STATION_COUNT; i++){
+    relayClosed[i] = 0;
+    relayStamp[i] = now;
   }
-  
+  portEXIT_CRITICAL_ISR(&relayMux);
+  return first;
+}
+
+bool IRAM_ATTR relayAllOpen (){
+  return (GPIO.in & relayMaskLow) == 0 && (GPIO.in1.data & relayMaskHigh) == 0;
+}
+
+void relayTripClear (){
+  portENTER_CRITICAL(&relayMux);
+  relayTripped = 0;
+  portEXIT_CRITICAL(&relayMux);
+}
+
+bool relayIsClosed (byte station){
+  return relayClosed[station];
+}
+
+uint32_t relayLastChange (byte station){
+  return relayStamp[station];
 }
 
 /////////////////////////////////////////  Data Wrangling Functions   ///////////////////////////////////
@@ -217,7 +320,7 @@ void byteToHexStr(byte * in, size_t insz, char * out, size_t outsz){
     pOut[1] = hex[ *pIn     & 0xF];
     //Serial.println(pOut[0]);
     pOut[2] = ':';
-    if (pOut + 3 - out > outsz) {
+    if ((size_t)(pOut + 3 - out) > outsz) {
       /* Better to truncate output string than overflow buffer */
       /* it would be still better to either return a status */
       /* or ensure the target buffer is large enough and it never happen */
@@ -229,37 +332,7 @@ void byteToHexStr(byte * in, size_t insz, char * out, size_t outsz){
 
 /////////////////////////////////////////  SPIFFS Functions   ///////////////////////////////////
 
-// Separate SPIFFS init function?
-// May not want to mount SPIFFS unless necessary
-
-void writeLog (metaStruct *progParams){
-
-// deleteFile(SPIFFS, "/test.txt");
-
-// Debugging 
-//listDir(SPIFFS, "/", 0); // Print directory list to Serial
-
-// Check for log file
-// If exists append
-// Check if log file exists
-if (SPIFFS.exists("/uidLogs")){ // Log file exists
-  appendFile (SPIFFS, "/uidLogs", progParams->card.uidStr);
-}
-// If doesn't exist then write
-else if (!SPIFFS.exists("/uidLogs")){ // Log file does not exist
-  writeFile (SPIFFS, "/uidLogs", progParams->card.uidStr); // Create log file and open file in write mode (we need not worry about overwriting)
-}
-
-// testFileIO (SPIFFS, "/uidLogs.txt");
-readFile(SPIFFS, "/uidLogs.txt"); // Read out the log you just wrote (function writes to Serial)
-
-
-// Read file for debugging purposes
-
-file.close();
-
-}
-
+// Access logging lives in access-log.cpp, the helpers below are for poking at SPIFFS from the Serial console
 
 // Very helpful code for interacting with SPIFFS https://gist.github.com/xxlukas42/fc0135639fcc1fc61c8b2a25649be59d
 // Originally found via youtube: https://www.youtube.com/watch?reload=9&v=v-7TI3kWntw
@@ -1,38 +1,100 @@
-#ifndef tool-access-RTOS_H    // Put these two lines at the top of your file.
-#define tool-access-RTOS_H    // (Use a suitable name, usually based on the file name.)
+#ifndef TOOL_ACCESS_RTOS_H    // Put these two lines at the top of your file.
+#define TOOL_ACCESS_RTOS_H    // (Use a suitable name, usually based on the file name.)
+
+#include "uid.h"
+#include "picc-scan.h"
 
 // Hardware defines
 #define RST_PIN         22          // Configurable, see typical pin layout above
 #define SS_PIN          21         // Configurable, see typical pin layout above
 #define RELAY_PIN       17         // GPIO pin wired to a BC337 transistor that triggers relay coil
 #define LEDATA_PIN 32             // WS2812 LEDs data pin is wired to pin 32 through a 330Ohm resistor
-#define NUM_LEDS 2                // # of LEDs in our daisy chain
+#ifndef READER_IRQ_PIN
+#define READER_IRQ_PIN  -1         // MFRC522 IRQ pin, -1 if not wired (readerTask then checks ComIrqReg itself)
+#endif
+#ifndef ESTOP_PIN
+#define ESTOP_PIN       -1         // Local eStop, normally closed switch to GND so a press or a cut wire reads HIGH. -1 if not wired. 34-39 need an external pull-up
+#endif
+#ifndef NUM_LEDS
+#define NUM_LEDS 2                // # of LEDs in our daisy chain, every station's LEDs together
+#endif
+
+// Stations, one per tool this board gates. The pins above are station 0's, the rest are in stationConfigs[] (tool-access-RTOS.cpp)
+#ifndef STATION_COUNT
+#define STATION_COUNT   1          // Rows in stationConfigs[], up to STATION_MAX
+#endif
+#define STATION_MAX     8          // Station numbers are packed 4 bits at a time in places (access log flags, metrics)
+#define STATION_ALL     0xFF       // accessPost () to every station at once (network and eStop events)
+
+/* Task placement. WiFi, lwIP and AsyncTCP live on core 0, so everything that talks to the network or flash goes there
+   too and core 1 is left to the readers, the state machine and the relay. The two sides only meet through lock-free
+   rings (lf-ring.h) so a slow broker or a flash write never holds up a tap. Build AsyncTCP with
+   -DCONFIG_ASYNC_TCP_RUNNING_CORE=0, its default of "any core" would let the MQTT callbacks land on core 1.
+*/
+#define CORE_NET          0
+#ifndef CORE_RF
+#define CORE_RF           1          // -DCORE_RF=0 runs everything on core 0, tools/core-split-bench.cpp compares the two
+#endif
+#define PRIO_ESTOP        6          // Highest of ours, only runs for the moment after an eStop. Still below WiFi/lwIP, which are on the other core anyway
+#define PRIO_ACCESS       5          // Runs the relay
+#define PRIO_READER       4
+#define PRIO_LED          2
+#define PRIO_OUTBOX       2          // Above the logs so a req isn't stuck behind a flash write
+#define PRIO_ACCESS_LOG   1
+#define PRIO_BACKGROUND   tskIDLE_PRIORITY // dlogTask and metricsTask, only get time nothing else wanted
+
+/* Task stacks in bytes (StackType_t is a byte on the ESP32). Every task is created static (see setup ()), these are
+   .bss and nothing of ours comes out of the heap after boot. Each task's headroom goes out with the metrics,
+   tools/ram-budget.py --snapshot says what each could be trimmed to.
+   These are still starting values, not sized off a board. Beside each is the most the host harness (tools/host) saw
+   used over every tool's run. Only a rough guide: those are x86-64 frames and glibc, not Xtensa and newlib, and a few
+   are over their define on the host alone. Size them off ram-budget.py --snapshot from a board that has been up
+   through a member sync, an outage and a flash log rollover.
+*/
+#define STACK_ESTOP       2048       // harness 216
+#define STACK_LED         2048       // harness 328. FastLED's RMT driver
+#define STACK_ACCESS      3072       // harness 3320
+#define STACK_READER      3072       // harness 2608. MFRC522 library plus picc-scan's pending branches
+#define STACK_DLOG        3072       // harness 2392. snprintf of a line, SPIFFS writes
+#define STACK_METRICS     2048       // harness 1144. Snapshot buffer is static
+#define STACK_MEMBER_SYNC 3072       // harness 2208. Flash erase and merge, buffers are static
+#define STACK_WARM_STATE  2048       // harness 3576. NVS writes, blobs are static
+#define STACK_OUTBOX      3072       // harness 3608
+#define STACK_ACCESS_LOG  3072       // harness 4408. A batch of records on the stack
 
 //Timing defines
 #define MS_WIFI_RECONNECT_PERIOD pdMS_TO_TICKS(2000) // Wifi reconnect time in ms converted to RTOS ticks
 #define MS_MQTT_RECONNECT_PERIOD pdMS_TO_TICKS(2000) // MQTT reconnect time in ms converted to RTOS ticks
-#define MS_POLL_TIMER_PERIOD pdMS_TO_TICKS(1000) // RFID module polling frequency converted to RTOS ticks
+#define MS_READER_FAST_PERIOD pdMS_TO_TICKS(30) // Reader polling period right after activity at the reader
+#define MS_READER_IDLE_PERIOD pdMS_TO_TICKS(250) // Reader polling period we back off to when idle
+#define MS_READER_PRESENT_PERIOD pdMS_TO_TICKS(100) // Presence/collision check period while a card is in session
+#define READER_ACTIVE_WINDOW 10000 // ms after the last activity that we keep polling at the fast period
+#define READER_STATS_PERIOD 60000 // ms between printing latency stats
 #define MS_TIMEOUT_PERIOD pdMS_TO_TICKS(60000) // ms_timeOut after card removal
 #define COLL_TIMEOUT_PERIOD pdMS_TO_TICKS(2000) // timeout when collision is detected
-#define LEDBLINK_PERIOD pdMS_TO_TICKS(10000) // Blink period for temporary blinking
+#define READER_SCAN_TIMEOUT 40 // MFRC522 timer ticks (25us each as PCD_Init sets the prescaler) to wait on a PICC during a scan, 1ms
+#define READER_LIB_TIMEOUT  1000 // What PCD_Init sets it to (25ms), put back for the library's own calls
 
 // MQTT defines
 //#define MQTT_HOST IPAddress(10, 1, 2, 123)
 #define MQTT_HOST IPAddress(192, 168, 1, 26)
 #define MQTT_PORT 1883
+#define NTP_SERVER "pool.ntp.org" // Sets the clock, access log records are stamped with it once it's set
+
+// What one station is wired to. Readers share the SPI bus (own SS each), relays and LED ranges are the station's own
+typedef struct {
+  byte ssPin;
+  byte rstPin;      // Can be shared between readers
+  byte relayPin;
+  int8_t irqPin;    // -1 if not wired
+  byte firstLed;    // This station's LEDs are leds[firstLed] .. leds[firstLed + ledCount - 1]
+  byte ledCount;
+} stationConfig;
 
-// Event group macros
-#define CARD_BIT_0 ( 1 << 0 )         // 1's
-#define AUTH_BIT_1 ( 1 << 1 )         // 2's
-#define RELAY_BIT_2 ( 1 << 2 )        // 4's
-#define TIMEOUT_BIT_3 ( 1 << 3 )      // 8's
-#define COLL_BIT_4 ( 1 << 4 )         // 16's
-#define ESTOPFIRE_BIT_5 ( 1 << 5 )    // 32's
-#define ESTOPCLEAR_BIT_6 ( 1 << 6 )   // 64's
-#define WIFIOUT_BIT_7 ( 1 << 7 )      // 128's
+extern const stationConfig stationConfigs[STATION_COUNT];
 
-// MFRC522 instantiation
-extern MFRC522 mfrc522;
+// MFRC522 instantiation, one per station
+extern MFRC522 readers[STATION_COUNT];
 
 //SPIFFS instantiation
 extern File file;
@@ -42,42 +104,51 @@ extern CRGB leds[];
 
 // Structs
 typedef struct {       // Struct for data to be logged
-  // These may be depreciated
-  byte uid_buffer[31]; // Holds UID read out of MFRC522 library
-  byte uid_length;     // Holds size of uid_buffer
+  uidType uid;         // Binary UID read out of MFRC522 library, this is what lookups are done on
   // Holds the string version of the uid byte living in the mfrc522 struct
   size_t uidStrLen; // Holds the length (not size) of uidStr
   char uidStr[31]; // Biggest possible UID is 10bytes * 3 (because we : separate, eg. 0xFF:etc) + 1 (NULL) = 31
-  // Counter used in detecting card collisions 
-  char collCounter;     
+  uint32_t sessionStart; // millis() when the relay closed, used for the session duration in the access log
+  uint32_t tapStamp;     // micros() when readerTask selected the card, for tap-to-relay latency
+  uint32_t removedStamp; // micros() when readerTask saw the card go, for removal-to-timeout latency
 }cardParams;
 
-typedef struct{ // Stuct for passing desired LED params
-  int led;            // Which LED
-  int blinkPeriod;    // Period of the LED blinking, specified in milliseconds
-  bool blink;         // To blink or not to blink?
-  bool blinkTemp;     // Do we want our blink to be temporary
-  CRGB myColour;      // What colour to be
-} LEDParams;
+typedef struct { // Reader bus counters
+  uint32_t cycles;    // Poll cycles run
+  uint32_t busyUs;    // Total us spent on the bus
+  uint32_t frames;    // RF frames sent by scans and card reads
+} readerStats;
 
 typedef struct{
-  LEDParams LEDParams0; // Parameters for LED0
-  LEDParams LEDParams1;  // Parameters for LED1
+  byte station;         // Index into stationConfigs[]
   cardParams card;      // Holds info about read card
 } metaStruct;
 
 
 //Initialization
 extern void toolAccessInit (); // Carries out initialization of various peripherals and WiFi
+extern bool storageInit (); // Mounts SPIFFS, after the readers are up
 
 //RFID Functions
-//extern uint8_t userID(byte buffer[], byte *size, byte value[], byte sizeBuff); // Prints out UID stored in mfrc522.uid.uid struct. Card must have been read by PICC_Select OR PICC_ReadCardSerial
-extern uint8_t userID(metaStruct *progParams, byte value[], byte sizeBuff); // Prints out UID stored in mfrc522.uid.uid struct. Card must have been read by PICC_Select OR PICC_ReadCardSerial
-extern void pollPres (metaStruct *progParams, EventGroupHandle_t *rfidStatesGroup, TaskHandle_t *blinkLEDHandle0, TaskHandle_t *blinkLEDHandle1, TaskHandle_t *pollNewHandle); // Polls for continued card presence at reader
-extern void collPolling (metaStruct *progParams, TaskHandle_t *blinkLEDHandle0, TaskHandle_t *blinkLEDHandle1, EventGroupHandle_t *rfidStatesGroup, TaskHandle_t *pollNewHandle);
+extern void readerIrqInit (byte station); // Routes RxIRq to the IRQ pin if the station's irqPin is wired
+extern void readerBusBusy (uint32_t us); // Adds a poll cycle's bus time to the stats
+extern readerStats * readerGetStats ();
+extern void readerArm (byte station); // Sends a REQA without waiting for the answer
+extern bool readerArmedHit (byte station); // Did a card answer the last readerArm ()
+extern bool readerNewCard (byte station, uidType *uid); // Selects, reads and halts a new card
+extern void readerScan (byte station, piccScanResult *result); // Every card in the field by UID, for presence and collisions
 extern bool isitTime (uint32_t *timeNow, uint32_t *timeLast, uint32_t interval); // Returns boolean for if a time interval has elapsed
-extern bool checkTwo ( byte a[], byte b[]); // Compares two byte arrays and returns result as bool
-extern bool isAllowed( byte test[]); 
+extern bool checkTwo (const uidType *a, const uidType *b); // Compares two UIDs and returns result as bool
+extern bool isAllowed (byte station, const uidType *test); // Is the UID in the member index for this station
+
+//Relay functions
+extern void relayInit (); // Every station's relay pin to an output, open
+extern void relaySet (byte station, bool closed); // Only way a relay gets switched, true closes it (tool powered). Won't close while tripped
+extern bool relayTrip (); // Opens every relay and latches them open, from an ISR or a task. True if they weren't already tripped
+extern void relayTripClear (); // Lets relaySet () close them again, accessTask on an eStop clear
+extern bool relayAllOpen (); // Every relay pin reads back low at the pad, from an ISR or a task
+extern bool relayIsClosed (byte station);
+extern uint32_t relayLastChange (byte station); // micros() of the station's last relaySet ()
 
 //LED functions
 extern void LEDInit ();
@@ -93,7 +164,6 @@ extern void structReset ();
 void byteToHexStr(byte * in, size_t insz, char * out, size_t outsz);
 
 //SPIFFS Functions
-extern void writeLog (metaStruct *progParams); // Take pointer to interger of UID previous read and writes it to uigLog.txt in SPIFFS partion
 extern void listDir(fs::FS &fs, const char * dirname, uint8_t levels);
 extern void readFile(fs::FS &fs, const char * path);
 extern void writeFile(fs::FS &fs, const char * path, const char * message);
@@ -102,4 +172,4 @@ extern void appendFile(fs::FS &fs, const char * path, const char * message);
 extern void appendFile(fs::FS &fs, const char * path, const int number, int base);
 extern void renameFile(fs::FS &fs, const char * path1, const char * path2);
 extern void deleteFile(fs::FS &fs, const char * path);
-#endif // tool-access-RTOS_H    // Put this line at the end of your file.
+#endif // TOOL_ACCESS_RTOS_H    // Put this line at the end of your file.
@@ -5,38 +5,63 @@
 #include <SPIFFS.h>
 #include <AsyncMqttClient.h>
 #include "tool-access-RTOS.h"
+#include "auth-cache.h"
+#include "member-index.h"
+#include "member-list.h"
+#include "member-sync.h"
+#include "access-log.h"
+#include "outbox.h"
+#include "access-fsm.h"
+#include "led-engine.h"
+#include "mqtt-dispatch.h"
+#include "debug-log.h"
+#include "metrics.h"
+#include "warm-state.h"
+#include "estop.h"
 #include "credentials.h"
 
 AsyncMqttClient mqttClient;
 
 // Task Handlers
-TaskHandle_t blinkLEDHandle0;
-TaskHandle_t blinkLEDHandle1;
+TaskHandle_t ledHandle;
 TaskHandle_t basicTaskHandle;
-TaskHandle_t closeRelayHandle;
-TaskHandle_t pollPresHandle;
-TaskHandle_t pollNewHandle;
-TaskHandle_t collPollHandle;
-TaskHandle_t timeoutHandle;
-TaskHandle_t eStopFireHandle;
-TaskHandle_t eStopClearHandle;
+TaskHandle_t accessHandle;
+TaskHandle_t readerHandle;
+TaskHandle_t accessLogHandle;
+TaskHandle_t outboxHandle;
+TaskHandle_t dlogHandle;
+TaskHandle_t metricsHandle;
+TaskHandle_t memberSyncHandle;
+TaskHandle_t warmStateHandle;
+TaskHandle_t estopHandle;
 
 // Timer Handlers
 TimerHandle_t mqttReconnectTimer;
 TimerHandle_t wifiReconnectTimer;
-TimerHandle_t LEDblinkTimer;
-
-// Event Group Handlers
-EventGroupHandle_t rfidStatesGroup;
-
-// Semaphore/Mutex Handlers
-SemaphoreHandle_t SPIMutexHandle;
+static StaticTimer_t mqttTimerBuf;
+static StaticTimer_t wifiTimerBuf;
 
+/* Every task's stack and TCB. Static, so they're counted at link time (tools/ram-budget.py) and the heap is left to
+   WiFi, lwIP and AsyncMqttClient. Named <task>Stack so the budget report can match them to the metrics' headroom.
+*/
+#define STATIC_TASK(name, bytes) static StackType_t name##Stack[bytes]; static StaticTask_t name##Tcb
+STATIC_TASK(estopTask, STACK_ESTOP);
+STATIC_TASK(ledTask, STACK_LED);
+STATIC_TASK(accessTask, STACK_ACCESS);
+STATIC_TASK(readerTask, STACK_READER);
+STATIC_TASK(dlogTask, STACK_DLOG);
+STATIC_TASK(metricsTask, STACK_METRICS);
+STATIC_TASK(memberSyncTask, STACK_MEMBER_SYNC);
+STATIC_TASK(warmStateTask, STACK_WARM_STATE);
+STATIC_TASK(outboxTask, STACK_OUTBOX);
+STATIC_TASK(accessLogTask, STACK_ACCESS_LOG);
+
+static metaStruct progParams[STATION_COUNT]; // One metaStuct per station, holds the card in session there. accessTask and readerTask keep pointers into it
 
 /////////////////////////////////////////  WiFi Tasks   ///////////////////////////////////
 
  void connectToWifi() {
-  Serial.println("Connecting to Wi-Fi...");
+  DLOG_INFO("Connecting to Wi-Fi...");
   
   //Correct credentials
   WiFi.begin(SSID, PASS); // Must create own credentials.h with appropriate #defines for SSID and PASS
@@ -47,28 +72,66 @@ SemaphoreHandle_t SPIMutexHandle;
 
 
 void connectToMqtt() {
-  Serial.println("Connecting to MQTT...");  
+  DLOG_INFO("Connecting to MQTT...");
   mqttClient.connect();
 }
 
+/* Everything session related goes out through the outbox (see outbox.cpp), this is how it reaches the broker.
+   QoS 1 so we get an onMqttPublish ack to clear the event with. BE VERY CAREFUL TO NOT SET THE RETAIN FLAG
+*/
+uint16_t mqttPublish(const char *topic, const char *payload) {
+  return mqttClient.publish(topic, 1, false, payload);
+}
+
+/* dlogTask's MQTT sink. QoS 0, debug lines aren't worth an ack (and the outbox would be handed acks it never asked for)
+*/
+uint16_t mqttPublishDebug(const char *topic, const char *payload) {
+  if (!mqttClient.connected()) {
+    return 0;
+  }
+  return mqttClient.publish(topic, 0, false, payload);
+}
+
+/* metricsTask's snapshots. Binary, so the length goes with it. QoS 0 for the same reason as the debug log, the counters
+   in it are totals so the next one makes up for a lost one
+*/
+uint16_t mqttPublishMetrics(const char *topic, const uint8_t *payload, size_t len) {
+  if (!mqttClient.connected()) {
+    return 0;
+  }
+  return mqttClient.publish(topic, 0, false, (const char*)payload, len);
+}
+
+/* memberSyncTask's "which version have we got" announcements. QoS 0, it says it again on the next connect or change
+*/
+uint16_t mqttPublishMembers(const char *topic, const char *payload) {
+  if (!mqttClient.connected()) {
+    return 0;
+  }
+  return mqttClient.publish(topic, 0, false, payload);
+}
+
 void WiFiEvent(WiFiEvent_t event) {
-    Serial.printf("[WiFi-event] event: %d\n", event);
+    DLOG_DEBUG("[WiFi-event] event: %d", event);
     switch(event) {
     case SYSTEM_EVENT_STA_GOT_IP:
-        Serial.println("WiFi connected");
-        Serial.println("IP address: ");
-        Serial.println(WiFi.localIP());
-        connectToMqtt();
-        // Clear the WiFi outage bit
-        xEventGroupClearBits(rfidStatesGroup, WIFIOUT_BIT_7);
+        {
+          IPAddress ip = WiFi.localIP();
+          DLOG_INFO("WiFi connected, IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        }
+        metricsBootMark(BOOT_WIFI);
+        configTime(0, 0, NTP_SERVER); // UTC, SNTP sets the clock in the background and keeps it there
+        connectToMqtt(); // Still an outage as far as the state machine goes until MQTT connects
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
-        Serial.println("WiFi lost connection");
+        DLOG_WARN("WiFi lost connection");
+        metricCount(CTR_WIFI_DROPS);
         xTimerStop(mqttReconnectTimer, 0); // ensure we don't reconnect to MQTT while reconnecting to Wi-Fi
 		    xTimerStart(wifiReconnectTimer, 0); // Start wifiReconnectTimer immediately
 
-        // Set WiFi outage bit to change our authorization scheme
-        xEventGroupSetBits(rfidStatesGroup, WIFIOUT_BIT_7);
+        accessPost(STATION_ALL, EV_NET_DOWN, NULL); // Changes our authorization scheme
+        break;
+    default: // Everything else the WiFi driver reports, nothing to do
         break;
     }
 }
@@ -76,640 +139,346 @@ void WiFiEvent(WiFiEvent_t event) {
 /////////////////////////////////////////  MQTT Tasks   ///////////////////////////////////
 
 void onMqttConnect(bool sessionPresent) {
-  Serial.println("Connected to MQTT.");
-  Serial.print("Session present: ");
-  Serial.println(sessionPresent);
-  xEventGroupClearBits(rfidStatesGroup, WIFIOUT_BIT_7); // We've established connection to MQTT now clear the outtage bit
+  DLOG_INFO("Connected to MQTT. Session present: %d", sessionPresent);
+  metricCount(CTR_MQTT_CONNECTS);
+  metricsBootMark(BOOT_MQTT);
+  accessPost(STATION_ALL, EV_NET_UP, NULL); // We've established connection to MQTT, back to asking the server
+  outboxConnected(1); // Start draining anything we held onto during the outage
 
-  // Sub to the rfid topic
-  uint16_t packetIdSub2 = mqttClient.subscribe("rfid/auth/rsp", 2);
-  Serial.print("Subscribing at QoS 2, packetId: ");
-  Serial.println(packetIdSub2);
+  // Sub to the rfid topic, onMqttSubscribe logs the acks
+  mqttClient.subscribe("rfid/auth/rsp", 2);
 
   // Sub to the estop topic
-  uint16_t packetIdSub3 = mqttClient.subscribe("rfid/estop", 2);
-  Serial.print("Subscribing at QoS 2, packetId: ");
-  Serial.println(packetIdSub3);
+  mqttClient.subscribe("rfid/estop", 2);
+
+  // Sub to our member list, then tell the server what version we have so it only sends what changed
+  mqttClient.subscribe(memberSyncTopic(), 1);
+  memberSyncAnnounce();
 }
 
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
-  Serial.println("Disconnected from MQTT.");
-  xEventGroupSetBits(rfidStatesGroup, WIFIOUT_BIT_7); // Can't connect to MQTT, set the outage bit to change auth scheme
+  DLOG_WARN("Disconnected from MQTT.");
+  metricCount(CTR_MQTT_DROPS);
+  accessPost(STATION_ALL, EV_NET_DOWN, NULL); // Can't connect to MQTT, change auth scheme
+  outboxConnected(0); // Hold events until we're back
   if (WiFi.isConnected()) {
     xTimerStart(mqttReconnectTimer, 0); // We're back on the WiFi time to start trying to reconnect to MQTT broker
   }
 }
 
 void onMqttSubscribe(uint16_t packetId, uint8_t qos) {
-  Serial.println("Subscribe acknowledged.");
-  Serial.print("  packetId: ");
-  Serial.println(packetId);
-  Serial.print("  qos: ");
-  Serial.println(qos);
+  DLOG_DEBUG("Subscribe acknowledged. packetId: %u qos: %u", packetId, qos);
 }
 
 void onMqttUnsubscribe(uint16_t packetId) {
-  Serial.println("Unsubscribe acknowledged.");
-  Serial.print("  packetId: ");
-  Serial.println(packetId);
+  DLOG_DEBUG("Unsubscribe acknowledged. packetId: %u", packetId);
 }
 
-void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
-
-  Serial.println("Publish received.");
-  Serial.print("  topic: ");
-  Serial.println(topic);
-  Serial.print("  qos: ");
-  Serial.println(properties.qos);
-  Serial.print("  dup: ");
-  Serial.println(properties.dup);
-  Serial.print("  retain: ");
-  Serial.println(properties.retain);
-  Serial.print("  len: ");
-  Serial.println(len);
-  Serial.print("  index: ");
-  Serial.println(index);
-  Serial.print("  total: ");
-  Serial.println(total);
-
-  int topicLength = (strlen(topic));
-  int payloadLength = (strlen(payload));
-  const char * rsp = "rfid/auth/rsp";
-  const char * estop = "rfid/estop";
-
-/* Possible pitfalls:
-Retained messages will fall straight through into this on boot!!!
-Be very careful how you use them.
+/* Everything we're subscribed to goes through the dispatch table in mqtt-dispatch.cpp. Runs in the AsyncTCP task,
+   keep it short. The payload is not null terminated, only len bytes of it are ours.
 */
-
-// refid/auth
-    // This should maybe be functionized for neatness
-    if ((strncmp (topic, rsp, topicLength)) == 0) // strncmp returns true if exact match
-    {
-      
-      Serial.println("We have a matching topic");
-      
-      if (((strncmp (payload, "auth", 4)) == 0)){ // Read only four indices just incase the payload is not null terminated
-        Serial.println("authorized!");
-        xEventGroupSetBits(rfidStatesGroup, AUTH_BIT_1); //Set the authorized bit
-        xEventGroupClearBits(rfidStatesGroup, TIMEOUT_BIT_3); // Clear the timeout bit just in case we're in a timeout
-      }
-      else if(((strncmp (payload, "denied", 6)) == 0)){
-        Serial.println("denied!");
-        xEventGroupClearBits(rfidStatesGroup, (CARD_BIT_0|AUTH_BIT_1)); // Revoke card and authorization bit if an unauthorized card arrives. 
-        vTaskResume(pollNewHandle); // Resume polling for new cards
-        
-        // Test  
-        xTaskNotify(pollNewHandle, (1<<0), eSetBits); // Set the 0th bit in the pollNew Handle
-      
-      
-      
-      }
-      else if(((strncmp (payload, "seekiosk", 8)) == 0)){
-        Serial.println("seekiosk!");
-        // Set kiosk bit?
-      }
-    }
-// rfid/estop
-    else if ((strncmp (topic, estop, topicLength) == 0)){
-      if (((strncmp (payload, "fire", 4)) == 0)){ // Read only four indices just incase the payload is not null terminated
-        Serial.println("Fire the eStop!");
-        xEventGroupSetBits(rfidStatesGroup, ESTOPFIRE_BIT_5); 
-        
-      }
-      else if(((strncmp (payload, "clear", 5)) == 0)){
-        Serial.println("Clear the eStop!");
-        xEventGroupSetBits(rfidStatesGroup, ESTOPCLEAR_BIT_6); 
-      }
-    }
+void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+  mqttDispatch(topic, payload, properties.retain, len, index, total);
 }
 
 void onMqttPublish(uint16_t packetId) {
-  Serial.println("Publish acknowledged.");
-  Serial.print("  packetId: ");
-  Serial.println(packetId);
+  DLOG_DEBUG("Publish acknowledged. packetId: %u", packetId);
+  outboxAck(packetId); // Broker has it, the outbox can let go of the event
 }
 
-  /////////////////////////////////////////  LED Task   ///////////////////////////////////
-
-  /* Single method for RTOS task blinkLED  
-  */
-  void blinkyLED (void *params){
-  UBaseType_t uxHighWaterMark;
-  uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-
-
-  Serial.print("blinkLED high water mark init:");
-  Serial.println(uxHighWaterMark);
-
-
-  LEDParams *l = (LEDParams*)params; // Dumping our struct parameters into task instance of LEDParams via casting of void *params to LEDParams
-
-  
-  for (;;){ // Infinite loop required for RTOS tasks b/c if allowed to return they would delete
-    // Task code here
-    uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.print("Blinky task: High watermark:");
-    Serial.println(uxHighWaterMark);
+/////////////////////////////////////////  State Machine Task  ///////////////////////////////////
 
-    if(l->blink){ // if parameters specify blinking
-
-      if (l->blinkTemp){
-          l->blinkTemp=0; // Only want the timer started once
-          xTimerStart(LEDblinkTimer, 0); // Start the timer
-      }
-
-      leds[l->led] = CRGB::Black; // Set LED specified in passed params to OFF state 
-      FastLED.show(); // Toggle the LED state to new
-      vTaskDelay(pdMS_TO_TICKS(l->blinkPeriod)); // RTOS delay blocks task not processor
-
-      leds[l->led] = l->myColour; // Set LED specificed in passed params to the colour specified in same passed params
-      //l->myColourl
-      FastLED.show();
-      vTaskDelay(pdMS_TO_TICKS(l->blinkPeriod));; // Set delay time according to passed param AND div by port TICK period ms
-    } 
+/* The access state machine's event loop (see access-fsm.cpp). Everything that changes the station's state comes
+   through here one event at a time, so the relay, LEDs and session bookkeeping are only ever touched from this task.
+*/
+void accessTask (void *params){
+  accessEvent event;
 
-    else{ 
-      leds[l->led] = l->myColour; // Set LED specificed in passed params to the colour specified in same passed params
-      FastLED.show(); // Show it 
-      vTaskSuspend ( NULL ); // Suspend ourselves since blink = false the task need not keep running 
+  for(;;){
+    if (accessReceive(&event, portMAX_DELAY)){
+      accessDispatch(&event);
     }
   }
 }
 
- /////////////////////////////////////////  Relay Task  ///////////////////////////////////
-
-void closeRelayTask (void *params){
-  
-  metaStruct *progParams = (metaStruct*) params; // Should be static/const maybe?
-  
-  // UBaseType_t uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL );
-  
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (CARD_BIT_0 | AUTH_BIT_1); // This creates a mask for checking our bits. To make mask we always use |
-  EventBits_t uxBits;                                          // But to check a mask we always use &
-
- // Serial.print("closeRelay high water mark init:");
- // Serial.println(uxHighWaterMark);
-  
-  for(;;){
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdFALSE, pdTRUE, xTicksToWait);
-        
-   // uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-   // Serial.print("closeRelay high water mark init:");
-   // Serial.println(uxHighWaterMark);
-    
-    Serial.println("I'm going to close the relay!");
-        
-    // Set both LEDS to Green
-    progParams->LEDParams0.myColour = CRGB::Green; 
-    progParams->LEDParams1.myColour = CRGB::Green;
-    // Set both LEDs to not blink
-    progParams->LEDParams0.blink = 0;
-    progParams->LEDParams1.blink = 0;
-        
-    Serial.println("Light the lights!");
-    vTaskResume(blinkLEDHandle0); // Resume the LED task
-    vTaskResume(blinkLEDHandle1); // Resume the LED task
-
-        
-    digitalWrite(RELAY_PIN, HIGH); // Close the relay
-
-     // Set relayBit
-    xEventGroupSetBits(rfidStatesGroup, RELAY_BIT_2);
-
-    vTaskSuspend ( NULL ); // Suspend ourselves. No need to keep polling for new now that we know a card is there
-   }
-  }
-
  /////////////////////////////////////////  RFID Tasks   ///////////////////////////////////
 
 
-void pollNewTask (void *params){
-  metaStruct *progParams = (metaStruct*) params;
-  uint32_t notificationValue;
-  // UBaseType_t uxHighWaterMark;
-
-  //uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-  //Serial.print("pollNew high watermark init:");
-  //Serial.println(uxHighWaterMark);
-  
-  
-  for(;;){
-    //uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    
-    vTaskDelay(MS_POLL_TIMER_PERIOD); // Wait for at least he polling time
-    
-    //Serial.print("pollNew high watermark task:");
-    //Serial.println(uxHighWaterMark);
-    
-    notificationValue = ulTaskNotifyTake (pdTRUE, pdMS_TO_TICKS(300));
-    if(notificationValue == 1 ){          // Notification from onMqttMessage that a card was denied
-      Serial.println("Notification!!");
-      Serial.println(notificationValue);
-      // Set both LEDS to Red
-      progParams->LEDParams0.myColour = CRGB::Red; 
-      progParams->LEDParams1.myColour = CRGB::Red;
-      // Set both LEDs to not blink
-      progParams->LEDParams0.blink = 1;
-      progParams->LEDParams1.blink = 1;
-      progParams->LEDParams0.blinkTemp = 1; // We set blinkTemp because we only want to blink LEDs for short period of time
-      progParams->LEDParams1.blinkTemp = 1; // That period is constrained by LEDblinkTimer and LEDBLINK_PERIOD
-      vTaskResume(blinkLEDHandle0);
-      vTaskResume(blinkLEDHandle1);
-    }
-
-
-    if(mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial ()){ // Poll for new cards BUT only when CARD_BIT_0 is not set
-
-      /* Redundancy - UID handling
-      Have facility to copy uid as byte from mfrc522 struct to our own
-      Have facility to convert uid from byte to string
-      Need not do both but which depends on approach
-      If sticking with MQTT may as well convert directly to string
-      If going with something else may make more sense to use byte
-      */
-
-      // Have removed copying of byte to our own struct for time being as prototype utilizes MQTT
-      // userID(progParams, mfrc522.uid.uidByte, mfrc522.uid.size); // Move UID from struct to our own buffer
-      
-      mfrc522.PICC_HaltA(); // We have read the card now be halt it
+volatile uint32_t readerIrqFired = 0; // Bit per station, set by readerIsr, tells readerTask to poll that reader now rather than wait out its period
 
-      xEventGroupSetBits(rfidStatesGroup, CARD_BIT_0); // Now that we have detected a card set CARD_BIT_0 to unblock some Tasks
+latencyStat pollLag; // How late each reader's poll ran, printed with the other stats
 
-      /* Conditional check for WiFi/MQTT check needed here to determine if we need to log
-      */
-
-      // Now we need to check if the card's UID is authorized
-      // But first we must convert that UID to a string
-
-      // 2 byte = 2 hex digits
-      // Size is bytes not length
-      // 
+/* Interrupt from a MFRC522 IRQ pin (only for stations with irqPin wired). Fires when a PICC answers the REQA readerTask armed.
+*/
+void IRAM_ATTR readerIsr (void *arg){
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  __atomic_fetch_or(&readerIrqFired, 1UL << (uintptr_t)arg, __ATOMIC_RELEASE);
+  vTaskNotifyGiveFromISR(readerHandle, &xHigherPriorityTaskWoken);
+  if (xHigherPriorityTaskWoken){
+    portYIELD_FROM_ISR();
+  }
+}
 
-      progParams->card.uidStrLen = (mfrc522.uid.size*3); // Our string length will be 3x the length the equivalent byte value
-      
-      byteToHexStr(mfrc522.uid.uidByte, mfrc522.uid.size, progParams->card.uidStr, progParams->card.uidStrLen); // Now convert the byte in the mfrc522 struct to a string and dump it into our struct string
+typedef struct { // readerTask's bookkeeping for one station's reader
+  TickType_t period;
+  TickType_t nextPoll;
+  uint32_t dueUs;         // micros() nextPoll works out to, poll lag is measured against it
+  uint32_t lastActivity;
+  uint32_t postedAt;
+  bool armed;             // A REQA from readerArm () is outstanding
+  bool tracking;          // Still reporting on the card in session, cleared once we've said it is gone
+  bool posted;            // Posted a new card the state machine hasn't acted on yet
+} readerSlot;
+
+/* One poll of one station's reader. What it does is set by that station's state machine (accessReaderMode ()): scan
+   for new cards, watch the card in session for removal or a collision, or leave the field alone. Polls every
+   MS_READER_FAST_PERIOD for READER_ACTIVE_WINDOW after anything happens at the reader, then backs off towards
+   MS_READER_IDLE_PERIOD. Everything it finds is posted to the state machine.
+*/
+static void readerPoll (metaStruct *progParams, readerSlot *slot){
+  byte station = progParams->station;
+  uidType uid;
+  piccScanResult scan;
+  byte mode;
+
+  if (slot->posted && accessTransitions(station) != slot->postedAt){
+    slot->posted = 0; // The state machine has moved on since
+  }
 
-      // Check if WiFi/MQTT is out
-      // Bitmask to just the bits we care about: WIFIOUT_BIT_7
-      if((xEventGroupGetBits(rfidStatesGroup) & 128) == 128){ // If the WiFi is out simply grant access and log
-        Serial.println("WiFi is out");
-        xEventGroupSetBits(rfidStatesGroup, AUTH_BIT_1); // If WiFi/MQTT server cannot be reached grant user access regardless of authorization
-        // Code for logging should go here.
+  mode = accessReaderMode(station);
+  switch (mode){
+    case READER_TRACK: // Card in session, is it still there and alone?
+      slot->armed = 0;
+      if (slot->tracking){
+        slot->lastActivity = millis();
+        readerScan(station, &scan); // One pass answers both questions
+        // Only changes are posted, a card still there and alone is what the state machine already thinks.
+        // If the queue won't take it we keep tracking and post it again next poll
+        if (scan.count > 1 || (scan.collided && scan.count > 0)){
+          slot->tracking = !accessPost(station, EV_COLLISION, NULL);
+        }
+        else if (!scan.answered || (scan.count == 1 && !piccScanHas(&scan, &progParams->card.uid))){
+          slot->tracking = !accessPost(station, EV_CARD_REMOVED, NULL); // Nothing there, or only someone else's card (left halted, they'll have to tap again)
+        }
+      }
+      slot->period = MS_READER_PRESENT_PERIOD;
+      break;
+
+    case READER_SCAN:
+      slot->tracking = 1;
+      if (!slot->posted){ // Don't read a second card before the state machine has seen the first
+        if (slot->armed && readerArmedHit(station) && readerNewCard(station, &uid)){
+          slot->lastActivity = millis();
+          if (accessPost(station, EV_CARD_ARRIVED, &uid)){
+            slot->postedAt = accessTransitions(station);
+            slot->posted = 1;
+          }
+        }
+        readerArm(station); // Send the next REQA, we check for an answer next time round
+        slot->armed = 1;
       }
-      
-      else{ // If the Wifi isn't out ask server for authorization
-        // Publish our uid string to find out if its authorized
-        uint16_t packetIdPub1 = mqttClient.publish("rfid/auth/req", 1, false, progParams->card.uidStr); // Publish the read UID to rfid/auth/req. BE VERY CAREFUL TO NOT SET THE RETAIN FLAG
-        Serial.print("Publishing at QoS 1, packetId: ");
-        Serial.println(packetIdPub1);
+      else{
+        slot->armed = 0;
       }
+      break;
 
-      Serial.print("EventBits:");
-      Serial.println(xEventGroupGetBits(rfidStatesGroup));
+    default: // READER_HOLD, waiting on the server, a collision timeout or an eStop
+      slot->tracking = 1;
+      slot->armed = 0;
+      break;
+  }
 
-      // Now suspend our polling task until we hear back from MQTT broker
-      vTaskSuspend ( NULL ); // Suspend ourselves. No need to keep polling now that there is a card
+  if (mode != READER_TRACK){
+    if ((millis() - slot->lastActivity) < READER_ACTIVE_WINDOW){
+      slot->period = MS_READER_FAST_PERIOD;
     }
-      
-    else {
-      // No new card
-      Serial.print("EventBits:");
-      Serial.println(xEventGroupGetBits(rfidStatesGroup));
+    else{
+      slot->period = min(slot->period * 2, (TickType_t)MS_READER_IDLE_PERIOD); // Idle, back off
     }
   }
 }
 
-/* Checks for continued presence of an RFID card at the reader. Goes to Timeout if card removed or Collision if >1 card present
+/* The only task that talks to the MFRC522s. Every station's reader is on the same SPI bus, so this takes turns:
+   each pass it polls every reader that is due (or whose IRQ fired), starting one further along each time so no
+   reader always goes last, then sleeps until the next one is due. A reader is polled at most once a pass, so however
+   many there are it never waits longer than its own period plus one poll of each of the others.
 */
-void pollPresTask (void *params){
-  //UBaseType_t uxHighWaterMark;
-  EventBits_t uxBits;
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (CARD_BIT_0 | AUTH_BIT_1 ); // This creates a mask for checking our bits. To make mask we always use |
-  byte resultWake;
-  byte bufferATQA[2];
-  byte bufferSize = sizeof(bufferATQA);
-
-  metaStruct *progParams = (metaStruct*) params; 
-  
-  
-  /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-  Serial.print("pollPres high watermark init:");
-  Serial.println(uxHighWaterMark);
-  Serial.println("##");*/
-
-  
-  Serial.print("EventBits:");
-  Serial.println(xEventGroupGetBits(rfidStatesGroup));
-  
-  
-  for(;;){
-    // Wait for CARD_BIT_0 and AUTH_BIT_1 to be set before proceeding
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdFALSE, pdTRUE, xTicksToWait);
-
-    xSemaphoreTake(SPIMutexHandle, portMAX_DELAY); // Must take the SPIMutex if you wish to proceed. This prevents presPoll and collPoll from trying to access SPI bus at same time
-
-    /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.print("pollPres high watermark task:");
-    Serial.println(uxHighWaterMark);*/
-    
-    vTaskDelay(MS_POLL_TIMER_PERIOD); // Only poll every 100ms?
-    
-    Serial.print("EventBits:");
-    Serial.println(xEventGroupGetBits(rfidStatesGroup));
-
-    pollPres(progParams, &rfidStatesGroup, &blinkLEDHandle0, &blinkLEDHandle1, &pollNewHandle);
-
-    xSemaphoreGive(SPIMutexHandle); // Now give up the Mutex handle so collPoll may execute
+void readerTask (void *params){
+  metaStruct *progParams = (metaStruct*) params; // STATION_COUNT of them
+  readerSlot slots[STATION_COUNT];
+  uint32_t lastStats = millis();
+  uint32_t busStart;
+  uint32_t fired;
+  bool polled;
+  byte first = 0;
+  TickType_t now;
+  TickType_t wait;
+
+  for (byte i = 0; i < STATION_COUNT; i++){
+    readerIrqInit(i);
+    slots[i].period = MS_READER_FAST_PERIOD;
+    slots[i].nextPoll = xTaskGetTickCount();
+    slots[i].dueUs = micros();
+    slots[i].lastActivity = millis();
+    slots[i].postedAt = 0;
+    slots[i].armed = 0;
+    slots[i].tracking = 1;
+    slots[i].posted = 0;
   }
-}
-
-/* Task to handle timeout condition
-Is blocked but TIMEOUT_BIT_3 and auto clears on xEventGroupClearBits
-Suspends LED tasks and opens relays (clears RELAY_BIT_2 as well)
-*/
-void timeoutTask (void *params){
-
-  metaStruct *progParams = (metaStruct*) params;
+  metricsBootMark(BOOT_TAP_READY); // From here a card on any reader is seen
 
-  //UBaseType_t uxHighWaterMark;
-  EventBits_t uxBits;
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (TIMEOUT_BIT_3); // This creates a mask for checking our bits. To make mask we always use |
-  
-  /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-  Serial.print("High watermark:");
-  Serial.println(uxHighWaterMark);
-  Serial.println("##");*/
-  
   for(;;){
-   
-    // Auto clear bits seems logical here however it prevents the timeout task from being interrupted (not an actual interrupt) by the arrival of a new auth card
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdFALSE, pdTRUE, xTicksToWait); 
-    
-    // Publish our UID to end of use topic RIGHT AWAY! If we wait for the full timeout someone could interrupt with a new card.
-    uint16_t packetIdPub1 = mqttClient.publish("rfid/auth/eou", 1, false, progParams->card.uidStr); // Publish the read UID to rfid/auth/req. BE VERY CAREFUL TO NOT SET THE RETAIN FLAG
-    Serial.print("Publishing at QoS 1, packetId: ");
-    Serial.println(packetIdPub1);
-
-    vTaskResume(closeRelayHandle);    // If we are in timeout we know that CARD_BIT_0 and AUTH_BIT_1 have been cleared therefore we must resume the closeRelayTask
-
-    // Check how we got to timeout
-    // Bitmask our GetBits to just the combination of bit we care about
-    // TIMEOUT_BIT_3 and COLL_BIT_4
-    if ((xEventGroupGetBits(rfidStatesGroup) & 24) == 24){
-      Serial.println("Timeout because a collision"); // If we have come here from a collision we mustr 
-    }
-    else if ((xEventGroupGetBits(rfidStatesGroup) & 24) == 8){
-      Serial.println("Timeout because a card was removed");
-      vTaskResume(pollNewHandle); // If we have come here from timeout we allow for a new card to interrupt and prevent the relay from being opened
-    }
-    
-    // Block task until timeout has expired
-    vTaskDelay(MS_TIMEOUT_PERIOD); 
-    // Two step - block again if the TIMEOUT_BIT_3 is cleared elsewhere (ie. in MQTT AUTH - a new authorized card has appeared)
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdFALSE, pdTRUE, xTicksToWait);
-
-    //uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.println("Timeout!");
-    Serial.print("EventBits:");
-    Serial.println(xEventGroupGetBits(rfidStatesGroup));
-    
-    // Turn LEDs off
-    progParams->LEDParams0.myColour = CRGB::Black; 
-    progParams->LEDParams1.myColour = CRGB::Black;
-    // Set both LEDs to not blink
-    progParams->LEDParams0.blink = 0;
-    progParams->LEDParams1.blink = 0;
-
-    digitalWrite(RELAY_PIN, LOW); // Open relay because we've timed out
-    //vTaskResume(closeRelayHandle); // We must resume the closeRelayTask that suspends after running once
-    xEventGroupClearBits(rfidStatesGroup, RELAY_BIT_2|TIMEOUT_BIT_3|COLL_BIT_4); // Clear the relay, collision and timeout bit
-
-
-    // Force waiting for timeout to occur if we got here because of a collision
-    vTaskResume(pollNewHandle); // Now we are safe to resume
-
+    now = xTaskGetTickCount();
+    fired = __atomic_exchange_n(&readerIrqFired, 0, __ATOMIC_ACQUIRE);
+    busStart = micros();
+    polled = 0;
+
+    for (byte k = 0; k < STATION_COUNT; k++){
+      byte i = (first + k) % STATION_COUNT;
+      readerSlot *slot = &slots[i];
+      bool due = ((int32_t)(now - slot->nextPoll) >= 0);
+      // RxIRq is raised by every frame the reader receives, our own scans' too, so the pin only means something
+      // while a REQA is armed. Otherwise tracking would wake itself straight back up and never sleep
+      if (!due && !((fired & (1UL << i)) && slot->armed)){
+        continue;
       }
-}
-
-void collPollTask (void *params){ // Must sync with pollPres
-
-  metaStruct *progParams = (metaStruct*) params;
-
-  EventBits_t uxBits;
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (CARD_BIT_0 | AUTH_BIT_1 ); // This creates a mask for checking our bits. To make mask we always use |
-  char collCounter = 0;
-
-  UBaseType_t uxHighWaterMark;
-
-
-
-  /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-  Serial.print("Init collPoll high watermark:");
-  Serial.println(uxHighWaterMark);
-  Serial.println("##");*/
-  
-  for(;;){
-    
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdFALSE, pdTRUE, xTicksToWait); // Block until card and auth bits are set
-    
-    xSemaphoreTake(SPIMutexHandle, portMAX_DELAY); // Must have the SPI mutex inorder to proceed. 
-
-    /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.print("Active collPoll high watermark:");
-    Serial.println(uxHighWaterMark);*/
-    
-    // Collision polling function call
-    collPolling (progParams, &blinkLEDHandle0, &blinkLEDHandle1, &rfidStatesGroup, &pollNewHandle);
-
-    xSemaphoreGive(SPIMutexHandle); // Now give up the Mutex handle so presPoll may execute
-  }
-}
-
-
- /////////////////////////////////////////  Emergency Stop Tasks   /////////////////////////////////////////
-
-void eStopFireTask (void *params){
-  /*UBaseType_t uxHighWaterMark;
-  uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation*/
-  
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (ESTOPFIRE_BIT_5); // This creates a mask for checking our bits. To make mask we always use |
-  EventBits_t uxBits;    
-  
-  metaStruct *progParams = (metaStruct*) params;
-  
-  /*Serial.print("eStop fire high watermark init:");
-  Serial.println(uxHighWaterMark);
-  Serial.println("##");*/
-
-  for(;;){
-
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdTRUE, pdTRUE, xTicksToWait); // Block until the estop bit is set && clear the bit on return
-    /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.print("Fire estop fire high watermark running");
-    Serial.println(uxHighWaterMark);*/
-
-    // Check rfidStatesGroup to determine what state we are currently in
-    if (xEventGroupGetBits(rfidStatesGroup) == 0){ // If no cards are present just shut everything down
-      // We only need to suspend pollNew as it is the entry point for all of the RFID functionality
-      vTaskSuspend(pollNewHandle); // We only need to suspend pollNew because all other tasks are gated by EventBits
-      // No need to open the relay because if EventBits = 0 it will not be open
-      Serial.println("Stop work!");
+      if (due){
+        // Due goes by ticks, so a poll can come up to a tick before dueUs, that's on time not 71 minutes late
+        uint32_t lag = max((int32_t)(micros() - slot->dueUs), (int32_t)0);
+        latencyRecord(&pollLag, lag);
+        metricObserve(HIST_POLL_LAG, lag);
+      }
+      readerPoll(&progParams[i], slot);
+      polled = 1;
+      slot->nextPoll = xTaskGetTickCount() + slot->period;
+      slot->dueUs = micros() + slot->period * portTICK_PERIOD_MS * 1000;
     }
-    else{ // If our state is anything other than no card present we'll have to clear all the event bits
-      xEventGroupClearBits(rfidStatesGroup, CARD_BIT_0|AUTH_BIT_1|RELAY_BIT_2|TIMEOUT_BIT_3|COLL_BIT_4);
-      digitalWrite(RELAY_PIN, LOW); // Open the relay
-      vTaskSuspend(pollNewHandle); // Then we can suspend pollNew
+    first = (first + 1) % STATION_COUNT;
 
-      Serial.println("Stop work!");
+    if (polled){
+      readerBusBusy(micros() - busStart);
     }
 
-    // Set both LEDS to Green
-    progParams->LEDParams0.myColour = CRGB::Yellow; 
-    progParams->LEDParams1.myColour = CRGB::Yellow;
-    // Set both LEDs to not blink
-    progParams->LEDParams0.blink = 1;
-    progParams->LEDParams1.blink = 1;
-
-    vTaskResume(blinkLEDHandle0);
-    vTaskResume(blinkLEDHandle1);
-
-    //Serial.print("Clear estop task high watermark running");
-    //Serial.println(uxHighWaterMark);
-  }
-}
-
-void eStopClearTask (void *params){
-  
-  //UBaseType_t uxHighWaterMark;
-  //uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-  
-  const TickType_t xTicksToWait = portMAX_DELAY; // Wait forever 
-  const EventBits_t xBitsToWaitFor = (ESTOPCLEAR_BIT_6); // This creates a mask for checking our bits. To make mask we always use |
-  EventBits_t uxBits;  
-  
-  metaStruct *progParams = (metaStruct*) params;
+    if ((millis() - lastStats) > READER_STATS_PERIOD){
+      readerStats *stats = readerGetStats();
+      lastStats = millis();
+      latencyPrint("tap-to-relay", &tapToRelay);
+      latencyPrint("removal-to-timeout", &removalToTimeout);
+      latencyPrint("transition", &transitionLatency);
+      latencyPrint("poll-lag", &pollLag);
+      ledStats *led = ledGetStats();
+      DLOG_INFO("led: frames=%lu shows=%lu show=%luus maxShow=%luus", (unsigned long)led->frames,
+                (unsigned long)led->shows, (unsigned long)led->showUs, (unsigned long)led->maxShowUs);
+      mqttDispatchStats *mqtt = mqttDispatchGetStats();
+      DLOG_INFO("mqtt: received=%lu handled=%lu unknown=%lu retained=%lu oversize=%lu", (unsigned long)mqtt->received,
+                (unsigned long)mqtt->handled, (unsigned long)mqtt->unknown, (unsigned long)mqtt->retained, (unsigned long)mqtt->oversize);
+      DLOG_INFO("reader: readers=%u cycles=%lu busy=%lums frames=%lu", STATION_COUNT, (unsigned long)stats->cycles,
+                (unsigned long)(stats->busyUs / 1000), (unsigned long)stats->frames);
+      uint32_t queueMax;
+      uint32_t queue = accessQueueDepth(&queueMax); // What our posts wait behind, the ring took over from the request queue
+      DLOG_INFO("access queue: depth=%lu max=%lu of %u", (unsigned long)queue, (unsigned long)queueMax, ACCESS_QUEUE_DEPTH);
+    }
 
-  /*Serial.print("eStop clear high watermark init:");
-  Serial.println(uxHighWaterMark);
-  Serial.println("##");*/
-  
-  
-  for(;;){
-    uxBits = xEventGroupWaitBits(rfidStatesGroup, xBitsToWaitFor, pdTRUE, pdTRUE, xTicksToWait); // Block until the estop bit is set
-    
-    /*uxHighWaterMark = uxTaskGetStackHighWaterMark( NULL ); // Returns the minimum amount of unused stack space available since task creation
-    Serial.print("Clear estop task high watermark running");
-    Serial.println(uxHighWaterMark);
-    Serial.println("Back to work!");*/
-    
-    // Set both LEDS to Green
-    progParams->LEDParams0.myColour = CRGB::Black; 
-    progParams->LEDParams1.myColour = CRGB::Black;
-    // Set both LEDs to not blink
-    progParams->LEDParams0.blink = 0;
-    progParams->LEDParams1.blink = 0;
-
-    vTaskResume(blinkLEDHandle0);
-    vTaskResume(blinkLEDHandle1);
-    
-    vTaskResume(pollNewHandle);
+    // Sleep until the next reader is due. An IRQ pin wakes us early when a card answers an armed REQA
+    now = xTaskGetTickCount();
+    wait = portMAX_DELAY;
+    for (byte i = 0; i < STATION_COUNT; i++){
+      int32_t left = (int32_t)(slots[i].nextPoll - now);
+      wait = min(wait, (TickType_t)max(left, (int32_t)0));
+    }
+    if (wait > 0){
+      ulTaskNotifyTake(pdTRUE, wait);
+    }
   }
 }
 
-/////////////////////////////Software Timer callbacks //////////////////////////////////////////
-
-/* Callback function triggered by setting the LEDparams.blinkTemp flag.
-Period of timer is constrained by #define LEDBLINK_PERIOD. When callback executes the LEDs are toggled out of the blink state and set to black.
-*/
-void LEDTimerCallback (TimerHandle_t LEDblinkTimer){
-  metaStruct *progParams = (metaStruct*) pvTimerGetTimerID (LEDblinkTimer);
-
-
-  Serial.println("Blink timer!");
-  progParams->LEDParams0.myColour = CRGB::Black;
-  progParams->LEDParams1.myColour = CRGB::Black;
-  progParams->LEDParams0.blink = 0;
-  progParams->LEDParams1.blink = 0;
-}
-
-
 void setup() {
   
-  // Variables
-  metaStruct progParams; // Create an instance of our metaStuct that holds our timers and LED parameters
-  
-  // Initialize our LED parameters
-  progParams.LEDParams0.myColour = CRGB::Black;
-  progParams.LEDParams1.myColour = CRGB::Black;
-  progParams.LEDParams0.led = 0;
-  progParams.LEDParams1.led = 1;
-  progParams.LEDParams0.blink = 0;
-  progParams.LEDParams1.blink = 0;
-  progParams.LEDParams0.blinkPeriod = 200;
-  progParams.LEDParams1.blinkPeriod = 200;
-  // Initialization of our collision counter
-  progParams.card.collCounter = 0;
+  for (byte i = 0; i < STATION_COUNT; i++){
+    progParams[i].station = i;
+  }
 
   
+  /* Boot order is about getting to tap-ready (BOOT_TAP_READY in the metrics) as soon as possible. Everything a tap
+     needs (readers, relay, auth cache, member index, warm state from NVS) comes up and the RF tasks start first, then
+     SPIFFS is mounted (seconds on the first boot, it formats) with the readers already running, then WiFi.
+     Taps made before then are decided offline and their log records and outbox events wait in the rings.
+  */
   Serial.begin(115200);
+  dlogInit(mqttPublishDebug); // First, everything after this can log
+  metricsInit(mqttPublishMetrics);
+  accessLogAppend(0, LOG_BOOT, NULL, 0); // Waits in the ring for accessLogTask, first so it comes before anything from this boot
 
   toolAccessInit(); // Call initialization function as per usual no need for RTOS tasking
-
-  // Event group creation
-  rfidStatesGroup = xEventGroupCreate();
-  // Check rdfidStatesGroup was created successfully
-  if( rfidStatesGroup == NULL ){
-    Serial.println("Event group creation failure due to insufficient heap");
-  }
-  else{
-    Serial.println("Eventgroup created successfully");
+  estopInit(); // Straight after the relays, the switch can open them from here on
+  authCacheInit();
+  if (!memberSyncInit(mqttPublishMembers) && !memberIndexBuild(memberList, MEMBER_LIST_COUNT)){ // A synced list wins over the built in one
+    DLOG_ERROR("Member list rejected, is it sorted by uidHash?");
   }
 
-  // Mutex/Semaphore creation
-  SPIMutexHandle = xSemaphoreCreateMutex();
-  if ( SPIMutexHandle == NULL){
-    Serial.println("Mutex could not be created.");
-  }
+  accessInit(progParams); // Queue and timers, before anything can post to it
+  warmStateRestore(); // Auth cache and eStops from before the reboot, posts to the state machine
 
 
   // Task creation 
 
   //xTaskCreatePinnedToCore(basicTask, "basicTask", 1024, NULL, 1, &basicTaskHandle, 1);
-  xTaskCreatePinnedToCore(blinkyLED, "blinkLED", 1024, &progParams.LEDParams0, 1, &blinkLEDHandle0, 1);
-  xTaskCreatePinnedToCore(blinkyLED, "blinkLED1", 1024, &progParams.LEDParams1, 1, &blinkLEDHandle1, 1);
-  
-  // Polling task that waits on !CARD_BIT_0 
-  xTaskCreatePinnedToCore(pollNewTask, "pollNewTask", 1024, &progParams, 1, &pollNewHandle, 1);
-  xTaskCreatePinnedToCore(closeRelayTask, "closeRelay", CONFIG_SYSTEM_EVENT_TASK_STACK_SIZE, &progParams, 1, &closeRelayHandle, 1); 
-  xTaskCreatePinnedToCore(pollPresTask, "pollPresTask", 1024, &progParams, 1, &pollPresHandle, 1);
-  xTaskCreatePinnedToCore(timeoutTask, "TimeoutTask", 1024, &progParams, 1, &timeoutHandle, 1);
-  xTaskCreatePinnedToCore(collPollTask, "TimeoutTask", 1024, &progParams, 1, &collPollHandle, 1);
-  xTaskCreatePinnedToCore(eStopFireTask,"eStopFireTask", 1024, &progParams, 1, &eStopFireHandle, 1 );
-  xTaskCreatePinnedToCore(eStopClearTask,"eStopClearTask", 1024, &progParams, 1, &eStopClearHandle, 1 );
-
-  // CONFIG_SYSTEM_EVENT_TASK_STACK_SIZE
-
-
-  /* xTimerCreate creates a dormant software timer (ie. it is not yet running)
+  // RF core: readers, state machine, relay and LEDs
+  estopHandle = xTaskCreateStaticPinnedToCore(estopTask, "estopTask", STACK_ESTOP, NULL, PRIO_ESTOP, estopTaskStack, &estopTaskTcb, CORE_RF); // Above accessTask, follows up the moment the ISR wakes it
+  ledHandle = xTaskCreateStaticPinnedToCore(ledTask, "ledTask", STACK_LED, NULL, PRIO_LED, ledTaskStack, &ledTaskTcb, CORE_RF); // Renders every LED, NUM_LEDS doesn't add tasks
+  // Runs the state machine, the relay and LEDs only change from here
+  accessHandle = xTaskCreateStaticPinnedToCore(accessTask, "accessTask", STACK_ACCESS, NULL, PRIO_ACCESS, accessTaskStack, &accessTaskTcb, CORE_RF);
+  // Owns the MFRC522s, everything RFID starts here
+  readerHandle = xTaskCreateStaticPinnedToCore(readerTask, "readerTask", STACK_READER, progParams, PRIO_READER, readerTaskStack, &readerTaskTcb, CORE_RF);
+
+  // Network core: anything that waits on the broker or on flash. The ones that don't need SPIFFS start now
+  dlogHandle = xTaskCreateStaticPinnedToCore(dlogTask, "dlogTask", STACK_DLOG, NULL, PRIO_BACKGROUND, dlogTaskStack, &dlogTaskTcb, CORE_NET); // Logging only gets spare time
+  metricsHandle = xTaskCreateStaticPinnedToCore(metricsTask, "metricsTask", STACK_METRICS, NULL, PRIO_BACKGROUND, metricsTaskStack, &metricsTaskTcb, CORE_NET);
+  memberSyncHandle = xTaskCreateStaticPinnedToCore(memberSyncTask, "memberSyncTask", STACK_MEMBER_SYNC, NULL, PRIO_ACCESS_LOG, memberSyncTaskStack, &memberSyncTaskTcb, CORE_NET);
+  warmStateHandle = xTaskCreateStaticPinnedToCore(warmStateTask, "warmStateTask", STACK_WARM_STATE, NULL, PRIO_ACCESS_LOG, warmStateTaskStack, &warmStateTaskTcb, CORE_NET);
+
+  // Now the slow part, with the readers already serving taps
+  if (storageInit()){
+    if (!accessLogInit()){
+      DLOG_ERROR("Access log could not be opened");
+    }
+  }
+  outboxInit(mqttPublish); // Restores what was held from before the reboot, if SPIFFS mounted
+  outboxHandle = xTaskCreateStaticPinnedToCore(outboxTask, "outboxTask", STACK_OUTBOX, NULL, PRIO_OUTBOX, outboxTaskStack, &outboxTaskTcb, CORE_NET);
+  accessLogHandle = xTaskCreateStaticPinnedToCore(accessLogTask, "accessLogTask", STACK_ACCESS_LOG, NULL, PRIO_ACCESS_LOG, accessLogTaskStack, &accessLogTaskTcb, CORE_NET);
+  metricsBootMark(BOOT_STORAGE);
+
+  // Stack headroom of everything we created goes out with the metrics
+  metricsWatchTask(ledHandle);
+  metricsWatchTask(accessHandle);
+  metricsWatchTask(readerHandle);
+  metricsWatchTask(accessLogHandle);
+  metricsWatchTask(outboxHandle);
+  metricsWatchTask(dlogHandle);
+  metricsWatchTask(metricsHandle);
+  metricsWatchTask(memberSyncHandle);
+  metricsWatchTask(warmStateHandle);
+  metricsWatchTask(estopHandle);
+
+
+  /* xTimerCreateStatic creates a dormant software timer (ie. it is not yet running) in the StaticTimer_t we give it
     Software timers MUST NOT call RTOS API that are task blocking
     All software timers share a command que controlled by RTOS daemon
   
     The task connectToMqtt is provided as the for our software timer TimerCallBackFunction (notice that we must cast it as such)
    pg. 178 Mastering FreeRTOS: https://www.freertos.org/wp-content/uploads/2018/07/161204_Mastering_the_FreeRTOS_Real_Time_Kernel-A_Hands-On_Tutorial_Guide.pdf
   */  
-  mqttReconnectTimer = xTimerCreate("mqttTimer", MS_MQTT_RECONNECT_PERIOD, pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToMqtt));
-  //(const char * const pcTimerName, TickType_t xTimerPeriodInTicks, UBaseType_t uxAutoRelaod, void * pvTimerID, TimerCallBackFunction_t pxCallbackFunction
-  wifiReconnectTimer = xTimerCreate("wifiTimer", MS_WIFI_RECONNECT_PERIOD, pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToWifi));
+  mqttReconnectTimer = xTimerCreateStatic("mqttTimer", MS_MQTT_RECONNECT_PERIOD, pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToMqtt), &mqttTimerBuf);
+  //(const char * const pcTimerName, TickType_t xTimerPeriodInTicks, UBaseType_t uxAutoRelaod, void * pvTimerID, TimerCallBackFunction_t pxCallbackFunction, StaticTimer_t *pxTimerBuffer
+  wifiReconnectTimer = xTimerCreateStatic("wifiTimer", MS_WIFI_RECONNECT_PERIOD, pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToWifi), &wifiTimerBuf);
   // Both timers are moved from Dormant to Running in the WiFiEvent task because we will only need to attempt the callbackTask in the event of a WiFi outage
-  LEDblinkTimer = xTimerCreate("LEDblinkTimer", LEDBLINK_PERIOD, pdFALSE, (void*)&progParams, reinterpret_cast<TimerCallbackFunction_t>(LEDTimerCallback));
-  // Create a one shot timer for when we want LEDs to only blink for a set period constrained by LEDBLINK_PERIOD
- 
+
+  for (byte i = 0; i < STATION_COUNT; i++){
+    if (stationConfigs[i].irqPin >= 0){
+      attachInterruptArg(digitalPinToInterrupt(stationConfigs[i].irqPin), readerIsr, (void*)(uintptr_t)i, FALLING);
+    }
+  }
+
   WiFi.onEvent(WiFiEvent);
 
   mqttClient.onConnect(onMqttConnect);
@@ -722,10 +491,8 @@ void setup() {
 
   connectToWifi();
 
-while(1){
-  vTaskDelay(1000/portTICK_PERIOD_MS);
-}
-
+  // Nothing of setup ()'s is needed any more (progParams is static), so end the Arduino loop task and give its stack back to the heap
+  vTaskDelete(NULL);
 }
 
 void loop() {
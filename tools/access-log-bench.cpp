@@ -0,0 +1,286 @@
+/* Access log benchmark: the binary log (access-log.cpp) against the CSV writeLog it replaced, on the host harness'
+   SPIFFS (tools/host), in memory or in a host directory. Records go in at a few tap rates from a task at accessTask's
+   priority on the RF core, the way taps do. For each rate and path:
+     caller  - what the tapping task is held up per record, avg/max. The old path has it wait on the flash itself,
+               the new one copies a record into the ring
+     busy    - core time per record, wherever it's spent (the caller for the old path, Serial included, accessLogTask
+               for the new)
+     landed  - the record being called in to its write () to flash returning, avg/max. The flush after a batch adds
+               another ~0.8ms before it's safe from a power cut
+     dropped - records the ring had no room for
+     got     - records/s actually taken, the old path can't keep up with its own flash time
+   The harness charges flash and Serial time but not the firmware's own code, so the ring's caller cost (a few us on
+   the ESP32) shows as 0.
+   Flash costs are host-spiffs.cpp's rough figures for SPIFFS on the ESP32's flash, so it's the ratios that carry over.
+   The old path is a copy of the baseline's writeLog (two exists () and an open per entry, a comma, then a read back
+   of /uidLogs.txt that isn't there) with its Serial chatter, at 115200 baud.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -include Arduino.h access-log.cpp debug-log.cpp picc-scan.cpp \
+       tools/host/host-*.cpp tools/access-log-bench.cpp -o /tmp/access-log-bench
+     /tmp/access-log-bench [records per run] [host dir]
+   With a host dir (it has to exist, and is emptied first) the files are real ones in it, left there afterwards for
+   tools/accesslog-decode.py.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-log.h"
+
+#define RUN_RECORDS   200          // Per rate and path, unless given
+#define RECORD_WITHIN 3000000      // us of run time allowed per record per run, the runs take ~2.3s between them
+#define OLD_LOG_PATH  "/uidLogs"
+
+static const uint16_t rates[] = {1, 10, 50, 200, 1000}; // Records/s, a quiet door to a burst of log lines
+
+typedef struct {
+  uint16_t rate;
+  bool old;
+  uint32_t records;
+  uint64_t callerUs;
+  uint32_t callerMax;
+  uint32_t busyUs;
+  uint64_t landedUs;
+  uint32_t landedMax;
+  uint32_t landed;
+  uint32_t dropped;
+  uint64_t spanUs;
+} benchRun;
+
+static uint32_t runRecords = RUN_RECORDS;
+static std::vector<benchRun> results;
+static TaskHandle_t logHandle = NULL;
+static bool done = 0;
+
+// Stamped as records land, by the main loop watching hostFsBytesWritten ()
+static bool watching = 0;
+static uint64_t watchBase = 0;
+static std::vector<uint64_t> calledUs;  // Each accepted record's, in the order they'll reach the file
+static std::vector<uint64_t> landedUs;
+
+//////// The old path, as it was in tool-access-RTOS.cpp ////////
+
+static void oldReadFile (fs::FS &fs, const char * path){
+  Serial.printf("Reading file: %s\r\n", path);
+  File file = fs.open(path);
+  if (!file || file.isDirectory()){
+    Serial.println("- failed to open file for reading");
+    return;
+  }
+  Serial.println("- read from file:");
+  while (file.available()){
+    Serial.println(file.read());
+  }
+}
+
+static void oldWriteFile (fs::FS &fs, const char * path, const char * message){
+  Serial.printf("Writing file: %s\r\n", path);
+  File file = fs.open(path, FILE_WRITE);
+  if (!file){
+    Serial.println("- failed to open file for writing");
+    return;
+  }
+  if (file.print(message)){
+    Serial.println("- file written");
+  }
+  else{
+    Serial.println("- frite failed");
+  }
+}
+
+static void oldAppendFile (fs::FS &fs, const char * path, const char * message){
+  Serial.printf("Appending to file: %s\r\n", path);
+  File file = fs.open(path, FILE_APPEND);
+  if (!file){
+    Serial.println("- failed to open file for appending");
+    return;
+  }
+  if (file.print(message)){
+    file.print(",");
+    Serial.println("- message appended");
+  }
+  else{
+    Serial.println("- append failed");
+  }
+}
+
+static void oldWriteLog (const char *uidStr){
+  if (SPIFFS.exists(OLD_LOG_PATH)){
+    oldAppendFile(SPIFFS, OLD_LOG_PATH, uidStr);
+  }
+  else if (!SPIFFS.exists(OLD_LOG_PATH)){
+    oldWriteFile(SPIFFS, OLD_LOG_PATH, uidStr);
+  }
+  oldReadFile(SPIFFS, "/uidLogs.txt");
+}
+
+//////// Runs ////////
+
+static uidType card (uint32_t n){
+  uidType uid = UID4(0x04, 0xB0, 0x00, 0x00);
+  uid.bytes[2] = n >> 8;
+  uid.bytes[3] = n;
+  return uid;
+}
+
+// Sleeps until us, to the tick, then spins out the rest so records go in on time at 1000/s too
+static void waitUntil (uint64_t us){
+  int64_t left = (int64_t)(us - hostNow());
+  if (left >= 1000){
+    vTaskDelay(pdMS_TO_TICKS(left / 1000));
+  }
+  while ((int64_t)(us - hostNow()) > 0){
+    hostBusy(us - hostNow());
+  }
+}
+
+static void oldRun (benchRun *r){
+  uint64_t start = hostNow();
+  for (uint32_t i = 0; i < r->records; i++){
+    char uidStr[16];
+    uidType uid = card(i);
+    snprintf(uidStr, sizeof(uidStr), "%02X:%02X:%02X:%02X", uid.bytes[0], uid.bytes[1], uid.bytes[2], uid.bytes[3]);
+    waitUntil(start + (uint64_t)i * 1000000 / r->rate);
+    uint32_t busy = hostTaskRunUs(xTaskGetCurrentTaskHandle());
+    uint64_t t = hostNow();
+    oldWriteLog(uidStr);
+    uint32_t took = hostNow() - t;
+    r->busyUs += hostTaskRunUs(xTaskGetCurrentTaskHandle()) - busy; // Not waitUntil ()'s spinning
+    r->callerUs += took;
+    r->callerMax = max(r->callerMax, took);
+    r->landedUs += took; // On flash once it returns, the close has committed it
+    r->landedMax = max(r->landedMax, took);
+    r->landed++;
+  }
+  r->spanUs = hostNow() - start;
+}
+
+static void newRun (benchRun *r){
+  uint32_t busyBefore = hostTaskRunUs(logHandle);
+  uint32_t droppedBefore = accessLogDropped();
+  calledUs.clear();
+  landedUs.clear();
+  watchBase = hostFsBytesWritten();
+  watching = 1;
+  uint64_t start = hostNow();
+  for (uint32_t i = 0; i < r->records; i++){
+    uidType uid = card(i);
+    waitUntil(start + (uint64_t)i * 1000000 / r->rate);
+    uint32_t d = accessLogDropped();
+    uint64_t t = hostNow();
+    accessLogAppend(0, LOG_TAP_REQ, &uid, 0);
+    uint32_t took = hostNow() - t;
+    r->callerUs += took;
+    r->callerMax = max(r->callerMax, took);
+    if (accessLogDropped() == d){
+      calledUs.push_back(t);
+    }
+  }
+  r->spanUs = hostNow() - start;
+  while (landedUs.size() < calledUs.size()){ // The rest go out on the next batch or flush period
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  watching = 0;
+  for (size_t i = 0; i < calledUs.size(); i++){
+    uint32_t l = landedUs[i] - calledUs[i];
+    r->landedUs += l;
+    r->landedMax = max(r->landedMax, l);
+  }
+  r->landed = calledUs.size();
+  r->dropped = accessLogDropped() - droppedBefore;
+  r->busyUs = hostTaskRunUs(logHandle) - busyBefore;
+}
+
+static void benchTask (void *params){
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++){
+    for (int old = 1; old >= 0; old--){
+      benchRun r;
+      memset(&r, 0, sizeof(r));
+      r.rate = rates[i];
+      r.old = old;
+      r.records = runRecords;
+      if (old){
+        oldRun(&r);
+      }
+      else{
+        newRun(&r);
+      }
+      results.push_back(r);
+    }
+  }
+  done = 1;
+  vTaskDelete(NULL);
+}
+
+void setup (){
+  Serial.begin(115200);
+  if (!SPIFFS.begin(true) || !accessLogInit()){
+    printf("The access log didn't open\n");
+    done = 1;
+    vTaskDelete(NULL);
+  }
+  xTaskCreatePinnedToCore(accessLogTask, "accessLogTask", STACK_ACCESS_LOG, NULL, PRIO_ACCESS_LOG, &logHandle, CORE_NET);
+  xTaskCreatePinnedToCore(benchTask, "benchTask", STACK_ACCESS, NULL, PRIO_ACCESS, NULL, CORE_RF);
+  vTaskDelete(NULL);
+}
+
+void loop (){
+}
+
+// Records land whole and in order, each batch is one write ()
+static bool watch (){
+  if (watching){
+    uint64_t records = (hostFsBytesWritten() - watchBase) / sizeof(accessLogRecord);
+    while (landedUs.size() < records && landedUs.size() < calledUs.size()){
+      landedUs.push_back(hostNow());
+    }
+  }
+  return done;
+}
+
+static void emptyDir (const char *dir){
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  while (d != NULL && (e = readdir(d)) != NULL){
+    if (e->d_name[0] != '.'){
+      unlink((std::string(dir) + "/" + e->d_name).c_str());
+    }
+  }
+  if (d != NULL){
+    closedir(d);
+  }
+}
+
+int main (int argc, char **argv){
+  if (argc > 1){
+    runRecords = max(atoi(argv[1]), 1);
+  }
+  if (argc > 2){
+    emptyDir(argv[2]);
+    hostFsRoot(argv[2]);
+  }
+
+  hostBoot();
+  uint64_t within = (uint64_t)runRecords * RECORD_WITHIN + 60000000;
+  if (!hostRunUntilTrue(watch, within, 0)){
+    printf("Runs didn't finish in %us\n", (unsigned)(within / 1000000));
+    return 1;
+  }
+
+  printf("%u records per run, %s\n\n", runRecords, (argc > 2) ? argv[2] : "in memory");
+  printf("%-5s %-4s %17s %10s %19s %8s %9s\n", "rate", "path", "caller us avg/max", "busy us", "landed ms avg/max",
+         "dropped", "got /s");
+  for (size_t i = 0; i < results.size(); i++){
+    benchRun *r = &results[i];
+    printf("%-5u %-4s %8.1f/%-8u %10.1f %9.2f/%-9.2f %8u %9.1f\n", r->rate, r->old ? "csv" : "ring",
+           (double)r->callerUs / r->records, r->callerMax, (double)r->busyUs / r->records,
+           r->landed ? r->landedUs / 1000.0 / r->landed : 0, r->landedMax / 1000.0, r->dropped,
+           r->spanUs ? r->landed * 1e6 / r->spanUs : 0);
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Offline decoder for the binary access log written by access-log.cpp.
+
+Pull /access.log (and /access.old) off the SPIFFS partition, then:
+    accesslog-decode.py access.old access.log > access.csv
+
+Records that fail their magic or CRC (torn writes from a power cut, or the
+0xFF padding written after one) are skipped and counted on stderr.
+"""
+import struct
+import sys
+
+RECORD = struct.Struct("<BBB10sBIIIH")  # Must match accessLogRecord, 28 bytes
+MAGIC = 0xA5
+LOGFLAG_EPOCH = 1 << 0
+LOGFLAG_STATION_SHIFT = 4
+
+EVENTS = {
+    0: "boot",
+    1: "tap_req",
+    2: "tap_cached",
+    3: "tap_offline",
+    4: "auth_granted",
+    5: "auth_denied",
+    6: "auth_revoked",
+    7: "session_end",
+    8: "collision",
+    9: "estop",
+}
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, same as accessLogCrc ()"""
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def decode(path, out):
+    bad = 0
+    with open(path, "rb") as f:
+        data = f.read()
+    for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        raw = data[off:off + RECORD.size]
+        magic, event, flags, uid, uid_len, seq, stamp, duration, crc = RECORD.unpack(raw)
+        if magic != MAGIC or crc != crc16(raw[:-2]) or uid_len > len(uid):
+            bad += 1
+            continue
+        clock = "epoch" if flags & LOGFLAG_EPOCH else "uptime_ms"
+        uid_str = ":".join("%02X" % b for b in uid[:uid_len])
+        station = flags >> LOGFLAG_STATION_SHIFT
+        out.write("%d,%s,%d,%d,%s,%s,%d\n" % (seq, clock, stamp, station, EVENTS.get(event, str(event)), uid_str, duration))
+    return bad
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 2
+    sys.stdout.write("seq,clock,timestamp,station,event,uid,duration_ms\n")
+    for path in argv[1:]:
+        bad = decode(path, sys.stdout)
+        if bad:
+            sys.stderr.write("%s: skipped %d bad records\n" % (path, bad))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,299 @@
+/* Checks for auth-cache.cpp, then what the cache buys a tap: tap-to-relay for the same cards uncached (the req goes to
+   the server and the relay waits on the rsp) and cached (the relay closes off the cache, the req still goes out and can
+   revoke), on the host harness (tools/host) against its broker at a few network latencies.
+   The checks run before the board boots, on the cache alone: hits and misses, per station keying, the online, offline
+   and deny TTLs, eviction of the oldest entry when full, export/import keeping ages, and authCacheResolve () matching
+   rsps to the pending card (echoed uidStr, late rsps, revoking a cached grant).
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -include Arduino.h -x c++ tool-access-RTOS.ino -x none *.cpp \
+       tools/host/host-*.cpp tools/auth-cache-test.cpp -o /tmp/auth-cache-test
+     /tmp/auth-cache-test [cards per latency] [seed]
+   Exits 1 if a check fails. Each tap is timed from the card entering the field, which has the reader's poll phase in
+   it (up to two idle periods), and from readerTask having the UID, which is what the cache changes: the round trip and
+   the server's own time go, the rest is the same for both. The harness charges bus, flash and network time but not the
+   firmware's own code, so a cached read-to-relay is little more than accessTask being switched in.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "auth-cache.h"
+#include "access-fsm.h"
+#include "latency.h"
+
+#define SERVER_DELAY_US   10000    // The server's own time to answer a req
+#define TAP_WITHIN        3000000  // us, anything slower is a failed tap
+
+static const uint32_t latencies[] = {1000, 5000, 20000, 50000}; // One way, LAN to a far away broker
+
+static uint32_t failures = 0;
+static uint64_t relayRiseUs = 0;
+static std::vector<std::string> allowed;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check (bool ok, const char *what, int line){
+  if (!ok){
+    printf("FAIL line %d: %s\n", line, what);
+    failures++;
+  }
+}
+
+static uidType card (uint16_t n){
+  uidType uid = UID4(0x04, 0xA0, 0x00, 0x00);
+  uid.bytes[2] = n >> 8;
+  uid.bytes[3] = n;
+  return uid;
+}
+
+static std::string uidString (const uidType *uid){
+  char s[UID_MAX_SIZE * 3 + 1];
+  for (byte i = 0; i < uid->length; i++){
+    snprintf(s + i * 3, 4, "%02X:", uid->bytes[i]);
+  }
+  s[uid->length * 3 - 1] = 0;
+  return s;
+}
+
+static bool resolve (bool allowed, const char *args, uidType *resolved){
+  return authCacheResolve(allowed, args, strlen(args), resolved, NULL);
+}
+
+//////// Checks, on the cache alone ////////
+
+static void checkLookups (){
+  uidType a = card(1);
+  uidType b = card(2);
+
+  authCacheInit();
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_MISS);
+  uint32_t gen = authCacheGeneration();
+  authCacheStore(0, &a, 1);
+  CHECK(authCacheGeneration() != gen);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_ALLOW);
+  CHECK(authCacheLookup(0, &b, 0) == CACHE_MISS);
+  CHECK(authCacheLookup(1, &a, 0) == CACHE_MISS); // A grant on one station says nothing about the next
+  authCacheStore(0, &a, 0);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_DENY); // Same entry, the latest answer wins
+
+  uidType none;
+  memset(&none, 0, sizeof(none));
+  authCacheStore(0, &none, 1);
+  CHECK(authCacheLookup(0, &none, 0) == CACHE_MISS);
+}
+
+static void checkTtls (){
+  uidType a = card(1);
+  uidType d = card(2);
+
+  authCacheInit();
+  authCacheStore(0, &a, 1);
+  authCacheStore(0, &d, 0);
+  hostRunFor((AUTHCACHE_DENY_TTL - 1) * 1000ULL);
+  CHECK(authCacheLookup(0, &d, 0) == CACHE_DENY);
+  hostRunFor(2000);
+  CHECK(authCacheLookup(0, &d, 0) == CACHE_MISS);
+  CHECK(authCacheLookup(0, &d, 1) == CACHE_MISS); // Offline doesn't stretch a deny
+
+  hostRunFor((AUTHCACHE_ALLOW_TTL - AUTHCACHE_DENY_TTL - 2) * 1000ULL);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_ALLOW);
+  hostRunFor(2000);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_MISS);
+  CHECK(authCacheLookup(0, &a, 1) == CACHE_ALLOW);
+  hostRunFor((AUTHCACHE_OFFLINE_TTL - AUTHCACHE_ALLOW_TTL) * 1000ULL);
+  CHECK(authCacheLookup(0, &a, 1) == CACHE_MISS);
+}
+
+static void checkEviction (){
+  authCacheInit();
+  for (byte i = 0; i < AUTHCACHE_SIZE; i++){
+    uidType u = card(i);
+    authCacheStore(0, &u, 1);
+    hostRunFor(1000);
+  }
+  uidType first = card(0);
+  uidType second = card(1);
+  authCacheStore(0, &first, 1); // Refreshed, card 1 is the oldest now
+  hostRunFor(1000);
+  uidType extra = card(AUTHCACHE_SIZE);
+  authCacheStore(0, &extra, 1);
+  CHECK(authCacheLookup(0, &extra, 0) == CACHE_ALLOW);
+  CHECK(authCacheLookup(0, &first, 0) == CACHE_ALLOW);
+  CHECK(authCacheLookup(0, &second, 0) == CACHE_MISS);
+  for (byte i = 2; i < AUTHCACHE_SIZE; i++){
+    uidType u = card(i);
+    CHECK(authCacheLookup(0, &u, 0) == CACHE_ALLOW);
+  }
+}
+
+static void checkExportImport (){
+  static authCacheEntry saved[AUTHCACHE_SIZE];
+  uidType a = card(1);
+
+  authCacheInit();
+  authCacheStore(0, &a, 1);
+  hostRunFor(1000000);
+  byte n = authCacheExport(saved);
+  CHECK(n == 1);
+  CHECK(saved[0].stamp == 1000); // Age, not stamp
+  authCacheInit();
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_MISS);
+  hostRunFor(5000000); // A reboot, the age carries on from the export
+  authCacheImport(saved, n);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_ALLOW);
+  hostRunFor((AUTHCACHE_ALLOW_TTL - 1000 - 1) * 1000ULL);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_ALLOW);
+  hostRunFor(2000);
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_MISS);
+
+  saved[0].uid.length = UID_MAX_SIZE + 1; // Garbage from NVS is skipped
+  authCacheInit();
+  authCacheImport(saved, 1);
+  CHECK(authCacheExport(saved) == 0);
+}
+
+// Before boot every station is IDLE, not waiting on the server, so only echoed rsps can be taken
+static void checkResolve (){
+  uidType a = card(1);
+  uidType b = card(2);
+  uidType resolved;
+
+  authCacheInit();
+  authCacheSetPending(0, &a, 0);
+  CHECK(!resolve(1, uidString(&b).c_str(), &resolved) && resolved.length == 0); // Not the card pending
+  CHECK(!resolve(1, "", &resolved) && resolved.length == 0);                     // Unnamed, and not waiting
+  CHECK(!resolve(1, uidString(&a).c_str(), &resolved) && uidEqual(resolved, a));
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_ALLOW);
+  CHECK(!resolve(1, uidString(&a).c_str(), &resolved) && resolved.length == 0);  // Taken already
+
+  authCacheSetPending(0, &a, 1); // Let in off the cache, the server now says no
+  CHECK(resolve(0, (uidString(&a) + ",0").c_str(), &resolved) && uidEqual(resolved, a));
+  CHECK(authCacheLookup(0, &a, 0) == CACHE_DENY);
+
+  authCacheSetPending(0, &b, 0); // Given up on after the req went out, its rsp is late
+  authCacheClearPending(0, 1);
+  CHECK(!resolve(1, uidString(&b).c_str(), &resolved) && resolved.length == 0);
+  authCacheSetPending(0, &a, 0); // An echoed rsp is still taken while one unnamed is owed
+  CHECK(!resolve(1, uidString(&a).c_str(), &resolved) && uidEqual(resolved, a));
+  authCacheClearPending(STATION_ALL, 0);
+}
+
+//////// Bench, on the booted board ////////
+
+static void relayEdge (uint8_t pin, int level){
+  if (pin == RELAY_PIN && level == HIGH){
+    relayRiseUs = hostNow();
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  std::string uid(payload, len);
+  uid = uid.substr(0, uid.find(','));
+  bool allow = (std::find(allowed.begin(), allowed.end(), uid) != allowed.end());
+  std::string rsp = (allow ? "auth," : "denied,") + uid;
+  hostAfter(SERVER_DELAY_US, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+typedef struct {
+  std::vector<uint32_t> field;  // Card in the field to the relay closing
+  std::vector<uint32_t> read;   // readerTask having the UID to the relay closing, the firmware's own tapToRelay
+} tapTimes;
+
+// Tap, some time in the next idle poll, to the relay closing with the station in expect
+static bool timeTap (const uidType *uid, byte expect, tapTimes *times){
+  uint32_t recorded = tapToRelay.total;
+  hostRunFor(hostRandom() % (MS_READER_IDLE_PERIOD * 1000));
+  relayRiseUs = 0;
+  hostCardEnter(SS_PIN, uid);
+  uint64_t t = hostNow();
+  if (!hostRunUntilTrue([=](){ return relayRiseUs != 0 && accessState(0) == expect; }, t + TAP_WITHIN, 0)
+      || tapToRelay.total == recorded){
+    return 0;
+  }
+  times->field.push_back((uint32_t)(relayRiseUs - t));
+  times->read.push_back(tapToRelay.samples[(tapToRelay.next + LATENCY_SAMPLES - 1) % LATENCY_SAMPLES]);
+  return 1;
+}
+
+// Card taken away, waits out the timeout back to IDLE
+static bool leave (const uidType *uid){
+  hostCardLeave(SS_PIN, uid);
+  return hostRunUntilTrue([](){ return accessState(0) == ST_IDLE && hostPinLevel(RELAY_PIN) == LOW; },
+                          hostNow() + MS_TIMEOUT_PERIOD * 1000ULL + 1000000, 0);
+}
+
+static void printRow (const char *name, std::vector<uint32_t> &us){
+  if (us.empty()){
+    printf("  %-15s -\n", name);
+    return;
+  }
+  std::sort(us.begin(), us.end());
+  uint64_t sum = 0;
+  for (size_t i = 0; i < us.size(); i++){
+    sum += us[i];
+  }
+  printf("  %-15s avg %8.3fms  p50 %8.3fms  p99 %8.3fms  max %8.3fms\n", name, sum / 1000.0 / us.size(),
+         us[us.size() / 2] / 1000.0, us[(us.size() * 99) / 100] / 1000.0, us.back() / 1000.0);
+}
+
+static void bench (int cards){
+  hostPinWatch(relayEdge);
+  hostBrokerOnPublish(serverHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    failures++;
+    return;
+  }
+  hostRunFor(READER_ACTIVE_WINDOW * 1000ULL); // Readers back off to the idle period, where a tap after a while finds them
+
+  uint16_t n = 0x100;
+  for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++){
+    tapTimes uncached;
+    tapTimes cached;
+    hostNetLatency(latencies[l]);
+    for (int i = 0; i < cards; i++){
+      uidType uid = card(n++);
+      allowed.push_back(uidString(&uid));
+      if (!timeTap(&uid, ST_RELAY_ON, &uncached) || !leave(&uid)){ // First time, the server decides
+        printf("FAIL: uncached tap at %lums latency\n", (unsigned long)(latencies[l] / 1000));
+        failures++;
+        continue;
+      }
+      if (!timeTap(&uid, ST_AUTHORIZED, &cached) || !leave(&uid)){ // Again, off the cache
+        printf("FAIL: cached tap at %lums latency\n", (unsigned long)(latencies[l] / 1000));
+        failures++;
+      }
+    }
+    printf("tap-to-relay, %lums each way to the broker, server %lums, %d cards\n", (unsigned long)(latencies[l] / 1000),
+           (unsigned long)(SERVER_DELAY_US / 1000), cards);
+    printRow("uncached field", uncached.field);
+    printRow("cached field", cached.field);
+    printRow("uncached read", uncached.read);
+    printRow("cached read", cached.read);
+  }
+}
+
+int main (int argc, char **argv){
+  int cards = (argc > 1) ? atoi(argv[1]) : 50;
+  hostSeed((argc > 2) ? strtoul(argv[2], NULL, 0) : 1);
+
+  checkLookups();
+  checkTtls();
+  checkEviction();
+  checkExportImport();
+  checkResolve();
+  printf("cache checks: %s\n\n", failures ? "FAILED" : "ok");
+
+  bench(cards);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+/* Core split benchmark: what putting the RF side (estop/access/reader/led tasks) on CORE_RF and the network side on
+   CORE_NET buys, on the host harness (tools/host). Built twice, as shipped and with -DCORE_RF=0 so everything shares
+   core 0 with the WiFi driver, lwIP and async_tcp the way the harness models them. Taps go in on station 0 at a
+   random point of the idle poll, the server answering each in 5ms over a 1ms broker, and are timed from the card
+   entering the field to the relay pin going high. Twice:
+     quiet - nothing else happening
+     flood - the network side kept busy the whole time: auth responses for other people's taps every FLOOD_RSP_US,
+             a burst of FLOOD_OUTBOX offline taps pushed to the outbox every FLOOD_OUTBOX_US, and a FLOOD_MEMBERS
+             member snapshot every FLOOD_SNAPSHOT_US (the WiFi driver and async_tcp take it in, memberSyncTask
+             writes it to flash and erases the spare slot)
+   Alongside, the firmware's own tapToRelay (card selected by readerTask to relay closed) and transitionLatency (any
+   event posted to accessTask to its transition done), every sample copied out before their windows wrap.
+   Build and run from the repo root:
+     for c in 1 0; do
+       g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -DCORE_RF=$c -include Arduino.h -x c++ tool-access-RTOS.ino \
+         -x none *.cpp tools/host/host-*.cpp tools/core-split-bench.cpp -o /tmp/core-split-bench && \
+         /tmp/core-split-bench 100 1 $c
+     done
+   Arguments are [taps per run] [seed] [header, 1 or 0].
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "latency.h"
+#include "member-sync.h"
+#include "outbox.h"
+
+#define LATENCY_US        1000
+#define SERVER_DELAY_US   5000
+#define TAP_WITHIN        3000000  // us, anything slower is a failed tap
+#define FLOOD_RSP_US      2000
+#define FLOOD_OUTBOX_US   20000
+#define FLOOD_OUTBOX      8
+#define FLOOD_SNAPSHOT_US 250000
+#define FLOOD_MEMBERS     2000     // ~14KB a snapshot
+
+typedef struct {
+  latencyStat *stat;
+  uint32_t seen;               // stat->total as of the last look
+  std::vector<uint32_t> *into; // Where its samples go while a run is timed
+} statWatch;
+
+typedef struct {
+  std::vector<uint32_t> relay;
+  std::vector<uint32_t> tapToRelay;
+  std::vector<uint32_t> transition;
+} runTimes;
+
+static statWatch watches[] = {{&tapToRelay, 0, NULL}, {&transitionLatency, 0, NULL}};
+static uint64_t relayRise = 0;
+static uint32_t failures = 0;
+static bool flooding = 0;
+static uint32_t snapshotVersion = 1;
+static std::vector<byte> snapshotMsg;
+
+static uidType card (byte kind, uint16_t n){
+  uidType uid = UID4(0x04, 0xC0, 0x00, 0x00);
+  uid.bytes[1] |= kind;
+  uid.bytes[2] = n >> 8;
+  uid.bytes[3] = n;
+  return uid;
+}
+
+static void relayEdge (uint8_t pin, int level){
+  if (pin == RELAY_PIN && level == HIGH){
+    relayRise = hostNow();
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  std::string p(payload, len);
+  std::string rsp = "auth," + p.substr(0, p.find(','));
+  hostAfter(SERVER_DELAY_US, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+// hostRunUntilTrue () predicate wrapper, copies out the new samples of each stat before its window wraps
+static bool watch (bool done){
+  for (size_t i = 0; i < sizeof(watches) / sizeof(watches[0]); i++){
+    statWatch *w = &watches[i];
+    uint32_t fresh = min(w->stat->total - w->seen, (uint32_t)LATENCY_SAMPLES);
+    for (uint32_t k = fresh; k > 0 && w->into != NULL; k--){
+      w->into->push_back(w->stat->samples[(w->stat->next + LATENCY_SAMPLES - k) % LATENCY_SAMPLES]);
+    }
+    w->seen = w->stat->total;
+  }
+  return done;
+}
+
+//////// Flood, each one rescheduling itself until flooding stops ////////
+
+static void put32 (std::vector<byte> *out, uint32_t v){
+  for (int i = 0; i < 4; i++){
+    out->push_back((byte)(v >> (8 * i)));
+  }
+}
+
+// zlib's crc32, what member-sync.cpp checks
+static uint32_t crc32 (const std::vector<byte> &data){
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < data.size(); i++){
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++){
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320UL : 0);
+    }
+  }
+  return ~crc;
+}
+
+// FLOOD_MEMBERS strangers in uidHash order, with the version patched in and the crc redone per send
+static void buildSnapshot (){
+  std::vector<uidType> uids;
+  for (uint16_t i = 0; i < FLOOD_MEMBERS; i++){
+    uids.push_back(card(0x30, i));
+  }
+  std::stable_sort(uids.begin(), uids.end(), [](const uidType &a, const uidType &b){ return uidHash(a) < uidHash(b); });
+  snapshotMsg.clear();
+  put32(&snapshotMsg, MEMBER_WIRE_MAGIC);
+  snapshotMsg.push_back(MEMBER_WIRE_SNAPSHOT);
+  snapshotMsg.push_back(0);
+  snapshotMsg.push_back((byte)FLOOD_MEMBERS);
+  snapshotMsg.push_back((byte)(FLOOD_MEMBERS >> 8));
+  put32(&snapshotMsg, 0); // version
+  put32(&snapshotMsg, 0); // base
+  for (size_t i = 0; i < uids.size(); i++){
+    snapshotMsg.push_back(uids[i].length);
+    snapshotMsg.insert(snapshotMsg.end(), uids[i].bytes, uids[i].bytes + uids[i].length);
+    snapshotMsg.push_back(0x02); // Station 1 only, so none of them skip the server on station 0
+  }
+}
+
+static void floodSnapshot (){
+  if (!flooding){
+    return;
+  }
+  std::vector<byte> msg = snapshotMsg;
+  uint32_t version = ++snapshotVersion;
+  for (int i = 0; i < 4; i++){
+    msg[8 + i] = (byte)(version >> (8 * i));
+  }
+  put32(&msg, crc32(msg));
+  hostBrokerSend(memberSyncTopic(), (const char*)msg.data(), msg.size(), 0);
+  hostAfter(FLOOD_SNAPSHOT_US, floodSnapshot);
+}
+
+static void floodRsp (){
+  if (!flooding){
+    return;
+  }
+  uidType uid = card(0x20, hostRandom());
+  char uidStr[31];
+  byteToHexStr(uid.bytes, uid.length, uidStr, sizeof(uidStr));
+  std::string rsp = std::string("auth,") + uidStr;
+  hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  hostAfter(FLOOD_RSP_US, floodRsp);
+}
+
+static void floodOutbox (){
+  if (!flooding){
+    return;
+  }
+  for (int i = 0; i < FLOOD_OUTBOX; i++){
+    outboxPush(0, OUTBOX_TAP, "DE:AD:BE:EF", 1);
+  }
+  hostAfter(FLOOD_OUTBOX_US, floodOutbox);
+}
+
+//////// Taps ////////
+
+static bool tap (const uidType *uid, runTimes *times){
+  hostRunUntilTrue([](){ return watch(0); }, hostNow() + hostRandom() % (MS_READER_IDLE_PERIOD * 1000), 0);
+  relayRise = 0;
+  hostCardEnter(SS_PIN, uid);
+  uint64_t t = hostNow();
+  if (!hostRunUntilTrue([](){ return watch(relayRise != 0); }, t + TAP_WITHIN, 0)){
+    return 0;
+  }
+  times->relay.push_back(relayRise - t);
+  hostCardLeave(SS_PIN, uid);
+  return hostRunUntilTrue([](){ return watch(accessState(0) == ST_IDLE); },
+                          hostNow() + MS_TIMEOUT_PERIOD * 1000ULL + 1000000, 0);
+}
+
+static void run (bool flood, int taps, uint16_t *n, runTimes *times){
+  flooding = flood;
+  if (flood){
+    floodRsp();
+    floodOutbox();
+    floodSnapshot();
+    hostRunFor(FLOOD_SNAPSHOT_US); // Into its stride
+  }
+  watch(0);
+  watches[0].into = &times->tapToRelay;
+  watches[1].into = &times->transition;
+  for (int i = 0; i < taps; i++){
+    uidType uid = card(0, (*n)++);
+    if (!tap(&uid, times)){
+      printf("FAIL: tap %d of the %s run\n", i, flood ? "flood" : "quiet");
+      failures++;
+    }
+  }
+  watches[0].into = NULL;
+  watches[1].into = NULL;
+  flooding = 0;
+  hostRunFor(2 * FLOOD_SNAPSHOT_US); // Let the last of it drain
+}
+
+static uint32_t pct (std::vector<uint32_t> &us, int p){
+  if (us.empty()){
+    return 0;
+  }
+  std::sort(us.begin(), us.end());
+  return us[min(us.size() - 1, (us.size() * p) / 100)];
+}
+
+static void printRow (const char *name, runTimes *t){
+  printf("%-5s %-5s %7.2f %7.2f %7.2f   %6u %6u %6u   %6u %6u %6u\n", CORE_RF == CORE_NET ? "one" : "split", name,
+         pct(t->relay, 50) / 1000.0, pct(t->relay, 99) / 1000.0, pct(t->relay, 100) / 1000.0,
+         pct(t->tapToRelay, 50), pct(t->tapToRelay, 99), pct(t->tapToRelay, 100),
+         pct(t->transition, 50), pct(t->transition, 99), pct(t->transition, 100));
+}
+
+int main (int argc, char **argv){
+  int taps = (argc > 1) ? atoi(argv[1]) : 100;
+  hostSeed((argc > 2) ? strtoul(argv[2], NULL, 0) : 1);
+  bool header = (argc > 3) ? atoi(argv[3]) : 1;
+
+  hostNetLatency(LATENCY_US);
+  hostPinWatch(relayEdge);
+  hostBrokerOnPublish(serverHook);
+  buildSnapshot();
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+
+  uint16_t n = 0;
+  runTimes quiet;
+  runTimes flood;
+  run(0, taps, &n, &quiet);
+  run(1, taps, &n, &flood);
+  if (memberSyncVersion() < 2){
+    printf("FAIL: no snapshot went in, the flood never reached the board\n");
+    failures++;
+  }
+
+  if (header){
+    printf("%-5s %-5s %23s   %20s   %20s\n", "", "", "card to relay ms", "tapToRelay us", "transition us");
+    printf("%-5s %-5s %7s %7s %7s   %6s %6s %6s   %6s %6s %6s\n", "cores", "run", "p50", "p99", "max", "p50", "p99",
+           "max", "p50", "p99", "max");
+  }
+  printRow("quiet", &quiet);
+  printRow("flood", &flood);
+  if (hostFaults() > 0){
+    printf("%u harness faults\n", hostFaults());
+    failures++;
+  }
+  return failures ? 1 : 0;
+}
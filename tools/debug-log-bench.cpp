@@ -0,0 +1,136 @@
+/* Debug log benchmark: what the Serial sink costs the tasks that log, on the host harness (tools/host), whose UART
+   takes 128 bytes into its FIFO and then holds the writer at 115200 baud the way the ESP32's does. The whole sketch is
+   built twice:
+     sync - with DLOG_SYNC, every line formatted and written to Serial by the task that logged it, as the Serial.print
+            calls did before debug-log.cpp
+     ring - as shipped, the line goes into the ring and dlogTask writes it at idle priority
+   then taps go in on station 0 (1ms broker, 5ms server) and are held for TAP_HOLD_US. Per build:
+     relay     card entering the field to the relay pin going high, avg and max
+     reader    readerTask's time per pass over the readers (its loop), avg
+     access    accessTask's busy time per tap
+     dlog      dlogTask's busy time per tap, where the Serial time went
+   A third argument of 1 boots with SPIFFS failing to mount and the flash sink turned up to INFO, so every line is one
+   it would write. fs opens counts SPIFFS.open () calls, everyone's, so a sink that keeps trying its file shows up.
+   Build and run from the repo root:
+     for mode in -DDLOG_SYNC -UDLOG_SYNC; do
+       g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. $mode -include Arduino.h -x c++ tool-access-RTOS.ino \
+         -x none *.cpp tools/host/host-*.cpp tools/debug-log-bench.cpp -o /tmp/debug-log-bench && /tmp/debug-log-bench
+     done
+   Arguments are [taps] [seed] [broken mount, 1 or 0].
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "debug-log.h"
+
+#define LATENCY_US      1000
+#define SERVER_DELAY_US 5000
+#define TAP_HOLD_US     2000000
+#define TAP_WITHIN      3000000  // us, anything slower is a failed tap
+
+extern TaskHandle_t accessHandle; // tool-access-RTOS.ino
+extern TaskHandle_t readerHandle;
+extern TaskHandle_t dlogHandle;
+
+static uint64_t relayRise = 0;
+static uint32_t failures = 0;
+
+static void relayEdge (uint8_t pin, int level){
+  if (pin == RELAY_PIN && level == HIGH){
+    relayRise = hostNow();
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  std::string p(payload, len);
+  std::string rsp = "auth," + p.substr(0, p.find(','));
+  hostAfter(SERVER_DELAY_US, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+static bool tap (uint16_t n, std::vector<uint32_t> *relay){
+  uidType uid = UID4(0x04, 0xD1, (byte)(n >> 8), (byte)n);
+  hostRunFor(hostRandom() % (MS_READER_IDLE_PERIOD * 1000));
+  relayRise = 0;
+  hostCardEnter(SS_PIN, &uid);
+  uint64_t t = hostNow();
+  if (!hostRunUntilTrue([](){ return relayRise != 0; }, t + TAP_WITHIN, 0)){
+    return 0;
+  }
+  relay->push_back(relayRise - t);
+  hostRunFor(TAP_HOLD_US);
+  hostCardLeave(SS_PIN, &uid);
+  return hostRunUntilTrue([](){ return accessState(0) == ST_IDLE; }, hostNow() + MS_TIMEOUT_PERIOD * 1000ULL + 1000000, 0);
+}
+
+int main (int argc, char **argv){
+  int taps = (argc > 1) ? atoi(argv[1]) : 40;
+  hostSeed((argc > 2) ? strtoul(argv[2], NULL, 0) : 1);
+  bool broken = (argc > 3) ? atoi(argv[3]) : 0;
+  std::vector<uint32_t> relay;
+
+  hostFsBroken(broken);
+  if (broken){
+    dlogSetSink(DLOG_SINK_FLASH, DLOG_LEVEL_INFO);
+  }
+  hostNetLatency(LATENCY_US);
+  hostPinWatch(relayEdge);
+  hostBrokerOnPublish(serverHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+  hostRunFor(READER_ACTIVE_WINDOW * 1000ULL); // Boot's lines out of the way, the reader backed off
+
+  uint32_t opens = hostFsOpens();
+  uint32_t accessUs = hostTaskRunUs(accessHandle);
+  uint32_t dlogUs = hostTaskRunUs(dlogHandle);
+  uint32_t readerUs = hostTaskRunUs(readerHandle);
+  uint32_t cycles = readerGetStats()->cycles;
+  uint64_t start = hostNow();
+  for (int i = 0; i < taps; i++){
+    if (!tap(i, &relay)){
+      printf("FAIL: tap %d\n", i);
+      failures++;
+    }
+  }
+  hostRunFor(DLOG_DRAIN_PERIOD * 1000ULL * 2); // The last lines drained
+  cycles = readerGetStats()->cycles - cycles;
+  taps = max(taps, 1);
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < relay.size(); i++){
+    sum += relay[i];
+  }
+  std::sort(relay.begin(), relay.end());
+
+#ifdef DLOG_SYNC
+  const char *build = "sync";
+#else
+  const char *build = "ring";
+#endif
+  printf("%-5s %6s %7s   %9s   %9s   %9s   %9s\n", "build", "relay", "ms", "reader us", "access us", "dlog us",
+         "fs opens");
+  printf("%-5s %6s %7s   %9s   %9s   %9s   %9s\n", "", "avg", "max", "per pass", "per tap", "per tap", "per min");
+  printf("%-5s %6.2f %7.2f   %9.0f   %9.0f   %9.0f   %9.1f\n", build,
+         relay.empty() ? 0 : sum / 1000.0 / relay.size(), relay.empty() ? 0 : relay.back() / 1000.0,
+         cycles ? (double)(hostTaskRunUs(readerHandle) - readerUs) / cycles : 0,
+         (double)(hostTaskRunUs(accessHandle) - accessUs) / taps, (double)(hostTaskRunUs(dlogHandle) - dlogUs) / taps,
+         (hostFsOpens() - opens) * 60e6 / (hostNow() - start));
+  if (hostFaults() > 0){
+    printf("%u harness faults\n", hostFaults());
+    failures++;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""eStop latency check against a board on a local broker.
+
+Fires rfid/estop "fire" then "clear" --rounds times, then waits for the
+board's next metrics snapshot and checks the worst fire-to-relays-open and
+fire-to-ESTOP times against the bounds in estop.h. Exits 1 if either was
+over, or if the board didn't time every fire.
+    estop-bench.py --host localhost --mac AABBCCDDEEFF --rounds 50
+
+rfid/estop is not per board, every board on the broker stops. Use a broker
+with only the bench board on it.
+
+A saved snapshot can be checked on its own, no broker needed:
+    estop-bench.py --snapshot snap.bin
+
+An MQTT fire runs the same relayTrip () and follow up as the switch, so this
+covers everything bar the switch ISR's entry. Needs paho-mqtt for the broker
+mode (pip install paho-mqtt).
+"""
+import argparse
+import os
+import queue
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+decoder = __import__("metrics-decode")
+
+RELAY_BOUND_US = 50    # ESTOP_RELAY_BOUND_US
+STATE_BOUND_US = 5000  # ESTOP_STATE_BOUND_US
+
+
+def check(snap, relay_bound, state_bound, fires):
+    """Prints the eStop numbers from a parsed snapshot, returns True if they're within the bounds"""
+    g, c, h = snap["gauges"], snap["counters"], snap["hists"]
+    timed = sum(h.get("estop_to_relay", ()))
+    relay = g.get("estop_relay_max_us", 0)
+    state = g.get("estop_state_max_us", 0)
+    ok = relay <= relay_bound and state <= state_bound and c.get("estop_late", 0) == 0
+    print("fires timed %d, worst to relays open %dus (bound %d), worst to ESTOP %dus (bound %d), over bound %d"
+          % (timed, relay, relay_bound, state, state_bound, c.get("estop_late", 0)))
+    if fires is not None and timed < fires:
+        print("only %d of the %d fires were timed" % (timed, fires))
+        ok = False
+    return ok
+
+
+class Board:
+    def __init__(self, host, port, mac):
+        import paho.mqtt.client as mqtt
+        self.snaps = queue.Queue()
+        self.client = mqtt.Client()
+        self.client.on_message = lambda client, userdata, msg: self.snaps.put(msg.payload)
+        self.client.connect(host, port)
+        self.client.subscribe("rfid/metrics/" + mac, 0)
+        self.client.loop_start()
+
+    def estop(self, command):
+        self.client.publish("rfid/estop", command, qos=2).wait_for_publish()
+
+    def next_snapshot(self, timeout):
+        try:
+            return decoder.parse(self.snaps.get(timeout=timeout))
+        except queue.Empty:
+            return None
+
+
+def main(argv):
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--host", default="localhost")
+    p.add_argument("--port", type=int, default=1883)
+    p.add_argument("--mac", help="board's MAC, 12 hex digits as in its rfid/metrics topic")
+    p.add_argument("--rounds", type=int, default=20)
+    p.add_argument("--hold", type=float, default=0.5, help="seconds between fire and clear, and clear and the next fire")
+    p.add_argument("--timeout", type=float, default=150.0, help="seconds to wait for a snapshot, METRICS_PERIOD is 60")
+    p.add_argument("--relay-bound", type=int, default=RELAY_BOUND_US)
+    p.add_argument("--state-bound", type=int, default=STATE_BOUND_US)
+    p.add_argument("--snapshot", help="check a saved snapshot instead")
+    args = p.parse_args(argv[1:])
+
+    if args.snapshot:
+        with open(args.snapshot, "rb") as f:
+            return 0 if check(decoder.parse(f.read()), args.relay_bound, args.state_bound, None) else 1
+    if not args.mac:
+        p.error("--mac is needed unless --snapshot")
+
+    board = Board(args.host, args.port, args.mac.upper())
+    before = board.next_snapshot(args.timeout)  # Totals are since boot, so count against one taken first
+    if before is None:
+        print("no metrics from %s" % args.mac)
+        return 1
+    for _ in range(args.rounds):
+        board.estop("fire")
+        time.sleep(args.hold)
+        board.estop("clear")
+        time.sleep(args.hold)
+    while not board.snaps.empty():  # Anything that went out mid run doesn't have all the fires in it
+        board.snaps.get_nowait()
+    after = board.next_snapshot(args.timeout)
+    if after is None:
+        print("no metrics after the fires")
+        return 1
+    fires = args.rounds + sum(before["hists"].get("estop_to_relay", ()))
+    return 0 if check(after, args.relay_bound, args.state_bound, fires) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
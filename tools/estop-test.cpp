@@ -0,0 +1,185 @@
+/* eStop test (estop.cpp) on the host harness (tools/host), with the switch wired. Everything is timed from outside the
+   firmware too, off the relay pin's own edge, so the bound is checked against what the pad did and not only against
+   the firmware's say so. Checks:
+   - switch: the switch's edge to the relay pin low is within ESTOP_RELAY_BOUND_US, ISR entry included. The
+     firmware's own figure (ISR entry to the pads reading low) is within it too, and no more than what was seen outside
+   - mqtt: the rfid/estop "fire" reaching the board to the relay pin low, the same
+   - queue full: a fire while the state machine's queue is full still gets the state machine to ESTOP (estopTask
+     retries the post), the queue's high water says it was full, and the clear after it lets the relay close again on
+     the next tap
+   - stuck relay: a relay pin held high from outside after the trip is reported as never opening (UINT32_MAX) and
+     counted late, rather than passed because the registers were written
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -DESTOP_PIN=25 -include Arduino.h -x c++ tool-access-RTOS.ino \
+       -x none *.cpp tools/host/host-*.cpp tools/estop-test.cpp -o /tmp/estop-test
+     /tmp/estop-test [seed]
+   Exits 1 if a check fails.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <stdlib.h>
+#include <string>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "estop.h"
+#include "metrics.h"
+
+#define LATENCY_US      1000
+#define SERVER_DELAY_US 5000
+#define TAP_WITHIN      3000000
+#define ESTOP_WITHIN    100000   // us, to ESTOP, well past ESTOP_STATE_BOUND_US so a slow one is measured not timed out
+
+static uint32_t failures = 0;
+static uint16_t cards = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check (bool ok, const char *what, int line){
+  if (!ok){
+    printf("FAIL line %d: %s\n", line, what);
+    failures++;
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  std::string p(payload, len);
+  std::string rsp = "auth," + p.substr(0, p.find(','));
+  hostAfter(SERVER_DELAY_US, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+static void mqttEstop (const char *command){
+  hostBrokerSend("rfid/estop", command, strlen(command), 0);
+}
+
+static bool waitState (byte state, uint64_t withinUs){
+  return hostRunUntilTrue([=](){ return accessState(0) == state; }, hostNow() + withinUs, 0);
+}
+
+// A card in session on station 0, relay closed
+static bool session (uidType *uid){
+  *uid = UID4(0x04, 0xE5, (byte)(cards >> 8), (byte)cards);
+  cards++;
+  hostCardEnter(SS_PIN, uid);
+  return hostRunUntilTrue([](){ return accessState(0) == ST_RELAY_ON && hostPinLevel(RELAY_PIN) == HIGH; },
+                          hostNow() + TAP_WITHIN, 0);
+}
+
+// Card gone, cleared, back in IDLE
+static bool clear (const uidType *uid){
+  hostCardLeave(SS_PIN, uid);
+  hostRunFor(hostRandom() % 200000);
+  mqttEstop("clear");
+  return waitState(ST_IDLE, 4 * LATENCY_US + 50000);
+}
+
+//////// Checks, on the booted board ////////
+
+static void checkSwitch (){
+  uidType uid;
+  uint32_t late = metricCounters[CTR_ESTOP_LATE];
+
+  CHECK(session(&uid));
+  hostRunFor(hostRandom() % 500000);
+  uint64_t edge = hostNow();
+  hostPinDrive(ESTOP_PIN, HIGH);
+  CHECK(waitState(ST_ESTOP, ESTOP_WITHIN));
+  CHECK(hostPinLevel(RELAY_PIN) == LOW);
+  uint64_t outside = hostPinChanged(RELAY_PIN) - edge;
+  CHECK(outside <= ESTOP_RELAY_BOUND_US);
+  CHECK(estopRelayMaxUs() <= ESTOP_RELAY_BOUND_US);
+  CHECK(estopRelayMaxUs() <= outside); // It can't see the edge before ISR entry
+  CHECK(metricCounters[CTR_ESTOP_LATE] == late);
+  printf("switch: edge to relay pin low %luus, firmware says %luus\n", (unsigned long)outside,
+         (unsigned long)estopRelayMaxUs());
+
+  hostPinDrive(ESTOP_PIN, LOW);
+  CHECK(clear(&uid));
+}
+
+static void checkMqtt (){
+  uidType uid;
+  uint32_t late = metricCounters[CTR_ESTOP_LATE];
+
+  CHECK(session(&uid));
+  hostRunFor(hostRandom() % 500000);
+  mqttEstop("fire");
+  CHECK(waitState(ST_ESTOP, ESTOP_WITHIN));
+  CHECK(hostPinLevel(RELAY_PIN) == LOW);
+  uint64_t outside = hostPinChanged(RELAY_PIN) - hostMqttArrived();
+  CHECK(outside <= ESTOP_RELAY_BOUND_US);
+  CHECK(estopRelayMaxUs() <= ESTOP_RELAY_BOUND_US);
+  CHECK(metricCounters[CTR_ESTOP_LATE] == late);
+  printf("mqtt: arrival to relay pin low %luus\n", (unsigned long)outside);
+  CHECK(clear(&uid));
+}
+
+static void checkQueueFull (){
+  uidType uid;
+  uint32_t filled = 0;
+
+  CHECK(session(&uid));
+  hostRunFor(hostRandom() % 500000);
+  hostAt(hostNow(), [&](){ // All in one go, nothing runs in between
+    while (accessPost(0, EV_NET_UP, NULL)){ // Ignored in RELAY_ON
+      filled++;
+    }
+    estopFire(ESTOP_SRC_MQTT, micros());
+  });
+  CHECK(waitState(ST_ESTOP, ESTOP_WITHIN));
+  CHECK(filled > 0);
+  uint32_t queueMax;
+  accessQueueDepth(&queueMax);
+  CHECK(queueMax == ACCESS_QUEUE_DEPTH); // The high water saw it full
+  CHECK(hostPinLevel(RELAY_PIN) == LOW);
+  printf("queue full: %lu events ahead of the fire\n", (unsigned long)filled);
+  CHECK(clear(&uid));
+
+  CHECK(session(&uid)); // The latch came off with the clear
+  hostCardLeave(SS_PIN, &uid);
+  CHECK(waitState(ST_IDLE, MS_TIMEOUT_PERIOD * 1000ULL + 1000000));
+}
+
+static void checkStuck (){
+  uidType uid;
+  uint32_t late = metricCounters[CTR_ESTOP_LATE];
+
+  CHECK(session(&uid));
+  hostPinStuck(RELAY_PIN, HIGH);
+  mqttEstop("fire");
+  CHECK(waitState(ST_ESTOP, ESTOP_WITHIN));
+  CHECK(estopRelayMaxUs() == UINT32_MAX);
+  CHECK(metricCounters[CTR_ESTOP_LATE] == late + 1);
+  hostPinStuck(RELAY_PIN, -1);
+  CHECK(hostPinLevel(RELAY_PIN) == LOW); // What was written all along
+  CHECK(clear(&uid));
+}
+
+int main (int argc, char **argv){
+  hostSeed((argc > 1) ? strtoul(argv[1], NULL, 0) : 1);
+  hostNetLatency(LATENCY_US);
+  hostBrokerOnPublish(serverHook);
+  hostPinDrive(ESTOP_PIN, LOW); // Switch closed to GND, not pressed
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+
+  checkSwitch();
+  checkMqtt();
+  checkQueueFull();
+  checkStuck(); // Last, the worst since boot is UINT32_MAX from here on
+  if (hostFaults() > 0){
+    printf("%u harness faults\n", hostFaults());
+    failures++;
+  }
+  printf("estop checks: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
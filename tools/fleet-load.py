@@ -0,0 +1,710 @@
+#!/usr/bin/env python3
+"""Fleet load generator for the auth server and broker.
+
+Runs --boards virtual boards of --stations stations each against a broker, one
+MQTT connection per board, and plays scripted taps, removals and collisions on
+them. Every station runs the firmware's own state machine: the states, events,
+transition table and reader modes are read out of access-fsm.h/.cpp, the
+topics and commands out of outbox.cpp and mqtt-dispatch.cpp and the periods
+out of the headers, each time it starts. An action or handler in those tables
+that this tool doesn't know stops it, so it can't quietly drift from the firmware.
+    fleet-load.py --host localhost --boards 200 --duration 300
+    fleet-load.py --host localhost --boards 200 --pattern shift --burst 60
+    fleet-load.py --host localhost --boards 100 --outage-every 60 --outage-for 10 --outage-fraction 1
+
+Patterns: "steady" taps each station about --rate times an hour, "shift" puts
+every station's first tap in the first --burst seconds (a shift change) and
+goes steady after. A session lasts about --hold seconds, --collision of them
+end with a second card on the reader, --retap of them come back within the
+removal timeout (a handover). --unknown of the cards aren't members.
+
+Outages drop --outage-fraction of the boards off the broker every
+--outage-every seconds for --outage-for, 1 is a reconnect storm. Boards come
+back the way the firmware does: on the next MS_MQTT_RECONNECT_PERIOD retry,
+then up to OUTBOX_CONNECT_JITTER before draining what they held. --estop-at
+fires rfid/estop (every real board on the broker stops too) and clears it
+--estop-for seconds later.
+
+Reports the auth round trip (req publish to rsp), tap to relay, throughput
+and the timeout and denial rates every --report seconds and at the end. Taps
+decided offline are counted but not timed. "engine lag" is how late this tool
+got to its own timers, if it's more than a few ms the numbers are the tool's.
+
+--loopback needs no broker: an in-process broker and a stand-in server that
+answers every req after about --server-ms, to check a script before pointing
+it at the real thing. Needs paho-mqtt otherwise (pip install paho-mqtt).
+"""
+import argparse
+import collections
+import heapq
+import math
+import os
+import queue
+import random
+import re
+import sys
+import time
+
+SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# access-fsm.cpp action -> Fleet method, mqtt-dispatch.cpp handler -> Fleet method
+ACTIONS = {
+    "actCardArrived": "card_arrived", "actHandover": "handover", "actSessionStart": "session_start",
+    "actHandoverGrant": "handover_grant", "actHandoverExpired": "handover_expired", "actDenied": "denied",
+    "actNoAnswer": "no_answer", "actRevoked": "revoked", "actRemoved": "removed", "actCollision": "collision",
+    "actTimedOut": "timed_out", "actEstop": "estop", "actEstopRepeat": "nothing", "actEstopClear": "estop_clear",
+}
+HANDLERS = {
+    "handleAuth": "handle_auth", "handleDenied": "handle_denied", "handleKiosk": "nothing",
+    "handleEstopFire": "handle_estop_fire", "handleEstopClear": "handle_estop_clear",
+}
+
+
+def read(name):
+    with open(os.path.join(SRC, name)) as f:
+        return f.read()
+
+
+def define(text, name):
+    """Value of #define NAME n or #define NAME pdMS_TO_TICKS(n)"""
+    m = re.search(r"#define\s+%s\s+(?:pdMS_TO_TICKS\()?(\d+)" % name, text)
+    if m is None:
+        raise SystemExit("#define %s not found, has it moved?" % name)
+    return int(m.group(1))
+
+
+class Firmware:
+    """The parts of the sketch the stations run"""
+
+    def __init__(self):
+        fsm_h, fsm_cpp = read("access-fsm.h"), read("access-fsm.cpp")
+        headers = "".join(read(f) for f in ("tool-access-RTOS.h", "access-fsm.h", "outbox.h", "auth-cache.h", "estop.h"))
+        self.const = {k: int(v, 0) for k, v in re.findall(r"#define\s+((?:ST|EV|RELAY|READER)_\w+)\s+(0x[0-9A-Fa-f]+|\d+)", fsm_h)}
+        self.ev = collections.namedtuple("Events", [k[3:] for k in self.const if k.startswith("EV_")])(
+            *[v for k, v in self.const.items() if k.startswith("EV_")])
+
+        # stateInfo[] has a row per ST_* in order: its name and what the reader does in it
+        rows = re.findall(r'\{"(\w+)",\s*(READER_\w+)\}', fsm_cpp)
+        self.states = [name for name, _ in rows]
+        self.reader = [self.const[mode] for _, mode in rows]
+
+        table = fsm_cpp[fsm_cpp.index("transitionTable[] = {"):]
+        table = table[:table.index("};")]
+        self.table = []  # (from, event, to, relay closed, action or None)
+        for frm, ev, to, relay, _led, action in re.findall(
+                r"\{(ST_\w+),\s*(EV_\w+),\s*(ST_\w+),\s*(RELAY_\w+),\s*(LED_\w+),\s*(\w+)\}", table):
+            self.table.append((self.const[frm], self.const[ev], self.const[to], relay == "RELAY_CLOSE",
+                               None if action == "NULL" else action))
+
+        self.commands = {}  # (topic, command word) -> handler
+        for topic, command, _retained, handler in re.findall(r'MQTT_ROW\("([^"]+)",\s*"(\w+)",\s*(\d),\s*(\w+)\)',
+                                                             read("mqtt-dispatch.cpp")):
+            self.commands[(topic, command)] = handler
+        named = dict(re.findall(r'#define\s+(\w+_TOPIC)\s+"([^"]+)"', headers))
+        self.topics = {}  # OUTBOX_* -> topic
+        for box, topic in re.findall(r"case (OUTBOX_\w+): return ([^;]+);", read("outbox.cpp")):
+            self.topics[box] = topic.strip('"') if topic.startswith('"') else named[topic]
+
+        self.auth_wait = define(headers, "MS_AUTH_WAIT_PERIOD") / 1000.0
+        self.removal_timeout = define(headers, "MS_TIMEOUT_PERIOD") / 1000.0
+        self.reconnect = define(headers, "MS_MQTT_RECONNECT_PERIOD") / 1000.0
+        self.jitter = define(headers, "OUTBOX_CONNECT_JITTER") / 1000.0
+        self.outbox_size = define(headers, "OUTBOX_SIZE")
+        self.grant_unknown = define(headers, "OFFLINE_GRANT_UNKNOWN") != 0
+
+        for row in self.table:
+            if row[4] is not None and row[4] not in ACTIONS:
+                raise SystemExit("access-fsm.cpp has an action this tool doesn't know, %s. Add it to ACTIONS" % row[4])
+        for handler in self.commands.values():
+            if handler not in HANDLERS:
+                raise SystemExit("mqtt-dispatch.cpp has a handler this tool doesn't know, %s. Add it to HANDLERS" % handler)
+
+    def find(self, state, event):
+        """First matching row wins, same as findTransition ()"""
+        for row in self.table:
+            if row[1] == event and (row[0] == state or row[0] == self.const["ST_ANY"]):
+                return row
+        return None
+
+
+class Engine:
+    """Every station runs on this one thread, like accessTask. MQTT callbacks post () to it, at () is a timer"""
+
+    def __init__(self):
+        self.inbox = queue.Queue()
+        self.timers = []
+        self.seq = 0
+        self.start = time.monotonic()
+        self.lag = 0.0  # Worst since the last report
+
+    def now(self):
+        return time.monotonic() - self.start
+
+    def post(self, fn, *args):
+        self.inbox.put((fn, args))
+
+    def at(self, delay, fn, *args):
+        self.seq += 1
+        heapq.heappush(self.timers, (self.now() + delay, self.seq, fn, args))
+
+    def run(self, until):
+        while True:
+            now = self.now()
+            while self.timers and self.timers[0][0] <= now:
+                due, _, fn, args = heapq.heappop(self.timers)
+                self.lag = max(self.lag, now - due)
+                fn(*args)
+            if now >= until:
+                return
+            wait = (self.timers[0][0] if self.timers else until) - now
+            try:
+                fn, args = self.inbox.get(timeout=max(0.0, min(wait, until - now)))
+                fn(*args)
+            except queue.Empty:
+                pass
+
+
+class Station:
+    def __init__(self, board, index):
+        self.board = board
+        self.index = index
+        self.state = 0          # ST_IDLE, accessInit () then posts EV_NET_DOWN
+        self.relay = False
+        self.timer_gen = 0
+        self.uid = None         # card.uidStr, the last card read
+        self.session = None     # Card the relay was closed for
+        self.tap_at = None      # When uid was read, until the relay closes for it
+        self.on_reader = []     # Cards physically on the reader
+        self.last_card = None
+
+
+class Board:
+    def __init__(self, index, stations):
+        self.index = index
+        self.stations = [Station(self, i) for i in range(stations)]
+        self.connected = False
+        self.cache = {}         # uidStr -> allowed, the auth cache
+        self.pending = {}       # station -> [uidStr, from cache, req published at]
+        self.owed = 0           # Reqs given up on whose rsp may still come
+        self.held = collections.deque()  # The outbox while offline: (box, station, uidStr, granted, stamp)
+        self.link = None
+
+
+def percentile(values, pct):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100.0))]
+
+
+def fmt_ms(s):
+    return "-" if s is None else "%.0fms" % (s * 1000)
+
+
+class Stats:
+    def __init__(self):
+        self.total = collections.Counter()
+        self.window = collections.Counter()
+        self.rtt = []
+        self.rtt_window = []
+        self.tap_to_relay = []
+
+    def add(self, name, n=1):
+        self.total[name] += n
+        self.window[name] += n
+
+    def line(self, count, rtt, seconds):
+        taps = count["taps"]
+        return ("taps %d req %d (%.1f/s) rsp %d (%.1f/s) rtt p50 %s p90 %s p99 %s max %s, timeouts %d (%.1f%%), denied %d (%.1f%%)"
+                % (taps, count["req"], count["req"] / seconds, count["rsp"], count["rsp"] / seconds,
+                   fmt_ms(percentile(rtt, 50)), fmt_ms(percentile(rtt, 90)), fmt_ms(percentile(rtt, 99)),
+                   fmt_ms(max(rtt) if rtt else None), count["no_answer"], 100.0 * count["no_answer"] / max(1, count["req"]),
+                   count["denied"] + count["revoked"], 100.0 * (count["denied"] + count["revoked"]) / max(1, taps)))
+
+
+class Fleet:
+    def __init__(self, fw, engine, args):
+        self.fw = fw
+        self.ev = fw.ev
+        self.engine = engine
+        self.args = args
+        self.stats = Stats()
+        self.followups = collections.deque()
+        self.removal_timeout = args.removal_timeout or fw.removal_timeout
+        rng = random.Random(args.seed)
+        self.rng = rng
+        self.cards = [":".join("%02X" % rng.randrange(256) for _ in range(7 if rng.random() < 0.2 else 4))
+                      for _ in range(args.cards)]
+        self.unknown = set(self.cards[:int(len(self.cards) * args.unknown)])
+        self.boards = [Board(i, args.stations) for i in range(args.boards)]
+        self.last_report = 0.0
+
+    # State machine, as accessDispatch () and the actions in access-fsm.cpp
+
+    def post(self, st, event, arg=None):
+        """accessPost (). We're already on the engine thread so it runs now, its follow ups before anything else"""
+        self.dispatch(st, event, arg)
+        while self.followups:
+            self.dispatch(*self.followups.popleft())
+
+    def follow(self, st, event):
+        self.followups.append((st, event, None))
+
+    def post_board(self, board, event):
+        """STATION_ALL, every station in turn"""
+        for st in board.stations:
+            self.post(st, event)
+
+    def dispatch(self, st, event, arg):
+        if event == self.ev.TIMEOUT_EXPIRED and arg != st.timer_gen:
+            return  # Stopped or restarted since
+        row = self.fw.find(st.state, event)
+        if row is None:
+            return
+        st.state = row[2]
+        if row[3] and not st.relay and st.tap_at is not None:
+            self.stats.tap_to_relay.append(self.engine.now() - st.tap_at)
+            st.tap_at = None
+        st.relay = row[3]
+        if row[4] is not None:
+            getattr(self, ACTIONS[row[4]])(st, arg)
+        if self.fw.reader[st.state] == self.fw.const["READER_TRACK"]:
+            self.engine.at(0.1, self.track, st)  # Next presence poll, MS_READER_PRESENT_PERIOD
+
+    def start_timer(self, st, seconds):
+        st.timer_gen += 1
+        self.engine.at(seconds, self.post, st, self.ev.TIMEOUT_EXPIRED, st.timer_gen)
+
+    def stop_timer(self, st):
+        st.timer_gen += 1
+
+    def back_to_idle(self, st):
+        if not st.board.connected:
+            self.follow(st, self.ev.NET_DOWN)
+
+    def decide(self, st, uid):
+        """decideAuth ()"""
+        board = st.board
+        st.uid = uid
+        st.tap_at = self.engine.now()
+        cached = board.cache.get(uid)
+        local = not board.connected
+        if not local:
+            board.pending[st.index] = [uid, cached is True, self.engine.now()]
+            if not self.outbox(st, "OUTBOX_REQ", uid):
+                self.clear_pending(st, False)
+                local = True
+            elif cached is True:
+                self.stats.add("cached")
+                self.follow(st, self.ev.AUTH_CACHED)
+        if local:
+            self.stats.add("offline")
+            granted = cached is True or (cached is None and self.fw.grant_unknown)
+            self.outbox(st, "OUTBOX_TAP", uid, granted)
+            self.follow(st, self.ev.AUTH_GRANTED if granted else self.ev.AUTH_DENIED)
+
+    def nothing(self, *args):
+        pass
+
+    def card_arrived(self, st, uid):
+        self.stats.add("taps")
+        self.start_timer(st, self.fw.auth_wait)
+        self.decide(st, uid)
+
+    def handover(self, st, uid):
+        self.stats.add("taps")
+        self.decide(st, uid)
+
+    def session_start(self, st, arg):
+        self.stop_timer(st)
+        st.session = st.uid
+        self.stats.add("grants")
+
+    def handover_grant(self, st, arg):
+        self.stop_timer(st)
+        st.session = st.uid
+        self.stats.add("grants")
+
+    def handover_expired(self, st, arg):
+        st.session = None
+        self.start_timer(st, self.fw.auth_wait)
+
+    def denied(self, st, arg):
+        self.stats.add("denied")
+        self.stop_timer(st)
+        self.back_to_idle(st)
+
+    def no_answer(self, st, arg):
+        self.stats.add("no_answer")
+        self.clear_pending(st, True)
+        self.back_to_idle(st)
+
+    def revoked(self, st, arg):
+        self.stats.add("revoked")
+        self.stop_timer(st)
+        st.session = None
+        self.back_to_idle(st)
+
+    def removed(self, st, arg):
+        self.outbox(st, "OUTBOX_EOU", st.uid)
+        self.start_timer(st, self.removal_timeout)
+
+    def collision(self, st, arg):
+        self.stats.add("collisions")
+        self.outbox(st, "OUTBOX_EOU", st.uid)
+        self.start_timer(st, self.removal_timeout)
+
+    def timed_out(self, st, arg):
+        st.session = None
+        self.back_to_idle(st)
+
+    def estop(self, st, arg):
+        self.stats.add("estops")
+        self.stop_timer(st)
+        self.clear_pending(st, True)
+        st.session = None
+
+    def estop_clear(self, st, arg):
+        self.back_to_idle(st)
+
+    # Outbox, as outbox.cpp: reqs only go out while connected, the rest are held until the next connect
+
+    def outbox(self, st, box, uid, granted=False):
+        board = st.board
+        if box == "OUTBOX_REQ" and not board.connected:
+            return False
+        entry = (box, st.index, uid, granted, self.engine.now())
+        if board.connected:
+            self.publish(board, entry)
+        else:
+            if len(board.held) == self.fw.outbox_size:
+                board.held.popleft()  # Full, lose the oldest
+                self.stats.add("held_dropped")
+            board.held.append(entry)
+            self.stats.add("held")
+        return True
+
+    def publish(self, board, entry):
+        box, station, uid, granted, stamp = entry
+        payload = uid
+        if box == "OUTBOX_TAP":
+            payload = "%s,%s,%d" % (uid, "granted" if granted else "denied", (self.engine.now() - stamp) * 1000)
+        if len(board.stations) > 1 and box != "OUTBOX_ESTOP":
+            payload += ",%d" % station
+        if box == "OUTBOX_REQ":
+            self.stats.add("req")
+        board.link.publish(self.fw.topics[box], payload)
+
+    def drain(self, board):
+        while board.connected and board.held:
+            self.publish(board, board.held.popleft())
+            self.stats.add("drained")
+
+    # Broker side, as onMqttConnect (), onMqttDisconnect () and mqtt-dispatch.cpp
+
+    def connected(self, board):
+        if board.connected:
+            return
+        board.connected = True
+        self.stats.add("connects")
+        self.post_board(board, self.ev.NET_UP)
+        self.engine.at(self.rng.uniform(0, self.fw.jitter), self.drain, board)
+
+    def disconnected(self, board):
+        if not board.connected:
+            return
+        board.connected = False
+        self.stats.add("drops")
+        board.pending.clear()  # authCacheClearPending (STATION_ALL, 0)
+        board.owed = 0
+        self.post_board(board, self.ev.NET_DOWN)
+
+    def message(self, board, topic, payload):
+        if not board.connected:
+            return
+        self.stats.add("delivered")
+        m = re.match(r"(\w+)[, \r\n]?(.*)", payload, re.S)
+        handler = self.fw.commands.get((topic, m.group(1))) if m else None
+        if handler is not None:
+            getattr(self, HANDLERS[handler])(board, m.group(2))
+
+    def clear_pending(self, st, sent):
+        """authCacheClearPending ()"""
+        if st.board.pending.pop(st.index, None) is not None and sent and len(st.board.stations) == 1:
+            st.board.owed += 1
+
+    def resolve(self, board, allowed, args):
+        """authCacheResolve (): the station waiting on the echoed uidStr. One without is only taken with a single
+        station still waiting on the server, and not while a req given up on is still owed its answer"""
+        uid = re.split(r"[, ]", args, 1)[0].strip()
+        if not uid and board.owed > 0:
+            board.owed -= 1
+            self.stats.add("late")
+            return None, False
+        if not uid and len(board.stations) > 1:
+            self.stats.add("unnamed")
+            return None, False
+        asking = set(self.fw.const[s] for s in ("ST_CARD", "ST_AUTHORIZED", "ST_HANDOVER"))
+        waiting = [s for s, p in board.pending.items()
+                   if (p[0] == uid if uid else board.stations[s].state in asking)]
+        if not waiting:
+            return None, False  # Another board's card, or one this board gave up on
+        station = waiting[0]
+        uid, from_cache, sent = board.pending.pop(station)
+        board.cache[uid] = allowed
+        rtt = self.engine.now() - sent
+        self.stats.rtt.append(rtt)
+        self.stats.rtt_window.append(rtt)
+        self.stats.add("rsp")
+        return board.stations[station], from_cache and not allowed
+
+    def handle_auth(self, board, args):
+        st, _ = self.resolve(board, True, args)
+        if st is not None:
+            self.post(st, self.ev.AUTH_GRANTED)
+
+    def handle_denied(self, board, args):
+        st, revoke = self.resolve(board, False, args)
+        if st is not None:
+            self.post(st, self.ev.AUTH_REVOKED if revoke else self.ev.AUTH_DENIED)
+
+    def handle_estop_fire(self, board, args):
+        self.post_board(board, self.ev.ESTOP_FIRE)
+
+    def handle_estop_clear(self, board, args):
+        self.post_board(board, self.ev.ESTOP_CLEAR)
+
+    # The people at the tools, and readerTask noticing what they do
+
+    def track(self, st):
+        """A presence poll in READER_TRACK"""
+        if self.fw.reader[st.state] != self.fw.const["READER_TRACK"]:
+            return
+        if len(st.on_reader) > 1:
+            self.post(st, self.ev.COLLISION)
+        elif not st.on_reader:
+            self.post(st, self.ev.CARD_REMOVED)
+
+    def tap(self, st):
+        args = self.args
+        card = st.last_card if st.last_card is not None else self.rng.choice(self.cards)
+        st.last_card = None
+        st.on_reader = [card]
+        if self.fw.reader[st.state] == self.fw.const["READER_SCAN"]:
+            self.post(st, self.ev.CARD_ARRIVED, card)
+        hold = self.rng.expovariate(1.0 / args.hold)
+        if self.rng.random() < args.collision:
+            self.engine.at(self.rng.uniform(0.2, 0.8) * hold, self.second_card, st)
+        self.engine.at(hold, self.lift, st, card)
+
+    def second_card(self, st):
+        if st.on_reader:
+            st.on_reader.append(self.rng.choice(self.cards))
+            self.track(st)
+
+    def lift(self, st, card):
+        st.on_reader = []
+        self.track(st)
+        if self.rng.random() < self.args.retap:
+            st.last_card = card  # Back before the removal timeout runs out
+            self.engine.at(self.rng.uniform(1.0, max(1.0, self.removal_timeout / 2)), self.tap, st)
+        else:
+            self.engine.at(self.rng.expovariate(self.args.rate / 3600.0), self.tap, st)
+
+    # Faults
+
+    def outage(self):
+        args = self.args
+        boards = self.rng.sample(self.boards, max(1, int(round(len(self.boards) * args.outage_fraction))))
+        for board in boards:
+            board.link.drop()
+        self.stats.add("outages")
+        # The firmware retries every MS_MQTT_RECONNECT_PERIOD, so it's back on the first retry after the outage
+        back = math.ceil(args.outage_for / self.fw.reconnect) * self.fw.reconnect
+        self.engine.at(back, self.restore, boards)
+        self.engine.at(args.outage_every, self.outage)
+
+    def restore(self, boards):
+        for board in boards:
+            board.link.restore()
+
+    def estop_publish(self, command):
+        for board in self.boards:
+            if board.connected:  # Any board still on the broker will do
+                board.link.publish("rfid/estop", command)
+                return
+        self.engine.at(1.0, self.estop_publish, command)
+
+    # Reports
+
+    def report(self):
+        now = self.engine.now()
+        seconds = max(0.001, now - self.last_report)
+        stations = [st for b in self.boards for st in b.stations]
+        states = collections.Counter(self.fw.states[st.state] for st in stations)
+        print("%6.0fs %s | %s | engine lag %s" % (now, self.stats.line(self.stats.window, self.stats.rtt_window, seconds),
+                                                 " ".join("%s %d" % kv for kv in sorted(states.items())), fmt_ms(self.engine.lag)))
+        sys.stdout.flush()
+        self.stats.window.clear()
+        self.stats.rtt_window = []
+        self.engine.lag = 0.0
+        self.last_report = now
+        self.engine.at(self.args.report, self.report)
+
+    def summary(self, seconds):
+        t = self.stats.total
+        print("\n%d boards x %d stations, %.0fs" % (len(self.boards), len(self.boards[0].stations), seconds))
+        print("  %s" % self.stats.line(t, self.stats.rtt, seconds))
+        print("  tap to relay p50 %s p90 %s p99 %s (cached and offline grants included)"
+              % tuple(fmt_ms(percentile(self.stats.tap_to_relay, p)) for p in (50, 90, 99)))
+        print("  grants %d (%d off the cache), offline decisions %d, collisions %d, estops %d"
+              % (t["grants"], t["cached"], t["offline"], t["collisions"], t["estops"]))
+        print("  rsp deliveries %d (%.1f per rsp, every board gets every rsp), late rsps dropped %d, unnamed %d"
+              % (t["delivered"], t["delivered"] / max(1, t["rsp"]), t["late"], t["unnamed"]))
+        print("  outages %d, drops %d, connects %d, held %d, drained %d, lost from a full outbox %d"
+              % (t["outages"], t["drops"], t["connects"], t["held"], t["drained"], t["held_dropped"]))
+
+
+class PahoLink:
+    """One board's connection to a real broker"""
+
+    def __init__(self, fleet, board, host, port, prefix):
+        import paho.mqtt.client as mqtt
+        self.fleet, self.board, self.host, self.port = fleet, board, host, port
+        self.client = mqtt.Client("%s-%d" % (prefix, board.index))
+        self.client.on_connect = self.on_connect
+        self.client.on_disconnect = self.on_disconnect
+        self.client.on_message = self.on_message
+        self.client.reconnect_delay_set(fleet.fw.reconnect, fleet.fw.reconnect)
+        self.restore()
+
+    def on_connect(self, client, userdata, flags, rc):
+        if rc != 0:
+            return
+        for topic in sorted(set(t for t, _ in self.fleet.fw.commands)):
+            client.subscribe(topic, 2)  # Same QoS as onMqttConnect ()
+        self.fleet.engine.post(self.fleet.connected, self.board)
+
+    def on_disconnect(self, client, userdata, rc):
+        self.fleet.engine.post(self.fleet.disconnected, self.board)
+
+    def on_message(self, client, userdata, msg):
+        self.fleet.engine.post(self.fleet.message, self.board, msg.topic, msg.payload.decode("ascii", "replace"))
+
+    def publish(self, topic, payload):
+        self.client.publish(topic, payload, qos=1)
+
+    def drop(self):
+        self.client.disconnect()
+        self.client.loop_stop()
+
+    def restore(self):
+        self.client.connect_async(self.host, self.port)
+        self.client.loop_start()
+
+
+class Loopback:
+    """In-process broker plus a stand-in auth server. Everything runs on the engine thread"""
+
+    def __init__(self, fleet, server_ms):
+        self.fleet = fleet
+        self.server_ms = server_ms / 1000.0
+        self.boards = []
+
+    def publish(self, topic, payload):
+        fleet = self.fleet
+        if topic == fleet.fw.topics["OUTBOX_REQ"]:
+            uid = payload.split(",")[0]
+            answer = "denied" if uid in fleet.unknown else "auth"
+            rsp = answer if fleet.args.no_echo else "%s,%s" % (answer, uid)
+            fleet.engine.at(fleet.rng.expovariate(1.0 / self.server_ms), self.deliver, "rfid/auth/rsp", rsp)
+        elif topic == "rfid/estop":
+            self.deliver(topic, payload)
+
+    def deliver(self, topic, payload):
+        for board in self.boards:
+            self.fleet.message(board, topic, payload)
+
+
+class LoopbackLink:
+    def __init__(self, loopback, board):
+        self.loopback = loopback
+        self.board = board
+        loopback.boards.append(board)
+        self.restore()
+
+    def publish(self, topic, payload):
+        if self.board.connected:
+            self.loopback.publish(topic, payload)
+
+    def drop(self):
+        self.loopback.fleet.engine.post(self.loopback.fleet.disconnected, self.board)
+
+    def restore(self):
+        self.loopback.fleet.engine.post(self.loopback.fleet.connected, self.board)
+
+
+def main(argv):
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--host", default="localhost")
+    p.add_argument("--port", type=int, default=1883)
+    p.add_argument("--client-prefix", default="fleet-load", help="MQTT client ids are <prefix>-<board>")
+    p.add_argument("--loopback", action="store_true", help="no broker, an in-process one and a stand-in server")
+    p.add_argument("--server-ms", type=float, default=20, help="--loopback server's mean answer time")
+    p.add_argument("--no-echo", action="store_true", help="--loopback server answers without the uidStr")
+    p.add_argument("--boards", type=int, default=50)
+    p.add_argument("--stations", type=int, default=1, help="per board, STATION_COUNT")
+    p.add_argument("--duration", type=float, default=120, help="seconds")
+    p.add_argument("--report", type=float, default=10, help="seconds between progress lines")
+    p.add_argument("--pattern", choices=("steady", "shift"), default="steady")
+    p.add_argument("--burst", type=float, default=60, help="shift: seconds every station's first tap falls in")
+    p.add_argument("--rate", type=float, default=6, help="taps per station per hour once steady")
+    p.add_argument("--hold", type=float, default=120, help="mean seconds a card stays on the reader")
+    p.add_argument("--collision", type=float, default=0.02, help="fraction of sessions a second card turns up in")
+    p.add_argument("--retap", type=float, default=0.1, help="fraction of removals the same card comes back before the timeout")
+    p.add_argument("--cards", type=int, default=500)
+    p.add_argument("--unknown", type=float, default=0.05, help="fraction of cards that aren't members (--loopback's server denies them)")
+    p.add_argument("--removal-timeout", type=float, default=0, help="seconds, 0 for MS_TIMEOUT_PERIOD")
+    p.add_argument("--outage-every", type=float, default=0, help="seconds, 0 for no outages")
+    p.add_argument("--outage-for", type=float, default=10)
+    p.add_argument("--outage-fraction", type=float, default=0.1, help="of the boards, 1 is a reconnect storm")
+    p.add_argument("--estop-at", type=float, default=0, help="seconds in, 0 for no eStop")
+    p.add_argument("--estop-for", type=float, default=10)
+    p.add_argument("--seed", type=int)
+    args = p.parse_args(argv[1:])
+
+    fw = Firmware()
+    engine = Engine()
+    fleet = Fleet(fw, engine, args)
+    loopback = Loopback(fleet, args.server_ms) if args.loopback else None
+    for board in fleet.boards:
+        fleet.post_board(board, fw.ev.NET_DOWN)  # accessInit (), OUTAGE until MQTT connects
+        if loopback is not None:
+            board.link = LoopbackLink(loopback, board)
+        else:
+            board.link = PahoLink(fleet, board, args.host, args.port, args.client_prefix)
+        for st in board.stations:
+            first = fleet.rng.uniform(0, args.burst) if args.pattern == "shift" else fleet.rng.expovariate(args.rate / 3600.0)
+            engine.at(first, fleet.tap, st)
+    print("%d boards x %d stations, %d transitions from access-fsm.cpp, auth wait %.0fs, removal timeout %.0fs"
+          % (args.boards, args.stations, len(fw.table), fw.auth_wait, fleet.removal_timeout))
+
+    engine.at(args.report, fleet.report)
+    if args.outage_every > 0:
+        engine.at(args.outage_every, fleet.outage)
+    if args.estop_at > 0:
+        engine.at(args.estop_at, fleet.estop_publish, "fire")
+        engine.at(args.estop_at + args.estop_for, fleet.estop_publish, "clear")
+    try:
+        engine.run(args.duration)
+    except KeyboardInterrupt:
+        pass
+    fleet.summary(engine.now())
+    if loopback is None:
+        for board in fleet.boards:
+            board.link.drop()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,103 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/* Enough of the ESP32 Arduino core to build the firmware on a PC, for the benchmarks and the simulation harness in
+   tools/. Not used by the firmware build. The FreeRTOS part is in host-rtos.h, run on virtual time by host-rtos.cpp,
+   and what the harness itself drives (clock, pins, cards, broker) is in host.h.
+   The benchmarks that only need the types (picc-scan-bench) don't have to link any of it.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "host-rtos.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define HIGH          1
+#define LOW           0
+#define INPUT         0x01
+#define OUTPUT        0x02
+#define PULLUP        0x04
+#define INPUT_PULLUP  0x05
+#define RISING        0x01
+#define FALLING       0x02
+#define CHANGE        0x03
+#define DEC           10
+#define HEX           16
+
+#define F(s)          s
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+//////// Time, virtual (see host-rtos.cpp) ////////
+
+extern uint32_t millis ();
+extern uint32_t micros ();
+extern void delay (uint32_t ms);
+extern void delayMicroseconds (uint32_t us);
+
+//////// GPIO ////////
+
+#define digitalPinToInterrupt(p) (p)
+
+extern void pinMode (uint8_t pin, uint8_t mode);
+extern void digitalWrite (uint8_t pin, uint8_t level);
+extern int digitalRead (uint8_t pin);
+extern void attachInterrupt (uint8_t pin, void (*isr)(), int mode);
+extern void attachInterruptArg (uint8_t pin, void (*isr)(void *), void *arg, int mode);
+extern void detachInterrupt (uint8_t pin);
+
+//////// Misc ////////
+
+extern long random (long howBig);
+extern long random (long howSmall, long howBig);
+extern void randomSeed (unsigned long seed);
+extern void configTime (long gmtOffset, int daylightOffset, const char *server1, const char *server2 = NULL, const char *server3 = NULL);
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+extern esp_err_t esp_efuse_mac_get_default (uint8_t *mac);
+extern uint32_t esp_get_free_heap_size ();
+extern uint32_t esp_get_minimum_free_heap_size ();
+
+//////// Serial ////////
+
+class HardwareSerial {
+public:
+  void begin (unsigned long baud);
+  void end (){}
+  void flush (){}
+  int availableForWrite ();
+  size_t write (uint8_t c);
+  size_t write (const uint8_t *buf, size_t len);
+  size_t print (const char *s);
+  size_t print (char c);
+  size_t print (int v, int base = DEC);
+  size_t print (unsigned int v, int base = DEC);
+  size_t print (long v, int base = DEC);
+  size_t print (unsigned long v, int base = DEC);
+  size_t print (unsigned char v, int base = DEC);
+  size_t println ();
+  template<typename T> size_t println (T v){ return print(v) + println(); }
+  template<typename T> size_t println (T v, int base){ return print(v, base) + println(); }
+  size_t printf (const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+// The sketch's, the harness runs them in loopTask the way the Arduino core does
+extern void setup ();
+extern void loop ();
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,64 @@
+#ifndef HOST_ASYNC_MQTT_CLIENT_H
+#define HOST_ASYNC_MQTT_CLIENT_H
+
+/* AsyncMqttClient for the host build (host-net.cpp), talking to the mock broker there. Callbacks come from the
+   async_tcp service task the way the library's come from AsyncTCP's, messages bigger than a TCP segment in chunks.
+*/
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+
+struct AsyncMqttClientMessageProperties {
+  uint8_t qos;
+  bool dup;
+  bool retain;
+};
+
+enum class AsyncMqttClientDisconnectReason : int8_t {
+  TCP_DISCONNECTED = 0,
+  MQTT_UNACCEPTABLE_PROTOCOL_VERSION = 1,
+  MQTT_IDENTIFIER_REJECTED = 2,
+  MQTT_SERVER_UNAVAILABLE = 3,
+  MQTT_MALFORMED_CREDENTIALS = 4,
+  MQTT_NOT_AUTHORIZED = 5,
+  ESP8266_NOT_ENOUGH_SPACE = 6,
+  TLS_BAD_FINGERPRINT = 7
+};
+
+class AsyncMqttClient {
+public:
+  typedef std::function<void (bool sessionPresent)> OnConnectUserCallback;
+  typedef std::function<void (AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+  typedef std::function<void (uint16_t packetId, uint8_t qos)> OnSubscribeUserCallback;
+  typedef std::function<void (uint16_t packetId)> OnUnsubscribeUserCallback;
+  typedef std::function<void (char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len,
+                              size_t index, size_t total)> OnMessageUserCallback;
+  typedef std::function<void (uint16_t packetId)> OnPublishUserCallback;
+
+  AsyncMqttClient & onConnect (OnConnectUserCallback cb){ connectCb = cb; return *this; }
+  AsyncMqttClient & onDisconnect (OnDisconnectUserCallback cb){ disconnectCb = cb; return *this; }
+  AsyncMqttClient & onSubscribe (OnSubscribeUserCallback cb){ subscribeCb = cb; return *this; }
+  AsyncMqttClient & onUnsubscribe (OnUnsubscribeUserCallback cb){ unsubscribeCb = cb; return *this; }
+  AsyncMqttClient & onMessage (OnMessageUserCallback cb){ messageCb = cb; return *this; }
+  AsyncMqttClient & onPublish (OnPublishUserCallback cb){ publishCb = cb; return *this; }
+  AsyncMqttClient & setServer (IPAddress ip, uint16_t port){ return *this; }
+  AsyncMqttClient & setClientId (const char *id){ return *this; }
+
+  bool connected () const;
+  void connect ();
+  void disconnect (bool force = false);
+  uint16_t subscribe (const char *topic, uint8_t qos);
+  uint16_t publish (const char *topic, uint8_t qos, bool retain, const char *payload = NULL, size_t length = 0,
+                    bool dup = false, uint16_t messageId = 0);
+
+  // host-net.cpp's, not the library's
+  OnConnectUserCallback connectCb;
+  OnDisconnectUserCallback disconnectCb;
+  OnSubscribeUserCallback subscribeCb;
+  OnUnsubscribeUserCallback unsubscribeCb;
+  OnMessageUserCallback messageCb;
+  OnPublishUserCallback publishCb;
+};
+
+#endif // HOST_ASYNC_MQTT_CLIENT_H
@@ -0,0 +1,55 @@
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+/* FastLED as far as the firmware uses it. show () takes as long as the strip's data does to clock out (30us an LED
+   plus the 50us latch) and keeps a copy of what was sent, hostLedsShown () in host.h.
+*/
+
+#include <Arduino.h>
+
+struct CRGB {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+
+  enum HTMLColorCode : uint32_t {
+    Black = 0x000000, Blue = 0x0000FF, Green = 0x008000, Orange = 0xFFA500, Purple = 0x800080, Red = 0xFF0000,
+    White = 0xFFFFFF, Yellow = 0xFFFF00
+  };
+
+  CRGB (){}
+  CRGB (uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib){}
+  CRGB (HTMLColorCode c) : r((c >> 16) & 0xFF), g((c >> 8) & 0xFF), b(c & 0xFF){}
+
+  bool operator== (const CRGB &o) const { return r == o.r && g == o.g && b == o.b; }
+  bool operator!= (const CRGB &o) const { return !(*this == o); }
+
+  CRGB & nscale8 (uint8_t scale){ // FastLED's scale8, 255 leaves it alone
+    r = (r * (scale + 1)) >> 8;
+    g = (g * (scale + 1)) >> 8;
+    b = (b * (scale + 1)) >> 8;
+    return *this;
+  }
+};
+
+enum EOrder { RGB = 0012, RBG = 0021, GRB = 0102, GBR = 0120, BRG = 0201, BGR = 0210 };
+
+template<uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2812 {};
+
+class CFastLED {
+public:
+  template<template<uint8_t, EOrder> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+  void addLeds (CRGB *data, int count){ attach(data, count, DATA_PIN); }
+  void attach (CRGB *data, int count, uint8_t pin);
+  void setBrightness (uint8_t scale){ brightness = scale; }
+  uint8_t getBrightness (){ return brightness; }
+  void show ();
+
+private:
+  uint8_t brightness = 255;
+};
+
+extern CFastLED FastLED;
+#define LEDS FastLED
+
+#endif // HOST_FASTLED_H
@@ -0,0 +1,62 @@
+#ifndef HOST_MFRC522_H
+#define HOST_MFRC522_H
+
+/* The MFRC522 library's API over a simulated reader and the ISO 14443A cards in its field (host-mfrc522.cpp). Only
+   what the firmware calls. Register reads and writes each take an SPI transfer's time, frames take their time on air,
+   the PICC's answer delay and the MFRC522 timer's timeout when nobody answers, all charged to the calling task.
+   A REQA sent with StartSend (readerArm ()) is answered in the background: RxIRq comes up in ComIrqReg when the
+   answer would have arrived, and on the IRQ pin if one is wired (hostReaderIrq () in host.h).
+*/
+
+#include <Arduino.h>
+
+struct hostReader;
+
+class MFRC522 {
+public:
+  enum PCD_Register : byte {
+    CommandReg = 0x01 << 1, ComIEnReg = 0x02 << 1, DivIEnReg = 0x03 << 1, ComIrqReg = 0x04 << 1, DivIrqReg = 0x05 << 1,
+    ErrorReg = 0x06 << 1, Status1Reg = 0x07 << 1, Status2Reg = 0x08 << 1, FIFODataReg = 0x09 << 1, FIFOLevelReg = 0x0A << 1,
+    ControlReg = 0x0C << 1, BitFramingReg = 0x0D << 1, CollReg = 0x0E << 1, ModeReg = 0x11 << 1, TxModeReg = 0x12 << 1,
+    RxModeReg = 0x13 << 1, TxControlReg = 0x14 << 1, TxASKReg = 0x15 << 1, CRCResultRegH = 0x21 << 1,
+    CRCResultRegL = 0x22 << 1, ModWidthReg = 0x24 << 1, TModeReg = 0x2A << 1, TPrescalerReg = 0x2B << 1,
+    TReloadRegH = 0x2C << 1, TReloadRegL = 0x2D << 1, VersionReg = 0x37 << 1
+  };
+
+  enum PCD_Command : byte {
+    PCD_Idle = 0x00, PCD_Mem = 0x01, PCD_CalcCRC = 0x03, PCD_Transmit = 0x04, PCD_Receive = 0x08, PCD_Transceive = 0x0C,
+    PCD_SoftReset = 0x0F
+  };
+
+  enum PICC_Command : byte {
+    PICC_CMD_REQA = 0x26, PICC_CMD_WUPA = 0x52, PICC_CMD_CT = 0x88, PICC_CMD_SEL_CL1 = 0x93, PICC_CMD_SEL_CL2 = 0x95,
+    PICC_CMD_SEL_CL3 = 0x97, PICC_CMD_HLTA = 0x50
+  };
+
+  enum StatusCode : byte {
+    STATUS_OK, STATUS_ERROR, STATUS_COLLISION, STATUS_TIMEOUT, STATUS_NO_ROOM, STATUS_INTERNAL_ERROR, STATUS_INVALID,
+    STATUS_CRC_WRONG, STATUS_MIFARE_NACK = 0xFF
+  };
+
+  typedef struct {
+    byte size;
+    byte uidByte[10];
+    byte sak;
+  } Uid;
+
+  Uid uid;
+
+  MFRC522 (){}
+  void PCD_Init (byte chipSelectPin, byte resetPowerDownPin);
+  void PCD_WriteRegister (PCD_Register reg, byte value);
+  byte PCD_ReadRegister (PCD_Register reg);
+  StatusCode PCD_TransceiveData (byte *sendData, byte sendLen, byte *backData, byte *backLen, byte *validBits = NULL,
+                                 byte rxAlign = 0, bool checkCRC = false);
+  StatusCode PICC_RequestA (byte *bufferATQA, byte *bufferSize);
+  StatusCode PICC_HaltA ();
+
+private:
+  hostReader *dev = NULL;
+};
+
+#endif // HOST_MFRC522_H
@@ -0,0 +1,28 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+/* Preferences (NVS) for the host build (host-nvs.cpp). Namespaces of keys in memory, kept for the life of the
+   process like NVS is across a reboot. Writes cost what an NVS entry write does, reads a lookup.
+*/
+
+#include <Arduino.h>
+#include <string>
+
+class Preferences {
+public:
+  bool begin (const char *name, bool readOnly = false, const char *partitionLabel = NULL);
+  void end ();
+  bool remove (const char *key);
+  size_t putBytes (const char *key, const void *value, size_t len);
+  size_t getBytes (const char *key, void *buf, size_t maxLen);
+  size_t getBytesLength (const char *key);
+  size_t putUChar (const char *key, uint8_t value);
+  uint8_t getUChar (const char *key, uint8_t defaultValue = 0);
+
+private:
+  std::string space;
+  bool started = 0;
+  bool readOnly = 0;
+};
+
+#endif // HOST_PREFERENCES_H
@@ -0,0 +1,13 @@
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+// The bus itself isn't modelled, the MFRC522 fake charges each register access to the calling task
+
+class SPIClass {
+public:
+  void begin (){}
+};
+
+extern SPIClass SPI;
+
+#endif // HOST_SPI_H
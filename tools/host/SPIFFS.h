@@ -0,0 +1,72 @@
+#ifndef HOST_SPIFFS_H
+#define HOST_SPIFFS_H
+
+/* SPIFFS for the host build (host-spiffs.cpp). Files are kept in memory, or in a directory on the host with
+   hostFsRoot () (host.h). Either way every call costs the calling task roughly what it would on the ESP32, and
+   nothing opens until SPIFFS.begin () has mounted (formatting first, if hostFsFresh ()). The flat namespace, the
+   open file limit and the partition's size are kept to, directories aren't modelled beyond listing "/".
+*/
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class FileImpl;
+
+class File {
+public:
+  File (){}
+  explicit File (const std::shared_ptr<FileImpl> &impl) : impl(impl){}
+
+  operator bool () const;
+  size_t size () const;
+  bool seek (uint32_t pos);
+  size_t position () const;
+  int available ();
+  int read ();
+  size_t read (uint8_t *buf, size_t len);
+  size_t write (uint8_t c);
+  size_t write (const uint8_t *buf, size_t len);
+  void flush ();
+  void close ();
+  bool isDirectory () const;
+  const char * name () const;
+  File openNextFile ();
+
+  size_t print (const char *s){ return write((const uint8_t*)s, strlen(s)); }
+  size_t print (int v, int base = DEC){ return print((long)v, base); }
+  size_t print (long v, int base = DEC);
+
+private:
+  std::shared_ptr<FileImpl> impl;
+};
+
+class FS {
+public:
+  File open (const char *path, const char *mode = FILE_READ);
+  bool exists (const char *path);
+  bool remove (const char *path);
+  bool rename (const char *from, const char *to);
+};
+
+} // namespace fs
+
+using fs::File;
+
+class SPIFFSFS : public fs::FS {
+public:
+  bool begin (bool formatOnFail = false, const char *basePath = "/spiffs", uint8_t maxOpenFiles = 10, const char *label = NULL);
+  void end ();
+  bool format ();
+  size_t totalBytes ();
+  size_t usedBytes ();
+};
+
+extern SPIFFSFS SPIFFS;
+
+#endif // HOST_SPIFFS_H
@@ -0,0 +1,49 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+/* WiFi for the host build (host-net.cpp). Joins the one AP there is, unless the harness has taken it away
+   (hostWifiUp () in host.h), and reports it through the event callback from the system event task like the ESP32 does.
+*/
+
+#include <Arduino.h>
+
+typedef enum {
+  SYSTEM_EVENT_WIFI_READY = 0,
+  SYSTEM_EVENT_SCAN_DONE,
+  SYSTEM_EVENT_STA_START,
+  SYSTEM_EVENT_STA_STOP,
+  SYSTEM_EVENT_STA_CONNECTED,
+  SYSTEM_EVENT_STA_DISCONNECTED,
+  SYSTEM_EVENT_STA_AUTHMODE_CHANGE,
+  SYSTEM_EVENT_STA_GOT_IP
+} WiFiEvent_t;
+
+typedef void (*WiFiEventCb)(WiFiEvent_t event);
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+
+class IPAddress {
+public:
+  IPAddress (){ bytes[0] = bytes[1] = bytes[2] = bytes[3] = 0; }
+  IPAddress (uint8_t a, uint8_t b, uint8_t c, uint8_t d){ bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d; }
+  uint8_t operator[] (int i) const { return bytes[i & 3]; }
+
+private:
+  uint8_t bytes[4];
+};
+
+class WiFiClass {
+public:
+  void begin (const char *ssid, const char *pass);
+  void disconnect ();
+  bool isConnected ();
+  IPAddress localIP ();
+  void onEvent (WiFiEventCb cb);
+  void mode (int m){}
+  void setSleep (bool on){}
+};
+
+extern WiFiClass WiFi;
+
+#endif // HOST_WIFI_H
@@ -0,0 +1,3 @@
+// The host build's, WiFi.begin () takes anything. The firmware's own credentials.h is kept out of the repo
+#define SSID "host"
+#define PASS "host"
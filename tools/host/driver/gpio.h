@@ -0,0 +1,24 @@
+#ifndef HOST_DRIVER_GPIO_H
+#define HOST_DRIVER_GPIO_H
+
+/* The bit of the ESP-IDF GPIO driver the firmware uses beside the Arduino calls (host-arduino.cpp). Host pins always
+   read back their level, so gpio_set_direction () only has the output side to set.
+*/
+
+#include <Arduino.h>
+
+#define GPIO_MODE_DEF_INPUT  (1 << 0)
+#define GPIO_MODE_DEF_OUTPUT (1 << 1)
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_MODE_DISABLE = 0,
+  GPIO_MODE_INPUT = GPIO_MODE_DEF_INPUT,
+  GPIO_MODE_OUTPUT = GPIO_MODE_DEF_OUTPUT,
+  GPIO_MODE_INPUT_OUTPUT = GPIO_MODE_DEF_INPUT | GPIO_MODE_DEF_OUTPUT
+} gpio_mode_t;
+
+extern esp_err_t gpio_set_direction (gpio_num_t gpio, gpio_mode_t mode);
+
+#endif // HOST_DRIVER_GPIO_H
@@ -0,0 +1,48 @@
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+/* The ESP-IDF partition API for the host build (host-partition.cpp), over the data partitions in partitions.csv that
+   the firmware opens by hand (the member list slots). They start erased and last the life of the process. Writes
+   only clear bits, like NOR flash, so a write over something not erased shows up as bad data the way it would.
+*/
+
+#include <Arduino.h>
+
+#define ESP_ERR_INVALID_ARG  0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND    0x105
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+
+typedef struct {
+  esp_partition_type_t type;
+  int subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+} esp_partition_t;
+
+typedef enum {
+  SPI_FLASH_MMAP_DATA,
+  SPI_FLASH_MMAP_INST
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+extern const esp_partition_t * esp_partition_find_first (esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+extern esp_err_t esp_partition_read (const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size);
+extern esp_err_t esp_partition_write (const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size);
+extern esp_err_t esp_partition_erase_range (const esp_partition_t *partition, size_t offset, size_t size);
+extern esp_err_t esp_partition_mmap (const esp_partition_t *partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory,
+                                     const void **outPtr, spi_flash_mmap_handle_t *outHandle);
+extern void spi_flash_munmap (spi_flash_mmap_handle_t handle);
+
+#endif // HOST_ESP_PARTITION_H
@@ -0,0 +1,343 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <vector>
+#include <SPI.h>
+#include <esp_heap_caps.h>
+#include <soc/gpio_struct.h>
+#include <driver/gpio.h>
+#include "host.h"
+
+/* The Arduino core's side of the shim: time, pins and their interrupts, Serial, and the odds and ends of the
+   ESP-IDF the firmware asks about. Pins are just levels, an output follows digitalWrite () (or the GPIO registers),
+   an input follows hostPinDrive (). An ISR runs HOST_ISR_ENTRY_US after its edge, on the core that attached it.
+*/
+
+#define UART_FIFO 128 // Bytes the ESP32's UART takes before write () has to wait
+
+HardwareSerial Serial;
+SPIClass SPI;
+gpio_dev_t GPIO = {{0, HIGH}, {0, LOW}, {{32, HIGH}}, {{32, LOW}}, {0}, {{32}}};
+
+typedef struct {
+  uint8_t mode;
+  uint8_t level;
+  uint64_t changedUs;
+  void (*isr)(void *);
+  void (*isrPlain)();
+  void *arg;
+  int edge;              // RISING, FALLING or CHANGE
+  BaseType_t core;       // Where it was attached, where it runs
+  bool driven;           // hostPinDrive () has set it, a pull-up doesn't override that
+  bool stuck;            // hostPinStuck (), reads stuckLevel whatever is written
+  uint8_t stuckLevel;
+  uint8_t written;       // Last level written or driven, what it goes back to when it comes unstuck
+} hostPin;
+
+static hostPin pins[HOST_PINS];
+static std::vector<std::function<void (uint8_t, int)> > watchers;
+static bool echo = 0;
+static uint32_t byteUs = 87;     // 115200 8N1
+static uint64_t txDoneUs = 0;    // When the last byte handed to the UART is out
+static uint32_t heapFree = 180000;
+static uint32_t heapMin = 180000;
+
+//////// Time ////////
+
+uint32_t millis (){
+  return (uint32_t)(hostNow() / 1000);
+}
+
+uint32_t micros (){
+  return (uint32_t)hostNow();
+}
+
+void delay (uint32_t ms){
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void delayMicroseconds (uint32_t us){
+  hostBusy(us); // Spins on the ESP32
+}
+
+//////// Pins ////////
+
+static void fireIsr (uint8_t pin){
+  hostPin *p = &pins[pin];
+  void (*isr)(void *) = p->isr;
+  void (*isrPlain)() = p->isrPlain;
+  void *arg = p->arg;
+  hostAt(hostNow() + HOST_ISR_ENTRY_US, [=](){
+    hostIsr(p->core, [=](){
+      if (isr != NULL){
+        isr(arg);
+      }
+      else{
+        isrPlain();
+      }
+    });
+  });
+}
+
+static void setLevel (uint8_t pin, int level){
+  hostPin *p = &pins[pin];
+  level = level ? HIGH : LOW;
+  p->written = level;
+  if (p->stuck){
+    level = p->stuckLevel;
+  }
+  if (p->level == level){
+    return;
+  }
+  p->level = level;
+  p->changedUs = hostNow();
+  for (size_t i = 0; i < watchers.size(); i++){
+    watchers[i](pin, level);
+  }
+  if ((p->isr != NULL || p->isrPlain != NULL)
+      && (p->edge == CHANGE || (p->edge == RISING && level == HIGH) || (p->edge == FALLING && level == LOW))){
+    fireIsr(pin);
+  }
+}
+
+static bool pinValid (uint8_t pin, const char *what){
+  if (pin >= HOST_PINS){
+    hostFault("%s on pin %u, there's no such GPIO", what, pin);
+    return 0;
+  }
+  return 1;
+}
+
+void pinMode (uint8_t pin, uint8_t mode){
+  if (!pinValid(pin, "pinMode")){
+    return;
+  }
+  if ((mode & OUTPUT) && pin >= 34){
+    hostFault("pinMode OUTPUT on pin %u, 34-39 are input only", pin);
+  }
+  pins[pin].mode = mode;
+  if (mode == INPUT_PULLUP && !pins[pin].driven){
+    pins[pin].level = HIGH; // Nothing has driven it yet
+  }
+}
+
+void digitalWrite (uint8_t pin, uint8_t level){
+  if (pinValid(pin, "digitalWrite") && (pins[pin].mode & OUTPUT)){
+    setLevel(pin, level);
+  }
+}
+
+int digitalRead (uint8_t pin){
+  return pinValid(pin, "digitalRead") ? pins[pin].level : LOW;
+}
+
+void attachInterruptArg (uint8_t pin, void (*isr)(void *), void *arg, int mode){
+  if (!pinValid(pin, "attachInterrupt")){
+    return;
+  }
+  pins[pin].isr = isr;
+  pins[pin].isrPlain = NULL;
+  pins[pin].arg = arg;
+  pins[pin].edge = mode;
+  pins[pin].core = xPortGetCoreID();
+}
+
+void attachInterrupt (uint8_t pin, void (*isr)(), int mode){
+  if (!pinValid(pin, "attachInterrupt")){
+    return;
+  }
+  pins[pin].isr = NULL;
+  pins[pin].isrPlain = isr;
+  pins[pin].edge = mode;
+  pins[pin].core = xPortGetCoreID();
+}
+
+esp_err_t gpio_set_direction (gpio_num_t gpio, gpio_mode_t mode){
+  if (!pinValid(gpio, "gpio_set_direction")){
+    return ESP_FAIL;
+  }
+  if ((mode & GPIO_MODE_DEF_OUTPUT) && gpio >= 34){
+    hostFault("gpio_set_direction output on pin %u, 34-39 are input only", gpio);
+  }
+  // Every pin reads back its level here, input enabled or not, so only the output side matters
+  pinMode(gpio, (mode & GPIO_MODE_DEF_OUTPUT) ? OUTPUT : INPUT);
+  return ESP_OK;
+}
+
+void detachInterrupt (uint8_t pin){
+  if (pinValid(pin, "detachInterrupt")){
+    pins[pin].isr = NULL;
+    pins[pin].isrPlain = NULL;
+  }
+}
+
+void hostGpioWrite::operator= (uint32_t mask) const {
+  for (uint8_t i = 0; i < 32 && first + i < HOST_PINS; i++){
+    if ((mask & (1UL << i)) && (pins[first + i].mode & OUTPUT)){
+      setLevel(first + i, level);
+    }
+  }
+}
+
+hostGpioRead::operator uint32_t () const {
+  uint32_t v = 0;
+  for (uint8_t i = 0; i < 32 && first + i < HOST_PINS; i++){
+    v |= (uint32_t)pins[first + i].level << i;
+  }
+  return v;
+}
+
+void hostPinDrive (uint8_t pin, int level){
+  if (!pinValid(pin, "hostPinDrive")){
+    return;
+  }
+  if (pins[pin].mode & OUTPUT){
+    hostFault("pin %u driven from outside while it's an output", pin);
+  }
+  pins[pin].driven = 1;
+  setLevel(pin, level);
+}
+
+void hostPinStuck (uint8_t pin, int level){
+  if (!pinValid(pin, "hostPinStuck")){
+    return;
+  }
+  pins[pin].stuck = (level >= 0);
+  pins[pin].stuckLevel = (level > 0) ? HIGH : LOW;
+  setLevel(pin, pins[pin].written);
+}
+
+int hostPinLevel (uint8_t pin){
+  return (pin < HOST_PINS) ? pins[pin].level : LOW;
+}
+
+uint64_t hostPinChanged (uint8_t pin){
+  return (pin < HOST_PINS) ? pins[pin].changedUs : 0;
+}
+
+void hostPinWatch (const std::function<void (uint8_t pin, int level)> &fn){
+  watchers.push_back(fn);
+}
+
+//////// Serial ////////
+
+void hostSerialEcho (bool on){
+  echo = on;
+}
+
+void HardwareSerial::begin (unsigned long baud){
+  byteUs = (uint32_t)(10000000UL / baud); // 8N1, ten bits a byte
+}
+
+int HardwareSerial::availableForWrite (){
+  uint64_t now = hostNow();
+  uint32_t queued = (txDoneUs > now) ? (uint32_t)((txDoneUs - now) / byteUs) : 0;
+  return (queued < UART_FIFO) ? UART_FIFO - queued : 0;
+}
+
+/* Bytes go into the FIFO at once and drain at the baud rate, write () only takes time once it's full. That's what
+   makes Serial logging from a busy task expensive, so it's modelled
+*/
+size_t HardwareSerial::write (const uint8_t *buf, size_t len){
+  uint64_t now = hostNow();
+  if (echo){
+    fwrite(buf, 1, len, stdout);
+  }
+  txDoneUs = max(txDoneUs, now) + len * byteUs;
+  if (txDoneUs - now > (uint64_t)UART_FIFO * byteUs){
+    hostBusy((uint32_t)(txDoneUs - now - UART_FIFO * byteUs));
+  }
+  return len;
+}
+
+size_t HardwareSerial::write (uint8_t c){
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::print (const char *s){
+  return write((const uint8_t*)s, strlen(s));
+}
+
+size_t HardwareSerial::print (char c){
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print (unsigned long v, int base){
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%lu", v);
+  return write((const uint8_t*)buf, n);
+}
+
+size_t HardwareSerial::print (long v, int base){
+  if (base == HEX){
+    return print((unsigned long)v, base);
+  }
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), "%ld", v);
+  return write((const uint8_t*)buf, n);
+}
+
+size_t HardwareSerial::print (int v, int base){
+  return print((long)v, base);
+}
+
+size_t HardwareSerial::print (unsigned int v, int base){
+  return print((unsigned long)v, base);
+}
+
+size_t HardwareSerial::print (unsigned char v, int base){
+  return print((unsigned long)v, base);
+}
+
+size_t HardwareSerial::println (){
+  return write((const uint8_t*)"\r\n", 2);
+}
+
+size_t HardwareSerial::printf (const char *fmt, ...){
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return write((const uint8_t*)buf, min(max(n, 0), (int)sizeof(buf) - 1));
+}
+
+//////// Misc ////////
+
+long random (long howBig){
+  return (howBig > 0) ? (long)(hostRandom() % (uint32_t)howBig) : 0;
+}
+
+long random (long howSmall, long howBig){
+  return (howBig > howSmall) ? howSmall + random(howBig - howSmall) : howSmall;
+}
+
+void randomSeed (unsigned long seed){
+  hostSeed((uint32_t)seed);
+}
+
+void configTime (long gmtOffset, int daylightOffset, const char *server1, const char *server2, const char *server3){
+  // SNTP isn't modelled, time () is the host's clock
+}
+
+esp_err_t esp_efuse_mac_get_default (uint8_t *mac){
+  static const uint8_t fixed[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+  memcpy(mac, fixed, sizeof(fixed));
+  return ESP_OK;
+}
+
+void hostHeapFree (uint32_t bytes){
+  heapFree = bytes;
+  heapMin = min(heapMin, bytes);
+}
+
+uint32_t esp_get_free_heap_size (){
+  return heapFree;
+}
+
+uint32_t esp_get_minimum_free_heap_size (){
+  return heapMin;
+}
+
+size_t heap_caps_get_largest_free_block (uint32_t caps){
+  return heapFree / 2;
+}
@@ -0,0 +1,37 @@
+#include <Arduino.h>
+#include <FastLED.h>
+#include <vector>
+#include "host.h"
+
+#define LED_BIT_US   30 // 24 bits at 800kHz
+#define LED_LATCH_US 50
+
+CFastLED FastLED;
+
+static CRGB *strip = NULL;
+static std::vector<CRGB> shown;
+static uint32_t shows = 0;
+
+void CFastLED::attach (CRGB *data, int count, uint8_t pin){
+  strip = data;
+  shown.assign(count, CRGB(0, 0, 0));
+}
+
+void CFastLED::show (){
+  if (strip == NULL){
+    hostFault("FastLED.show () before addLeds ()");
+    return;
+  }
+  std::vector<CRGB> frame(strip, strip + shown.size()); // Taken now, showing once it's all clocked out
+  hostBusy(LED_LATCH_US + LED_BIT_US * shown.size());
+  shown = frame;
+  shows++;
+}
+
+const CRGB * hostLedsShown (){
+  return shown.data();
+}
+
+uint32_t hostLedShows (){
+  return shows;
+}
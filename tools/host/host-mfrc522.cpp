@@ -0,0 +1,419 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <vector>
+#include "host.h"
+#include "picc-scan.h"
+
+/* Simulated MFRC522s, one per SS pin, and the ISO 14443A cards in each one's field. The card model is the one
+   tools/picc-scan-bench.cpp checks picc-scan.cpp against: IDLE, READY, ACTIVE, HALT and the * states after a WUPA
+   from HALT, anticollision bit by bit, answers of every card in the field OR'd together so they collide where they
+   differ. Timing is the same too, see the defines.
+*/
+
+#define SPI_US        6       // One register access, 4MHz SPI plus chip select
+#define BIT_US        9.44    // One bit at 106 kbit/s
+#define FDT_US        90      // PICC answer delay
+#define FRAME_SPI_OPS 12      // Register accesses PCD_CommunicateWithPICC makes around a frame, not counting the waiting
+#define CRC_SPI_OPS   10      // PCD_CalculateCRC on the MFRC522's coprocessor, PICC_HaltA uses it
+#define TIMER_TICK_US 25      // The MFRC522 timer with PCD_Init's prescaler
+#define RESET_MS      50      // PCD_Init waits this long for the oscillator
+#define VERSION       0x92    // MFRC522 v2.0
+#define RX_IRQ        0x20    // ComIrqReg RxIRq
+#define IRQ_INV       0x80    // ComIEnReg IRqInv, IRQ pin active low
+#define START_SEND    0x80    // BitFramingReg
+
+enum { CARD_IDLE, CARD_READY, CARD_ACTIVE, CARD_HALT };
+
+struct hostCard {
+  uidType uid;
+  byte state;
+  bool star;      // Woken out of HALT, goes back there instead of IDLE
+  byte level;     // Cascade level it is at while READY
+  uint8_t dropPct;
+
+  byte levels () const { return uid.length == 4 ? 1 : (uid.length == 7 ? 2 : 3); }
+
+  void cl (byte lvl, byte *out) const { // This card's 5 byte UID CLn
+    if (lvl + 1 < levels()){
+      out[0] = 0x88;
+      memcpy(out + 1, uid.bytes + lvl * 3, 3);
+    }
+    else{
+      memcpy(out, uid.bytes + lvl * 3, 4);
+    }
+    out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+  }
+
+  void other (){ // Anything unexpected
+    if (state == CARD_READY || state == CARD_ACTIVE){
+      state = star ? CARD_HALT : CARD_IDLE;
+    }
+  }
+};
+
+struct hostReader {
+  uint8_t ss;
+  int irqPin;
+  byte regs[64];
+  byte fifo[64];
+  byte fifoLen;
+  std::vector<hostCard> cards;
+  uint32_t armGen;   // Bumped when a background REQA is cancelled, its RxIRq event checks it
+  uint32_t frames;
+};
+
+static std::vector<hostReader*> devs;
+
+static hostReader * readerFor (uint8_t ss){
+  for (size_t i = 0; i < devs.size(); i++){
+    if (devs[i]->ss == ss){
+      return devs[i];
+    }
+  }
+  hostReader *r = new hostReader();
+  r->ss = ss;
+  r->irqPin = -1;
+  r->regs[MFRC522::ComIEnReg >> 1] = IRQ_INV; // Reset values that matter
+  r->regs[MFRC522::VersionReg >> 1] = VERSION;
+  devs.push_back(r);
+  return r;
+}
+
+static bool bitOf (const byte *b, int i){
+  return (b[i / 8] >> (i % 8)) & 1;
+}
+
+//////// Cards ////////
+
+// One card's answer as bits, or -1 for silence
+static int react (hostCard &c, const byte *f, int sendBits, byte *ans){
+  if (sendBits == 7){ // REQA/WUPA
+    bool wupa = (f[0] == MFRC522::PICC_CMD_WUPA);
+    if (c.state == CARD_IDLE || (wupa && c.state == CARD_HALT)){
+      c.star = (c.state == CARD_HALT);
+      c.state = CARD_READY;
+      c.level = 0;
+      ans[0] = (c.uid.length == 4) ? 0x04 : 0x44;
+      ans[1] = 0;
+      return 16;
+    }
+    c.other();
+    return -1;
+  }
+  if (f[0] == MFRC522::PICC_CMD_HLTA && sendBits == 32){
+    if (c.state == CARD_ACTIVE){
+      c.state = CARD_HALT;
+    }
+    else{
+      c.other();
+    }
+    return -1;
+  }
+  if ((f[0] == 0x93 || f[0] == 0x95 || f[0] == 0x97) && sendBits >= 16){
+    if (c.state != CARD_READY){
+      c.other();
+      return -1;
+    }
+    if (f[0] != 0x93 + 2 * c.level){
+      return -1; // Not its level, sits it out
+    }
+    byte cl[5];
+    c.cl(c.level, cl);
+    if (f[1] == 0x70){ // SELECT
+      if (sendBits != 72 || memcmp(f + 2, cl, 5) != 0){
+        return -1;
+      }
+      byte more = (c.level + 1 < c.levels());
+      ans[0] = more ? 0x04 : 0x08;
+      if (more){
+        c.level++;
+      }
+      else{
+        c.state = CARD_ACTIVE;
+      }
+      uint16_t crc = piccCrcA(ans, 1);
+      ans[1] = crc & 0xFF;
+      ans[2] = crc >> 8;
+      return 24;
+    }
+    int known = sendBits - 16;
+    for (int i = 0; i < known; i++){
+      if (bitOf(f + 2, i) != bitOf(cl, i)){
+        return -1; // Not on this branch
+      }
+    }
+    memset(ans, 0, 6);
+    int r = known % 8;
+    for (int i = known; i < 40; i++){ // Stored carrying on from the partial byte
+      int at = r + (i - known);
+      if (bitOf(cl, i)){
+        ans[at / 8] |= 1 << (at % 8);
+      }
+    }
+    return 40 - known;
+  }
+  c.other();
+  return -1;
+}
+
+/* Every card in the field hears the frame, what comes back is all their answers on top of each other. Returns the
+   bits received (alignment included, -1 for nothing) and the first collided one in *coll (-1 for none). *airUs is how
+   long it took from the first bit sent, timeout included.
+*/
+static int exchange (hostReader *r, const byte *send, int sendBits, int stored, byte *merged, int *coll, uint32_t *airUs){
+  byte ans[8];
+  int len = -1;
+
+  r->frames++;
+  *coll = -1;
+  memset(merged, 0, 8);
+  for (size_t i = 0; i < r->cards.size(); i++){
+    memset(ans, 0, sizeof(ans));
+    int n = react(r->cards[i], send, sendBits, ans);
+    if (n < 0 || (r->cards[i].dropPct > 0 && hostRandom() % 100 < r->cards[i].dropPct)){
+      continue;
+    }
+    if (len < 0){
+      len = n;
+      memcpy(merged, ans, sizeof(ans)); // react () already put it where it's stored
+      continue;
+    }
+    for (int b = stored; b < stored + n && b < stored + len; b++){
+      if (bitOf(merged, b) != bitOf(ans, b) && (*coll < 0 || b < *coll)){
+        *coll = b;
+      }
+      merged[b / 8] |= ans[b / 8] & (1 << (b % 8));
+    }
+  }
+
+  uint32_t timeout = ((r->regs[MFRC522::TReloadRegH >> 1] << 8) | r->regs[MFRC522::TReloadRegL >> 1]) * TIMER_TICK_US;
+  *airUs = (uint32_t)(sendBits * BIT_US + ((len < 0) ? timeout : FDT_US + len * BIT_US));
+  return (len < 0) ? -1 : stored + len;
+}
+
+//////// Registers ////////
+
+static void updateIrq (hostReader *r){
+  if (r->irqPin < 0){
+    return;
+  }
+  byte en = r->regs[MFRC522::ComIEnReg >> 1];
+  bool active = (r->regs[MFRC522::ComIrqReg >> 1] & en & 0x7F) != 0;
+  int level = (en & IRQ_INV) ? !active : active;
+  if (hostPinLevel(r->irqPin) != level){
+    hostPinDrive(r->irqPin, level);
+  }
+}
+
+static void setIrq (hostReader *r, byte bits, bool set){
+  if (set){
+    r->regs[MFRC522::ComIrqReg >> 1] |= bits;
+  }
+  else{
+    r->regs[MFRC522::ComIrqReg >> 1] &= ~bits;
+  }
+  updateIrq(r);
+}
+
+// StartSend with Transceive, the REQA readerArm () sends. Answered in the background
+static void startSend (hostReader *r){
+  byte lastBits = r->regs[MFRC522::BitFramingReg >> 1] & 0x07;
+  int sendBits = (r->fifoLen == 0) ? 0 : (r->fifoLen - 1) * 8 + (lastBits ? lastBits : 8);
+  byte merged[8];
+  int coll;
+  uint32_t airUs;
+
+  int got = exchange(r, r->fifo, sendBits, 0, merged, &coll, &airUs);
+  r->fifoLen = 0;
+  if (got < 0){
+    return;
+  }
+  uint32_t gen = r->armGen;
+  hostAt(hostNow() + airUs, [r, gen](){
+    if (r->armGen == gen){
+      setIrq(r, RX_IRQ, 1);
+    }
+  });
+}
+
+void MFRC522::PCD_WriteRegister (PCD_Register reg, byte value){
+  hostReader *r = dev;
+  hostBusy(SPI_US);
+  if (r == NULL){
+    return; // Not initialised, nothing's listening on its SS
+  }
+  switch (reg){
+    case CommandReg:
+      r->regs[reg >> 1] = value & 0x0F;
+      if ((value & 0x0F) == PCD_Idle){
+        r->armGen++; // Whatever was in flight is abandoned
+      }
+      break;
+    case ComIrqReg:
+      setIrq(r, value & 0x7F, value & 0x80); // Set1: 1 sets the bits given, 0 clears them
+      break;
+    case ComIEnReg:
+      r->regs[reg >> 1] = value;
+      updateIrq(r);
+      break;
+    case FIFOLevelReg:
+      if (value & 0x80){
+        r->fifoLen = 0;
+      }
+      break;
+    case FIFODataReg:
+      if (r->fifoLen < sizeof(r->fifo)){
+        r->fifo[r->fifoLen++] = value;
+      }
+      break;
+    case BitFramingReg:
+      r->regs[reg >> 1] = value & 0x7F;
+      if ((value & START_SEND) && r->regs[CommandReg >> 1] == PCD_Transceive){
+        startSend(r);
+      }
+      break;
+    case VersionReg:
+      break;
+    default:
+      r->regs[reg >> 1] = value;
+      break;
+  }
+}
+
+byte MFRC522::PCD_ReadRegister (PCD_Register reg){
+  hostBusy(SPI_US);
+  if (dev == NULL){
+    return 0x00; // Floating MISO reads as 0x00 or 0xFF
+  }
+  return dev->regs[reg >> 1];
+}
+
+void MFRC522::PCD_Init (byte chipSelectPin, byte resetPowerDownPin){
+  pinMode(chipSelectPin, OUTPUT);
+  digitalWrite(chipSelectPin, HIGH);
+  pinMode(resetPowerDownPin, OUTPUT);
+  digitalWrite(resetPowerDownPin, HIGH);
+  delay(RESET_MS);
+
+  dev = readerFor(chipSelectPin);
+  memset(dev->regs, 0, sizeof(dev->regs));
+  dev->regs[ComIEnReg >> 1] = IRQ_INV;
+  dev->regs[VersionReg >> 1] = VERSION;
+  dev->fifoLen = 0;
+  dev->armGen++;
+  PCD_WriteRegister(TModeReg, 0x80);
+  PCD_WriteRegister(TPrescalerReg, 0xA9); // 25us ticks
+  PCD_WriteRegister(TReloadRegH, 0x03);   // 1000 ticks, 25ms
+  PCD_WriteRegister(TReloadRegL, 0xE8);
+  PCD_WriteRegister(TxASKReg, 0x40);
+  PCD_WriteRegister(ModeReg, 0x3D);
+  PCD_WriteRegister(TxControlReg, 0x83);  // Antenna on
+  updateIrq(dev);
+}
+
+/* What PCD_CommunicateWithPICC does around a frame: idle, clear the IRQs, flush, load the FIFO, send, wait on the
+   IRQs (the time on air), read back. Received bits land from rxAlign up in backData[0], bits below it are left alone
+*/
+MFRC522::StatusCode MFRC522::PCD_TransceiveData (byte *sendData, byte sendLen, byte *backData, byte *backLen, byte *validBits,
+                                                 byte rxAlign, bool checkCRC){
+  hostReader *r = dev;
+  byte lastBits = (validBits != NULL) ? *validBits : 0;
+  int sendBits = (sendLen - 1) * 8 + (lastBits ? lastBits : 8);
+  byte merged[8];
+  int coll;
+  uint32_t airUs;
+
+  if (r == NULL){
+    hostBusy(FRAME_SPI_OPS * SPI_US);
+    return STATUS_TIMEOUT;
+  }
+  r->armGen++;
+  setIrq(r, 0x7F, 0);
+  int got = exchange(r, sendData, sendBits, rxAlign, merged, &coll, &airUs);
+  hostBusy(FRAME_SPI_OPS * SPI_US + airUs);
+  if (got < 0){
+    return STATUS_TIMEOUT;
+  }
+  setIrq(r, RX_IRQ, 1);
+
+  byte n = (got + 7) / 8;
+  if (backData == NULL || backLen == NULL || n > *backLen){
+    return STATUS_NO_ROOM;
+  }
+  byte keep = (1 << rxAlign) - 1;
+  backData[0] = (backData[0] & keep) | (merged[0] & ~keep);
+  memcpy(backData + 1, merged + 1, n - 1);
+  *backLen = n;
+  if (validBits != NULL){
+    *validBits = got % 8;
+  }
+  if (coll >= 0){
+    r->regs[CollReg >> 1] = (coll < 32) ? (coll + 1) % 32 : 0x20; // CollPos 1-32 with 0 meaning 32, CollPosNotValid past that
+    return STATUS_COLLISION;
+  }
+  return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_RequestA (byte *bufferATQA, byte *bufferSize){
+  byte cmd = PICC_CMD_REQA;
+  byte bits = 7;
+
+  if (bufferATQA == NULL || *bufferSize < 2){
+    return STATUS_NO_ROOM;
+  }
+  hostBusy(2 * SPI_US); // Clears ValuesAfterColl in CollReg
+  StatusCode s = PCD_TransceiveData(&cmd, 1, bufferATQA, bufferSize, &bits);
+  if (s != STATUS_OK){
+    return s;
+  }
+  return (*bufferSize != 2 || bits != 0) ? STATUS_ERROR : STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_HaltA (){
+  byte frame[4] = {PICC_CMD_HLTA, 0, 0, 0};
+  byte back[1];
+  byte backLen = sizeof(back);
+
+  hostBusy(CRC_SPI_OPS * SPI_US);
+  uint16_t crc = piccCrcA(frame, 2);
+  frame[2] = crc & 0xFF;
+  frame[3] = crc >> 8;
+  StatusCode s = PCD_TransceiveData(frame, 4, back, &backLen);
+  if (s == STATUS_TIMEOUT){
+    return STATUS_OK; // Silence is the only good answer to HLTA
+  }
+  return (s == STATUS_OK) ? STATUS_ERROR : s;
+}
+
+//////// Harness side ////////
+
+void hostCardEnter (uint8_t ss, const uidType *uid, uint8_t dropPct){
+  hostCard c;
+  memset(&c, 0, sizeof(c));
+  c.uid = *uid;
+  c.state = CARD_IDLE; // Just powered up by the field
+  c.dropPct = dropPct;
+  readerFor(ss)->cards.push_back(c);
+}
+
+void hostCardLeave (uint8_t ss, const uidType *uid){
+  std::vector<hostCard> &cards = readerFor(ss)->cards;
+  for (size_t i = 0; i < cards.size(); i++){
+    if (uidEqual(cards[i].uid, *uid)){
+      cards.erase(cards.begin() + i);
+      return;
+    }
+  }
+}
+
+void hostCardsClear (uint8_t ss){
+  readerFor(ss)->cards.clear();
+}
+
+void hostReaderIrq (uint8_t ss, int irqPin){
+  readerFor(ss)->irqPin = irqPin;
+}
+
+uint32_t hostReaderFrames (uint8_t ss){
+  return readerFor(ss)->frames;
+}
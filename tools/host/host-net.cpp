@@ -0,0 +1,371 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AsyncMqttClient.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "host.h"
+
+/* WiFi, the TCP connection and a broker at the other end of it, see WiFi.h and AsyncMqttClient.h. One AP, one
+   broker, one client. Anything on its way across (either direction) is lost if the link is down by the time it would
+   arrive, and the board only finds out the link went when TCP or the WiFi driver would tell it. Clean sessions: the
+   broker forgets the board's subscriptions when it goes, retained messages it keeps.
+   Every segment in or out also costs the WiFi driver and lwIP their time, in one "wifi" service at the WiFi task's
+   priority on core 0 (above all of ours), which is where network load lands on the ESP32.
+*/
+
+#define WIFI_JOIN_US       1200000  // Scan, associate, DHCP
+#define WIFI_GIVEUP_US     3000000  // No AP found, STA_DISCONNECTED
+#define WIFI_BEACON_LOSS_US 6000000 // The driver's beacon timeout, how long a vanished AP takes to notice
+#define NET_LATENCY_US     2000     // Each way, board to broker, until hostNetLatency ()
+#define TCP_SEGMENT        1400     // Payload bytes a chunk of a big message brings, roughly the MSS less headers
+#define MQTT_PUBLISH_US    40       // Building the packet, handing it to lwIP
+#define MQTT_BYTE_NS       20
+#define MQTT_RX_US         25       // Parsing a chunk in AsyncMqttClient before the callback
+#define WIFI_SEGMENT_US    50       // The WiFi driver and lwIP per segment either way, roughly, at 240MHz
+#define WIFI_BYTE_NS       100      // And per byte of it, ~190us for a full segment
+#define WIFI_PRIO          23       // ESP-IDF's WiFi task, pinned to core 0
+
+WiFiClass WiFi;
+
+static WiFiEventCb wifiCb = NULL;
+static TaskHandle_t sysEvt = NULL;
+static TaskHandle_t asyncTcp = NULL;
+static TaskHandle_t wifiTask = NULL;
+static AsyncMqttClient *client = NULL;
+
+static bool apUp = 1;              // The harness' side of things
+static bool brokerUp = 1;
+static uint32_t latencyUs = NET_LATENCY_US;
+static bool joining = 0;           // The board's
+static bool wifiConnected = 0;
+static bool tcpOpen = 0;           // Connected or connecting
+static bool mqttConnected = 0;
+static uint32_t epoch = 0;         // Bumped each time the connection goes, anything in flight for an older one is dropped
+static uint16_t nextPacketId = 1;
+static uint32_t publishes = 0;
+static uint64_t lastArrival = 0;
+static std::vector<std::string> subscriptions; // The broker's, for the board
+static std::map<std::string, std::string> retained;
+static std::vector<hostPublishHook> hooks;
+
+static void services (){
+  if (sysEvt == NULL){
+    sysEvt = hostServiceCreate("sys_evt", 20, 0);
+    asyncTcp = hostServiceCreate("async_tcp", 3, 0);
+    wifiTask = hostServiceCreate("wifi", WIFI_PRIO, 0);
+  }
+}
+
+static bool linkUp (){
+  return apUp && brokerUp && wifiConnected;
+}
+
+static bool topicMatch (const std::string &filter, const std::string &topic){
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.size()){
+    if (filter[f] == '#'){
+      return 1;
+    }
+    if (filter[f] == '+'){
+      while (t < topic.size() && topic[t] != '/'){
+        t++;
+      }
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t]){
+      return 0;
+    }
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+static uint16_t packetId (){
+  uint16_t id = nextPacketId++;
+  if (nextPacketId == 0){
+    nextPacketId = 1;
+  }
+  return id;
+}
+
+//////// WiFi ////////
+
+static void wifiEvent (WiFiEvent_t event){
+  hostServicePost(sysEvt, hostNow(), [=](){
+    if (wifiCb != NULL){
+      wifiCb(event);
+    }
+  });
+}
+
+void WiFiClass::begin (const char *ssid, const char *pass){
+  services();
+  if (joining || wifiConnected){
+    return;
+  }
+  joining = 1;
+  hostAfter(apUp ? WIFI_JOIN_US : WIFI_GIVEUP_US, [](){
+    joining = 0;
+    if (apUp){
+      wifiConnected = 1;
+      wifiEvent(SYSTEM_EVENT_STA_GOT_IP);
+    }
+    else{
+      wifiEvent(SYSTEM_EVENT_STA_DISCONNECTED);
+    }
+  });
+}
+
+void WiFiClass::disconnect (){
+  if (wifiConnected){
+    wifiConnected = 0;
+    wifiEvent(SYSTEM_EVENT_STA_DISCONNECTED);
+  }
+}
+
+bool WiFiClass::isConnected (){
+  return wifiConnected;
+}
+
+IPAddress WiFiClass::localIP (){
+  return wifiConnected ? IPAddress(192, 168, 1, 50) : IPAddress();
+}
+
+void WiFiClass::onEvent (WiFiEventCb cb){
+  services();
+  wifiCb = cb;
+}
+
+//////// The connection, board side ////////
+
+// The board finds out: everything in flight is dropped, the broker forgets it, onDisconnect from async_tcp
+static void connectionLost (uint64_t atUs){
+  uint32_t e = epoch;
+  hostServicePost(asyncTcp, atUs, [=](){
+    if (e != epoch || !tcpOpen){
+      return;
+    }
+    epoch++;
+    tcpOpen = 0;
+    mqttConnected = 0;
+    subscriptions.clear();
+    if (client != NULL && client->disconnectCb){
+      client->disconnectCb(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+  });
+}
+
+// Something crossing to the broker, fn runs when it gets there if the link is still up
+static void toBroker (const std::function<void ()> &fn){
+  uint32_t e = epoch;
+  hostAfter(latencyUs, [=](){
+    if (e == epoch && linkUp()){
+      fn();
+    }
+  });
+}
+
+// What a segment of bytes costs the WiFi driver and lwIP, on core 0 ahead of everything of ours
+static void wifiCost (size_t bytes, const std::function<void ()> &then){
+  hostServicePost(wifiTask, hostNow(), [=](){
+    hostBusy(WIFI_SEGMENT_US + (uint32_t)((bytes * WIFI_BYTE_NS) / 1000));
+    then();
+  });
+}
+
+// Something crossing to the board, bytes of it, fn runs in async_tcp once the WiFi driver and lwIP have handed it on
+static void toBoard (uint64_t atUs, size_t bytes, const std::function<void ()> &fn){
+  uint32_t e = epoch;
+  hostAt(atUs, [=](){
+    if (e == epoch && linkUp()){
+      wifiCost(bytes, [=](){
+        hostServicePost(asyncTcp, hostNow(), [=](){
+          if (e == epoch && tcpOpen){
+            fn();
+          }
+        });
+      });
+    }
+  });
+}
+
+static void deliver (const std::string &topic, const std::string &payload, bool retain, uint64_t atUs){
+  std::shared_ptr<std::string> t(new std::string(topic));
+  std::shared_ptr<std::string> p(new std::string(payload));
+  size_t total = p->size();
+  size_t index = 0;
+  do{
+    size_t len = min(total - index, (size_t)TCP_SEGMENT);
+    toBoard(atUs, len, [=](){
+      AsyncMqttClientMessageProperties props = {0, false, retain};
+      if (index == 0){
+        lastArrival = hostNow();
+      }
+      hostBusy(MQTT_RX_US);
+      if (client->messageCb){
+        client->messageCb(&(*t)[0], &(*p)[0] + index, props, len, index, total);
+      }
+    });
+    index += len;
+  } while (index < total);
+}
+
+bool AsyncMqttClient::connected () const {
+  return mqttConnected;
+}
+
+void AsyncMqttClient::connect (){
+  services();
+  client = this;
+  if (tcpOpen){
+    return;
+  }
+  tcpOpen = 1;
+  if (!wifiConnected){
+    connectionLost(hostNow()); // No route, AsyncTCP gives up at once
+    return;
+  }
+  if (!apUp || !brokerUp){
+    connectionLost(hostNow() + 2 * latencyUs); // RST back, or nothing and the same as far as we care
+    return;
+  }
+  // SYN/SYN-ACK, then CONNECT/CONNACK
+  toBoard(hostNow() + 4 * latencyUs, 0, [](){
+    mqttConnected = 1;
+    if (client->connectCb){
+      client->connectCb(0);
+    }
+  });
+}
+
+void AsyncMqttClient::disconnect (bool force){
+  if (tcpOpen){
+    connectionLost(hostNow());
+  }
+}
+
+uint16_t AsyncMqttClient::subscribe (const char *topic, uint8_t qos){
+  if (!mqttConnected){
+    return 0;
+  }
+  uint16_t id = packetId();
+  std::string filter(topic);
+  hostBusy(MQTT_PUBLISH_US);
+  toBroker([=](){
+    subscriptions.push_back(filter);
+    toBoard(hostNow() + latencyUs, 0, [=](){
+      if (client->subscribeCb){
+        client->subscribeCb(id, qos);
+      }
+    });
+    for (std::map<std::string, std::string>::iterator i = retained.begin(); i != retained.end(); ++i){
+      if (topicMatch(filter, i->first)){
+        deliver(i->first, i->second, 1, hostNow() + latencyUs);
+      }
+    }
+  });
+  return id;
+}
+
+uint16_t AsyncMqttClient::publish (const char *topic, uint8_t qos, bool retain, const char *payload, size_t length,
+                                   bool dup, uint16_t messageId){
+  if (!mqttConnected){
+    return 0;
+  }
+  if (payload != NULL && length == 0){
+    length = strlen(payload);
+  }
+  uint16_t id = (qos > 0) ? packetId() : 1;
+  std::string t(topic);
+  std::string p(payload != NULL ? payload : "", length);
+  hostBusy(MQTT_PUBLISH_US + (uint32_t)((length * MQTT_BYTE_NS) / 1000));
+  publishes++;
+  wifiCost(length, [](){}); // Sending it, the broker's latency is counted from the publish all the same
+  toBroker([=](){
+    for (size_t i = 0; i < hooks.size(); i++){
+      hooks[i](t.c_str(), p.data(), p.size(), qos);
+    }
+    hostBrokerSend(t.c_str(), p.data(), p.size(), retain); // To the board too, if it's subscribed to its own topic
+    if (qos > 0){ // PUBACK, or PUBREC/PUBREL/PUBCOMP
+      toBoard(hostNow() + ((qos == 1) ? 1 : 3) * latencyUs, 0, [=](){
+        if (client->publishCb){
+          client->publishCb(id);
+        }
+      });
+    }
+  });
+  return id;
+}
+
+//////// Harness side ////////
+
+void hostWifiUp (bool up){
+  bool was = apUp;
+  apUp = up;
+  if (was && !up && wifiConnected){
+    hostAfter(WIFI_BEACON_LOSS_US, [](){
+      if (apUp || !wifiConnected){
+        return; // Back in time, or already noticed
+      }
+      wifiConnected = 0;
+      wifiEvent(SYSTEM_EVENT_STA_DISCONNECTED);
+      connectionLost(hostNow());
+    });
+  }
+}
+
+// A broker going away closes its sockets, the board sees the FIN/RST one trip later
+void hostBrokerUp (bool up){
+  bool was = brokerUp;
+  brokerUp = up;
+  if (was && !up && tcpOpen && wifiConnected){
+    connectionLost(hostNow() + latencyUs);
+  }
+}
+
+void hostNetLatency (uint32_t oneWayUs){
+  latencyUs = oneWayUs;
+}
+
+void hostBrokerOnPublish (const hostPublishHook &hook){
+  hooks.push_back(hook);
+}
+
+void hostBrokerSend (const char *topic, const char *payload, size_t len, bool retain){
+  std::string t(topic);
+  std::string p(payload, len);
+  if (retain){
+    if (len == 0){
+      retained.erase(t);
+    }
+    else{
+      retained[t] = p;
+    }
+  }
+  if (!brokerUp){
+    return;
+  }
+  for (size_t i = 0; i < subscriptions.size(); i++){
+    if (topicMatch(subscriptions[i], t)){
+      deliver(t, p, 0, hostNow() + latencyUs); // Retain is only set on what a subscribe turns up
+      return;
+    }
+  }
+}
+
+bool hostMqttConnected (){
+  return mqttConnected;
+}
+
+uint32_t hostMqttPublishes (){
+  return publishes;
+}
+
+uint64_t hostMqttArrived (){
+  return lastArrival;
+}
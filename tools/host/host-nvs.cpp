@@ -0,0 +1,95 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "host.h"
+
+/* NVS on the host, see Preferences.h. The costs are rough: a write appends an entry (and its blob chunks) to the NVS
+   pages, a read walks the page's hash list.
+*/
+
+#define NVS_OPEN_US       200
+#define NVS_READ_US       40
+#define NVS_WRITE_US      1200      // An entry, plus NVS_WRITE_BYTE_NS for the blob behind it
+#define NVS_WRITE_BYTE_NS 2800
+#define NVS_KEY_MAX       15        // NVS_KEY_NAME_MAX_SIZE less the terminator
+#define NVS_BLOB_MAX      4000      // Roughly a page, bigger blobs are split and we don't need them
+
+static std::map<std::string, std::vector<uint8_t> > entries; // "namespace/key"
+
+static bool keyValid (const char *key){
+  if (key == NULL || strlen(key) == 0 || strlen(key) > NVS_KEY_MAX){
+    hostFault("NVS key \"%s\" is empty or longer than %u", key ? key : "", NVS_KEY_MAX);
+    return 0;
+  }
+  return 1;
+}
+
+bool Preferences::begin (const char *name, bool readOnly, const char *partitionLabel){
+  if (started){
+    return 0;
+  }
+  if (!keyValid(name)){
+    return 0;
+  }
+  hostBusy(NVS_OPEN_US);
+  space = name;
+  this->readOnly = readOnly;
+  started = 1;
+  return 1;
+}
+
+void Preferences::end (){
+  started = 0;
+}
+
+bool Preferences::remove (const char *key){
+  if (!started || readOnly || !keyValid(key)){
+    return 0;
+  }
+  hostBusy(NVS_WRITE_US);
+  return entries.erase(space + "/" + key) > 0;
+}
+
+size_t Preferences::putBytes (const char *key, const void *value, size_t len){
+  if (!started || readOnly || !keyValid(key) || value == NULL || len == 0){
+    return 0;
+  }
+  if (len > NVS_BLOB_MAX){
+    hostFault("NVS blob \"%s\" is %u bytes", key, (unsigned)len);
+    return 0;
+  }
+  hostBusy(NVS_WRITE_US + (uint32_t)((len * NVS_WRITE_BYTE_NS) / 1000));
+  const uint8_t *p = (const uint8_t*)value;
+  entries[space + "/" + key].assign(p, p + len);
+  return len;
+}
+
+size_t Preferences::getBytesLength (const char *key){
+  if (!started || !keyValid(key)){
+    return 0;
+  }
+  hostBusy(NVS_READ_US);
+  std::map<std::string, std::vector<uint8_t> >::iterator i = entries.find(space + "/" + key);
+  return (i != entries.end()) ? i->second.size() : 0;
+}
+
+// Same as the real one: nothing is copied unless the whole blob fits
+size_t Preferences::getBytes (const char *key, void *buf, size_t maxLen){
+  size_t len = getBytesLength(key);
+  if (len == 0 || buf == NULL || len > maxLen){
+    return 0;
+  }
+  memcpy(buf, entries[space + "/" + key].data(), len);
+  return len;
+}
+
+size_t Preferences::putUChar (const char *key, uint8_t value){
+  return putBytes(key, &value, 1);
+}
+
+uint8_t Preferences::getUChar (const char *key, uint8_t defaultValue){
+  uint8_t v;
+  return (getBytesLength(key) == 1 && getBytes(key, &v, 1) == 1) ? v : defaultValue;
+}
@@ -0,0 +1,105 @@
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <vector>
+#include "host.h"
+
+/* Raw flash partitions on the host, see esp_partition.h. Costs are the datasheet's typical figures for the ESP32's
+   flash: a 4KB sector erase, a 256 byte page program, reads at 40MHz. mmap is free, reads through it are just memory.
+*/
+
+#define FLASH_SECTOR        4096
+#define FLASH_ERASE_US      45000     // A sector
+#define FLASH_WRITE_BYTE_NS 2800      // ~0.7ms a 256 byte page
+#define FLASH_READ_BYTE_NS  200
+#define FLASH_CALL_US       10        // Taking the flash lock, the command
+
+typedef struct {
+  esp_partition_t part;
+  std::vector<uint8_t> data;
+} hostPartition;
+
+// The rows of partitions.csv the firmware opens itself
+static hostPartition parts[] = {
+  {{ESP_PARTITION_TYPE_DATA, 0x40, 0x3B4000, 0x1E000, "members_a", false}, std::vector<uint8_t>()},
+  {{ESP_PARTITION_TYPE_DATA, 0x41, 0x3D2000, 0x1E000, "members_b", false}, std::vector<uint8_t>()},
+};
+static uint32_t mapped = 0;
+
+static hostPartition * lookup (const esp_partition_t *partition){
+  for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++){
+    if (&parts[i].part == partition){
+      if (parts[i].data.empty()){
+        parts[i].data.assign(parts[i].part.size, 0xFF);
+      }
+      return &parts[i];
+    }
+  }
+  hostFault("not a partition from esp_partition_find_first ()");
+  return NULL;
+}
+
+static bool inRange (const hostPartition *p, size_t offset, size_t size){
+  return p != NULL && offset <= p->part.size && size <= p->part.size - offset;
+}
+
+const esp_partition_t * esp_partition_find_first (esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label){
+  for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++){
+    hostPartition *p = &parts[i];
+    if (p->part.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || p->part.subtype == subtype)
+        && (label == NULL || strcmp(label, p->part.label) == 0)){
+      return &p->part;
+    }
+  }
+  return NULL;
+}
+
+esp_err_t esp_partition_read (const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size){
+  hostPartition *p = lookup(partition);
+  if (!inRange(p, srcOffset, size)){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  hostBusy(FLASH_CALL_US + (uint32_t)((size * FLASH_READ_BYTE_NS) / 1000));
+  memcpy(dst, p->data.data() + srcOffset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write (const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size){
+  hostPartition *p = lookup(partition);
+  if (!inRange(p, dstOffset, size)){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  hostBusy(FLASH_CALL_US + (uint32_t)((size * FLASH_WRITE_BYTE_NS) / 1000));
+  for (size_t i = 0; i < size; i++){
+    p->data[dstOffset + i] &= ((const uint8_t*)src)[i]; // NOR, programming only clears bits
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range (const esp_partition_t *partition, size_t offset, size_t size){
+  hostPartition *p = lookup(partition);
+  if (offset % FLASH_SECTOR != 0 || size % FLASH_SECTOR != 0){
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!inRange(p, offset, size)){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  hostBusy(FLASH_CALL_US + (uint32_t)(size / FLASH_SECTOR) * FLASH_ERASE_US);
+  memset(p->data.data() + offset, 0xFF, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap (const esp_partition_t *partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory,
+                              const void **outPtr, spi_flash_mmap_handle_t *outHandle){
+  hostPartition *p = lookup(partition);
+  if (!inRange(p, offset, size)){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  hostBusy(FLASH_CALL_US);
+  *outPtr = p->data.data() + offset;
+  *outHandle = ++mapped;
+  return ESP_OK;
+}
+
+void spi_flash_munmap (spi_flash_mmap_handle_t handle){
+  // Nothing to give back, the pointer stays good (unlike on the ESP32, where it is a fault waiting to happen)
+}
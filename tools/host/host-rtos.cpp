@@ -0,0 +1,833 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <vector>
+#include <queue>
+#include "host.h"
+
+/* FreeRTOS on virtual time, see host-rtos.h for what it models. Every task is a coroutine with its own host stack and
+   the scheduler runs on main ()'s: it runs whatever is due outside the board (hostAt () events, interrupts), wakes
+   the tasks whose timeouts are up, then switches to the highest priority task that can run. A task runs until it
+   blocks, is preempted by a task it woke, or calls hostBusy (). When nothing can run the clock jumps to the next wake.
+
+   hostBusy () is how time passes: the task holds its core until then and only a higher priority task on that core
+   gets in (which pushes the end of the busy task's wait back by as long as it ran). If nothing else could run in
+   that time anyway it just moves the clock on without switching, which is most calls.
+   Firmware code itself takes no virtual time, only what the fakes charge and HOST_SWITCH_US whenever a core switches
+   to a task it wasn't already running (woken, or back after being preempted).
+*/
+
+#define HOST_STACK_BYTES  (128 * 1024) // Host code needs more than the firmware's STACK_* and nothing here is short of RAM
+#define HOST_STACK_PAINT  0xA5          // What an untouched stack byte reads as, for the high water mark
+#define HOST_SWITCH_US    2             // A FreeRTOS context switch on the ESP32 at 240MHz, roughly
+
+enum { TASK_READY, TASK_BLOCKED, TASK_BUSY, TASK_SUSPENDED, TASK_DELETED };
+
+//////// Context switching ////////
+
+#if defined(__x86_64__) && defined(__linux__)
+/* Callee saved registers onto the stack, swap stacks, pop them back. Four times faster than swapcontext (~550ns a
+   round trip here), which saves and restores the signal mask with a system call each way.
+*/
+extern "C" void hostSwitch (void **save, void *load);
+__asm__(
+  ".text\n"
+  ".globl hostSwitch\n"
+  ".type hostSwitch, @function\n"
+  "hostSwitch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size hostSwitch, .-hostSwitch\n");
+
+typedef struct { void *sp; } hostContext;
+
+static void contextInit (hostContext *c, uint8_t *stack, size_t bytes, void (*entry)()){
+  void **top = (void**)(((uintptr_t)(stack + bytes)) & ~(uintptr_t)15);
+  *--top = NULL;            // entry's return address, it never returns
+  *--top = (void*)entry;    // Where hostSwitch's ret lands the first time
+  for (int i = 0; i < 6; i++){
+    *--top = NULL;          // rbp rbx r12-r15
+  }
+  c->sp = top;
+}
+
+static inline void contextSwitch (hostContext *from, hostContext *to){
+  hostSwitch(&from->sp, to->sp);
+}
+#else
+#include <ucontext.h>
+
+typedef struct { ucontext_t uc; } hostContext;
+
+static void contextInit (hostContext *c, uint8_t *stack, size_t bytes, void (*entry)()){
+  getcontext(&c->uc);
+  c->uc.uc_stack.ss_sp = stack;
+  c->uc.uc_stack.ss_size = bytes;
+  c->uc.uc_link = NULL;
+  makecontext(&c->uc, entry, 0);
+}
+
+static inline void contextSwitch (hostContext *from, hostContext *to){
+  swapcontext(&from->uc, &to->uc);
+}
+#endif
+
+//////// State ////////
+
+struct hostItem { // A hostAt () event or a service callback
+  uint64_t us;
+  uint64_t seq;    // Same time, first posted runs first
+  std::function<void ()> fn;
+};
+
+struct hostItemLater {
+  bool operator() (const hostItem &a, const hostItem &b) const { return a.us != b.us ? a.us > b.us : a.seq > b.seq; }
+};
+
+typedef std::priority_queue<hostItem, std::vector<hostItem>, hostItemLater> hostItemQueue;
+
+struct hostTask {
+  char name[configMAX_TASK_NAME_LEN];
+  TaskFunction_t fn;
+  void *arg;
+  UBaseType_t prio;
+  BaseType_t core;
+  uint32_t stackBytes;    // What the firmware asked for
+  uint8_t state;
+  bool waitingNotify;
+  byte callbacks;         // Inside a timer or service callback, which mustn't block
+  uint32_t notify;
+  uint64_t wakeUs;        // BLOCKED or BUSY until
+  uint64_t readyOrder;    // FIFO among equal priorities
+  bool switching;         // BUSY being switched to, keeps its place in the FIFO
+  uint64_t runUs;
+  uint8_t *stack;
+  hostContext ctx;
+  hostItemQueue *items;   // Services only
+};
+
+struct hostTimer {
+  char name[configMAX_TASK_NAME_LEN];
+  TickType_t period;
+  bool reload;
+  bool active;
+  void *id;
+  TimerCallbackFunction_t callback;
+  uint64_t expiryUs;
+};
+
+static std::vector<hostTask*> tasks;
+static std::vector<hostTimer*> timers;
+static hostItemQueue events;
+static hostContext schedulerCtx;
+static hostTask *current = NULL;          // NULL while the scheduler (or an event on it) runs
+static hostTask *timerTask = NULL;
+static hostTask *idleTasks[portNUM_PROCESSORS];
+static hostTask *onCore[portNUM_PROCESSORS];  // The task each core last switched to, NULL once it blocked
+static uint64_t nowUs = 0;
+static uint64_t itemSeq = 0;
+static uint64_t readySeq = 0;
+static uint64_t switches = 0;
+static uint32_t faults = 0;
+static int critical = 0;                  // portENTER_CRITICAL nesting
+static bool yieldPending = 0;             // Preempted inside a critical section, switch on the way out
+static bool inEvent = 0;
+static BaseType_t eventCore = 0;
+static bool booted = 0;
+static uint32_t rngState = 1;
+
+//////// Scheduler ////////
+
+static uint64_t tickDeadline (TickType_t ticks){
+  if (ticks == portMAX_DELAY){
+    return HOST_FOREVER;
+  }
+  return ((nowUs / 1000) + ticks) * 1000; // Ticks are counted from the last tick, not from now
+}
+
+static void makeReady (hostTask *t){
+  t->state = TASK_READY;
+  t->wakeUs = HOST_FOREVER;
+  t->readyOrder = readySeq++;
+}
+
+// Highest priority ready task that no busy task of at least its priority is holding the core from
+static hostTask * pick (){
+  int held[portNUM_PROCESSORS] = {-1, -1};
+  hostTask *best = NULL;
+
+  for (size_t i = 0; i < tasks.size(); i++){
+    if (tasks[i]->state == TASK_BUSY && (int)tasks[i]->prio > held[tasks[i]->core]){
+      held[tasks[i]->core] = tasks[i]->prio;
+    }
+  }
+  for (size_t i = 0; i < tasks.size(); i++){
+    hostTask *t = tasks[i];
+    if (t->state != TASK_READY || (int)t->prio <= held[t->core]){
+      continue;
+    }
+    if (best == NULL || t->prio > best->prio || (t->prio == best->prio && t->readyOrder < best->readyOrder)){
+      best = t;
+    }
+  }
+  return best;
+}
+
+static uint64_t nextWake (){
+  uint64_t next = events.empty() ? HOST_FOREVER : events.top().us;
+  for (size_t i = 0; i < tasks.size(); i++){
+    if ((tasks[i]->state == TASK_BLOCKED || tasks[i]->state == TASK_BUSY) && tasks[i]->wakeUs < next){
+      next = tasks[i]->wakeUs;
+    }
+  }
+  return next;
+}
+
+static bool otherReady (const hostTask *me){
+  for (size_t i = 0; i < tasks.size(); i++){
+    if (tasks[i] != me && tasks[i]->state == TASK_READY){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Back to the scheduler, returns once this task is picked again
+static void switchOut (){
+  hostTask *me = current;
+  contextSwitch(&me->ctx, &schedulerCtx);
+}
+
+static void preemptBy (hostTask *t){
+  hostTask *me = current;
+  if (me == NULL || inEvent || t->core != me->core || t->prio <= me->prio){
+    return; // Another core's, or not above us, it gets its turn when we block
+  }
+  if (critical > 0){
+    yieldPending = 1;
+    return;
+  }
+  makeReady(me);
+  switchOut();
+}
+
+static void runEvent (){
+  hostItem e = events.top();
+  events.pop();
+  inEvent = 1;
+  eventCore = 0;
+  e.fn();
+  inEvent = 0;
+}
+
+static const std::function<bool ()> *stopWhen = NULL; // hostRunUntilTrue ()'s, checked after every event and task switch
+
+void hostRunUntil (uint64_t us){
+  if (current != NULL || inEvent){
+    hostFault("hostRunUntil from inside the simulation");
+    return;
+  }
+  for(;;){
+    if (!events.empty() && events.top().us <= nowUs){
+      runEvent();
+      if (stopWhen != NULL && (*stopWhen)()){
+        break;
+      }
+      continue;
+    }
+    for (size_t i = 0; i < tasks.size(); i++){
+      hostTask *t = tasks[i];
+      if (t->state == TASK_BUSY && t->switching && t->wakeUs <= nowUs){
+        t->state = TASK_READY;
+        t->switching = 0;
+      }
+      else if ((t->state == TASK_BLOCKED || t->state == TASK_BUSY) && t->wakeUs <= nowUs){
+        makeReady(t);
+      }
+    }
+    hostTask *t = pick();
+    if (t != NULL && onCore[t->core] != t){ // The switch itself holds the core first
+      onCore[t->core] = t;
+      for (size_t i = 0; i < tasks.size(); i++){
+        if (tasks[i]->state == TASK_BUSY && tasks[i]->core == t->core){
+          tasks[i]->wakeUs += HOST_SWITCH_US; // Preempted
+        }
+      }
+      t->state = TASK_BUSY;
+      t->switching = 1;
+      t->wakeUs = nowUs + HOST_SWITCH_US;
+      t->runUs += HOST_SWITCH_US;
+      continue;
+    }
+    if (t != NULL){
+      current = t;
+      switches++;
+      contextSwitch(&schedulerCtx, &t->ctx);
+      current = NULL;
+      if (t->state != TASK_READY && t->state != TASK_BUSY){
+        onCore[t->core] = NULL;
+      }
+      if (t->state == TASK_DELETED && t->stack != NULL){
+        free(t->stack);
+        t->stack = NULL;
+      }
+      if (stopWhen != NULL && (*stopWhen)()){
+        break;
+      }
+      continue;
+    }
+    uint64_t next = nextWake();
+    if (next > us){
+      nowUs = max(nowUs, us);
+      break;
+    }
+    nowUs = next;
+  }
+}
+
+void hostRunFor (uint64_t us){
+  hostRunUntil(nowUs + us);
+}
+
+bool hostRunUntilTrue (const std::function<bool ()> &done, uint64_t maxUs, uint64_t stepUs){
+  for(;;){
+    if (done()){
+      return 1;
+    }
+    if (nowUs >= maxUs){
+      return 0;
+    }
+    if (stepUs == 0){ // Stops as soon as it's true, to the us
+      stopWhen = &done;
+      hostRunUntil(maxUs);
+      stopWhen = NULL;
+    }
+    else{
+      hostRunUntil(min(nowUs + stepUs, maxUs));
+    }
+  }
+}
+
+uint64_t hostNow (){
+  return nowUs;
+}
+
+void hostAt (uint64_t us, const std::function<void ()> &fn){
+  hostItem e = {max(us, nowUs), itemSeq++, fn};
+  events.push(e);
+}
+
+void hostAfter (uint64_t us, const std::function<void ()> &fn){
+  hostAt(nowUs + us, fn);
+}
+
+void hostIsr (BaseType_t core, const std::function<void ()> &fn){
+  bool was = inEvent;
+  BaseType_t wasCore = eventCore;
+  inEvent = 1;
+  eventCore = core;
+  fn();
+  inEvent = was;
+  eventCore = wasCore;
+}
+
+bool hostInIsr (){
+  return inEvent;
+}
+
+void hostBusy (uint32_t us){
+  hostTask *me = current;
+  if (us == 0){
+    return;
+  }
+  if (me == NULL || inEvent || critical > 0){ // An ISR or a critical section, nothing else gets in
+    nowUs += us;
+    return;
+  }
+  me->runUs += us;
+  for (size_t i = 0; i < tasks.size(); i++){ // Anything we got in ahead of on this core waits that much longer
+    if (tasks[i] != me && tasks[i]->state == TASK_BUSY && tasks[i]->core == me->core){
+      tasks[i]->wakeUs += us;
+    }
+  }
+  if (!otherReady(me) && nextWake() > nowUs + us){
+    nowUs += us;
+    return;
+  }
+  me->state = TASK_BUSY;
+  me->wakeUs = nowUs + us;
+  switchOut();
+}
+
+uint64_t hostSwitches (){
+  return switches;
+}
+
+void hostFault (const char *fmt, ...){
+  va_list ap;
+  faults++;
+  fprintf(stderr, "host: %.3fms %s: ", nowUs / 1000.0, current != NULL ? current->name : (inEvent ? "isr" : "-"));
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+uint32_t hostFaults (){
+  return faults;
+}
+
+void hostSeed (uint32_t seed){
+  rngState = seed ? seed : 1;
+}
+
+uint32_t hostRandom (){ // xorshift32, the same run for the same seed
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// A blocking call, is it allowed here? Faults if not
+static bool canBlock (const char *what){
+  if (current == NULL || inEvent){
+    hostFault("%s outside a task", what);
+    return 0;
+  }
+  if (current->callbacks > 0){
+    hostFault("%s in a callback", what);
+    return 0;
+  }
+  return 1;
+}
+
+//////// Tasks ////////
+
+static void taskStart (){
+  hostTask *me = current;
+  me->fn(me->arg);
+  hostFault("task function returned"); // The IDF aborts
+  vTaskDelete(NULL);
+}
+
+static hostTask * taskNew (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg, UBaseType_t prio, BaseType_t core){
+  hostTask *t = new hostTask();
+  strncpy(t->name, name, sizeof(t->name) - 1);
+  t->fn = fn;
+  t->arg = arg;
+  t->prio = min(prio, (UBaseType_t)(configMAX_PRIORITIES - 1));
+  t->core = (core >= 0 && core < portNUM_PROCESSORS) ? core : 0; // tskNO_AFFINITY goes on core 0
+  t->stackBytes = stackBytes;
+  t->items = NULL;
+  t->stack = (uint8_t*)malloc(HOST_STACK_BYTES);
+  memset(t->stack, HOST_STACK_PAINT, HOST_STACK_BYTES);
+  contextInit(&t->ctx, t->stack, HOST_STACK_BYTES, taskStart);
+  makeReady(t);
+  tasks.push_back(t);
+  return t;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg,
+                                            UBaseType_t prio, StackType_t *stack, StaticTask_t *tcb, BaseType_t core){
+  hostTask *t = taskNew(fn, name, stackBytes, arg, prio, core);
+  preemptBy(t);
+  return t;
+}
+
+BaseType_t xTaskCreatePinnedToCore (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg,
+                                    UBaseType_t prio, TaskHandle_t *handle, BaseType_t core){
+  hostTask *t = taskNew(fn, name, stackBytes, arg, prio, core);
+  if (handle != NULL){
+    *handle = t;
+  }
+  preemptBy(t);
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg, UBaseType_t prio, TaskHandle_t *handle){
+  return xTaskCreatePinnedToCore(fn, name, stackBytes, arg, prio, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete (TaskHandle_t task){
+  hostTask *t = (task != NULL) ? task : current;
+  if (t == NULL){
+    hostFault("vTaskDelete (NULL) outside a task");
+    return;
+  }
+  t->state = TASK_DELETED;
+  if (t == current){
+    switchOut(); // Never comes back, the scheduler frees the stack
+  }
+  free(t->stack);
+  t->stack = NULL;
+}
+
+void vTaskSuspend (TaskHandle_t task){
+  hostTask *t = (task != NULL) ? task : current;
+  if (t == NULL || t->state == TASK_DELETED){
+    return;
+  }
+  t->state = TASK_SUSPENDED;
+  if (t == current){
+    switchOut();
+  }
+}
+
+void vTaskResume (TaskHandle_t task){
+  if (task != NULL && task->state == TASK_SUSPENDED){
+    makeReady(task);
+    preemptBy(task);
+  }
+}
+
+void vTaskDelay (TickType_t ticks){
+  if (!canBlock("vTaskDelay")){
+    return;
+  }
+  if (ticks == 0){
+    hostYield();
+    return;
+  }
+  current->state = TASK_BLOCKED;
+  current->waitingNotify = 0;
+  current->wakeUs = tickDeadline(ticks);
+  switchOut();
+}
+
+void hostYield (){
+  if (current == NULL || inEvent){
+    return;
+  }
+  makeReady(current);
+  switchOut();
+}
+
+void hostYieldFromIsr (){
+  // The scheduler picks once the event is done anyway
+}
+
+void hostEnterCritical (portMUX_TYPE *mux){
+  critical++;
+  mux->count++;
+}
+
+void hostExitCritical (portMUX_TYPE *mux){
+  if (critical == 0 || mux->count == 0){
+    hostFault("portEXIT_CRITICAL without a matching enter");
+    return;
+  }
+  mux->count--;
+  critical--;
+  if (critical == 0 && yieldPending){
+    yieldPending = 0;
+    hostYield();
+  }
+}
+
+TickType_t xTaskGetTickCount (){
+  return (TickType_t)(nowUs / 1000);
+}
+
+TickType_t xTaskGetTickCountFromISR (){
+  return (TickType_t)(nowUs / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle (){
+  return current;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU (UBaseType_t core){
+  return (core < portNUM_PROCESSORS) ? idleTasks[core] : NULL;
+}
+
+const char * pcTaskGetTaskName (TaskHandle_t task){
+  hostTask *t = (task != NULL) ? task : current;
+  return (t != NULL) ? t->name : "";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark (TaskHandle_t task){
+  hostTask *t = (task != NULL) ? task : current;
+  if (t == NULL || t->stack == NULL){
+    return 0;
+  }
+  uint32_t untouched = 0;
+  while (untouched < HOST_STACK_BYTES && t->stack[untouched] == HOST_STACK_PAINT){
+    untouched++;
+  }
+  // What the host used, against what the firmware gave it. Only a rough guide, x86 frames aren't Xtensa ones
+  uint32_t used = HOST_STACK_BYTES - untouched;
+  return (used < t->stackBytes) ? t->stackBytes - used : 0;
+}
+
+void vTaskGetInfo (TaskHandle_t task, TaskStatus_t *status, BaseType_t getHighWaterMark, eTaskState state){
+  hostTask *t = (task != NULL) ? task : current;
+  memset(status, 0, sizeof(*status));
+  if (t == NULL){
+    return;
+  }
+  status->xHandle = t;
+  status->pcTaskName = t->name;
+  status->eCurrentState = (state == eInvalid) ? eTaskGetState(t) : state;
+  status->uxCurrentPriority = t->prio;
+  status->uxBasePriority = t->prio;
+  status->ulRunTimeCounter = (uint32_t)hostTaskRunUs(t);
+  status->xCoreID = t->core;
+  if (getHighWaterMark){
+    status->usStackHighWaterMark = uxTaskGetStackHighWaterMark(t);
+  }
+}
+
+eTaskState eTaskGetState (TaskHandle_t task){
+  if (task == current && task != NULL){
+    return eRunning;
+  }
+  switch (task->state){
+    case TASK_READY:     return eReady;
+    case TASK_BUSY:      return eReady;
+    case TASK_BLOCKED:   return eBlocked;
+    case TASK_SUSPENDED: return eSuspended;
+    default:             return eDeleted;
+  }
+}
+
+BaseType_t xPortGetCoreID (){
+  if (inEvent){
+    return eventCore;
+  }
+  return (current != NULL) ? current->core : 0;
+}
+
+uint32_t hostTaskRunUs (TaskHandle_t task){
+  for (int c = 0; c < portNUM_PROCESSORS; c++){
+    if (task == idleTasks[c]){ // Idle gets whatever nothing else on its core used
+      uint64_t used = 0;
+      for (size_t i = 0; i < tasks.size(); i++){
+        if (tasks[i]->core == c){
+          used += tasks[i]->runUs;
+        }
+      }
+      return (uint32_t)(nowUs - min(used, nowUs));
+    }
+  }
+  return (task != NULL) ? (uint32_t)task->runUs : 0;
+}
+
+//////// Notifications ////////
+
+BaseType_t xTaskNotifyGive (TaskHandle_t task){
+  if (task == NULL || task->state == TASK_DELETED){
+    return pdFAIL;
+  }
+  task->notify++;
+  if (task->state == TASK_BLOCKED && task->waitingNotify){
+    makeReady(task);
+    preemptBy(task);
+  }
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR (TaskHandle_t task, BaseType_t *higherPriorityTaskWoken){
+  if (task == NULL || task->state == TASK_DELETED){
+    return;
+  }
+  task->notify++;
+  if (task->state == TASK_BLOCKED && task->waitingNotify){
+    makeReady(task);
+    if (higherPriorityTaskWoken != NULL){
+      *higherPriorityTaskWoken = pdTRUE;
+    }
+  }
+}
+
+uint32_t ulTaskNotifyTake (BaseType_t clearOnExit, TickType_t wait){
+  hostTask *me = current;
+  if (me == NULL || inEvent){
+    hostFault("ulTaskNotifyTake outside a task");
+    return 0;
+  }
+  if (me->notify == 0 && wait > 0 && canBlock("ulTaskNotifyTake")){
+    me->state = TASK_BLOCKED;
+    me->waitingNotify = 1;
+    me->wakeUs = tickDeadline(wait);
+    switchOut();
+    me->waitingNotify = 0;
+  }
+  uint32_t v = me->notify;
+  if (v > 0){
+    me->notify = clearOnExit ? 0 : v - 1;
+  }
+  return v;
+}
+
+//////// Services ////////
+
+// Blocks the service until us, or until something earlier is posted to it
+static void serviceWait (uint64_t us){
+  hostTask *me = current;
+  me->state = TASK_BLOCKED;
+  me->waitingNotify = 0;
+  me->wakeUs = us;
+  switchOut();
+}
+
+static void serviceLoop (void *arg){
+  hostTask *me = current;
+  for(;;){
+    while (!me->items->empty() && me->items->top().us <= nowUs){
+      hostItem item = me->items->top();
+      me->items->pop();
+      me->callbacks++;
+      item.fn();
+      me->callbacks--;
+    }
+    serviceWait(me->items->empty() ? HOST_FOREVER : me->items->top().us);
+  }
+}
+
+TaskHandle_t hostServiceCreate (const char *name, UBaseType_t prio, BaseType_t core){
+  hostTask *t = taskNew(serviceLoop, name, 4096, NULL, prio, core);
+  t->items = new hostItemQueue();
+  return t;
+}
+
+void hostServicePost (TaskHandle_t service, uint64_t atUs, const std::function<void ()> &fn){
+  hostItem item = {max(atUs, nowUs), itemSeq++, fn};
+  service->items->push(item);
+  if (service->state == TASK_BLOCKED && item.us < service->wakeUs){
+    service->wakeUs = item.us;
+  }
+}
+
+//////// Timers ////////
+
+static uint64_t nextExpiry (){
+  uint64_t next = HOST_FOREVER;
+  for (size_t i = 0; i < timers.size(); i++){
+    if (timers[i]->active && timers[i]->expiryUs < next){
+      next = timers[i]->expiryUs;
+    }
+  }
+  return next;
+}
+
+static void timerLoop (void *arg){
+  hostTask *me = current;
+  for(;;){
+    for(;;){
+      hostTimer *due = NULL;
+      for (size_t i = 0; i < timers.size(); i++){
+        if (timers[i]->active && timers[i]->expiryUs <= nowUs && (due == NULL || timers[i]->expiryUs < due->expiryUs)){
+          due = timers[i];
+        }
+      }
+      if (due == NULL){
+        break;
+      }
+      if (due->reload){
+        due->expiryUs += due->period * 1000ULL;
+      }
+      else{
+        due->active = 0;
+      }
+      me->callbacks++;
+      due->callback(due);
+      me->callbacks--;
+    }
+    serviceWait(nextExpiry());
+  }
+}
+
+static void timerArm (hostTimer *t){
+  t->active = 1;
+  t->expiryUs = tickDeadline(t->period);
+  if (timerTask != NULL && timerTask->state == TASK_BLOCKED && t->expiryUs < timerTask->wakeUs){
+    timerTask->wakeUs = t->expiryUs;
+  }
+}
+
+TimerHandle_t xTimerCreateStatic (const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                                  TimerCallbackFunction_t callback, StaticTimer_t *buffer){
+  hostTimer *t = new hostTimer();
+  strncpy(t->name, name, sizeof(t->name) - 1);
+  t->period = max(period, (TickType_t)1);
+  t->reload = autoReload;
+  t->active = 0;
+  t->id = id;
+  t->callback = callback;
+  timers.push_back(t);
+  return t;
+}
+
+TimerHandle_t xTimerCreate (const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback){
+  return xTimerCreateStatic(name, period, autoReload, id, callback, NULL);
+}
+
+BaseType_t xTimerStart (TimerHandle_t timer, TickType_t wait){
+  timerArm(timer);
+  return pdPASS;
+}
+
+BaseType_t xTimerStop (TimerHandle_t timer, TickType_t wait){
+  timer->active = 0;
+  return pdPASS;
+}
+
+BaseType_t xTimerReset (TimerHandle_t timer, TickType_t wait){
+  timerArm(timer);
+  return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod (TimerHandle_t timer, TickType_t period, TickType_t wait){
+  timer->period = max(period, (TickType_t)1);
+  timerArm(timer);
+  return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive (TimerHandle_t timer){
+  return timer->active;
+}
+
+TickType_t xTimerGetPeriod (TimerHandle_t timer){
+  return timer->period;
+}
+
+void * pvTimerGetTimerID (TimerHandle_t timer){
+  return timer->id;
+}
+
+//////// Arduino's loop task ////////
+
+static void loopTask (void *params){
+  setup();
+  for(;;){
+    loop();
+    vTaskDelay(1); // The core spins on loop (), which would stop the clock here
+  }
+}
+
+void hostBoot (){
+  if (booted){
+    return;
+  }
+  booted = 1;
+  for (int c = 0; c < portNUM_PROCESSORS; c++){ // Never run, they're only there to be asked about
+    idleTasks[c] = new hostTask();
+    snprintf(idleTasks[c]->name, sizeof(idleTasks[c]->name), "IDLE%d", c);
+    idleTasks[c]->core = c;
+    idleTasks[c]->state = TASK_READY;
+  }
+  timerTask = taskNew(timerLoop, "Tmr Svc", 2048, NULL, configTIMER_TASK_PRIORITY, 0);
+  taskNew(loopTask, "loopTask", 8192, NULL, 1, 1);
+}
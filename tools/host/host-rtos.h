@@ -0,0 +1,117 @@
+#ifndef HOST_RTOS_H
+#define HOST_RTOS_H
+
+/* The part of FreeRTOS (the ESP-IDF SMP flavour) the firmware uses, on a PC. Tasks are coroutines on one thread and
+   time is virtual: nothing takes any time unless a fake says it does (SPI transfers, LED refreshes, flash writes,
+   see hostBusy () in host.h), and when every task is blocked the clock jumps straight to the next wake up. So a
+   60s removal timeout costs nothing to wait out, and a run is the same every time for the same inputs.
+
+   Scheduling follows FreeRTOS where it matters to us: the highest priority ready task on a core runs, a task woken
+   by a higher priority one on its own core takes over at once, the two cores run side by side (each has its own
+   busy task), timers fire from a timer service task at configTIMER_TASK_PRIORITY. What isn't modelled: time slicing
+   between equal priorities, and preemption anywhere but at a call into this API.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t; // A byte on the ESP32, stack sizes are in bytes
+typedef struct hostTask * TaskHandle_t;
+typedef struct hostTimer * TimerHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+// The static buffers are only taken for the API's sake, the host keeps its own (bigger) stacks
+typedef struct { void *unused; } StaticTask_t;
+typedef struct { void *unused; } StaticTimer_t;
+
+typedef struct { uint32_t owner; uint32_t count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdPASS              1
+#define pdFAIL              0
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portNUM_PROCESSORS  2
+#define tskIDLE_PRIORITY    0
+#define tskNO_AFFINITY      0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+#define configMAX_TASK_NAME_LEN 16
+#define configTIMER_TASK_PRIORITY 1
+#define configSUPPORT_STATIC_ALLOCATION 1
+#define configGENERATE_RUN_TIME_STATS 1 // Runtime is the virtual time a task was busy
+#define configUSE_TRACE_FACILITY 1
+
+typedef enum { eRunning = 0, eReady, eBlocked, eSuspended, eDeleted, eInvalid } eTaskState;
+
+typedef struct {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  UBaseType_t xTaskNumber;
+  eTaskState eCurrentState;
+  UBaseType_t uxCurrentPriority;
+  UBaseType_t uxBasePriority;
+  uint32_t ulRunTimeCounter;
+  StackType_t *pxStackBase;
+  uint32_t usStackHighWaterMark;
+  BaseType_t xCoreID;
+} TaskStatus_t;
+
+// Critical sections only keep the scheduler from switching away, there is nothing else to keep out on one thread
+extern void hostEnterCritical (portMUX_TYPE *mux);
+extern void hostExitCritical (portMUX_TYPE *mux);
+extern void hostYieldFromIsr ();
+extern void hostYield ();
+
+#define portENTER_CRITICAL(mux)     hostEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)      hostExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) hostEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)  hostExitCritical(mux)
+#define portYIELD_FROM_ISR()        hostYieldFromIsr()
+#define taskYIELD()                 hostYield()
+
+// Tasks
+extern TaskHandle_t xTaskCreateStaticPinnedToCore (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg,
+                                                   UBaseType_t prio, StackType_t *stack, StaticTask_t *tcb, BaseType_t core);
+extern BaseType_t xTaskCreatePinnedToCore (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg,
+                                           UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+extern BaseType_t xTaskCreate (TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg, UBaseType_t prio, TaskHandle_t *handle);
+extern void vTaskDelete (TaskHandle_t task);
+extern void vTaskSuspend (TaskHandle_t task);
+extern void vTaskResume (TaskHandle_t task);
+extern void vTaskDelay (TickType_t ticks);
+extern TickType_t xTaskGetTickCount ();
+extern TickType_t xTaskGetTickCountFromISR ();
+extern TaskHandle_t xTaskGetCurrentTaskHandle ();
+extern TaskHandle_t xTaskGetIdleTaskHandleForCPU (UBaseType_t core);
+extern const char * pcTaskGetTaskName (TaskHandle_t task);
+extern UBaseType_t uxTaskGetStackHighWaterMark (TaskHandle_t task);
+extern void vTaskGetInfo (TaskHandle_t task, TaskStatus_t *status, BaseType_t getHighWaterMark, eTaskState state);
+extern eTaskState eTaskGetState (TaskHandle_t task);
+extern BaseType_t xPortGetCoreID ();
+
+// Direct to task notifications, the counting kind
+extern BaseType_t xTaskNotifyGive (TaskHandle_t task);
+extern void vTaskNotifyGiveFromISR (TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+extern uint32_t ulTaskNotifyTake (BaseType_t clearOnExit, TickType_t wait);
+
+// Software timers
+extern TimerHandle_t xTimerCreateStatic (const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                                         TimerCallbackFunction_t callback, StaticTimer_t *buffer);
+extern TimerHandle_t xTimerCreate (const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback);
+extern BaseType_t xTimerStart (TimerHandle_t timer, TickType_t wait);
+extern BaseType_t xTimerStop (TimerHandle_t timer, TickType_t wait);
+extern BaseType_t xTimerReset (TimerHandle_t timer, TickType_t wait);
+extern BaseType_t xTimerChangePeriod (TimerHandle_t timer, TickType_t period, TickType_t wait);
+extern BaseType_t xTimerIsTimerActive (TimerHandle_t timer);
+extern TickType_t xTimerGetPeriod (TimerHandle_t timer);
+extern void * pvTimerGetTimerID (TimerHandle_t timer);
+
+#endif // HOST_RTOS_H
@@ -0,0 +1,439 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host.h"
+
+/* SPIFFS on the host, see SPIFFS.h. The costs are rough figures for SPIFFS on the ESP32's 40MHz flash, enough for
+   flash work to show up where it happens (and to be slow where it is slow: opens and page programs), not measurements.
+   They're charged to the calling task only, the flash cache being off on both cores during a write isn't modelled.
+*/
+
+#define FS_TOTAL         0x124000  // The spiffs row of partitions.csv
+#define FS_MAX_OPEN      10        // SPIFFS.begin ()'s maxOpenFiles default
+#define FS_MOUNT_US      60000
+#define FS_FORMAT_US     10000000  // ~300 sector erases
+#define FS_UNMOUNTED_US  50        // Any call with nothing mounted, the VFS finds no driver for the path and gives up
+#define FS_OPEN_US       2500      // Scanning the object lookup pages
+#define FS_CLOSE_US      800       // Writing the object index back
+#define FS_FLUSH_US      800
+#define FS_WRITE_US      150       // A write () call, before its bytes
+#define FS_WRITE_BYTE_NS 2800      // Page program, ~0.7ms per 256 bytes
+#define FS_READ_US       60
+#define FS_READ_BYTE_NS  250
+#define FS_REMOVE_US     4000
+#define FS_RENAME_US     4000
+
+typedef std::shared_ptr<std::vector<uint8_t> > hostBlob;
+
+SPIFFSFS SPIFFS;
+
+static bool mounted = 0;
+static bool fresh = 0;
+static bool broken = 0;
+static std::string root;                       // Empty: files are kept in memory
+static std::map<std::string, hostBlob> blobs;
+static size_t used = 0;
+static int openCount = 0;
+static uint32_t opens = 0;
+static uint64_t bytesWritten = 0;
+
+static std::string hostPath (const std::string &path){
+  return root + path;
+}
+
+static bool diskSize (const std::string &path, size_t *size){
+  struct stat st;
+  if (stat(hostPath(path).c_str(), &st) != 0 || !S_ISREG(st.st_mode)){
+    return 0;
+  }
+  *size = st.st_size;
+  return 1;
+}
+
+static std::vector<std::string> listing (){
+  std::vector<std::string> names;
+  if (root.empty()){
+    for (std::map<std::string, hostBlob>::iterator i = blobs.begin(); i != blobs.end(); ++i){
+      names.push_back(i->first);
+    }
+    return names;
+  }
+  DIR *d = opendir(root.c_str());
+  struct dirent *e;
+  size_t size;
+  while (d != NULL && (e = readdir(d)) != NULL){
+    std::string path = std::string("/") + e->d_name;
+    if (diskSize(path, &size)){
+      names.push_back(path);
+    }
+  }
+  if (d != NULL){
+    closedir(d);
+  }
+  return names;
+}
+
+static size_t sizeOf (const std::string &path, bool *found){
+  size_t size = 0;
+  if (root.empty()){
+    std::map<std::string, hostBlob>::iterator i = blobs.find(path);
+    *found = (i != blobs.end());
+    return *found ? i->second->size() : 0;
+  }
+  *found = diskSize(path, &size);
+  return size;
+}
+
+static void charge (uint32_t us, size_t bytes, uint32_t byteNs){
+  hostBusy(us + (uint32_t)((bytes * byteNs) / 1000));
+}
+
+namespace fs {
+
+class FileImpl {
+public:
+  std::string path;
+  bool open = 0;
+  bool readable = 0;
+  bool writable = 0;
+  bool append = 0;
+  size_t pos = 0;
+  hostBlob blob;                      // In memory
+  FILE *f = NULL;                     // On the host
+  bool dir = 0;
+  std::vector<std::string> entries;   // A directory's, openNextFile () walks them
+  size_t next = 0;
+
+  size_t size () const {
+    if (blob){
+      return blob->size();
+    }
+    struct stat st;
+    fflush(f);
+    return (fstat(fileno(f), &st) == 0) ? st.st_size : 0;
+  }
+
+  void shut (){
+    if (!open){
+      return;
+    }
+    hostBusy(writable ? FS_CLOSE_US : 20);
+    if (f != NULL){
+      fclose(f);
+      f = NULL;
+    }
+    blob.reset();
+    open = 0;
+    openCount--;
+  }
+
+  ~FileImpl (){ shut(); } // The last copy going closes it, and costs the same, as on the ESP32
+};
+
+File::operator bool () const {
+  return impl && impl->open;
+}
+
+size_t File::size () const {
+  return (*this) ? impl->size() : 0;
+}
+
+bool File::seek (uint32_t pos){
+  if (!*this || impl->dir || pos > impl->size()){
+    return 0;
+  }
+  hostBusy(20);
+  if (impl->f != NULL){
+    return fseek(impl->f, pos, SEEK_SET) == 0;
+  }
+  impl->pos = pos;
+  return 1;
+}
+
+size_t File::position () const {
+  if (!*this){
+    return 0;
+  }
+  return (impl->f != NULL) ? (size_t)ftell(impl->f) : impl->pos;
+}
+
+int File::available (){
+  if (!*this || !impl->readable){
+    return 0;
+  }
+  return (int)(impl->size() - position());
+}
+
+size_t File::read (uint8_t *buf, size_t len){
+  if (!*this || !impl->readable){
+    return 0;
+  }
+  size_t n;
+  if (impl->f != NULL){
+    n = fread(buf, 1, len, impl->f);
+  }
+  else{
+    n = min(len, impl->blob->size() - min(impl->pos, impl->blob->size()));
+    memcpy(buf, impl->blob->data() + impl->pos, n);
+    impl->pos += n;
+  }
+  charge(FS_READ_US, n, FS_READ_BYTE_NS);
+  return n;
+}
+
+int File::read (){
+  uint8_t c;
+  return (read(&c, 1) == 1) ? c : -1;
+}
+
+size_t File::write (const uint8_t *buf, size_t len){
+  if (!*this || !impl->writable){
+    return 0;
+  }
+  if (used + len > FS_TOTAL){
+    hostBusy(FS_WRITE_US);
+    return 0; // Full, SPIFFS fails the whole write
+  }
+  size_t before = impl->size();
+  if (impl->f != NULL){
+    len = fwrite(buf, 1, len, impl->f);
+  }
+  else{
+    std::vector<uint8_t> &b = *impl->blob;
+    if (impl->append){
+      impl->pos = b.size();
+    }
+    b.resize(max(b.size(), impl->pos + len));
+    memcpy(b.data() + impl->pos, buf, len);
+    impl->pos += len;
+  }
+  used += impl->size() - before; // Overwriting in place doesn't grow it
+  charge(FS_WRITE_US, len, FS_WRITE_BYTE_NS);
+  bytesWritten += len; // Counted once it's on flash
+  return len;
+}
+
+size_t File::write (uint8_t c){
+  return write(&c, 1);
+}
+
+void File::flush (){
+  if (*this && impl->writable){
+    hostBusy(FS_FLUSH_US);
+    if (impl->f != NULL){
+      fflush(impl->f);
+    }
+  }
+}
+
+void File::close (){
+  if (*this){
+    impl->shut();
+  }
+}
+
+bool File::isDirectory () const {
+  return *this && impl->dir;
+}
+
+const char * File::name () const {
+  return impl ? impl->path.c_str() : "";
+}
+
+File File::openNextFile (){
+  if (!isDirectory() || impl->next >= impl->entries.size()){
+    return File();
+  }
+  return SPIFFS.open(impl->entries[impl->next++].c_str(), FILE_READ);
+}
+
+size_t File::print (long v, int base){
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%ld", v);
+  return write((const uint8_t*)buf, n);
+}
+
+File FS::open (const char *path, const char *mode){
+  std::shared_ptr<FileImpl> impl(new FileImpl());
+  std::string p(path);
+  bool found;
+
+  opens++;
+  if (!mounted){
+    hostBusy(FS_UNMOUNTED_US);
+    return File();
+  }
+  hostBusy(FS_OPEN_US);
+  if (openCount >= FS_MAX_OPEN){
+    return File();
+  }
+  impl->path = p;
+  if (p == "/"){
+    impl->dir = 1;
+    impl->entries = listing();
+  }
+  else{
+    size_t size = sizeOf(p, &found);
+    impl->readable = (mode[0] == 'r' || mode[1] == '+');
+    impl->writable = (mode[0] != 'r' || mode[1] == '+');
+    impl->append = (mode[0] == 'a');
+    if (mode[0] == 'r' && !found){
+      return File();
+    }
+    if (mode[0] == 'w'){
+      used -= size; // Truncated
+    }
+    if (root.empty()){
+      if (mode[0] == 'w' || !found){
+        blobs[p] = hostBlob(new std::vector<uint8_t>());
+      }
+      impl->blob = blobs[p];
+    }
+    else{
+      const char *m = (mode[0] == 'r') ? (impl->writable ? "r+b" : "rb") : (mode[0] == 'w' ? "w+b" : "a+b");
+      impl->f = fopen(hostPath(p).c_str(), m);
+      if (impl->f == NULL){
+        return File();
+      }
+    }
+  }
+  impl->open = 1;
+  openCount++;
+  return File(impl);
+}
+
+bool FS::exists (const char *path){
+  bool found;
+  if (!mounted){
+    hostBusy(FS_UNMOUNTED_US);
+    return 0;
+  }
+  hostBusy(FS_OPEN_US); // The core's exists () is an open and a close
+  sizeOf(path, &found);
+  return found;
+}
+
+bool FS::remove (const char *path){
+  bool found;
+  if (!mounted){
+    hostBusy(FS_UNMOUNTED_US);
+    return 0;
+  }
+  hostBusy(FS_REMOVE_US);
+  size_t size = sizeOf(path, &found);
+  if (!found){
+    return 0;
+  }
+  used -= size;
+  if (root.empty()){
+    blobs.erase(path); // Anything still open on it keeps its blob
+    return 1;
+  }
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename (const char *from, const char *to){
+  bool found;
+  if (!mounted){
+    hostBusy(FS_UNMOUNTED_US);
+    return 0;
+  }
+  hostBusy(FS_RENAME_US);
+  sizeOf(from, &found);
+  if (!found){
+    return 0;
+  }
+  size_t replaced = sizeOf(to, &found);
+  if (found){
+    return 0; // SPIFFS won't rename over a file
+  }
+  used -= replaced;
+  if (root.empty()){
+    blobs[to] = blobs[from];
+    blobs.erase(from);
+    return 1;
+  }
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+} // namespace fs
+
+bool SPIFFSFS::begin (bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *label){
+  if (mounted){
+    return 1;
+  }
+  hostBusy(FS_MOUNT_US);
+  if (broken || fresh){
+    if (!formatOnFail || broken){
+      return 0;
+    }
+    mounted = 1; // format () wants it mounted, same as the driver
+    format();
+  }
+  mounted = 1;
+  used = 0;
+  std::vector<std::string> names = listing();
+  for (size_t i = 0; i < names.size(); i++){
+    bool found;
+    used += sizeOf(names[i], &found);
+  }
+  return 1;
+}
+
+void SPIFFSFS::end (){
+  mounted = 0;
+}
+
+bool SPIFFSFS::format (){
+  if (broken){
+    return 0;
+  }
+  hostBusy(FS_FORMAT_US);
+  std::vector<std::string> names = listing();
+  for (size_t i = 0; i < names.size(); i++){
+    if (root.empty()){
+      blobs.erase(names[i]);
+    }
+    else{
+      unlink(hostPath(names[i]).c_str());
+    }
+  }
+  used = 0;
+  fresh = 0;
+  return 1;
+}
+
+size_t SPIFFSFS::totalBytes (){
+  return FS_TOTAL;
+}
+
+size_t SPIFFSFS::usedBytes (){
+  return mounted ? used : 0;
+}
+
+//////// Harness side ////////
+
+void hostFsRoot (const char *dir){
+  root = (dir != NULL) ? dir : "";
+}
+
+void hostFsFresh (){
+  fresh = 1;
+}
+
+void hostFsBroken (bool on){
+  broken = on;
+}
+
+uint32_t hostFsOpens (){
+  return opens;
+}
+
+uint64_t hostFsBytesWritten (){
+  return bytesWritten;
+}
@@ -0,0 +1,90 @@
+#ifndef HOST_H
+#define HOST_H
+
+/* The simulation harness' side of the host build: the virtual clock and scheduler (host-rtos.cpp), the pins, the
+   readers' RF field, the LEDs, WiFi and the broker, SPIFFS and NVS. The firmware never includes this, it only sees the
+   Arduino/ESP32 API the fakes put in front of it. tools/scenario-runner.cpp is the main user.
+
+   Anything outside the board (a card going into the field, the broker sending something, the eStop switch) is an
+   event at a virtual time, run between tasks the way an interrupt would be. Time only moves inside hostRunUntil ().
+*/
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <functional>
+#include "uid.h"
+
+#define HOST_FOREVER      UINT64_MAX
+#define HOST_ISR_ENTRY_US 2          // Edge to the first line of an IRAM ISR on the ESP32, roughly
+
+//////// Clock and scheduler (host-rtos.cpp) ////////
+
+extern uint64_t hostNow ();                              // Virtual us since boot
+extern void hostBoot ();                                 // Starts loopTask, setup () runs on the first hostRunUntil ()
+extern void hostRunUntil (uint64_t us);                  // Runs tasks and events until the clock reaches us
+extern void hostRunFor (uint64_t us);
+extern bool hostRunUntilTrue (const std::function<bool ()> &done, uint64_t maxUs, uint64_t stepUs); // Checks done every stepUs, 0: after everything that happens
+extern void hostAt (uint64_t us, const std::function<void ()> &fn); // fn runs at us, outside any task (like an ISR)
+extern void hostAfter (uint64_t us, const std::function<void ()> &fn);
+extern void hostBusy (uint32_t us);                      // The calling task holds its core for us, fakes call it for bus and flash time
+extern void hostIsr (BaseType_t core, const std::function<void ()> &fn); // fn as an interrupt on core, from an event
+extern bool hostInIsr ();
+
+// Services run callbacks the way AsyncTCP or the WiFi event loop do, one at a time in their own task. Callbacks can't block
+extern TaskHandle_t hostServiceCreate (const char *name, UBaseType_t prio, BaseType_t core);
+extern void hostServicePost (TaskHandle_t service, uint64_t atUs, const std::function<void ()> &fn);
+
+extern void hostFault (const char *fmt, ...) __attribute__((format(printf, 1, 2))); // Something the real thing wouldn't allow
+extern uint32_t hostFaults ();
+extern uint64_t hostSwitches ();                         // Context switches, for the harness' own speed
+extern uint32_t hostTaskRunUs (TaskHandle_t task);       // Virtual time the task was busy
+extern void hostSeed (uint32_t seed);                    // random () and the fakes' dice
+extern uint32_t hostRandom ();
+
+//////// Pins (host-arduino.cpp) ////////
+
+#define HOST_PINS 40
+
+extern void hostPinDrive (uint8_t pin, int level);       // From outside, an input's level. Attached ISRs fire on the edge
+extern int hostPinLevel (uint8_t pin);
+extern uint64_t hostPinChanged (uint8_t pin);            // hostNow () of its last edge
+extern void hostPinWatch (const std::function<void (uint8_t pin, int level)> &fn); // Every edge, outputs too
+extern void hostPinStuck (uint8_t pin, int level);       // Reads level whatever is written, a shorted driver. -1 frees it
+extern void hostSerialEcho (bool on);                    // Serial to stdout, off by default
+extern void hostHeapFree (uint32_t bytes);               // What esp_get_free_heap_size () says
+
+//////// Readers (host-mfrc522.cpp), by SS pin ////////
+
+extern void hostCardEnter (uint8_t ss, const uidType *uid, uint8_t dropPct = 0); // dropPct: chance an answer is lost, a card at the edge of the field
+extern void hostCardLeave (uint8_t ss, const uidType *uid);
+extern void hostCardsClear (uint8_t ss);
+extern void hostReaderIrq (uint8_t ss, int irqPin);      // Wire the reader's IRQ output, before hostBoot ()
+extern uint32_t hostReaderFrames (uint8_t ss);           // RF frames it has sent
+
+//////// LEDs (host-fastled.cpp) ////////
+
+extern const CRGB * hostLedsShown ();                    // What the strip is showing, as of the last show ()
+extern uint32_t hostLedShows ();
+
+//////// WiFi and the broker (host-net.cpp) ////////
+
+typedef std::function<void (const char *topic, const char *payload, size_t len, uint8_t qos)> hostPublishHook;
+
+extern void hostWifiUp (bool up);                        // Takes the AP away (or brings it back), the board finds out on its own
+extern void hostBrokerUp (bool up);
+extern void hostNetLatency (uint32_t oneWayUs);          // Board to broker, each way
+extern void hostBrokerOnPublish (const hostPublishHook &hook); // Everything the board publishes, when it reaches the broker
+extern void hostBrokerSend (const char *topic, const char *payload, size_t len, bool retain); // To the board if it's subscribed, retained for later if asked
+extern bool hostMqttConnected ();
+extern uint32_t hostMqttPublishes ();
+extern uint64_t hostMqttArrived ();                      // hostNow () the last message to the board reached AsyncMqttClient, past the WiFi driver and lwIP
+
+//////// Storage (host-spiffs.cpp, host-nvs.cpp, host-partition.cpp) ////////
+
+extern void hostFsRoot (const char *dir);                // SPIFFS files live in dir on the host, before hostBoot (). NULL: in memory
+extern void hostFsFresh ();                              // Unformatted, the first mount formats
+extern void hostFsBroken (bool broken);                  // Mounting fails
+extern uint32_t hostFsOpens ();                          // SPIFFS.open () calls, failed ones too
+extern uint64_t hostFsBytesWritten ();                   // Through File::write (), as of the end of the write's time
+
+#endif // HOST_H
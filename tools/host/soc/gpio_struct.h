@@ -0,0 +1,32 @@
+#ifndef HOST_GPIO_STRUCT_H
+#define HOST_GPIO_STRUCT_H
+
+/* The ESP32's GPIO registers, the few the firmware pokes directly. Writes to the set/clear registers change the
+   pins the same way digitalWrite () would (host-arduino.cpp), the in registers read every pin's level back.
+*/
+
+#include <stdint.h>
+
+struct hostGpioWrite { // out_w1ts/out_w1tc and the out1_ pair, a bit per pin from first
+  uint8_t first;
+  uint8_t level;
+  void operator= (uint32_t mask) const;
+};
+
+struct hostGpioRead {
+  uint8_t first;
+  operator uint32_t () const;
+};
+
+typedef struct {
+  hostGpioWrite out_w1ts;
+  hostGpioWrite out_w1tc;
+  struct { hostGpioWrite val; } out1_w1ts;  // Pins 32-39
+  struct { hostGpioWrite val; } out1_w1tc;
+  hostGpioRead in;
+  union { hostGpioRead data; hostGpioRead val; } in1;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+
+#endif // HOST_GPIO_STRUCT_H
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Encoder for the member list snapshots and deltas member-sync.cpp applies.
+
+Member files are one uid per line in the colon hex uidStr form the boards
+publish (DE:AD:BE:EF), then the stations on the board it may use, comma
+separated (DE:AD:BE:EF 0,2). No stations is station 0 only, a board's only
+station when it has one. Blank lines and # comments are ignored.
+
+Whole list, for a board that has nothing yet or has fallen too far behind:
+    member-encode.py snapshot members.txt --version 7 -o snap.bin
+What changed between two versions of the list:
+    member-encode.py delta members-v6.txt members.txt --base 6 --version 7 -o delta.bin
+Then publish it to the board's topic (the MAC it reports on rfid/members/have):
+    mosquitto_pub -h broker -t rfid/members/AABBCCDDEEFF -f delta.bin
+
+A delta only applies to a board on exactly --base, anything else is ignored and
+the board asks again, answer that with a snapshot.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+WIRE_MAGIC = 0x3153424D  # "MBS1"
+KIND_SNAPSHOT = 0
+KIND_DELTA = 1
+OP_REMOVE = 0x80
+UID_MAX_SIZE = 10
+STATION_MAX = 8  # One bit each in the stations byte
+INDEX_MAX = 10000  # MEMBER_INDEX_MAX
+DELTA_MAX = 256  # MEMBER_DELTA_MAX
+HEADER = struct.Struct("<IBBHII")
+
+
+def uid_hash(uid):
+    """FNV-1a, same as uidHash () in uid.h"""
+    h = 2166136261
+    for b in uid:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def parse_uid(text):
+    uid = bytes(int(part, 16) for part in text.split(":"))
+    if not 0 < len(uid) <= UID_MAX_SIZE:
+        raise ValueError("bad uid %r" % text)
+    return uid
+
+
+def parse_stations(text):
+    stations = 0
+    for part in text.split(","):
+        n = int(part)
+        if not 0 <= n < STATION_MAX:
+            raise ValueError("bad station %r" % part)
+        stations |= 1 << n
+    return stations
+
+
+def read_members(path):
+    """{uid: stations bits}"""
+    members = {}
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            fields = line.split("#", 1)[0].split()
+            if not fields:
+                continue
+            try:
+                members[parse_uid(fields[0])] = parse_stations(fields[1]) if len(fields) > 1 else 1
+            except ValueError as e:
+                raise ValueError("%s:%d: %s" % (path, n, e))
+    return members
+
+
+def pack(kind, entries, version, base):
+    body = HEADER.pack(WIRE_MAGIC, kind, 0, len(entries), version, base) + b"".join(entries)
+    return body + struct.pack("<I", zlib.crc32(body) & 0xFFFFFFFF)
+
+
+def encode_snapshot(members, version):
+    if len(members) > INDEX_MAX:
+        raise ValueError("%d members, a board takes %d" % (len(members), INDEX_MAX))
+    ordered = sorted(members, key=lambda u: (uid_hash(u), u))  # The board builds its index straight off this order
+    return pack(KIND_SNAPSHOT, [bytes([len(u)]) + u + bytes([members[u]]) for u in ordered], version, 0)
+
+
+def encode_delta(old, new, base, version):
+    """Adds for new members and ones whose stations changed, removes for the ones gone"""
+    entries = [bytes([len(u)]) + u + bytes([new[u]]) for u in sorted(new) if old.get(u) != new[u]]
+    entries += [bytes([len(u) | OP_REMOVE]) + u + bytes([0]) for u in sorted(set(old) - set(new))]
+    if len(entries) > DELTA_MAX:
+        raise ValueError("%d changes, more than a delta takes (%d), send a snapshot" % (len(entries), DELTA_MAX))
+    return pack(KIND_DELTA, entries, version, base)
+
+
+def main(argv):
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = p.add_subparsers(dest="kind", required=True)
+    s = sub.add_parser("snapshot")
+    s.add_argument("members")
+    d = sub.add_parser("delta")
+    d.add_argument("old")
+    d.add_argument("members")
+    d.add_argument("--base", type=int, required=True, help="version the board must already have")
+    for q in (s, d):
+        q.add_argument("--version", type=int, required=True, help="version this makes, must not be 0")
+        q.add_argument("-o", "--output", required=True)
+    args = p.parse_args(argv[1:])
+
+    if args.version <= 0:
+        p.error("--version must be above 0, 0 means a board has no synced list")
+    try:
+        members = read_members(args.members)
+        if args.kind == "snapshot":
+            data = encode_snapshot(members, args.version)
+        else:
+            data = encode_delta(read_members(args.old), members, args.base, args.version)
+    except ValueError as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+
+    with open(args.output, "wb") as f:
+        f.write(data)
+    sys.stderr.write("%s: %s version %d, %d bytes\n" % (args.output, args.kind, args.version, len(data)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,129 @@
+/* Member lookup benchmark: memberIndexStations () (member-index.cpp) against the string path it replaced, the UID
+   turned into its uidStr with byteToHexStr () and compared against a list of uidStrs, both as a straight scan (what
+   isAllowed () over a member list of strings does) and as a binary search of a sorted one (the best the strings get).
+   Hits and misses, at a few list sizes up to MEMBER_INDEX_MAX. Host ns, so it's the ratios that carry over to the
+   ESP32, not the numbers. On the ESP32 the list is read out of mmapped flash, which favours the index even more: it
+   touches one bucket of 12 byte entries, a scan touches the whole list.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -Itools/host -I. tools/member-index-bench.cpp member-index.cpp -o /tmp/member-index-bench
+     /tmp/member-index-bench [lookups] [seed]
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "member-index.h"
+
+#define UIDSTR_SIZE 31 // metaStruct's uidStr
+
+static const uint16_t sizes[] = {100, 1000, 5000, MEMBER_INDEX_MAX};
+
+// memberIndexDrain ()'s wait, only reached with a lookup in another task. There's just the one here
+void vTaskDelay (TickType_t ticks){}
+
+// As in tool-access-RTOS.cpp
+static void byteToHexStr (const byte *in, size_t insz, char *out, size_t outsz){
+  const char *hex = "0123456789ABCDEF";
+  char *p = out;
+  for (size_t i = 0; i < insz && (size_t)(p + 3 - out) <= outsz; i++, p += 3){
+    p[0] = hex[(in[i] >> 4) & 0xF];
+    p[1] = hex[in[i] & 0xF];
+    p[2] = ':';
+  }
+  p[-1] = 0;
+}
+
+static bool scanContains (const std::vector<std::string> &list, const uidType *uid){
+  char s[UIDSTR_SIZE];
+  byteToHexStr(uid->bytes, uid->length, s, sizeof(s));
+  for (size_t i = 0; i < list.size(); i++){
+    if (strcmp(list[i].c_str(), s) == 0){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static bool sortedContains (const std::vector<std::string> &sorted, const uidType *uid){
+  char s[UIDSTR_SIZE];
+  byteToHexStr(uid->bytes, uid->length, s, sizeof(s));
+  return std::binary_search(sorted.begin(), sorted.end(), std::string(s));
+}
+
+static uidType randomUid (std::mt19937 &rng){
+  uidType uid;
+  memset(&uid, 0, sizeof(uid));
+  uid.length = (rng() % 4 == 0) ? 7 : 4;
+  for (byte i = 0; i < uid.length; i++){
+    uid.bytes[i] = (byte)rng();
+  }
+  return uid;
+}
+
+static double nsNow (){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// ns per lookup over probes, found counts the hits as a check (and so the lookups can't be optimised away)
+template<typename F> static double timeLookups (const std::vector<uidType> &probes, F contains, uint32_t *found){
+  double start = nsNow();
+  *found = 0;
+  for (size_t i = 0; i < probes.size(); i++){
+    *found += contains(&probes[i]);
+  }
+  return (nsNow() - start) / probes.size();
+}
+
+int main (int argc, char **argv){
+  int lookups = (argc > 1) ? atoi(argv[1]) : 20000;
+  std::mt19937 rng((argc > 2) ? strtoul(argv[2], NULL, 0) : 1);
+
+  printf("%-6s %-5s %12s %12s %12s %10s\n", "list", "probe", "index ns", "scan ns", "sorted ns", "scan/index");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+    std::vector<memberEntry> members;
+    std::vector<std::string> strings;
+    for (uint16_t i = 0; i < sizes[s]; i++){
+      memberEntry m = {randomUid(rng), 1};
+      members.push_back(m);
+    }
+    std::sort(members.begin(), members.end(), [](const memberEntry &a, const memberEntry &b){ return uidHash(a.uid) < uidHash(b.uid); });
+    for (size_t i = 0; i < members.size(); i++){
+      char str[UIDSTR_SIZE];
+      byteToHexStr(members[i].uid.bytes, members[i].uid.length, str, sizeof(str));
+      strings.push_back(str);
+    }
+    std::vector<std::string> sorted = strings;
+    std::sort(sorted.begin(), sorted.end());
+    if (!memberIndexBuild(members.data(), members.size())){
+      printf("memberIndexBuild refused %u members\n", sizes[s]);
+      return 1;
+    }
+
+    for (int hit = 1; hit >= 0; hit--){
+      std::vector<uidType> probes;
+      for (int i = 0; i < lookups; i++){
+        probes.push_back(hit ? members[rng() % members.size()].uid : randomUid(rng)); // A random one is all but never a member
+      }
+      uint32_t a;
+      uint32_t b;
+      uint32_t c;
+      double index = timeLookups(probes, [](const uidType *u){ return memberIndexStations(u) != 0; }, &a);
+      double scan = timeLookups(probes, [&](const uidType *u){ return scanContains(strings, u); }, &b);
+      double bsearch = timeLookups(probes, [&](const uidType *u){ return sortedContains(sorted, u); }, &c);
+      if (a != b || a != c){
+        printf("lookups disagree: index %u, scan %u, sorted %u\n", a, b, c);
+        return 1;
+      }
+      printf("%-6u %-5s %12.1f %12.1f %12.1f %9.0fx\n", sizes[s], hit ? "hit" : "miss", index, scan, bsearch, scan / index);
+    }
+  }
+  printf("\nRAM: index %u bytes per table (two), string list %u bytes of uidStr at %u members\n",
+         (unsigned)((MEMBER_INDEX_BUCKETS + 1) * sizeof(uint16_t)), (unsigned)(MEMBER_INDEX_MAX * UIDSTR_SIZE), MEMBER_INDEX_MAX);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Member list sync benchmark against a real board and a local broker.
+
+Sends the board a snapshot of --members random members, then --rounds deltas of
+--changes adds/removes each, and times each one from publish to the board
+reporting the new version on rfid/members/have. Also prints what the same
+change would have cost as per-tap auth requests.
+    member-sync-bench.py --host localhost --mac AABBCCDDEEFF --members 5000 --changes 20
+
+--dry-run skips the broker and only prints the payload sizes. Needs paho-mqtt
+otherwise (pip install paho-mqtt).
+"""
+import argparse
+import os
+import queue
+import random
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+encoder = __import__("member-encode")
+
+HAVE_TOPIC = "rfid/members/have"
+REQ_BYTES = 2 + 2 + len("rfid/auth/req") + len("DE:AD:BE:EF")  # Fixed header, topic length, topic, uidStr
+RSP_BYTES = 2 + 2 + len("rfid/auth/rsp") + len("auth,DE:AD:BE:EF") + 2  # QoS 2 adds a packet id
+
+
+def random_uid(rng):
+    return bytes(rng.randrange(256) for _ in range(rng.choice((4, 7))))
+
+
+def mutate(members, changes, rng):
+    new = dict(members)
+    for _ in range(changes):
+        if new and rng.random() < 0.5:
+            del new[rng.choice(sorted(new))]
+        else:
+            new[random_uid(rng)] = 1
+    return new
+
+
+class Board:
+    def __init__(self, host, port, mac):
+        import paho.mqtt.client as mqtt
+        self.mac = mac
+        self.versions = queue.Queue()
+        self.client = mqtt.Client()
+        self.client.on_message = self.on_message
+        self.client.connect(host, port)
+        self.client.subscribe(HAVE_TOPIC, 0)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, msg):
+        mac, _, version = msg.payload.decode("ascii", "replace").partition(",")
+        if mac == self.mac and version.isdigit():
+            self.versions.put(int(version))
+
+    def send(self, data, version, timeout):
+        """Seconds from publish to the board saying it has version, None if it never did"""
+        start = time.monotonic()
+        self.client.publish("rfid/members/" + self.mac, data, qos=1).wait_for_publish()
+        while True:
+            left = timeout - (time.monotonic() - start)
+            try:
+                if left > 0 and self.versions.get(timeout=left) == version:
+                    return time.monotonic() - start
+            except queue.Empty:
+                pass
+            if left <= 0:
+                return None
+
+
+def main(argv):
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--host", default="localhost")
+    p.add_argument("--port", type=int, default=1883)
+    p.add_argument("--mac", help="board's MAC, 12 hex digits as it reports it")
+    p.add_argument("--members", type=int, default=1000)
+    p.add_argument("--changes", type=int, default=10, help="adds/removes per delta")
+    p.add_argument("--rounds", type=int, default=5)
+    p.add_argument("--first-version", type=int, default=int(time.time()) & 0x7FFFFFFF)
+    p.add_argument("--timeout", type=float, default=60.0)
+    p.add_argument("--seed", type=int, default=1)
+    p.add_argument("--dry-run", action="store_true")
+    args = p.parse_args(argv[1:])
+    if not args.dry_run and not args.mac:
+        p.error("--mac is needed unless --dry-run")
+
+    rng = random.Random(args.seed)
+    members = {}
+    while len(members) < args.members:
+        members[random_uid(rng)] = 1
+    board = None if args.dry_run else Board(args.host, args.port, args.mac.upper())
+
+    version = args.first_version
+    snap = encoder.encode_snapshot(members, version)
+    taps = len(members) * (REQ_BYTES + RSP_BYTES)
+    line = "snapshot  %6d members %8d bytes (vs %d bytes of req/rsp for one tap each)" % (len(members), len(snap), taps)
+    if board is not None:
+        took = board.send(snap, version, args.timeout)
+        line += "  " + ("timed out" if took is None else "%.2fs" % took)
+    print(line)
+
+    for _ in range(args.rounds):
+        new = mutate(members, args.changes, rng)
+        delta = encoder.encode_delta(members, new, version, version + 1)
+        members, version = new, version + 1
+        line = "delta     %6d changes %8d bytes" % (args.changes, len(delta))
+        if board is not None:
+            took = board.send(delta, version, args.timeout)
+            line += "  " + ("timed out" if took is None else "%.2fs" % took)
+        print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
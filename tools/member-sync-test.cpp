@@ -0,0 +1,373 @@
+/* Member sync test (member-sync.cpp) on the host harness (tools/host), its broker standing in for the server and its
+   partitions for members_a/members_b. Lists go in over rfid/members/<MAC> the way the server sends them, built here
+   from the wire format in member-sync.h, and what the board ends up with is read back through isAllowed () station by
+   station. Checks:
+   - announce: the board says "<MAC>,0" on connect, and "<MAC>,<version>" after every list that goes in
+   - snapshot: every member on exactly their stations, nobody else, and a full MEMBER_INDEX_MAX list fits the slot
+   - delta: adds, removes, a member's stations changed, a remove of someone not on the list. A uid in one delta twice
+     is merged once, the last entry counting
+   - reject: bad crc, truncated, a delta for another version, bad magic, one member too many. The list and version stay
+     as they were, the board says its old version again and the next good list still goes in
+   - power cut: part way through writing a snapshot, the reboot keeps the old list. Once the new one's header is
+     written (last) and before the swap, the reboot takes the new one. The reboot is memberSyncInit () over the
+     partitions as they were left, which is all a boot reads
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -include Arduino.h -x c++ tool-access-RTOS.ino -x none *.cpp \
+       tools/host/host-*.cpp tools/member-sync-test.cpp -o /tmp/member-sync-test
+     /tmp/member-sync-test [seed]
+   Exits 1 if a check fails.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "member-index.h"
+#include "member-sync.h"
+
+#define LATENCY_US   1000
+#define SYNC_WITHIN  10000000 // us, the message, the merge or swap and erasing the spare for next time
+#define CHUNK        1400     // Bytes per memberSyncMessage () call when the test feeds it directly, a TCP segment
+
+extern uint16_t mqttPublishMembers (const char *topic, const char *payload); // tool-access-RTOS.ino
+
+typedef std::map<std::string, byte> memberMap; // Raw uid bytes to stations
+
+typedef struct {
+  uidType uid;
+  byte stations;
+  bool remove;
+} wireEntry;
+
+static uint32_t failures = 0;
+static std::vector<std::string> haves;           // Everything said on MEMBER_HAVE_TOPIC
+static std::string mac;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check (bool ok, const char *what, int line){
+  if (!ok){
+    printf("FAIL line %d: %s\n", line, what);
+    failures++;
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, MEMBER_HAVE_TOPIC) == 0){
+    haves.push_back(std::string(payload, len));
+  }
+}
+
+static std::string have (uint32_t version){
+  return mac + "," + std::to_string(version);
+}
+
+static uidType randomUid (){
+  uidType uid;
+  memset(&uid, 0, sizeof(uid));
+  uid.length = (hostRandom() % 4 == 0) ? 7 : 4;
+  for (byte i = 0; i < uid.length; i++){
+    uid.bytes[i] = (byte)hostRandom();
+  }
+  return uid;
+}
+
+static std::string key (const uidType &uid){
+  return std::string((const char*)uid.bytes, uid.length);
+}
+
+static uidType unkey (const std::string &k){
+  uidType uid;
+  uidFromBytes(&uid, (const byte*)k.data(), k.size());
+  return uid;
+}
+
+//////// Wire format, member-sync.h ////////
+
+// zlib's, bit at a time, kept apart from the firmware's so a slip in one doesn't hide in both
+static uint32_t crc32 (const std::vector<byte> &data){
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < data.size(); i++){
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++){
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320UL : 0);
+    }
+  }
+  return ~crc;
+}
+
+static void put32 (std::vector<byte> *out, uint32_t v){
+  for (int i = 0; i < 4; i++){
+    out->push_back((byte)(v >> (8 * i)));
+  }
+}
+
+// count is what the header says, normally entries.size ()
+static std::vector<byte> wire (byte kind, const std::vector<wireEntry> &entries, uint32_t version, uint32_t base,
+                               size_t count, uint32_t magic = MEMBER_WIRE_MAGIC){
+  std::vector<byte> out;
+  put32(&out, magic);
+  out.push_back(kind);
+  out.push_back(0);
+  out.push_back((byte)count);
+  out.push_back((byte)(count >> 8));
+  put32(&out, version);
+  put32(&out, base);
+  for (size_t i = 0; i < entries.size(); i++){
+    const wireEntry *e = &entries[i];
+    out.push_back(e->uid.length | (e->remove ? MEMBER_OP_REMOVE : 0));
+    out.insert(out.end(), e->uid.bytes, e->uid.bytes + e->uid.length);
+    out.push_back(e->stations);
+  }
+  put32(&out, crc32(out));
+  return out;
+}
+
+static std::vector<byte> snapshot (const memberMap &members, uint32_t version){
+  std::vector<wireEntry> entries;
+  for (memberMap::const_iterator i = members.begin(); i != members.end(); ++i){
+    wireEntry e = {unkey(i->first), i->second, 0};
+    entries.push_back(e);
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const wireEntry &a, const wireEntry &b){ return uidHash(a.uid) < uidHash(b.uid); });
+  return wire(MEMBER_WIRE_SNAPSHOT, entries, version, 0, entries.size());
+}
+
+static std::vector<byte> delta (const std::vector<wireEntry> &entries, uint32_t version, uint32_t base){
+  return wire(MEMBER_WIRE_DELTA, entries, version, base, entries.size());
+}
+
+// What applying the delta should leave, entry by entry, the last one for a uid counting
+static void applyModel (memberMap *members, const std::vector<wireEntry> &entries){
+  for (size_t i = 0; i < entries.size(); i++){
+    if (entries[i].remove){
+      members->erase(key(entries[i].uid));
+    }
+    else{
+      (*members)[key(entries[i].uid)] = entries[i].stations;
+    }
+  }
+}
+
+static memberMap randomMembers (size_t n){
+  memberMap members;
+  while (members.size() < n){
+    members[key(randomUid())] = 1 + hostRandom() % 0xFF; // At least one station
+  }
+  return members;
+}
+
+//////// The board ////////
+
+// Sends msg from the server, true once the board says it has version
+static bool send (const std::vector<byte> &msg, uint32_t version){
+  size_t n = haves.size();
+  hostBrokerSend(memberSyncTopic(), (const char*)msg.data(), msg.size(), 0);
+  std::string want = have(version);
+  return hostRunUntilTrue([=](){ return haves.size() > n && haves.back() == want; }, hostNow() + SYNC_WITHIN, 0);
+}
+
+// Everyone in members on exactly their stations, the index holding no one else
+static bool holds (const memberMap &members){
+  bool ok = (memberIndexCount() == members.size());
+  for (memberMap::const_iterator i = members.begin(); i != members.end() && ok; ++i){
+    uidType uid = unkey(i->first);
+    for (byte s = 0; s < STATION_MAX; s++){
+      ok = ok && (isAllowed(s, &uid) == ((i->second >> s) & 1));
+    }
+  }
+  for (int i = 0; i < 200 && ok; i++){
+    uidType stranger = randomUid();
+    ok = members.count(key(stranger)) || memberIndexStations(&stranger) == 0;
+  }
+  return ok;
+}
+
+// The server's message as async_tcp hands it over, from..to bytes of it, at once outside any task
+static void feed (const std::vector<byte> &msg, size_t from, size_t to){
+  for (size_t i = from; i < to; i += CHUNK){
+    memberSyncMessage((const char*)msg.data() + i, min(to - i, (size_t)CHUNK), i, msg.size());
+  }
+}
+
+/* fn, then the power goes and the board boots off what's in the partitions, all at once so nothing of the board's
+   runs in between. Its connect announces the version it came up with, true if that's version
+*/
+static bool cutAfter (const std::function<void ()> &fn, uint32_t version){
+  size_t n = haves.size();
+  hostAt(hostNow(), [=](){
+    fn();
+    memberSyncInit(mqttPublishMembers);
+    memberSyncAnnounce();
+  });
+  std::string want = have(version);
+  return hostRunUntilTrue([=](){ return haves.size() > n && haves.back() == want; }, hostNow() + SYNC_WITHIN, 0);
+}
+
+//////// Checks, on the booted board ////////
+
+static void checkSnapshot (memberMap *members, uint32_t *version){
+  *members = randomMembers(MEMBER_INDEX_MAX);
+  CHECK(send(snapshot(*members, 5), 5));
+  CHECK(memberSyncVersion() == 5);
+  CHECK(holds(*members));
+  printf("snapshot: %u members in\n", memberIndexCount());
+
+  *members = randomMembers(300);
+  CHECK(send(snapshot(*members, 6), 6));
+  CHECK(memberSyncVersion() == 6);
+  CHECK(holds(*members));
+  *version = 6;
+}
+
+static void checkDelta (memberMap *members, uint32_t *version){
+  std::vector<wireEntry> entries;
+  memberMap::const_iterator m = members->begin();
+
+  for (int i = 0; i < 20; i++){ // New members
+    wireEntry e = {randomUid(), (byte)(1 << (i % STATION_MAX)), 0};
+    entries.push_back(e);
+  }
+  for (int i = 0; i < 20; i++, ++m){ // Removed
+    wireEntry e = {unkey(m->first), 0, 1};
+    entries.push_back(e);
+  }
+  for (int i = 0; i < 20; i++, ++m){ // Moved to other stations
+    wireEntry e = {unkey(m->first), (byte)~m->second, 0};
+    entries.push_back(e);
+  }
+  wireEntry gone = {randomUid(), 0, 1}; // Never was a member
+  entries.push_back(gone);
+  wireEntry twice = {randomUid(), 0x01, 0};
+  entries.push_back(twice);
+  twice.stations = 0x06;
+  entries.push_back(twice);               // The same uid again, this one counts
+  wireEntry dropped = {randomUid(), 0x01, 0};
+  entries.push_back(dropped);
+  dropped.remove = 1;
+  entries.push_back(dropped);             // Added and removed in the one delta, ends up not a member
+  wireEntry again = {unkey(m->first), 0x10, 0};
+  entries.push_back(again);
+  again.stations = 0x20;
+  entries.push_back(again);               // An existing member twice
+
+  applyModel(members, entries);
+  CHECK(send(delta(entries, *version + 1, *version), *version + 1));
+  (*version)++;
+  CHECK(memberSyncVersion() == *version);
+  CHECK(holds(*members));
+  CHECK(isAllowed(1, &twice.uid) && isAllowed(2, &twice.uid) && !isAllowed(0, &twice.uid));
+  CHECK(memberIndexStations(&dropped.uid) == 0);
+  CHECK(memberIndexStations(&again.uid) == 0x20);
+  printf("delta: %u entries merged, %u members\n", (unsigned)entries.size(), memberIndexCount());
+}
+
+static void checkReject (memberMap *members, uint32_t *version){
+  wireEntry add = {randomUid(), 0x01, 0};
+  std::vector<wireEntry> one(1, add);
+  std::vector<byte> msg;
+
+  msg = delta(one, *version + 1, *version);
+  msg[msg.size() - 1] ^= 0x55;
+  CHECK(send(msg, *version));     // Bad crc
+
+  msg = wire(MEMBER_WIRE_DELTA, one, *version + 1, *version, 2);
+  CHECK(send(msg, *version));     // Truncated, the header says there's another entry
+
+  msg = delta(one, *version + 2, *version + 1);
+  CHECK(send(msg, *version));     // For a version we don't have
+
+  msg = wire(MEMBER_WIRE_DELTA, one, *version + 1, *version, 1, MEMBER_WIRE_MAGIC + 1);
+  CHECK(send(msg, *version));     // Someone else's format
+
+  memberMap tooMany = randomMembers(MEMBER_INDEX_MAX + 1);
+  CHECK(send(snapshot(tooMany, *version + 1), *version));
+
+  memberMap half = randomMembers(MEMBER_INDEX_MAX);
+  msg = snapshot(half, *version + 1);
+  msg[msg.size() - 5] ^= 0x01;
+  CHECK(send(msg, *version));     // The last entry spoilt, after the rest of it was written to the slot
+
+  CHECK(memberSyncVersion() == *version);
+  CHECK(holds(*members));
+
+  applyModel(members, one);
+  CHECK(send(delta(one, *version + 1, *version), *version + 1)); // And the next good one goes in
+  (*version)++;
+  CHECK(holds(*members));
+  printf("reject: 6 bad lists turned away, still on version %lu\n", (unsigned long)*version);
+}
+
+static void checkPowerCut (memberMap *members, uint32_t *version){
+  memberMap next = randomMembers(2000);
+  std::vector<byte> msg = snapshot(next, *version + 1);
+
+  CHECK(cutAfter([=](){ feed(msg, 0, msg.size() / 2); }, *version)); // Half of it written to the spare
+  CHECK(memberSyncVersion() == *version);
+  CHECK(holds(*members));
+
+  CHECK(send(msg, *version + 1)); // The server sends it again and it goes in
+  (*version)++;
+  *members = next;
+  CHECK(holds(*members));
+
+  next = randomMembers(1000);
+  msg = snapshot(next, *version + 1);
+  uint32_t was = *version;
+  bool swapped = 0;
+  CHECK(cutAfter([=, &swapped](){ // All of it, header and all, before memberSyncTask swaps it in
+    feed(msg, 0, msg.size());
+    swapped = (memberSyncVersion() != was);
+  }, *version + 1));
+  CHECK(!swapped);
+  (*version)++;
+  *members = next;
+  CHECK(memberSyncVersion() == *version);
+  CHECK(holds(*members));
+
+  next = randomMembers(100);
+  CHECK(send(snapshot(next, *version + 1), *version + 1)); // And on from there
+  (*version)++;
+  *members = next;
+  CHECK(holds(*members));
+  printf("power cut: old list kept mid write, new one taken once committed, on version %lu\n", (unsigned long)*version);
+}
+
+int main (int argc, char **argv){
+  uint8_t m[6];
+  char s[13];
+
+  hostSeed((argc > 1) ? strtoul(argv[1], NULL, 0) : 1);
+  esp_efuse_mac_get_default(m);
+  snprintf(s, sizeof(s), "%02X%02X%02X%02X%02X%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+  mac = s;
+  hostNetLatency(LATENCY_US);
+  hostBrokerOnPublish(serverHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return !haves.empty(); }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+  CHECK(haves.back() == have(0)); // Nothing synced yet
+  CHECK(memberIndexCount() == 0);
+
+  memberMap members;
+  uint32_t version = 0;
+  checkSnapshot(&members, &version);
+  checkDelta(&members, &version);
+  checkReject(&members, &version);
+  checkPowerCut(&members, &version);
+  if (hostFaults() > 0){
+    printf("%u harness faults\n", hostFaults());
+    failures++;
+  }
+  printf("member sync checks: %s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
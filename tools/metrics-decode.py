@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Decoder for the metrics snapshots metrics.cpp publishes on rfid/metrics/<MAC>.
+
+Save a payload (or several, one file each) and decode them:
+    mosquitto_sub -h broker -t 'rfid/metrics/AABBCCDDEEFF' -C 1 > snap.bin
+    metrics-decode.py snap.bin
+
+Counters and histogram buckets are totals since boot. Task runtime is only
+filled in when FreeRTOS was built with run time stats.
+"""
+import struct
+import sys
+
+VERSION = 2
+FLAG_RUNTIME = 0x01
+HEADER = struct.Struct("<BBBBBBBBII")  # Must match buildSnapshot (), 16 bytes
+BUCKET_SHIFT = 8
+
+# Same order as the CTR_*, GAUGE_* and HIST_* defines in metrics.h
+COUNTERS = ["taps", "grants", "denies", "timeouts", "collisions", "estops", "wifi_drops", "mqtt_connects", "mqtt_drops",
+            "member_syncs", "estop_late", "heap_drift"]
+GAUGES = ["uptime_s", "heap_free", "heap_min", "outbox_depth", "outbox_dropped", "dlog_dropped", "access_state", "member_version",
+          "boot_tap_ready_ms", "boot_storage_ms", "boot_wifi_ms", "boot_mqtt_ms", "boot_first_auth_ms",
+          "estop_relay_max_us", "estop_state_max_us", "heap_settled", "heap_largest", "accesslog_dropped"]
+HISTS = ["tap_to_auth", "auth_to_relay", "removal_to_timeout", "mqtt_rtt", "poll_lag", "estop_to_relay", "estop_to_state"]
+STATES = ["IDLE", "OUTAGE", "CARD", "AUTHORIZED", "RELAY_ON", "TIMEOUT", "HANDOVER", "COLLISION", "ESTOP"]
+
+
+def name(names, i):
+    return names[i] if i < len(names) else "#%d" % i
+
+
+def bucket_upper(b, buckets):
+    """Upper edge of bucket b in us, None for the open ended last one"""
+    if b == buckets - 1:
+        return None
+    return 1 << (b + BUCKET_SHIFT)
+
+
+def percentile(counts, pct):
+    """Upper edge of the bucket the pct'th percentile falls in, "" with no samples"""
+    total = sum(counts)
+    if total == 0:
+        return ""
+    want = total * pct / 100.0
+    seen = 0
+    for b, n in enumerate(counts):
+        seen += n
+        if seen >= want:
+            return bucket_upper(b, len(counts))
+    return None
+
+
+def fmt_us(us):
+    if us == "":
+        return "=-"
+    if us is None:
+        return ">4.2s"
+    return "<%dms" % (us // 1000) if us >= 1000 else "<%dus" % us
+
+
+def parse(data):
+    """Snapshot as a dict, counters/gauges/hists keyed by name (hists are bucket counts), tasks as (name, headroom, runtime)"""
+    version, flags, ctrs, gauges, hists, buckets, tasks, stations, seq, elapsed = HEADER.unpack_from(data, 0)
+    if version != VERSION:
+        raise ValueError("snapshot version %d, this decoder knows %d" % (version, VERSION))
+    off = HEADER.size
+
+    def take(n):
+        nonlocal off
+        vals = struct.unpack_from("<%dI" % n, data, off)
+        off += 4 * n
+        return vals
+
+    snap = {"seq": seq, "elapsed": elapsed, "flags": flags, "stations": stations, "counters": {}, "gauges": {},
+            "hists": {}, "tasks": []}
+    for i, v in enumerate(take(ctrs)):
+        snap["counters"][name(COUNTERS, i)] = v
+    for i, v in enumerate(take(gauges)):
+        snap["gauges"][name(GAUGES, i)] = v
+    for i in range(hists):
+        snap["hists"][name(HISTS, i)] = take(buckets)
+    for _ in range(tasks):
+        n = data[off]
+        task = data[off + 1:off + 1 + n].decode("ascii", "replace")
+        off += 1 + n
+        headroom, runtime = take(2)
+        snap["tasks"].append((task, headroom, runtime))
+    return snap
+
+
+def decode(data, out):
+    snap = parse(data)
+    elapsed = snap["elapsed"]
+    out.write("seq %d, %.1fs since the last snapshot\n" % (snap["seq"], elapsed / 1e6))
+    for n, v in snap["counters"].items():
+        out.write("  %-20s %d\n" % (n, v))
+    for n, v in snap["gauges"].items():
+        if n == "access_state":  # 4 bits per station
+            v = " ".join(name(STATES, (v >> (4 * st)) & 0x0F) for st in range(snap["stations"]))
+        out.write("  %-20s %s\n" % (n, v))
+    for n, counts in snap["hists"].items():
+        out.write("  %-20s n=%d p50%s p90%s p99%s\n" % (n, sum(counts), fmt_us(percentile(counts, 50)),
+                                                         fmt_us(percentile(counts, 90)), fmt_us(percentile(counts, 99))))
+    for task, headroom, runtime in snap["tasks"]:
+        load = ""
+        if snap["flags"] & FLAG_RUNTIME and elapsed:
+            load = " cpu=%.1f%%" % (100.0 * runtime / elapsed)  # Of one core
+        out.write("  task %-15s stack_free=%d%s\n" % (task, headroom, load))
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 2
+    for path in argv[1:]:
+        with open(path, "rb") as f:
+            data = f.read()
+        sys.stdout.write("%s: " % path)
+        try:
+            decode(data, sys.stdout)
+        except (ValueError, struct.error, IndexError) as e:
+            sys.stderr.write("%s: %s\n" % (path, e))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
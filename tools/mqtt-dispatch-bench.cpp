@@ -0,0 +1,140 @@
+/* MQTT dispatch benchmark: mqttDispatch () (mqtt-dispatch.cpp) against the chained strncmp's of the onMqttMessage it
+   replaced, over the messages the board gets: rsps, eStops, something on a topic we don't handle, and a rsp in chunks.
+   The handlers' own work (the cache, the state machine's ring, the relays) is stubbed out on both sides, so it's the
+   finding of the handler that's timed. Host ns, the ratios are what carry over. Left out of the old path are the eight
+   Serial lines it printed per message, ~130 bytes, which at 115200 baud held the AsyncTCP task for ~11ms once the
+   UART FIFO was full, far more than either lookup. It also needed the payload null terminated (strlen), which it
+   isn't, so it gets a terminated copy here.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -Itools/host -I. tools/mqtt-dispatch-bench.cpp mqtt-dispatch.cpp -o /tmp/mqtt-dispatch-bench
+     /tmp/mqtt-dispatch-bench [messages]
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "uid.h"
+#include "mqtt-dispatch.h"
+
+#define MEMBER_TOPIC "rfid/members/240AC4A1B2C3" // What memberSyncTopic () is on a board
+
+typedef struct {
+  const char *name;
+  const char *topic;
+  const char *payload;
+  size_t chunk;         // Bytes per chunk, 0 for one go
+} benchMessage;
+
+static const benchMessage messages[] = {
+  {"auth",      "rfid/auth/rsp", "auth,04:A0:12:34", 0},
+  {"denied",    "rfid/auth/rsp", "denied,04:A0:12:34", 0},
+  {"fire",      "rfid/estop",    "fire", 0},
+  {"clear",     "rfid/estop",    "clear", 0},
+  {"unknown",   "rfid/other",    "auth", 0},
+  {"chunked",   "rfid/auth/rsp", "auth,04:A0:12:34", 6},
+};
+
+static volatile uint32_t handled = 0; // Bumped by both sides' handlers
+
+//////// Stubs for what the handlers call ////////
+
+bool authCacheResolve (bool allowed, const char *args, size_t argsLen, uidType *resolved, byte *station){
+  handled++;
+  resolved->length = 0; // Nobody asked, the handler stops there
+  return 0;
+}
+void accessLogAppend (byte station, byte event, const uidType *uid, uint32_t duration){}
+bool accessPost (byte station, byte type, const uidType *uid){ return 1; }
+void estopFire (byte source, uint32_t seenUs){ handled++; }
+bool estopClear (){ handled++; return 1; }
+bool memberSyncOwns (const char *topic){ return strcmp(topic, MEMBER_TOPIC) == 0; }
+void memberSyncMessage (const char *payload, size_t len, size_t index, size_t total){}
+uint32_t micros (){ return 0; } // mqttDispatch () stamps each message's arrival for the eStop
+
+//////// The old path, onMqttMessage as it was less its Serial lines ////////
+
+static void oldMessage (char *topic, char *payload, size_t len, size_t index, size_t total){
+  int topicLength = (strlen(topic));
+  int payloadLength = (strlen(payload));
+  const char * rsp = "rfid/auth/rsp";
+  const char * estop = "rfid/estop";
+
+  (void)payloadLength;
+  if ((strncmp (topic, rsp, topicLength)) == 0){
+    if (((strncmp (payload, "auth", 4)) == 0)){
+      handled++;
+    }
+    else if (((strncmp (payload, "denied", 6)) == 0)){
+      handled++;
+    }
+    else if (((strncmp (payload, "seekiosk", 8)) == 0)){
+    }
+  }
+  else if ((strncmp (topic, estop, topicLength) == 0)){
+    if (((strncmp (payload, "fire", 4)) == 0)){
+      handled++;
+    }
+    else if (((strncmp (payload, "clear", 5)) == 0)){
+      handled++;
+    }
+  }
+}
+
+static double nsNow (){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// ns per message, each chunk handed over the way AsyncMqttClient does it
+static double timeNew (const benchMessage *m, int n){
+  char topic[32];
+  strcpy(topic, m->topic);
+  size_t total = strlen(m->payload);
+  size_t step = m->chunk ? m->chunk : total;
+  double start = nsNow();
+  for (int i = 0; i < n; i++){
+    for (size_t index = 0; index < total; index += step){
+      mqttDispatch(topic, m->payload + index, 0, min(step, total - index), index, total);
+    }
+  }
+  return (nsNow() - start) / n;
+}
+
+static double timeOld (const benchMessage *m, int n){
+  char topic[32];
+  char payload[MQTT_CMD_MAX + 1];
+  strcpy(topic, m->topic);
+  size_t total = strlen(m->payload);
+  size_t step = m->chunk ? m->chunk : total;
+  double start = nsNow();
+  for (int i = 0; i < n; i++){
+    for (size_t index = 0; index < total; index += step){
+      size_t len = min(step, total - index);
+      memcpy(payload, m->payload + index, len); // Each chunk on its own, the old path didn't put them back together
+      payload[len] = 0;
+      oldMessage(topic, payload, len, index, total);
+    }
+  }
+  return (nsNow() - start) / n;
+}
+
+int main (int argc, char **argv){
+  int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  printf("%-8s %10s %10s %8s\n", "message", "table ns", "strncmp ns", "handled");
+  for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++){
+    uint32_t before = handled;
+    double table = timeNew(&messages[i], n);
+    uint32_t byTable = handled - before;
+    before = handled;
+    double chain = timeOld(&messages[i], n);
+    uint32_t byChain = handled - before;
+    printf("%-8s %10.1f %10.1f %3s/%-3s\n", messages[i].name, table, chain, byTable ? "yes" : "no",
+           byChain ? "yes" : "no");
+  }
+  mqttDispatchStats *s = mqttDispatchGetStats();
+  printf("\ntable: %u received, %u handled, %u unknown, %u retained, %u oversize\n", s->received, s->handled,
+         s->unknown, s->retained, s->oversize);
+  return 0;
+}
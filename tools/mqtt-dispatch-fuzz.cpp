@@ -0,0 +1,233 @@
+/* Fuzz target for mqttDispatch () (mqtt-dispatch.cpp), the parser every incoming MQTT message goes through, and the
+   rsp args parsing behind it (authCacheResolve ()). Each input is a flags byte (bit 0 retain, the rest a chunk size,
+   0 for one go), a topic up to the first 0 byte and the payload after it. The payload gets a heap buffer of exactly
+   its length, so reading past len (the old strlen (payload)) is caught by ASan.
+   Besides not crashing, every message has to come out the way a plain reading of the table says: handled only on an
+   exact topic and command word, retained ignored unless the row allows it, everything else unknown. Then again in
+   chunks, which has to come out the same, or as oversize past MQTT_CMD_MAX.
+   The whole sketch is linked (the handlers post to the state machine, trip the relays...) but never booted.
+   Build and run from the repo root, with the standalone driver (mutates the seeds below, or replays files given):
+     g++ -std=gnu++11 -O1 -g -no-pie -fsanitize=address,undefined -Itools/host -I. -include Arduino.h \
+       -x c++ tool-access-RTOS.ino -x none *.cpp tools/host/host-*.cpp tools/mqtt-dispatch-fuzz.cpp \
+       -o /tmp/mqtt-dispatch-fuzz
+     /tmp/mqtt-dispatch-fuzz [iterations] | [input files...]
+   Or with libFuzzer: clang++ with -fsanitize=fuzzer,address -DMQTT_FUZZ_LIBFUZZER and the same sources.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "mqtt-dispatch.h"
+#include "member-sync.h"
+
+#define FUZZ_ITERATIONS 1000000 // Standalone, unless given
+#define FUZZ_INPUT_MAX  96
+
+typedef struct { // mqtt-dispatch.cpp's table as the protocol has it, written out separately on purpose
+  const char *topic;
+  const char *command;
+  bool retainedOk;
+} fuzzRow;
+
+static const fuzzRow rows[] = {
+  {"rfid/auth/rsp", "auth",     0},
+  {"rfid/auth/rsp", "denied",   0},
+  {"rfid/auth/rsp", "seekiosk", 0},
+  {"rfid/estop",    "fire",     1},
+  {"rfid/estop",    "clear",    1},
+};
+
+typedef struct {
+  const char *data;
+  size_t size;
+} fuzzSeed;
+
+#define SEED(s) {s, sizeof(s) - 1} // They have 0s in them
+
+static const fuzzSeed seeds[] = { // Flags byte, topic, 0, payload
+  SEED("\x00rfid/auth/rsp\0auth"),
+  SEED("\x00rfid/auth/rsp\0auth,04:A0:12:34"),
+  SEED("\x00rfid/auth/rsp\0denied,04:A0:12:34,0"),
+  SEED("\x0Arfid/auth/rsp\0auth,04:A0:12:34:56:78:9A"),
+  SEED("\x00rfid/auth/rsp\0seekiosk"),
+  SEED("\x01rfid/estop\0fire"),
+  SEED("\x05rfid/estop\0clear\r\n"),
+  SEED("\x01rfid/auth/rsp\0auth"),
+  SEED("\x00rfid\0auth"),
+  SEED("\x00rfid/auth/rsp\0authorized"),
+};
+
+enum { OUT_HANDLED, OUT_UNKNOWN, OUT_RETAINED, OUT_OVERSIZE };
+
+static int expected (const std::string &topic, const uint8_t *payload, size_t len, bool retain){
+  size_t cmdLen = 0;
+  while (cmdLen < len && payload[cmdLen] != ',' && payload[cmdLen] != ' ' && payload[cmdLen] != '\r'
+         && payload[cmdLen] != '\n'){
+    cmdLen++;
+  }
+  std::string command((const char*)payload, cmdLen);
+  for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++){
+    if (topic == rows[i].topic && command == rows[i].command){
+      return (retain && !rows[i].retainedOk) ? OUT_RETAINED : OUT_HANDLED;
+    }
+  }
+  return OUT_UNKNOWN;
+}
+
+// Which counter the message moved, -1 if none or more than one
+static int outcome (const mqttDispatchStats *before){
+  const mqttDispatchStats *s = mqttDispatchGetStats();
+  int moved = (s->handled != before->handled) + (s->unknown != before->unknown) + (s->retained != before->retained)
+              + (s->oversize != before->oversize);
+  if (moved != 1){
+    return -1;
+  }
+  if (s->handled != before->handled){
+    return OUT_HANDLED;
+  }
+  if (s->unknown != before->unknown){
+    return OUT_UNKNOWN;
+  }
+  return (s->retained != before->retained) ? OUT_RETAINED : OUT_OVERSIZE;
+}
+
+static void failed (const char *what, const uint8_t *data, size_t size){
+  fprintf(stderr, "mqtt-dispatch-fuzz: %s, input:", what);
+  for (size_t i = 0; i < size; i++){
+    fprintf(stderr, " %02X", data[i]);
+  }
+  fprintf(stderr, "\n");
+  abort();
+}
+
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size){
+  if (size < 1){
+    return 0;
+  }
+  bool retain = data[0] & 1;
+  size_t chunk = data[0] >> 1;
+  const uint8_t *end = (const uint8_t*)memchr(data + 1, 0, size - 1);
+  std::string topic((const char*)data + 1, end ? end - (data + 1) : size - 1);
+  size_t at = end ? (end - data) + 1 : size;
+  size_t len = size - at;
+  if (memberSyncOwns(topic.c_str())){
+    return 0; // Binary, and not ours to check here
+  }
+
+  // Exactly len bytes each time, AsyncMqttClient doesn't terminate it
+  std::vector<uint8_t> payload(data + at, data + size);
+  int want = expected(topic, payload.data(), len, retain);
+  mqttDispatchStats before = *mqttDispatchGetStats();
+  uint8_t *whole = (uint8_t*)malloc(len ? len : 1);
+  if (len > 0){
+    memcpy(whole, payload.data(), len);
+  }
+  mqttDispatch(topic.c_str(), (const char*)whole, retain, len, 0, len);
+  free(whole);
+  if (outcome(&before) != want){
+    failed("whole message came out wrong", data, size);
+  }
+
+  if (chunk == 0 || len <= chunk){
+    return 0;
+  }
+  before = *mqttDispatchGetStats();
+  for (size_t index = 0; index < len; index += chunk){
+    size_t n = min(chunk, len - index);
+    uint8_t *part = (uint8_t*)malloc(n);
+    memcpy(part, payload.data() + index, n);
+    mqttDispatch(topic.c_str(), (const char*)part, retain, n, index, len);
+    free(part);
+  }
+  if (outcome(&before) != ((len > MQTT_CMD_MAX) ? OUT_OVERSIZE : want)){
+    failed("chunked message came out wrong", data, size);
+  }
+  return 0;
+}
+
+#ifndef MQTT_FUZZ_LIBFUZZER
+
+// One of: flip a byte, insert one, delete one, or splice in a piece of another seed
+static void mutate (std::vector<uint8_t> &in, std::mt19937 &rng){
+  int steps = 1 + rng() % 4;
+  for (int s = 0; s < steps; s++){
+    size_t at = in.empty() ? 0 : rng() % in.size();
+    switch (rng() % 4){
+      case 0:
+        if (!in.empty()){
+          in[at] = (rng() % 2) ? (uint8_t)rng() : in[at] ^ (1 << (rng() % 8));
+        }
+        break;
+      case 1:
+        if (in.size() < FUZZ_INPUT_MAX){
+          in.insert(in.begin() + at, (uint8_t)((rng() % 2) ? rng() : ",: \r\n0"[rng() % 6]));
+        }
+        break;
+      case 2:
+        if (!in.empty()){
+          in.erase(in.begin() + at);
+        }
+        break;
+      default:{
+        size_t k = rng() % (sizeof(seeds) / sizeof(seeds[0]));
+        size_t from = rng() % seeds[k].size;
+        size_t n = min((size_t)(rng() % 12), seeds[k].size - from);
+        if (in.size() + n <= FUZZ_INPUT_MAX){
+          in.insert(in.begin() + at, (const uint8_t*)seeds[k].data + from, (const uint8_t*)seeds[k].data + from + n);
+        }
+      }
+    }
+  }
+}
+
+static bool replay (const char *path){
+  FILE *f = fopen(path, "rb");
+  if (f == NULL){
+    printf("Can't open %s\n", path);
+    return 0;
+  }
+  std::vector<uint8_t> in;
+  int c;
+  while ((c = fgetc(f)) != EOF){
+    in.push_back(c);
+  }
+  fclose(f);
+  LLVMFuzzerTestOneInput(in.data(), in.size());
+  return 1;
+}
+
+int main (int argc, char **argv){
+  if (argc > 1 && atoi(argv[1]) == 0){ // Files
+    for (int i = 1; i < argc; i++){
+      if (!replay(argv[i])){
+        return 1;
+      }
+    }
+    printf("%d inputs ok\n", argc - 1);
+    return 0;
+  }
+
+  long iterations = (argc > 1) ? atol(argv[1]) : FUZZ_ITERATIONS;
+  std::mt19937 rng(1);
+  for (size_t k = 0; k < sizeof(seeds) / sizeof(seeds[0]); k++){
+    LLVMFuzzerTestOneInput((const uint8_t*)seeds[k].data, seeds[k].size);
+  }
+  for (long i = 0; i < iterations; i++){
+    size_t k = rng() % (sizeof(seeds) / sizeof(seeds[0]));
+    std::vector<uint8_t> in((const uint8_t*)seeds[k].data, (const uint8_t*)seeds[k].data + seeds[k].size);
+    mutate(in, rng);
+    LLVMFuzzerTestOneInput(in.data(), in.size());
+  }
+  mqttDispatchStats *s = mqttDispatchGetStats();
+  printf("%ld inputs ok: %u received, %u handled, %u unknown, %u retained, %u oversize\n", iterations, s->received,
+         s->handled, s->unknown, s->retained, s->oversize);
+  return 0;
+}
+
+#endif // MQTT_FUZZ_LIBFUZZER
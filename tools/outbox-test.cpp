@@ -0,0 +1,279 @@
+/* Outbox test (outbox.cpp) on the host harness (tools/host), its broker standing in for a local mosquitto. The whole
+   sketch runs with its files in a host directory, so the test can watch /outbox.bin and /outbox.tmp from outside
+   without the board noticing. Checks:
+   - online: a tap's req and eou reach the broker once each, and the outbox never touches flash
+   - outage: events queued while the broker is away are on flash, and after the reconnect reach the broker once each,
+     in order, no sooner than the connect and within OUTBOX_CONNECT_JITTER of it, with no more than OUTBOX_INFLIGHT
+     in any one round trip. The file is gone once they're all acked
+   - drop mid drain: the broker goes away again part way through the backlog, nothing is lost, and only what was in
+     flight (unacked) when it went is sent twice
+   - overflow: more than OUTBOX_SIZE events in one outage, the oldest are dropped and counted, the rest arrive
+   Events other than the tap's are pushed straight into outboxPush (), the way accessTask does.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -include Arduino.h -x c++ tool-access-RTOS.ino -x none *.cpp \
+       tools/host/host-*.cpp tools/outbox-test.cpp -o /tmp/outbox-test
+     /tmp/outbox-test [seed]
+   Exits 1 if a check fails.
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "outbox.h"
+
+#define LATENCY_US        20000    // One way, long enough for the in flight window to show at the broker
+#define SERVER_DELAY_US   10000
+#define BACKLOG           40       // Events per outage, under OUTBOX_SIZE
+#define PUSH_GAP_US       100000   // Between pushes, outboxTask keeps up with the intake ring
+#define COME_BACK_WITHIN  30000000 // us, the reconnect timer and the drain
+#define TAP_WITHIN        3000000
+
+typedef struct {
+  uint64_t us;
+  std::string topic;
+  std::string uid;    // Payload up to the first ','
+} arrival;
+
+static uint32_t failures = 0;
+static std::string fsDir;
+static std::vector<arrival> arrivals;
+static bool fileSeen = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check (bool ok, const char *what, int line){
+  if (!ok){
+    printf("FAIL line %d: %s\n", line, what);
+    failures++;
+  }
+}
+
+static bool hostFile (const char *path, size_t *size){
+  struct stat st;
+  if (stat((fsDir + path).c_str(), &st) != 0){
+    return 0;
+  }
+  if (size != NULL){
+    *size = st.st_size;
+  }
+  return 1;
+}
+
+// hostRunUntilTrue () predicate wrapper, notes the outbox file existing at any point along the way
+static bool watchFile (bool done){
+  fileSeen |= hostFile(OUTBOX_PATH, NULL) || hostFile(OUTBOX_TMP_PATH, NULL);
+  return done;
+}
+
+static std::string eventUid (byte phase, uint16_t n){
+  char s[16];
+  snprintf(s, sizeof(s), "0B:%02X:%02X:%02X", phase, (n >> 8) & 0xFF, n & 0xFF);
+  return s;
+}
+
+static bool outboxTopic (const char *topic){
+  return strcmp(topic, "rfid/auth/req") == 0 || strcmp(topic, "rfid/auth/eou") == 0
+         || strcmp(topic, "rfid/auth/offline") == 0;
+}
+
+// The broker's side: note what arrives, and answer reqs as the server would
+static void brokerHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (!outboxTopic(topic)){
+    return; // Debug lines, metrics, member sync
+  }
+  std::string p(payload, len);
+  arrival a = {hostNow(), topic, p.substr(0, p.find(','))};
+  arrivals.push_back(a);
+  if (strcmp(topic, "rfid/auth/req") == 0){
+    std::string rsp = "auth," + a.uid;
+    hostAfter(SERVER_DELAY_US, [=](){
+      hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+    });
+  }
+}
+
+static uint32_t arrivedCount (const std::string &uid){
+  uint32_t n = 0;
+  for (size_t i = 0; i < arrivals.size(); i++){
+    n += (arrivals[i].uid == uid);
+  }
+  return n;
+}
+
+// Most arrivals in any span shorter than a round trip
+static uint32_t mostPerRoundTrip (){
+  uint32_t most = 0;
+  for (size_t i = 0; i < arrivals.size(); i++){
+    uint32_t n = 0;
+    for (size_t j = i; j < arrivals.size() && arrivals[j].us < arrivals[i].us + 2 * LATENCY_US; j++){
+      n++;
+    }
+    most = max(most, n);
+  }
+  return most;
+}
+
+static bool connected (bool up){
+  return hostRunUntilTrue([=](){ return watchFile(hostMqttConnected() == up); }, hostNow() + COME_BACK_WITHIN, 0);
+}
+
+// Takes the broker away and waits for the board to notice
+static bool outage (){
+  hostBrokerUp(0);
+  return connected(0);
+}
+
+// Pushes n events, eou and offline taps in turn, spaced out
+static void pushEvents (byte phase, uint16_t n){
+  for (uint16_t i = 0; i < n; i++){
+    outboxPush(0, (i & 1) ? OUTBOX_TAP : OUTBOX_EOU, eventUid(phase, i).c_str(), 1);
+    hostRunUntilTrue([](){ return watchFile(0); }, hostNow() + PUSH_GAP_US, 0);
+  }
+}
+
+// Broker back, waits for everything pushed in phase from first to n to arrive
+static bool drain (byte phase, uint16_t first, uint16_t n, uint64_t *connectUs){
+  hostBrokerUp(1);
+  if (!connected(1)){
+    return 0;
+  }
+  *connectUs = hostNow();
+  return hostRunUntilTrue([=](){
+    for (uint16_t i = first; i < n; i++){
+      if (arrivedCount(eventUid(phase, i)) == 0){
+        return watchFile(0);
+      }
+    }
+    return watchFile(1);
+  }, hostNow() + COME_BACK_WITHIN, 0);
+}
+
+//////// Checks, on the booted board ////////
+
+static void checkOnline (){
+  uidType uid = UID4(0x04, 0xC0, 0x00, 0x01);
+  std::string s = "04:C0:00:01";
+
+  arrivals.clear();
+  fileSeen = 0;
+  hostCardEnter(SS_PIN, &uid);
+  CHECK(hostRunUntilTrue([](){ return watchFile(accessState(0) == ST_RELAY_ON); }, hostNow() + TAP_WITHIN, 0));
+  hostCardLeave(SS_PIN, &uid);
+  CHECK(hostRunUntilTrue([](){ return watchFile(accessState(0) == ST_IDLE); },
+                         hostNow() + MS_TIMEOUT_PERIOD * 1000ULL + 1000000, 0));
+  hostRunUntilTrue([](){ return watchFile(outboxDepth() == 0); }, hostNow() + 1000000, 0); // The eou's ack
+  CHECK(arrivals.size() == 2);
+  CHECK(arrivals.size() == 2 && arrivals[0].topic == "rfid/auth/req" && arrivals[0].uid == s);
+  CHECK(arrivals.size() == 2 && arrivals[1].topic == "rfid/auth/eou" && arrivals[1].uid == s);
+  CHECK(outboxDepth() == 0);
+  CHECK(!fileSeen); // Online, an ack is only ever a round trip away
+}
+
+static void checkOutage (){
+  uint64_t connectUs;
+  size_t size = 0;
+
+  arrivals.clear();
+  CHECK(outage());
+  pushEvents(1, BACKLOG);
+  CHECK(hostFile(OUTBOX_PATH, &size) && size == sizeof(uint32_t) + BACKLOG * sizeof(outboxEntry));
+  CHECK(outboxDepth() == BACKLOG);
+  CHECK(arrivals.empty());
+
+  CHECK(drain(1, 0, BACKLOG, &connectUs));
+  CHECK(arrivals.size() == BACKLOG);
+  for (uint16_t i = 0; i < BACKLOG; i++){
+    CHECK(arrivedCount(eventUid(1, i)) == 1);
+    CHECK(i >= arrivals.size() || arrivals[i].uid == eventUid(1, i)); // In the order they happened
+  }
+  CHECK(!arrivals.empty() && arrivals[0].us >= connectUs);
+  CHECK(!arrivals.empty() && arrivals[0].us <= connectUs + OUTBOX_CONNECT_JITTER * 1000ULL + 2 * LATENCY_US);
+  CHECK(mostPerRoundTrip() <= OUTBOX_INFLIGHT);
+  CHECK(hostRunUntilTrue([](){ // Removed once the last ack is in
+    return outboxDepth() == 0 && !hostFile(OUTBOX_PATH, NULL) && !hostFile(OUTBOX_TMP_PATH, NULL);
+  }, hostNow() + 1000000, 0));
+  printf("outage: %u events drained in %.0fms after the connect, at most %u per round trip\n", BACKLOG,
+         arrivals.empty() ? 0 : (arrivals.back().us - connectUs) / 1000.0, mostPerRoundTrip());
+}
+
+static void checkDropMidDrain (){
+  uint64_t connectUs;
+
+  arrivals.clear();
+  CHECK(outage());
+  pushEvents(2, BACKLOG);
+  hostBrokerUp(1);
+  CHECK(connected(1));
+  CHECK(hostRunUntilTrue([](){ return watchFile(arrivals.size() >= BACKLOG / 4); }, hostNow() + COME_BACK_WITHIN, 0));
+  size_t before = arrivals.size();
+  CHECK(outage()); // Acks for what's in flight are lost with it
+  CHECK(hostFile(OUTBOX_PATH, NULL));
+  CHECK(drain(2, 0, BACKLOG, &connectUs));
+
+  uint32_t twice = 0;
+  for (uint16_t i = 0; i < BACKLOG; i++){
+    uint32_t n = arrivedCount(eventUid(2, i));
+    CHECK(n == 1 || n == 2);
+    twice += (n == 2);
+  }
+  CHECK(twice <= OUTBOX_INFLIGHT);
+  CHECK(arrivals.size() == BACKLOG + twice);
+  hostRunUntilTrue([](){ return watchFile(outboxDepth() == 0); }, hostNow() + 1000000, 0);
+  CHECK(outboxDepth() == 0);
+  printf("drop mid drain: broker gone after %u of %u, %u sent twice\n", (unsigned)before, BACKLOG, twice);
+}
+
+static void checkOverflow (){
+  uint64_t connectUs;
+  uint16_t n = OUTBOX_SIZE + 10;
+  uint32_t dropped = outboxDropped();
+
+  arrivals.clear();
+  CHECK(outage());
+  pushEvents(3, n);
+  CHECK(outboxDropped() - dropped == (uint32_t)(n - OUTBOX_SIZE));
+  CHECK(outboxDepth() == OUTBOX_SIZE);
+  CHECK(drain(3, n - OUTBOX_SIZE, n, &connectUs));
+  for (uint16_t i = 0; i < n; i++){
+    CHECK(arrivedCount(eventUid(3, i)) == (i >= n - OUTBOX_SIZE)); // Oldest go first
+  }
+}
+
+int main (int argc, char **argv){
+  char dir[] = "/tmp/outbox-testXXXXXX";
+
+  hostSeed((argc > 1) ? strtoul(argv[1], NULL, 0) : 1);
+  if (mkdtemp(dir) == NULL){
+    printf("No temp dir\n");
+    return 1;
+  }
+  fsDir = dir;
+  hostFsRoot(dir);
+  hostNetLatency(LATENCY_US);
+  hostBrokerOnPublish(brokerHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+  hostRunFor(OUTBOX_CONNECT_JITTER * 1000ULL); // Past the first connect's hold off
+
+  checkOnline();
+  checkOutage();
+  checkDropMidDrain();
+  checkOverflow();
+  printf("outbox checks: %s\n", failures ? "FAILED" : "ok");
+
+  std::string rm = std::string("rm -rf ") + dir;
+  if (system(rm.c_str()) != 0){
+    printf("Couldn't remove %s\n", dir);
+  }
+  return failures ? 1 : 0;
+}
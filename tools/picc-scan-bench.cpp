@@ -0,0 +1,387 @@
+/* Presence/collision benchmark for picc-scan.cpp against a simulated ISO 14443A field, next to the checks it
+   replaced (WUPA/HLTA presence plus four PICC_IsNewCardPresent () for collisions). Counts RF frames, SPI register
+   accesses and time the bus is held per poll, and how long removals and a second card take to be noticed.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -Itools/host -I. tools/picc-scan-bench.cpp picc-scan.cpp -o /tmp/picc-scan-bench
+     /tmp/picc-scan-bench [trials] [seed]
+
+   The simulated PICCs follow the ISO 14443-3 state machine (IDLE, READY, ACTIVE, HALT and the * states after a
+   WUPA from HALT). Timing is modelled, not measured: 106 kbit/s frames, ~90us for a PICC to answer, the MFRC522
+   library's 25ms timeout when nobody does (1ms for the scan, see READER_SCAN_TIMEOUT) and its busy polling of
+   ComIrqReg while it waits, which is where most of the old checks' SPI traffic went.
+*/
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include "picc-scan.h"
+
+#define BIT_US          9.44   // One bit at 106 kbit/s
+#define FDT_US          90.0   // PICC answer delay
+#define POLL_SPI_US     8.0    // One ComIrqReg read while waiting on the PICC
+#define FRAME_SPI_OPS   12     // Register accesses PCD_CommunicateWithPICC makes around a frame, not counting the waiting
+#define CRC_SPI_OPS     10     // PCD_CalculateCRC on the MFRC522's coprocessor
+#define LEGACY_TIMEOUT  25000  // us, PCD_Init's TReload
+#define SCAN_TIMEOUT    1000   // us, READER_SCAN_TIMEOUT
+#define PERIOD_US       100000 // MS_READER_PRESENT_PERIOD
+
+enum { IDLE, READY, ACTIVE, HALT };
+
+struct Card {
+  uidType uid;
+  byte state;
+  bool star;      // Woken out of HALT, goes back there instead of IDLE
+  byte level;     // Cascade level it is at while READY
+  double drop;    // Chance any one answer is lost (a card at the edge of the field)
+
+  byte levels () const { return uid.length == 4 ? 1 : (uid.length == 7 ? 2 : 3); }
+
+  void cl (byte level, byte *out) const { // This card's 5 byte UID CLn
+    byte n = levels();
+    if (level + 1 < n){
+      out[0] = 0x88;
+      memcpy(out + 1, uid.bytes + level * 3, 3);
+    }
+    else{
+      memcpy(out, uid.bytes + level * 3, 4);
+    }
+    out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+  }
+
+  void other (){ // Anything unexpected
+    if (state == READY || state == ACTIVE){
+      state = star ? HALT : IDLE;
+    }
+  }
+};
+
+static bool bitOf (const byte *b, int i){
+  return (b[i / 8] >> (i % 8)) & 1;
+}
+
+struct Sim {
+  std::vector<Card> cards;
+  std::mt19937 *rng;
+  double timeoutUs;
+  double busyUs;
+  uint32_t frames;
+  uint32_t spiOps;
+
+  void reset (){ busyUs = 0; frames = 0; spiOps = 0; }
+
+  bool lost (const Card &c){
+    return c.drop > 0 && std::uniform_real_distribution<double>(0, 1)(*rng) < c.drop;
+  }
+
+  // One card's answer as bits, or -1 for silence
+  int react (Card &c, const byte *f, byte sendBits, byte *ans){
+    if (sendBits == 7){ // REQA/WUPA
+      bool wupa = (f[0] == 0x52);
+      if (c.state == IDLE || (wupa && c.state == HALT)){
+        c.star = (c.state == HALT);
+        c.state = READY;
+        c.level = 0;
+        ans[0] = (c.uid.length == 4) ? 0x04 : 0x44;
+        ans[1] = 0;
+        return 16;
+      }
+      c.other();
+      return -1;
+    }
+    if (f[0] == 0x50 && sendBits == 32){ // HLTA
+      if (c.state == ACTIVE){
+        c.state = HALT;
+      }
+      else{
+        c.other();
+      }
+      return -1;
+    }
+    if ((f[0] == 0x93 || f[0] == 0x95 || f[0] == 0x97) && sendBits >= 16){
+      if (c.state != READY){
+        c.other();
+        return -1;
+      }
+      if (f[0] != 0x93 + 2 * c.level){
+        return -1; // Not its level, sits it out
+      }
+      byte cl[5];
+      c.cl(c.level, cl);
+      if (f[1] == 0x70){ // SELECT
+        if (sendBits != 72 || memcmp(f + 2, cl, 5) != 0){
+          return -1;
+        }
+        byte more = (c.level + 1 < c.levels());
+        ans[0] = more ? 0x04 : 0x08;
+        if (more){
+          c.level++;
+        }
+        else{
+          c.state = ACTIVE;
+        }
+        uint16_t crc = piccCrcA(ans, 1);
+        ans[1] = crc & 0xFF;
+        ans[2] = crc >> 8;
+        return 24;
+      }
+      int known = sendBits - 16;
+      for (int i = 0; i < known; i++){
+        if (bitOf(f + 2, i) != bitOf(cl, i)){
+          return -1; // Not on this branch
+        }
+      }
+      memset(ans, 0, 6);
+      int r = known % 8;
+      for (int i = known; i < 40; i++){ // Stored carrying on from the partial byte
+        int at = r + (i - known);
+        if (bitOf(cl, i)){
+          ans[at / 8] |= 1 << (at % 8);
+        }
+      }
+      return 40 - known;
+    }
+    c.other();
+    return -1;
+  }
+
+  byte transceive (const byte *send, byte sendBits, byte *back, byte backMax, byte *backBits, byte *collBit){
+    byte ans[8];
+    int len = -1;
+    int coll = -1;
+    int r = sendBits % 8;
+    byte merged[8] = {0};
+
+    frames++;
+    spiOps += FRAME_SPI_OPS;
+    for (size_t i = 0; i < cards.size(); i++){
+      int n = react(cards[i], send, sendBits, ans);
+      if (n < 0 || lost(cards[i])){
+        continue;
+      }
+      int stored = (sendBits == 7) ? 0 : r; // Short frames aren't aligned
+      if (len < 0){
+        len = n;
+        memcpy(merged, ans, sizeof(merged));
+        continue;
+      }
+      for (int b = stored; b < stored + n && b < stored + len; b++){
+        if (bitOf(merged, b) != bitOf(ans, b) && (coll < 0 || b < coll)){
+          coll = b;
+        }
+        merged[b / 8] |= ans[b / 8] & (1 << (b % 8));
+      }
+    }
+
+    double wait = (len < 0) ? timeoutUs : FDT_US + len * BIT_US;
+    busyUs += sendBits * BIT_US + wait;
+    spiOps += (int)(wait / POLL_SPI_US);
+    if (len < 0){
+      return PICC_TIMEOUT;
+    }
+    int stored = (sendBits == 7) ? 0 : r;
+    *backBits = stored + len;
+    memcpy(back, merged, backMax);
+    if (coll >= 0){
+      *collBit = coll;
+      spiOps++; // CollReg
+      return PICC_COLLISION;
+    }
+    return PICC_OK;
+  }
+};
+
+static byte simTransceive (void *ctx, const byte *send, byte sendBits, byte *back, byte backMax, byte *backBits, byte *collBit){
+  return ((Sim*)ctx)->transceive(send, sendBits, back, backMax, backBits, collBit);
+}
+
+//////// The two ways of checking on the card in session ////////
+
+#define SEEN_PRESENT   0
+#define SEEN_REMOVED   1
+#define SEEN_COLLISION 2
+
+// What readerCardPresent () and readerCollision () did before, through the MFRC522 library
+static byte legacyPoll (Sim *sim, const uidType *){
+  byte frame[4];
+  byte back[8];
+  byte bits;
+  byte coll;
+
+  sim->timeoutUs = LEGACY_TIMEOUT;
+  sim->spiOps += 3; // TxModeReg, RxModeReg, ModWidthReg
+  frame[0] = 0x52;
+  if (sim->transceive(frame, 7, back, sizeof(back), &bits, &coll) == PICC_OK){ // PICC_WakeupA, a collided ATQA isn't OK
+    frame[0] = 0x50; frame[1] = 0; frame[2] = 0x57; frame[3] = 0xCD;
+    sim->spiOps += CRC_SPI_OPS;
+    sim->transceive(frame, 32, back, sizeof(back), &bits, &coll); // PICC_HaltA
+  }
+  else{
+    frame[0] = 0x52;
+    sim->transceive(frame, 7, back, sizeof(back), &bits, &coll); // The second WakeupA, result ignored
+    return SEEN_REMOVED;
+  }
+
+  byte hits = 0;
+  for (int i = 0; i < 4; i++){ // PICC_IsNewCardPresent
+    sim->spiOps += 3;
+    frame[0] = 0x26;
+    byte s = sim->transceive(frame, 7, back, sizeof(back), &bits, &coll);
+    hits += (s == PICC_OK || s == PICC_COLLISION);
+  }
+  return (hits >= 2) ? SEEN_COLLISION : SEEN_PRESENT;
+}
+
+// What readerPoll () does now
+static byte scanPoll (Sim *sim, const uidType *session){
+  piccLink link = {sim, simTransceive};
+  piccScanResult r;
+
+  sim->timeoutUs = SCAN_TIMEOUT;
+  sim->spiOps += 4; // TReloadReg there and back
+  piccScan(&link, &r);
+  if (!r.answered){
+    return SEEN_REMOVED;
+  }
+  if (r.count > 1 || (r.collided && r.count > 0)){
+    return SEEN_COLLISION;
+  }
+  if (r.count == 1 && !piccScanHas(&r, session)){
+    return SEEN_REMOVED; // Someone else's card, ours is gone
+  }
+  return SEEN_PRESENT; // Ours, or something that answered but couldn't be read this time
+}
+
+typedef byte (*pollFn)(Sim *sim, const uidType *session);
+
+//////// Scenarios ////////
+
+static Card makeCard (std::mt19937 &rng, byte len, double drop){
+  Card c;
+  memset(&c, 0, sizeof(c));
+  c.uid.length = len;
+  for (byte i = 0; i < len; i++){
+    c.uid.bytes[i] = rng() & 0xFF;
+  }
+  if (len > 4){
+    c.uid.bytes[0] = 0x04; // NXP, and never the cascade tag
+  }
+  else if (c.uid.bytes[0] == 0x88){
+    c.uid.bytes[0] = 0x08;
+  }
+  c.state = HALT; // Read and halted when the session started
+  c.drop = drop;
+  return c;
+}
+
+struct Outcome {
+  uint32_t polls;
+  uint32_t frames;
+  uint32_t spiOps;
+  double busyUs;
+  uint32_t falseRemovals;
+  uint32_t falseCollisions;
+  uint32_t detected;
+  uint32_t missed;
+  double latencySum;
+  double latencyMax;
+};
+
+/* Polls a resting session card every PERIOD_US (or straight away if the last poll ran over). At eventUs either a
+   second card comes into the field (want SEEN_COLLISION) or the card is taken away (want SEEN_REMOVED). Anything
+   else reported before then is a false detection. brownout is the chance per poll that a card half in the field loses
+   power and comes back IDLE, forgetting it was halted.
+*/
+static void trial (pollFn poll, std::mt19937 &rng, Outcome *o, byte want, byte len, byte intruderLen, double drop, double brownout){
+  Sim sim;
+  sim.rng = &rng;
+  sim.reset();
+  sim.cards.push_back(makeCard(rng, len, drop));
+  uidType session = sim.cards[0].uid;
+  double eventUs = std::uniform_real_distribution<double>(0, 10 * PERIOD_US)(rng);
+  double now = 0;
+  bool happened = 0;
+
+  while (now < eventUs + 20 * PERIOD_US){
+    if (!happened && now >= eventUs){
+      happened = 1;
+      if (want == SEEN_COLLISION){
+        Card c = makeCard(rng, intruderLen, 0);
+        c.state = IDLE;
+        sim.cards.push_back(c);
+      }
+      else{
+        sim.cards.clear();
+      }
+    }
+    if (brownout > 0 && !sim.cards.empty() && std::uniform_real_distribution<double>(0, 1)(rng) < brownout){
+      sim.cards[0].state = IDLE;
+    }
+
+    double before = sim.busyUs;
+    byte seen = poll(&sim, &session);
+    double took = sim.busyUs - before;
+    o->polls++;
+
+    if (seen != SEEN_PRESENT){
+      if (!happened){
+        if (seen == SEEN_REMOVED){
+          o->falseRemovals++;
+        }
+        else{
+          o->falseCollisions++;
+        }
+      }
+      else if (seen == want){
+        o->detected++;
+        double lat = now + took - eventUs;
+        o->latencySum += lat;
+        o->latencyMax = (lat > o->latencyMax) ? lat : o->latencyMax;
+      }
+      else{
+        o->missed++; // Noticed something, but the wrong thing
+      }
+      break;
+    }
+    now += (took > PERIOD_US) ? took : PERIOD_US;
+  }
+  if (happened && sim.cards.size() != 0 && now >= eventUs + 20 * PERIOD_US){
+    o->missed++;
+  }
+  o->frames += sim.frames;
+  o->spiOps += sim.spiOps;
+  o->busyUs += sim.busyUs;
+}
+
+static void run (const char *name, byte want, byte len, byte intruderLen, double drop, double brownout, int trials, uint32_t seed){
+  static const char *names[] = {"before", "scan"};
+  static const pollFn polls[] = {legacyPoll, scanPoll};
+
+  printf("%s\n", name);
+  for (int a = 0; a < 2; a++){
+    std::mt19937 rng(seed);
+    Outcome o;
+    memset(&o, 0, sizeof(o));
+    for (int t = 0; t < trials; t++){
+      trial(polls[a], rng, &o, want, len, intruderLen, drop, brownout);
+    }
+    printf("  %-7s frames/poll %5.1f  spi/poll %6.0f  bus/poll %6.2fms  detected %4u  missed %4u  false removal %4u"
+           "  false collision %4u  latency avg %6.1fms max %6.1fms\n",
+           names[a], (double)o.frames / o.polls, (double)o.spiOps / o.polls, o.busyUs / o.polls / 1000.0, o.detected, o.missed,
+           o.falseRemovals, o.falseCollisions, o.detected ? o.latencySum / o.detected / 1000.0 : 0.0, o.latencyMax / 1000.0);
+  }
+}
+
+int main (int argc, char **argv){
+  int trials = (argc > 1) ? atoi(argv[1]) : 500;
+  uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+
+  printf("%d trials each, poll period %dms\n", trials, PERIOD_US / 1000);
+  run("second card, both 4 byte UIDs", SEEN_COLLISION, 4, 4, 0, 0, trials, seed);
+  run("second card, 4 byte in session, 7 byte arrives", SEEN_COLLISION, 4, 7, 0, 0, trials, seed);
+  run("second card, both 7 byte UIDs", SEEN_COLLISION, 7, 7, 0, 0, trials, seed);
+  run("card removed", SEEN_REMOVED, 4, 0, 0, 0, trials, seed);
+  run("card removed, card at the edge of the field (5% of answers lost)", SEEN_REMOVED, 4, 0, 0.05, 0, trials, seed);
+  run("card removed, card browning out (5% of polls it comes back IDLE)", SEEN_REMOVED, 4, 0, 0, 0.05, trials, seed);
+  return 0;
+}
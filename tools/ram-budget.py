@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Static RAM budget of a firmware build, by subsystem.
+
+Run it on the .elf the Arduino build leaves behind (arduino-cli compile
+--export-binaries, or the sketch's temporary build folder):
+    ram-budget.py build/tool-access-RTOS.ino.elf
+    ram-budget.py build/tool-access-RTOS.ino.elf --budget 98304
+
+Every .bss and .data symbol is put down to the source file it came from, so
+each subsystem's rings, pools and buffers show up under its own name. Task
+stacks (the <task>Stack arrays setup () creates them in) are listed on their
+own. Anything without a file (the SDK, libraries built without -g) is totalled
+as "other". Exits 1 if our own symbols come to more than --budget bytes.
+
+With a metrics snapshot (see metrics-decode.py) it also shows how much of each
+stack has been used so far, and what the STACK_* define could be with --margin
+bytes spare:
+    ram-budget.py build/tool-access-RTOS.ino.elf --snapshot snap.bin
+
+Needs the toolchain's nm, xtensa-esp32-elf-nm by default (--nm to change it).
+"""
+import argparse
+import collections
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+decoder = __import__("metrics-decode")
+
+DATA_TYPES = "bBdD"  # .bss and .data, local and global
+STACK_SUFFIX = "Stack"
+
+
+def symbols(nm, elf):
+    """(name, size, source file or None) for every .bss/.data symbol with a size"""
+    out = subprocess.run([nm, "-S", "-C", "-l", elf], check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    syms = []
+    for line in out.splitlines():
+        # addr size type name[\tfile:line]
+        where = None
+        if "\t" in line:
+            line, where = line.split("\t", 1)
+            where = os.path.basename(where.rsplit(":", 1)[0])
+        parts = line.split(None, 3)
+        if len(parts) < 4 or parts[2] not in DATA_TYPES:
+            continue
+        syms.append((parts[3], int(parts[1], 16), where))
+    return syms
+
+
+def subsystem(where):
+    """access-fsm.cpp -> access-fsm, the sketch and its .cpp share a name"""
+    return os.path.splitext(where)[0].replace(".ino", "")
+
+
+def report(syms, sources, top):
+    """Prints the tables, returns (our total, stacks by task name)"""
+    groups = collections.defaultdict(list)
+    stacks = {}
+    other = 0
+    for name, size, where in syms:
+        if where is None or where not in sources:
+            other += size
+        elif name.endswith(STACK_SUFFIX):
+            stacks[name[:-len(STACK_SUFFIX)]] = size
+        else:
+            groups[subsystem(where)].append((size, name))
+
+    ours = 0
+    print("%-20s %8s   largest" % ("subsystem", "bytes"))
+    for sub, items in sorted(groups.items(), key=lambda kv: -sum(s for s, _ in kv[1])):
+        items.sort(reverse=True)
+        total = sum(s for s, _ in items)
+        ours += total
+        print("%-20s %8d   %s" % (sub, total, ", ".join("%s %d" % (n, s) for s, n in items[:top])))
+    print("%-20s %8d   %d tasks" % ("task stacks", sum(stacks.values()), len(stacks)))
+    ours += sum(stacks.values())
+    print("%-20s %8d" % ("total (ours)", ours))
+    print("%-20s %8d   SDK, WiFi, libraries" % ("other", other))
+    return ours, stacks
+
+
+def stack_use(stacks, snap, margin):
+    print("\n%-16s %8s %8s %8s" % ("task", "stack", "peak", "could be"))
+    for task, headroom, _ in snap["tasks"]:
+        if task not in stacks:
+            continue  # IDLE and anything created outside setup ()
+        size = stacks[task]
+        peak = size - headroom
+        trim = (peak + margin + 255) // 256 * 256
+        print("%-16s %8d %8d %8d%s" % (task, size, peak, trim, "  raise it" if headroom < margin else ""))
+
+
+def main(argv):
+    ap = argparse.ArgumentParser(description="Static RAM budget of a firmware build, by subsystem")
+    ap.add_argument("elf")
+    ap.add_argument("--nm", default="xtensa-esp32-elf-nm")
+    ap.add_argument("--src", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                    help="the sketch folder, its .cpp/.ino files are the ones counted as ours")
+    ap.add_argument("--budget", type=int, default=0, help="bytes our symbols may add up to, 0 for no limit")
+    ap.add_argument("--top", type=int, default=3, help="largest symbols listed per subsystem")
+    ap.add_argument("--snapshot", help="a metrics snapshot, for how much of each stack is used")
+    ap.add_argument("--margin", type=int, default=512, help="spare bytes to leave on a stack")
+    args = ap.parse_args(argv[1:])
+
+    sources = set(f for f in os.listdir(args.src) if f.endswith((".cpp", ".ino", ".h")))
+    ours, stacks = report(symbols(args.nm, args.elf), sources, args.top)
+
+    if args.snapshot:
+        with open(args.snapshot, "rb") as f:
+            stack_use(stacks, decoder.parse(f.read()), args.margin)
+
+    if args.budget and ours > args.budget:
+        print("\nover budget by %d bytes" % (ours - args.budget))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
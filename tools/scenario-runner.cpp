@@ -0,0 +1,696 @@
+/* Scenario runner for the firmware on the host harness (tools/host). The whole sketch runs, every task, on virtual
+   time against the fake readers, relay pins, LEDs and broker: taps granted, denied and cached, a server that never
+   answers, removal and its timeout, handover, collisions, eStops from MQTT and the switch, the broker going away.
+   The board boots once, then each run forks from there so runs can't leak into each other and a crash is just a
+   failed run. Every scenario is checked as it goes (relay only ever closed in a closed state, never while eStopped,
+   harness faults) and against what it should end in.
+   accessDispatch is wrapped at link time, so each transition the state machine takes is timed two ways: host ns for
+   the dispatch itself (only counted when it ran without being switched out) and virtual us from the event being
+   posted to its transition being done, which is what the board would see.
+   Build and run from the repo root:
+     g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -DREADER_IRQ_PIN=35 -DESTOP_PIN=25 -include Arduino.h \
+       -x c++ tool-access-RTOS.ino -x none *.cpp tools/host/host-*.cpp tools/scenario-runner.cpp \
+       -Wl,--wrap=_Z14accessDispatchPK11accessEvent -o /tmp/scenario-runner
+     /tmp/scenario-runner [runs] [first seed] [scenario]
+   Leave out the -D's for the polled reader and no switch. One run of one scenario ("1 7 handover") echoes Serial,
+   which is how a failing seed gets looked at. -no-pie because DLOG keeps pointers in 32 bits, the same as on the
+   ESP32, so its strings have to be in the low 4GB.
+*/
+#include <Arduino.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "access-fsm.h"
+#include "estop.h"
+
+#define FAIL_SEEDS_SHOWN  5        // Per scenario
+#define SERVER_DELAY_MIN  5000     // us the server takes to answer a req, picked per run
+#define SERVER_DELAY_MAX  60000
+#define LATENCY_MIN       500      // us each way to the broker, picked per run
+#define LATENCY_MAX       8000
+#define TAP_WITHIN        (2 * MS_READER_IDLE_PERIOD * 1000 + 2 * LATENCY_MAX + SERVER_DELAY_MAX + 20000) // A tap to its answer, worst case: the REQA is answered on one poll and picked up on the next
+#define TRACK_WITHIN      (MS_READER_PRESENT_PERIOD * 1000 + 20000) // A removal or second card to being noticed
+
+static const char *stateNames[ST_COUNT] = {"IDLE", "OUTAGE", "CARD", "AUTHORIZED", "RELAY_ON", "TIMEOUT", "HANDOVER",
+                                           "COLLISION", "ESTOP"};
+static const char *eventNames[EV_COUNT] = {"CARD_ARRIVED", "CARD_REMOVED", "COLLISION", "AUTH_CACHED", "AUTH_GRANTED",
+                                           "AUTH_DENIED", "AUTH_REVOKED", "TIMEOUT_EXPIRED", "ESTOP_FIRE", "ESTOP_CLEAR",
+                                           "NET_DOWN", "NET_UP"};
+static const bool relayMayClose[ST_COUNT] = {0, 0, 0, 1, 1, 1, 1, 1, 0};
+
+typedef struct { // One transition's timing, from a run or all of them
+  uint16_t key;           // (from * EV_COUNT + event) * ST_COUNT + to
+  uint32_t count;
+  uint32_t hostCount;     // Dispatches that ran start to end without a switch, the only ones host ns is kept for
+  uint64_t hostNsSum;
+  uint32_t hostNsMax;
+  uint64_t virtUsSum;
+  uint32_t virtUsMax;
+} transitionStat;
+
+typedef struct { // What a run sends back up the pipe, its transitionStats follow
+  bool failed;
+  char why[160];
+  uint64_t virtUs;
+  uint32_t tapToRelayUs;  // 0 if the run didn't time one
+  uint32_t estopRelayUs;  // Fire reaching the board to the relay pin low, 0 if no eStop
+  uint32_t estopStateUs;  // And to ESTOP
+  uint16_t transitions;
+} runResult;
+
+typedef struct {
+  const char *name;
+  void (*run)();
+  bool needsSwitch;       // Only with ESTOP_PIN wired
+} scenario;
+
+typedef struct { // The parent's totals for a scenario
+  uint32_t runs;
+  uint32_t fails;
+  uint64_t virtUs;
+  uint32_t taps;
+  uint64_t tapUsSum;
+  uint32_t tapUsMax;
+  uint32_t estops;
+  uint32_t estopRelayMax;
+  uint32_t estopStateMax;
+  std::vector<std::string> failSeeds;
+} scenarioTotals;
+
+// This run's, in the child
+static runResult result;
+static transitionStat stats[ST_COUNT * EV_COUNT * ST_COUNT];
+static uint64_t relayRiseUs;
+static uint64_t relayFallUs;
+static uint32_t relayRises;
+static uint32_t relayFalls;
+static bool estopActive = 0;     // Fired and not yet seen out of ESTOP
+static uint32_t faultsAtStart;
+
+// The server
+static std::vector<std::string> allowed;
+static bool serverSilent = 0;
+static uint32_t serverDelayUs = SERVER_DELAY_MIN;
+static uint32_t latencyUs = LATENCY_MIN;
+static uint32_t reqs = 0;
+
+//////// Checks ////////
+
+static void fail (const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void fail (const char *fmt, ...){
+  if (result.failed){
+    return; // The first one is what went wrong, the rest follow from it
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  int n = snprintf(result.why, sizeof(result.why), "@%lums ", (unsigned long)((hostNow() - result.virtUs) / 1000));
+  vsnprintf(result.why + n, sizeof(result.why) - n, fmt, ap);
+  va_end(ap);
+  result.failed = 1;
+}
+
+static void checkRelay (const char *when){
+  byte state = accessState(0);
+  if (hostPinLevel(RELAY_PIN) == HIGH && !relayMayClose[state]){
+    fail("relay closed in %s, %s", stateNames[state], when);
+  }
+}
+
+// The state machine's transitions, timed and checked. Linked in place of accessDispatch (-Wl,--wrap)
+extern "C" void __real__Z14accessDispatchPK11accessEvent (const accessEvent *event);
+
+extern "C" void __wrap__Z14accessDispatchPK11accessEvent (const accessEvent *event){
+  byte before[STATION_COUNT];
+  uint32_t taken[STATION_COUNT];
+  struct timespec a;
+  struct timespec b;
+
+  for (byte i = 0; i < STATION_COUNT; i++){
+    before[i] = accessState(i);
+    taken[i] = accessTransitions(i);
+  }
+  uint64_t switches = hostSwitches();
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  __real__Z14accessDispatchPK11accessEvent(event);
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  bool alone = (hostSwitches() == switches);
+  uint32_t ns = (uint32_t)((b.tv_sec - a.tv_sec) * 1000000000LL + (b.tv_nsec - a.tv_nsec));
+  uint32_t us = micros() - event->stamp;
+
+  for (byte i = 0; i < STATION_COUNT; i++){
+    if (accessTransitions(i) == taken[i]){
+      continue; // Nothing for this station
+    }
+    transitionStat *s = &stats[(before[i] * EV_COUNT + event->type) * ST_COUNT + accessState(i)];
+    s->count++;
+    s->virtUsSum += us;
+    s->virtUsMax = max(s->virtUsMax, us);
+    if (alone){
+      s->hostCount++;
+      s->hostNsSum += ns;
+      s->hostNsMax = max(s->hostNsMax, ns);
+    }
+  }
+  if (estopActive && accessState(0) != ST_ESTOP && before[0] == ST_ESTOP){
+    estopActive = 0;
+  }
+  checkRelay(eventNames[event->type]);
+}
+
+static void relayEdge (uint8_t pin, int level){
+  if (pin != RELAY_PIN){
+    return;
+  }
+  if (level == HIGH){
+    relayRiseUs = hostNow();
+    relayRises++;
+    if (estopActive){
+      fail("relay closed while eStopped");
+    }
+  }
+  else{
+    relayFallUs = hostNow();
+    relayFalls++;
+  }
+}
+
+//////// Server ////////
+
+static std::string uidString (const uidType *uid){
+  char s[UID_MAX_SIZE * 3 + 1];
+  for (byte i = 0; i < uid->length; i++){
+    snprintf(s + i * 3, 4, "%02X:", uid->bytes[i]);
+  }
+  s[uid->length * 3 - 1] = 0;
+  return s;
+}
+
+// Answers rfid/auth/req the way the server does, echoing the uidStr so the rsp finds its station
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  reqs++;
+  if (serverSilent){
+    return;
+  }
+  std::string uid(payload, len);
+  uid = uid.substr(0, uid.find(','));
+  bool allow = 0;
+  for (size_t i = 0; i < allowed.size(); i++){
+    allow = allow || (allowed[i] == uid);
+  }
+  std::string rsp = (allow ? "auth," : "denied,") + uid;
+  hostAfter(serverDelayUs, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+//////// Helpers for the scenarios ////////
+
+static uint32_t pick (uint32_t lo, uint32_t hi){
+  return lo + hostRandom() % (hi - lo + 1);
+}
+
+static uidType randomCard (){
+  uidType uid;
+  memset(&uid, 0, sizeof(uid));
+  uid.length = (hostRandom() % 4 == 0) ? 7 : 4;
+  for (byte i = 0; i < uid.length; i++){
+    uid.bytes[i] = (byte)hostRandom();
+  }
+  if (uid.length == 4 && uid.bytes[0] == 0x88){
+    uid.bytes[0] = 0x08; // 0x88 is the cascade tag, not a single size UID's first byte
+  }
+  return uid;
+}
+
+static bool waitFor (const std::function<bool ()> &done, uint64_t withinUs, const char *what){
+  if (!hostRunUntilTrue(done, hostNow() + withinUs, 0)){
+    fail("%s: not within %lums, %s", what, (unsigned long)(withinUs / 1000), stateNames[accessState(0)]);
+    return 0;
+  }
+  return 1;
+}
+
+static bool waitState (byte state, uint64_t withinUs){
+  char what[32];
+  snprintf(what, sizeof(what), "waiting on %s", stateNames[state]);
+  return waitFor([=](){ return accessState(0) == state; }, withinUs, what);
+}
+
+// A card in the field some time in the next idle poll, timed to the relay closing if it does
+static uint64_t tap (const uidType *uid){
+  hostRunFor(pick(0, MS_READER_IDLE_PERIOD * 1000));
+  hostCardEnter(SS_PIN, uid);
+  return hostNow();
+}
+
+static void timeTap (uint64_t tapUs){
+  if (relayRises > 0 && relayRiseUs >= tapUs){
+    result.tapToRelayUs = (uint32_t)(relayRiseUs - tapUs);
+  }
+}
+
+// Tapped and granted by the server, relay closed
+static bool session (const uidType *uid){
+  allowed.push_back(uidString(uid));
+  uint64_t t = tap(uid);
+  if (!waitState(ST_RELAY_ON, TAP_WITHIN)){
+    return 0;
+  }
+  timeTap(t);
+  if (hostPinLevel(RELAY_PIN) != HIGH){
+    fail("RELAY_ON with the relay open");
+    return 0;
+  }
+  return 1;
+}
+
+static void settled (){
+  hostRunFor(MS_READER_IDLE_PERIOD * 2000);
+  if (accessState(0) != ST_IDLE || hostPinLevel(RELAY_PIN) != LOW){
+    fail("didn't settle, %s with the relay %s", stateNames[accessState(0)], hostPinLevel(RELAY_PIN) ? "closed" : "open");
+  }
+}
+
+// arrival says when the fire reached the board, asked once the relay is open
+static void estopBy (const std::function<void ()> &fire, const std::function<uint64_t ()> &arrival){
+  estopActive = 1;
+  fire();
+  if (!waitFor([](){ return hostPinLevel(RELAY_PIN) == LOW && accessState(0) == ST_ESTOP; }, 100000, "eStop")){
+    return;
+  }
+  result.estopRelayUs = (uint32_t)(hostPinChanged(RELAY_PIN) - arrival());
+  if (result.estopRelayUs > ESTOP_RELAY_BOUND_US){
+    fail("eStop took %luus to open the relay", (unsigned long)result.estopRelayUs);
+  }
+  result.estopStateUs = estopStateMaxUs();
+  if (result.estopStateUs > ESTOP_STATE_BOUND_US){
+    fail("eStop took %luus to reach ESTOP", (unsigned long)result.estopStateUs);
+  }
+}
+
+static void mqttEstop (const char *command){
+  hostBrokerSend("rfid/estop", command, strlen(command), 0);
+}
+
+//////// Scenarios ////////
+
+static void runGranted (){
+  uidType card = randomCard();
+  if (!session(&card)){
+    return;
+  }
+  hostRunFor(50000); // ledTask is behind accessTask
+  if (hostLedsShown()[0].g == 0 || hostLedsShown()[0].r != 0){
+    fail("LED isn't green in session, %02X%02X%02X", hostLedsShown()[0].r, hostLedsShown()[0].g, hostLedsShown()[0].b);
+  }
+}
+
+static void runDenied (){
+  uidType card = randomCard();
+  tap(&card);
+  if (!waitFor([](){ return reqs > 0; }, TAP_WITHIN, "req") || !waitState(ST_IDLE, TAP_WITHIN)){
+    return;
+  }
+  hostRunFor(MS_READER_IDLE_PERIOD * 2000); // Still in the field, halted, mustn't be read again
+  if (relayRises > 0 || reqs != 1){
+    fail("denied card: %lu relay closes, %lu reqs", (unsigned long)relayRises, (unsigned long)reqs);
+  }
+  settled();
+}
+
+// Granted, gone for good, the timeout runs out. Then the same card again, off the cache this time
+static void runRemoval (){
+  uidType card = randomCard();
+  if (!session(&card)){
+    return;
+  }
+  hostRunFor(pick(0, 2000000));
+  hostCardLeave(SS_PIN, &card);
+  if (!waitState(ST_TIMEOUT, TRACK_WITHIN)){
+    return;
+  }
+  if (hostPinLevel(RELAY_PIN) != HIGH){
+    fail("relay opened on removal, should wait out the timeout");
+    return;
+  }
+  if (!waitState(ST_IDLE, MS_TIMEOUT_PERIOD * 1000 + 100000)){
+    return;
+  }
+  serverDelayUs = SERVER_DELAY_MAX * 4; // Slow enough that a cache hit can't be mistaken for the server
+  result.tapToRelayUs = 0;
+  uint64_t t = tap(&card);
+  if (!waitState(ST_AUTHORIZED, TAP_WITHIN)){
+    return;
+  }
+  timeTap(t);
+  if (hostPinLevel(RELAY_PIN) != HIGH){
+    fail("cached grant with the relay open");
+    return;
+  }
+  waitState(ST_RELAY_ON, TAP_WITHIN + serverDelayUs); // The server agrees
+}
+
+static void runSilent (){
+  uidType card = randomCard();
+  serverSilent = 1;
+  tap(&card);
+  if (!waitState(ST_CARD, TAP_WITHIN) || !waitState(ST_IDLE, MS_AUTH_WAIT_PERIOD * 1000 + 100000)){
+    return;
+  }
+  if (relayRises > 0){
+    fail("relay closed with no answer from the server");
+  }
+  hostCardLeave(SS_PIN, &card);
+  settled();
+}
+
+static void runHandover (){
+  uidType a = randomCard();
+  uidType b = randomCard();
+  if (!session(&a)){
+    return;
+  }
+  hostCardLeave(SS_PIN, &a);
+  if (!waitState(ST_TIMEOUT, TRACK_WITHIN)){
+    return;
+  }
+  allowed.push_back(uidString(&b));
+  hostRunFor(pick(0, 3000000));
+  hostCardEnter(SS_PIN, &b);
+  if (!waitState(ST_HANDOVER, TAP_WITHIN) || !waitState(ST_RELAY_ON, TAP_WITHIN)){ // TIMEOUT scans, so it's a tap not a track
+    return;
+  }
+  if (relayFalls > 0){
+    fail("relay opened during the handover");
+  }
+}
+
+static void runCollision (){
+  uidType a = randomCard();
+  uidType b = randomCard();
+  if (!session(&a)){
+    return;
+  }
+  hostRunFor(pick(0, 1000000));
+  hostCardEnter(SS_PIN, &b);
+  if (!waitState(ST_COLLISION, TRACK_WITHIN)){
+    return;
+  }
+  if (hostPinLevel(RELAY_PIN) != HIGH){
+    fail("relay opened on the collision, should wait out the timeout");
+  }
+  if (!waitState(ST_IDLE, MS_TIMEOUT_PERIOD * 1000 + 100000)){ // actCollision waits the removal timeout, not COLL_TIMEOUT_PERIOD
+    return;
+  }
+  hostCardsClear(SS_PIN);
+  settled();
+}
+
+static void runEstopMqtt (){
+  uidType card = randomCard();
+  if (!session(&card)){
+    return;
+  }
+  hostRunFor(pick(0, 500000));
+  estopBy([](){ mqttEstop("fire"); }, [](){ return hostMqttArrived(); });
+  hostCardLeave(SS_PIN, &card);
+  hostRunFor(pick(0, 500000));
+  mqttEstop("clear");
+  if (!waitState(ST_IDLE, 4 * latencyUs + 50000)){
+    return;
+  }
+  settled();
+}
+
+static void runEstopSwitch (){
+  uidType card = randomCard();
+  if (!session(&card)){
+    return;
+  }
+  hostRunFor(pick(0, 500000));
+  uint64_t edge = hostNow();
+  estopBy([](){ hostPinDrive(ESTOP_PIN, HIGH); }, [=](){ return edge; });
+  hostRunFor(pick(0, 500000));
+  mqttEstop("clear"); // Still pressed, has to be ignored
+  hostRunFor(4 * latencyUs + 50000);
+  if (accessState(0) != ST_ESTOP){
+    fail("cleared with the switch still pressed");
+    return;
+  }
+  hostPinDrive(ESTOP_PIN, LOW);
+  hostCardLeave(SS_PIN, &card);
+  mqttEstop("clear");
+  if (!waitState(ST_IDLE, 4 * latencyUs + 50000)){
+    return;
+  }
+  settled();
+}
+
+// The broker goes, taps are decided offline (an unknown card is denied), it comes back and the board reconnects
+static void runNetDrop (){
+  uidType card = randomCard();
+  hostRunFor(pick(0, 500000));
+  hostBrokerUp(0);
+  if (!waitState(ST_OUTAGE, 2 * latencyUs + 50000)){
+    return;
+  }
+  uint32_t before = accessTransitions(0);
+  tap(&card);
+  // CARD, denied back to IDLE and on to OUTAGE again
+  if (!waitFor([=](){ return accessTransitions(0) >= before + 3 && accessState(0) == ST_OUTAGE; }, TAP_WITHIN, "offline deny")){
+    return;
+  }
+  if (relayRises > 0 || reqs > 0){
+    fail("offline tap of an unknown card: %lu relay closes, %lu reqs", (unsigned long)relayRises, (unsigned long)reqs);
+    return;
+  }
+  hostCardLeave(SS_PIN, &card);
+  hostBrokerUp(1);
+  if (!waitState(ST_IDLE, MS_MQTT_RECONNECT_PERIOD * 1000 + 10 * latencyUs + 100000)){
+    return;
+  }
+  settled();
+}
+
+static const scenario scenarios[] = {
+  {"granted",      runGranted,     0},
+  {"denied",       runDenied,      0},
+  {"removal",      runRemoval,     0},
+  {"silent",       runSilent,      0},
+  {"handover",     runHandover,    0},
+  {"collision",    runCollision,   0},
+  {"estop-mqtt",   runEstopMqtt,   0},
+  {"estop-switch", runEstopSwitch, 1},
+  {"net-drop",     runNetDrop,     0},
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+//////// Runs ////////
+
+// In the child, from the booted board
+static void runOne (const scenario *sc, uint32_t seed, int out){
+  memset(&result, 0, sizeof(result));
+  memset(stats, 0, sizeof(stats));
+  hostSeed(seed);
+  latencyUs = pick(LATENCY_MIN, LATENCY_MAX);
+  serverDelayUs = pick(SERVER_DELAY_MIN, SERVER_DELAY_MAX);
+  hostNetLatency(latencyUs);
+  faultsAtStart = hostFaults();
+  result.virtUs = hostNow();
+
+  sc->run();
+
+  if (hostFaults() != faultsAtStart){
+    fail("%lu harness faults", (unsigned long)(hostFaults() - faultsAtStart));
+  }
+  result.virtUs = hostNow() - result.virtUs;
+
+  std::vector<transitionStat> used;
+  for (uint16_t k = 0; k < ST_COUNT * EV_COUNT * ST_COUNT; k++){
+    if (stats[k].count > 0){
+      stats[k].key = k;
+      used.push_back(stats[k]);
+    }
+  }
+  result.transitions = used.size();
+  if (write(out, &result, sizeof(result)) != sizeof(result)
+      || (!used.empty() && write(out, used.data(), used.size() * sizeof(transitionStat)) != (ssize_t)(used.size() * sizeof(transitionStat)))){
+    _exit(2);
+  }
+  _exit(0);
+}
+
+static bool readAll (int fd, void *buf, size_t len){
+  size_t got = 0;
+  while (got < len){
+    ssize_t n = read(fd, (char*)buf + got, len - got);
+    if (n <= 0){
+      return 0;
+    }
+    got += n;
+  }
+  return 1;
+}
+
+// Forks a run, folds what it sends back into the totals. A child that dies is a failed run
+static void fork1 (const scenario *sc, uint32_t seed, bool echo, scenarioTotals *t, transitionStat *all){
+  runResult r;
+  int fds[2];
+  char seedName[96];
+
+  fflush(stdout);
+  if (pipe(fds) != 0){
+    perror("pipe");
+    exit(1);
+  }
+  pid_t pid = fork();
+  if (pid == 0){
+    close(fds[0]);
+    hostSerialEcho(echo);
+    runOne(sc, seed, fds[1]);
+  }
+  close(fds[1]);
+
+  bool ok = readAll(fds[0], &r, sizeof(r));
+  std::vector<transitionStat> got(ok ? r.transitions : 0);
+  ok = ok && (got.empty() || readAll(fds[0], got.data(), got.size() * sizeof(transitionStat)));
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!ok){
+    memset(&r, 0, sizeof(r));
+    r.failed = 1;
+    snprintf(r.why, sizeof(r.why), "run died (%s)", WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "no result");
+  }
+
+  t->runs++;
+  t->virtUs += r.virtUs;
+  if (r.tapToRelayUs > 0){
+    t->taps++;
+    t->tapUsSum += r.tapToRelayUs;
+    t->tapUsMax = max(t->tapUsMax, r.tapToRelayUs);
+  }
+  if (r.estopRelayUs > 0 || r.estopStateUs > 0){
+    t->estops++;
+    t->estopRelayMax = max(t->estopRelayMax, r.estopRelayUs);
+    t->estopStateMax = max(t->estopStateMax, r.estopStateUs);
+  }
+  if (r.failed){
+    t->fails++;
+    if (t->failSeeds.size() < FAIL_SEEDS_SHOWN){
+      snprintf(seedName, sizeof(seedName), "seed %lu: ", (unsigned long)seed);
+      t->failSeeds.push_back(std::string(seedName) + r.why);
+    }
+  }
+  for (size_t i = 0; i < got.size(); i++){
+    transitionStat *a = &all[got[i].key];
+    a->count += got[i].count;
+    a->hostCount += got[i].hostCount;
+    a->hostNsSum += got[i].hostNsSum;
+    a->hostNsMax = max(a->hostNsMax, got[i].hostNsMax);
+    a->virtUsSum += got[i].virtUsSum;
+    a->virtUsMax = max(a->virtUsMax, got[i].virtUsMax);
+  }
+}
+
+int main (int argc, char **argv){
+  int runs = (argc > 1) ? atoi(argv[1]) : 200;
+  uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+  const char *only = (argc > 3) ? argv[3] : NULL;
+  bool echo = (runs == 1 && only != NULL);
+  static transitionStat all[ST_COUNT * EV_COUNT * ST_COUNT];
+  scenarioTotals totals[SCENARIO_COUNT] = {};
+  struct timespec a;
+  struct timespec b;
+
+  // Boot once, everything forks from a board that's up, connected and idle
+  if (READER_IRQ_PIN >= 0){
+    hostReaderIrq(SS_PIN, READER_IRQ_PIN);
+  }
+  if (ESTOP_PIN >= 0){
+    hostPinDrive(ESTOP_PIN, LOW); // Switch closed to GND, not pressed
+  }
+  hostSerialEcho(echo);
+  hostPinWatch(relayEdge);
+  hostBrokerOnPublish(serverHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, 10000000, 1000)){
+    printf("Board never came up: %s, MQTT %s, %lu faults\n", stateNames[accessState(0)],
+           hostMqttConnected() ? "up" : "down", (unsigned long)hostFaults());
+    return 1;
+  }
+  hostRunFor(100000); // Subscriptions through
+  hostSerialEcho(0);
+  printf("Booted in %lums (virtual), IRQ pin %d, eStop pin %d, %d run(s) a scenario from seed %lu\n",
+         (unsigned long)(hostNow() / 1000), READER_IRQ_PIN, ESTOP_PIN, runs, (unsigned long)seed);
+
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  uint32_t total = 0;
+  uint32_t failed = 0;
+  for (size_t s = 0; s < SCENARIO_COUNT; s++){
+    if ((only != NULL && strcmp(only, scenarios[s].name) != 0) || (scenarios[s].needsSwitch && ESTOP_PIN < 0)){
+      continue;
+    }
+    for (int i = 0; i < runs; i++){
+      fork1(&scenarios[s], seed + i, echo, &totals[s], all);
+    }
+    total += totals[s].runs;
+    failed += totals[s].fails;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  double secs = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+
+  printf("\n%-13s %6s %6s %10s %22s %24s\n", "scenario", "runs", "fails", "virt/run", "tap-to-relay avg/max", "eStop relay/state max");
+  for (size_t s = 0; s < SCENARIO_COUNT; s++){
+    scenarioTotals *t = &totals[s];
+    if (t->runs == 0){
+      continue;
+    }
+    printf("%-13s %6lu %6lu %8.0fms", scenarios[s].name, (unsigned long)t->runs, (unsigned long)t->fails,
+           t->virtUs / 1000.0 / t->runs);
+    if (t->taps > 0){
+      printf(" %12.1fms/%5.1fms", t->tapUsSum / 1000.0 / t->taps, t->tapUsMax / 1000.0);
+    }
+    else{
+      printf(" %22s", "-");
+    }
+    if (t->estops > 0){
+      printf(" %15luus/%5luus", (unsigned long)t->estopRelayMax, (unsigned long)t->estopStateMax);
+    }
+    printf("\n");
+    for (size_t i = 0; i < t->failSeeds.size(); i++){
+      printf("    %s\n", t->failSeeds[i].c_str());
+    }
+  }
+
+  printf("\n%-44s %8s %18s %22s\n", "transition", "count", "host ns avg/max", "posted-to-done avg/max");
+  for (uint16_t k = 0; k < ST_COUNT * EV_COUNT * ST_COUNT; k++){
+    transitionStat *s = &all[k];
+    if (s->count == 0){
+      continue;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s -> %s on %s", stateNames[k / (EV_COUNT * ST_COUNT)], stateNames[k % ST_COUNT],
+             eventNames[(k / ST_COUNT) % EV_COUNT]);
+    printf("%-44s %8lu", name, (unsigned long)s->count);
+    if (s->hostCount > 0){
+      printf(" %9.0f/%8lu", (double)s->hostNsSum / s->hostCount, (unsigned long)s->hostNsMax);
+    }
+    else{
+      printf(" %18s", "-");
+    }
+    printf(" %12.0fus/%7luus\n", (double)s->virtUsSum / s->count, (unsigned long)s->virtUsMax);
+  }
+
+  printf("\n%lu runs, %lu failed, %.2fs: %.0f scenarios/s\n", (unsigned long)total, (unsigned long)failed, secs, total / secs);
+  return failed > 0;
+}
@@ -0,0 +1,210 @@
+/* Station scaling benchmark: how tap latency holds up as readers are added to the one SPI bus, on the host harness
+   (tools/host). The whole sketch is built once per station count (rows in tools/station-scaling-bench.h), then taps
+   go in at a random point of the idle poll, spread over every station, and are timed from the card entering the field
+   to its station leaving IDLE (detect) and to its relay closing (relay, with a 1ms broker and a 5ms server). Twice:
+     quiet - every other reader idle too, backed off to MS_READER_IDLE_PERIOD
+     busy  - every other station has a card in session, so its reader is checked every MS_READER_PRESENT_PERIOD, and
+             the taps all go to the last station
+   With no IRQ wired a card is seen on the second idle poll after it arrives (the REQA goes out one poll and is
+   answered the next), so detect sits between one and two MS_READER_IDLE_PERIODs however many readers there are.
+   What grows with them is how late the polls run and how busy the bus is.
+   Alongside, pollLag (how late readerTask got round to a reader it was due to poll, its own figure) and how much of
+   the time the bus was busy. The harness charges SPI and RF time per frame, so this is the bus sharing showing, not
+   the firmware's code.
+   Build and run from the repo root:
+     for n in 1 2 4 6 8; do
+       g++ -std=gnu++11 -O2 -no-pie -Itools/host -I. -DSTATION_COUNT=$n -include Arduino.h \
+         -include tools/station-scaling-bench.h -x c++ tool-access-RTOS.ino -x none *.cpp tools/host/host-*.cpp \
+         tools/station-scaling-bench.cpp -o /tmp/station-scaling-bench && /tmp/station-scaling-bench 40 1 $((n == 1))
+     done
+   Arguments are [taps per run] [seed] [header, 1 or 0].
+*/
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "tool-access-RTOS.h"
+#include "access-fsm.h"
+#include "latency.h"
+
+#define LATENCY_US      1000
+#define SERVER_DELAY_US 5000
+#define TAP_WITHIN      3000000    // us, anything slower is a failed tap
+
+extern latencyStat pollLag; // tool-access-RTOS.ino
+
+static uint64_t relayRise[STATION_COUNT];
+static uint32_t failures = 0;
+static std::vector<uint32_t> *lagInto = NULL; // Where pollLag's samples go while a run is timed
+static uint32_t lagSeen = 0;                  // pollLag.total as of the last look
+
+typedef struct {
+  std::vector<uint32_t> detect;
+  std::vector<uint32_t> relay;
+  std::vector<uint32_t> lag;
+  uint64_t busUs;
+  uint64_t spanUs;
+} runTimes;
+
+static uidType card (byte kind, uint16_t n){
+  uidType uid = UID4(0x04, 0xD0, 0x00, 0x00);
+  uid.bytes[1] |= kind;
+  uid.bytes[2] = n >> 8;
+  uid.bytes[3] = n;
+  return uid;
+}
+
+static void relayEdge (uint8_t pin, int level){
+  for (byte i = 0; i < STATION_COUNT; i++){
+    if (pin == stationConfigs[i].relayPin && level == HIGH){
+      relayRise[i] = hostNow();
+    }
+  }
+}
+
+static void serverHook (const char *topic, const char *payload, size_t len, uint8_t qos){
+  if (strcmp(topic, "rfid/auth/req") != 0){
+    return;
+  }
+  std::string p(payload, len);
+  std::string rsp = "auth," + p.substr(0, p.find(',')); // Echoed, there's more than one station
+  hostAfter(SERVER_DELAY_US, [=](){
+    hostBrokerSend("rfid/auth/rsp", rsp.data(), rsp.size(), 0);
+  });
+}
+
+// hostRunUntilTrue () predicate wrapper, copies out pollLag's new samples before its window wraps
+static bool watchLag (bool done){
+  uint32_t fresh = min(pollLag.total - lagSeen, (uint32_t)LATENCY_SAMPLES);
+  for (uint32_t k = fresh; k > 0 && lagInto != NULL; k--){
+    lagInto->push_back(pollLag.samples[(pollLag.next + LATENCY_SAMPLES - k) % LATENCY_SAMPLES]);
+  }
+  lagSeen = pollLag.total;
+  return done;
+}
+
+// A card on station s until it's in session
+static bool sit (byte s, const uidType *uid){
+  hostCardEnter(stationConfigs[s].ssPin, uid);
+  return hostRunUntilTrue([=](){ return accessState(s) == ST_RELAY_ON; }, hostNow() + TAP_WITHIN, 0);
+}
+
+// Taken away, waits out the timeout back to IDLE
+static bool leave (byte s, const uidType *uid){
+  hostCardLeave(stationConfigs[s].ssPin, uid);
+  return hostRunUntilTrue([=](){ return watchLag(accessState(s) == ST_IDLE); },
+                          hostNow() + MS_TIMEOUT_PERIOD * 1000ULL + 1000000, 0);
+}
+
+static bool tap (byte s, const uidType *uid, runTimes *times){
+  hostRunUntilTrue([](){ return watchLag(0); }, hostNow() + hostRandom() % (MS_READER_IDLE_PERIOD * 1000), 0);
+  relayRise[s] = 0;
+  hostCardEnter(stationConfigs[s].ssPin, uid);
+  uint64_t t = hostNow();
+  if (!hostRunUntilTrue([=](){ return watchLag(accessState(s) != ST_IDLE); }, t + TAP_WITHIN, 0)){
+    return 0;
+  }
+  times->detect.push_back(hostNow() - t);
+  if (!hostRunUntilTrue([=](){ return watchLag(relayRise[s] != 0); }, t + TAP_WITHIN, 0)){
+    return 0;
+  }
+  times->relay.push_back(relayRise[s] - t);
+  return leave(s, uid);
+}
+
+// Taps spread over stations first to last, with the ones before first holding cards
+static void run (byte first, int taps, uint16_t *n, runTimes *times){
+  for (byte s = 0; s < first; s++){
+    uidType uid = card(0x08, s);
+    if (!sit(s, &uid)){
+      printf("FAIL: station %u never took its resident card\n", s);
+      failures++;
+    }
+  }
+  hostRunFor(READER_ACTIVE_WINDOW * 1000ULL); // Everything else back to its resting period
+
+  watchLag(0);
+  lagInto = &times->lag;
+  uint32_t bus = readerGetStats()->busyUs; // Wraps after ~71 minutes of bus time, a run is well under
+  uint64_t start = hostNow();
+  for (int i = 0; i < taps; i++){
+    byte s = first + i % (STATION_COUNT - first);
+    uidType uid = card(0, (*n)++);
+    if (!tap(s, &uid, times)){
+      printf("FAIL: tap on station %u\n", s);
+      failures++;
+    }
+  }
+  lagInto = NULL;
+  times->busUs = readerGetStats()->busyUs - bus;
+  times->spanUs = hostNow() - start;
+
+  for (byte s = 0; s < first; s++){
+    uidType uid = card(0x08, s);
+    leave(s, &uid);
+  }
+}
+
+static uint32_t pct (std::vector<uint32_t> &us, int p){
+  if (us.empty()){
+    return 0;
+  }
+  std::sort(us.begin(), us.end());
+  return us[min(us.size() - 1, (us.size() * p) / 100)];
+}
+
+static uint32_t avg (const std::vector<uint32_t> &us){
+  uint64_t sum = 0;
+  for (size_t i = 0; i < us.size(); i++){
+    sum += us[i];
+  }
+  return us.empty() ? 0 : sum / us.size();
+}
+
+static void printRow (const char *name, runTimes *t){
+  printf("%-8u %-5s %7.1f %7.1f %7.1f   %7.1f %7.1f   %6.2f %6.2f   %5.1f%%\n", STATION_COUNT, name,
+         avg(t->detect) / 1000.0, pct(t->detect, 99) / 1000.0, pct(t->detect, 100) / 1000.0,
+         avg(t->relay) / 1000.0, pct(t->relay, 100) / 1000.0, pct(t->lag, 99) / 1000.0, pct(t->lag, 100) / 1000.0,
+         t->spanUs ? t->busUs * 100.0 / t->spanUs : 0);
+}
+
+int main (int argc, char **argv){
+  int taps = (argc > 1) ? atoi(argv[1]) : 40;
+  hostSeed((argc > 2) ? strtoul(argv[2], NULL, 0) : 1);
+  bool header = (argc > 3) ? atoi(argv[3]) : 1;
+
+  hostNetLatency(LATENCY_US);
+  hostPinWatch(relayEdge);
+  hostBrokerOnPublish(serverHook);
+  hostBoot();
+  if (!hostRunUntilTrue([](){ return hostMqttConnected() && accessState(0) == ST_IDLE; }, hostNow() + 10000000, 0)){
+    printf("FAIL: board never came up\n");
+    return 1;
+  }
+
+  uint16_t n = 0;
+  runTimes quiet;
+  runTimes busy;
+  run(0, taps, &n, &quiet);
+  if (STATION_COUNT > 1){
+    run(STATION_COUNT - 1, taps, &n, &busy);
+  }
+
+  if (header){
+    printf("%-8s %-5s %23s   %15s   %13s   %6s\n", "", "", "detect ms", "relay ms", "poll lag ms", "bus");
+    printf("%-8s %-5s %7s %7s %7s   %7s %7s   %6s %6s   %6s\n", "stations", "run", "avg", "p99", "max", "avg", "max",
+           "p99", "max", "busy");
+  }
+  printRow("quiet", &quiet);
+  if (STATION_COUNT > 1){
+    printRow("busy", &busy);
+  }
+  if (hostFaults() > 0){
+    printf("%u harness faults\n", hostFaults());
+    failures++;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,36 @@
+#ifndef STATION_SCALING_BENCH_H
+#define STATION_SCALING_BENCH_H
+
+/* Station rows for tools/station-scaling-bench.cpp, -include'd into every file of the build along with
+   -DSTATION_COUNT=n (1 to 8). Every reader on the one SPI bus with its own SS, a shared RST and no IRQ wired, so
+   readerTask polls them all. Two LEDs each. Station 0 is the usual one.
+   Eight don't fit a real ESP32's pins: the last relay is on GPIO1, which is TX0, a board that big wants its relays on
+   an I/O expander. The harness doesn't mind.
+*/
+
+#define NUM_LEDS (2 * STATION_COUNT)
+
+//                      SS  RST relay IRQ LEDs
+#define STATION_ROW_0 {21, 22, 17, -1, 0, 2}
+#define STATION_ROW_1 { 5, 22, 16, -1, 2, 2}
+#define STATION_ROW_2 {15, 22, 27, -1, 4, 2}
+#define STATION_ROW_3 {13, 22, 26, -1, 6, 2}
+#define STATION_ROW_4 {14, 22, 25, -1, 8, 2}
+#define STATION_ROW_5 {12, 22, 33, -1, 10, 2}
+#define STATION_ROW_6 { 4, 22,  0, -1, 12, 2}
+#define STATION_ROW_7 { 2, 22,  1, -1, 14, 2}
+
+#define STATION_ROWS_1 STATION_ROW_0
+#define STATION_ROWS_2 STATION_ROWS_1, STATION_ROW_1
+#define STATION_ROWS_3 STATION_ROWS_2, STATION_ROW_2
+#define STATION_ROWS_4 STATION_ROWS_3, STATION_ROW_3
+#define STATION_ROWS_5 STATION_ROWS_4, STATION_ROW_4
+#define STATION_ROWS_6 STATION_ROWS_5, STATION_ROW_5
+#define STATION_ROWS_7 STATION_ROWS_6, STATION_ROW_6
+#define STATION_ROWS_8 STATION_ROWS_7, STATION_ROW_7
+
+#define STATION_ROWS_N(n) STATION_ROWS_##n
+#define STATION_ROWS_OF(n) STATION_ROWS_N(n) // So STATION_COUNT is expanded first
+#define STATION_ROWS STATION_ROWS_OF(STATION_COUNT)
+
+#endif // STATION_SCALING_BENCH_H
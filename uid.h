@@ -0,0 +1,67 @@
+#ifndef UID_H
+#define UID_H
+
+#include <Arduino.h>
+
+#define UID_MAX_SIZE 10 // ISO 14443A UIDs are 4, 7 or 10 bytes
+
+/* Fixed size binary UID. Replaces passing byte arrays + separate lengths around.
+   Bytes past length are always zero so a whole struct memcmp is also a valid compare.
+*/
+typedef struct {
+  byte bytes[UID_MAX_SIZE];
+  byte length;
+} uidType;
+
+// Literal helpers, eg. const uidType fob = UID4(0xDE, 0xAD, 0xBE, 0xEF);
+#define UID4(a, b, c, d) {{a, b, c, d, 0, 0, 0, 0, 0, 0}, 4}
+#define UID7(a, b, c, d, e, f, g) {{a, b, c, d, e, f, g, 0, 0, 0}, 7}
+
+// FNV-1a over the UID bytes. Written as single return recursion so it stays constexpr under C++11
+constexpr uint32_t uidHashStep (const byte *b, byte n, uint32_t h){
+  return (n == 0) ? h : uidHashStep(b + 1, n - 1, (h ^ *b) * 16777619UL);
+}
+
+constexpr uint32_t uidHash (const uidType &u){
+  return uidHashStep(u.bytes, u.length, 2166136261UL);
+}
+
+constexpr bool uidBytesEqual (const byte *a, const byte *b, byte n){
+  return (n == 0) || ((*a == *b) && uidBytesEqual(a + 1, b + 1, n - 1));
+}
+
+constexpr bool uidEqual (const uidType &a, const uidType &b){
+  return (a.length == b.length) && uidBytesEqual(a.bytes, b.bytes, a.length);
+}
+
+// Fill a uidType from the mfrc522.uid.uidByte/size pair. Oversize UIDs come back with length 0 (never matches anything)
+inline void uidFromBytes (uidType *u, const byte *in, byte size){
+  memset(u, 0, sizeof(uidType));
+  if (size <= UID_MAX_SIZE){
+    memcpy(u->bytes, in, size);
+    u->length = size;
+  }
+}
+
+// Parse the colon separated hex uidStr form (eg. "DE:AD:BE:EF"), len chars of it. False (and length 0) if it isn't one
+inline bool uidFromHexStr (uidType *u, const char *s, size_t len){
+  memset(u, 0, sizeof(uidType));
+  for (size_t i = 0; i < len; i += 3){
+    byte v = 0;
+    for (size_t j = i; j < i + 2; j++){
+      char c = (j < len) ? s[j] : 0;
+      if (c >= '0' && c <= '9')      v = (v << 4) | (c - '0');
+      else if (c >= 'A' && c <= 'F') v = (v << 4) | (c - 'A' + 10);
+      else if (c >= 'a' && c <= 'f') v = (v << 4) | (c - 'a' + 10);
+      else { u->length = 0; return 0; }
+    }
+    if (u->length == UID_MAX_SIZE || (i + 2 < len && s[i + 2] != ':')){
+      u->length = 0;
+      return 0;
+    }
+    u->bytes[u->length++] = v;
+  }
+  return (u->length > 0);
+}
+
+#endif // UID_H
@@ -0,0 +1,164 @@
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <SPIFFS.h>
+#include <FastLED.h>
+#include <Preferences.h>
+#include "warm-state.h"
+#include "access-fsm.h"
+#include "auth-cache.h"
+#include "debug-log.h"
+
+/* Two keys so a session or eStop change (rare, and wanted on flash right away) never drags the cache write
+   (bigger, and only wanted once a period) along with it. Both are packed with a version byte in front, a build with a
+   different layout or STATION_COUNT sees the wrong length or version and starts cold.
+*/
+
+typedef struct __attribute__((packed)) {
+  byte version;                   // WARM_VERSION
+  byte estop;                     // Bit per station that was stopped
+  byte sessions;                  // Bit per station with a session for sessionUid[station]
+  uidType sessionUid[STATION_COUNT];
+} warmSessions;
+
+typedef struct __attribute__((packed)) {
+  uidType uid;
+  byte station;
+  byte allowed;
+  uint32_t age;                   // ms since the server answered, at the time it was saved
+} warmCacheEntry;
+
+typedef struct __attribute__((packed)) {
+  byte version;                   // WARM_VERSION
+  byte count;
+  warmCacheEntry entries[AUTHCACHE_SIZE];
+} warmCache;
+
+static_assert(STATION_COUNT <= 8, "warmSessions packs a bit per station in a byte");
+
+static Preferences prefs;
+static bool opened = 0;
+static warmSessions current;      // What accessTask last told us, under warmMux
+static bool sessionsDirty = 0;
+static portMUX_TYPE warmMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t warmHandle = NULL;
+static warmCache cacheBlob;       // Static so it isn't on the task stack
+static authCacheEntry cacheCopy[AUTHCACHE_SIZE];
+
+void warmStateRestore (){
+  warmSessions saved;
+
+  current.version = WARM_VERSION;
+  opened = prefs.begin(WARM_NAMESPACE, false);
+  if (!opened){
+    DLOG_WARN("Warm state: NVS would not open, starting cold");
+    return;
+  }
+
+  size_t len = prefs.getBytes("cache", &cacheBlob, sizeof(cacheBlob));
+  if (len >= 2 && cacheBlob.version == WARM_VERSION && cacheBlob.count <= AUTHCACHE_SIZE
+      && len == 2 + cacheBlob.count * sizeof(warmCacheEntry)){
+    for (byte i = 0; i < cacheBlob.count; i++){
+      cacheCopy[i].uid = cacheBlob.entries[i].uid;
+      cacheCopy[i].station = cacheBlob.entries[i].station;
+      cacheCopy[i].allowed = cacheBlob.entries[i].allowed;
+      cacheCopy[i].stamp = cacheBlob.entries[i].age;
+    }
+    authCacheImport(cacheCopy, cacheBlob.count);
+    DLOG_INFO("Warm state: %u cached answers restored", cacheBlob.count);
+  }
+
+  if (prefs.getBytes("sess", &saved, sizeof(saved)) != sizeof(saved) || saved.version != WARM_VERSION){
+    return;
+  }
+  for (byte i = 0; i < STATION_COUNT; i++){
+    if (saved.estop & (1 << i)){ // Still stopped, whoever hit it has to clear it
+      DLOG_WARN("Warm state: station %u was eStopped", i);
+      accessPost(i, EV_ESTOP_FIRE, NULL);
+    }
+    else if ((saved.sessions & (1 << i)) && saved.sessionUid[i].length > 0 && saved.sessionUid[i].length <= UID_MAX_SIZE){
+      DLOG_INFO("Warm state: station %u had a session, granting that card on sight", i);
+      authCacheStore(i, &saved.sessionUid[i], 1); // Fresh stamp, the server still gets asked and can revoke it
+    }
+  }
+  current.estop = saved.estop; // Sessions start over, accessTask tells us again once the relay closes
+}
+
+void warmStateSession (byte station, const uidType *uid){
+  portENTER_CRITICAL(&warmMux);
+  if (uid != NULL){
+    current.sessions |= (1 << station);
+    current.sessionUid[station] = *uid;
+  }
+  else{
+    current.sessions &= ~(1 << station);
+  }
+  sessionsDirty = 1;
+  portEXIT_CRITICAL(&warmMux);
+  if (warmHandle != NULL){
+    xTaskNotifyGive(warmHandle);
+  }
+}
+
+void warmStateEstop (byte station, bool stopped){
+  portENTER_CRITICAL(&warmMux);
+  if (stopped){
+    current.estop |= (1 << station);
+  }
+  else{
+    current.estop &= ~(1 << station);
+  }
+  sessionsDirty = 1;
+  portEXIT_CRITICAL(&warmMux);
+  if (warmHandle != NULL){
+    xTaskNotifyGive(warmHandle);
+  }
+}
+
+static void saveCache (){
+  byte n = authCacheExport(cacheCopy);
+
+  cacheBlob.version = WARM_VERSION;
+  cacheBlob.count = n;
+  for (byte i = 0; i < n; i++){
+    cacheBlob.entries[i].uid = cacheCopy[i].uid;
+    cacheBlob.entries[i].station = cacheCopy[i].station;
+    cacheBlob.entries[i].allowed = cacheCopy[i].allowed;
+    cacheBlob.entries[i].age = cacheCopy[i].stamp;
+  }
+  prefs.putBytes("cache", &cacheBlob, 2 + n * sizeof(warmCacheEntry));
+}
+
+/* Writes session and eStop changes as soon as accessTask reports them, the cache at most once a WARM_CACHE_PERIOD
+   and only if something was stored since the last write.
+*/
+void warmStateTask (void *params){
+  warmSessions copy;
+  uint32_t savedGen = authCacheGeneration();
+  TickType_t lastCache = xTaskGetTickCount();
+  bool dirty;
+
+  if (!opened){
+    vTaskSuspend(NULL); // Nowhere to write, stays suspended rather than deleted so the metrics can still read the handle
+  }
+  warmHandle = xTaskGetCurrentTaskHandle();
+
+  for(;;){
+    ulTaskNotifyTake(pdTRUE, WARM_CACHE_PERIOD);
+
+    portENTER_CRITICAL(&warmMux);
+    dirty = sessionsDirty;
+    sessionsDirty = 0;
+    copy = current;
+    portEXIT_CRITICAL(&warmMux);
+    if (dirty && prefs.putBytes("sess", &copy, sizeof(copy)) != sizeof(copy)){
+      DLOG_WARN("Warm state: session write failed");
+    }
+
+    uint32_t gen = authCacheGeneration();
+    if (gen != savedGen && (xTaskGetTickCount() - lastCache) >= WARM_CACHE_PERIOD){
+      saveCache();
+      savedGen = gen;
+      lastCache = xTaskGetTickCount();
+    }
+  }
+}
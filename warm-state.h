@@ -0,0 +1,23 @@
+#ifndef WARM_STATE_H
+#define WARM_STATE_H
+
+#include <Arduino.h>
+#include "uid.h"
+
+/* Warm restart. What a power blip would otherwise lose is kept in NVS (Preferences), small enough to rewrite often:
+   which card each station had a session for, which stations were eStopped and the auth cache. On boot the cache comes
+   back with its ages carried on, a card that had a session is granted off the cache the moment the reader sees it again
+   (even with the network still down), and an eStop stays stopped until it is cleared.
+   The relay is never closed from NVS alone, the card has to still be there.
+*/
+
+#define WARM_NAMESPACE     "warm"
+#define WARM_VERSION       1
+#define WARM_CACHE_PERIOD  pdMS_TO_TICKS(60000) // Most often the auth cache is rewritten, every tap refreshes a stamp and NVS pages wear
+
+extern void warmStateRestore ();  // In setup, after authCacheInit () and accessInit ()
+extern void warmStateTask (void *params);
+extern void warmStateSession (byte station, const uidType *uid); // From accessTask: relay closed for uid, NULL once the session is over
+extern void warmStateEstop (byte station, bool stopped);         // From accessTask
+
+#endif // WARM_STATE_H